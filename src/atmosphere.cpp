@@ -0,0 +1,755 @@
+#include "atmosphere.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "trace.h"
+
+namespace {
+
+const float PI = 3.14159265358979f;
+const uint32_t CACHE_MAGIC = 0x534f4d41; // "AMOS"
+const uint32_t CACHE_VERSION = 1;
+
+const int SCATTERING_WIDTH = ATMOSPHERE_SCATTERING_NU * ATMOSPHERE_SCATTERING_MU_S;
+const int SCATTERING_TEXELS = SCATTERING_WIDTH * ATMOSPHERE_SCATTERING_MU * ATMOSPHERE_SCATTERING_R;
+const int TRANSMITTANCE_TEXELS = ATMOSPHERE_TRANSMITTANCE_WIDTH * ATMOSPHERE_TRANSMITTANCE_HEIGHT;
+const int IRRADIANCE_TEXELS = ATMOSPHERE_IRRADIANCE_WIDTH * ATMOSPHERE_IRRADIANCE_HEIGHT;
+
+// Directions sampled per texel for the scattering density and the ground
+// irradiance, per quarter turn. Half of the reference implementation's;
+// the density step dominates the precomputation.
+const int DENSITY_SAMPLES = 8;
+const int IRRADIANCE_SAMPLES = 16;
+
+// Sampled like GL_LINEAR textures with GL_CLAMP_TO_EDGE, so the CPU
+// passes read their inputs exactly as the shaders will
+template <typename T>
+struct Table {
+    int width;
+    int height;
+    int depth;
+    std::vector<T> texels;
+
+    Table(int w, int h, int d = 1) : width(w), height(h), depth(d), texels((size_t)w * h * d, T(0.0f)) {}
+
+    T& at(int x, int y, int z = 0) { return texels[((size_t)z * height + y) * width + x]; }
+    const T& at(int x, int y, int z = 0) const { return texels[((size_t)z * height + y) * width + x]; }
+};
+
+static void texelWeights(float coord, int size, int& i0, int& i1, float& f) {
+    float x = coord * size - 0.5f;
+    float fl = std::floor(x);
+    f = x - fl;
+    i0 = std::min(std::max((int)fl, 0), size - 1);
+    i1 = std::min(std::max((int)fl + 1, 0), size - 1);
+}
+
+template <typename T>
+T sample(const Table<T>& table, const glm::vec2& uv) {
+    int x0, x1, y0, y1;
+    float fx, fy;
+    texelWeights(uv.x, table.width, x0, x1, fx);
+    texelWeights(uv.y, table.height, y0, y1, fy);
+    T bottom = glm::mix(table.at(x0, y0), table.at(x1, y0), fx);
+    T top = glm::mix(table.at(x0, y1), table.at(x1, y1), fx);
+    return glm::mix(bottom, top, fy);
+}
+
+template <typename T>
+T sample(const Table<T>& table, const glm::vec3& uvw) {
+    int x0, x1, y0, y1, z0, z1;
+    float fx, fy, fz;
+    texelWeights(uvw.x, table.width, x0, x1, fx);
+    texelWeights(uvw.y, table.height, y0, y1, fy);
+    texelWeights(uvw.z, table.depth, z0, z1, fz);
+    auto plane = [&](int z) {
+        T bottom = glm::mix(table.at(x0, y0, z), table.at(x1, y0, z), fx);
+        T top = glm::mix(table.at(x0, y1, z), table.at(x1, y1, z), fx);
+        return glm::mix(bottom, top, fy);
+        };
+    return glm::mix(plane(z0), plane(z1), fz);
+}
+
+// Runs `body(i)` for i in [0, count), interleaved over the cores
+template <typename F>
+void parallelFor(int count, const F& body) {
+    int jobs = std::max(1, std::min((int)std::thread::hardware_concurrency(), count));
+    auto run = [&](int first) {
+        for (int i = first; i < count; i += jobs)
+            body(i);
+        };
+    std::vector<std::future<void>> workers;
+    for (int job = 1; job < jobs; ++job)
+        workers.push_back(std::async(std::launch::async, run, job));
+    run(0);
+    for (auto& worker : workers)
+        worker.get();
+}
+
+float clampCosine(float mu) {
+    return std::min(std::max(mu, -1.0f), 1.0f);
+}
+
+float safeSqrt(float a) {
+    return std::sqrt(std::max(a, 0.0f));
+}
+
+float coordFromUnitRange(float x, int size) {
+    return 0.5f / size + x * (1.0f - 1.0f / size);
+}
+
+float unitRangeFromCoord(float u, int size) {
+    return (u - 0.5f / size) / (1.0f - 1.0f / size);
+}
+
+float rayleighPhase(float nu) {
+    return 3.0f / (16.0f * PI) * (1.0f + nu * nu);
+}
+
+float miePhase(float g, float nu) {
+    float k = 3.0f / (8.0f * PI) * (1.0f - g * g) / (2.0f + g * g);
+    return k * (1.0f + nu * nu) / std::pow(1.0f + g * g - 2.0f * g * nu, 1.5f);
+}
+
+// The precomputation's state: the parameters and the tables built so far.
+// Function names follow the reference implementation.
+struct Model {
+    const AtmosphereParameters& p;
+    float horizon; // distance to the top along a horizontal ray from the ground
+
+    Table<glm::vec3> transmittance;
+    Table<glm::vec3> deltaIrradiance;
+    Table<glm::vec3> irradiance;
+    Table<glm::vec3> deltaRayleigh;
+    Table<glm::vec3> deltaMie;
+    Table<glm::vec3> deltaMultiple;
+    Table<glm::vec3> deltaDensity;
+    Table<glm::vec4> scattering;
+
+    explicit Model(const AtmosphereParameters& parameters)
+        : p(parameters),
+        horizon(std::sqrt(parameters.topRadius * parameters.topRadius -
+            parameters.bottomRadius * parameters.bottomRadius)),
+        transmittance(ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT),
+        deltaIrradiance(ATMOSPHERE_IRRADIANCE_WIDTH, ATMOSPHERE_IRRADIANCE_HEIGHT),
+        irradiance(ATMOSPHERE_IRRADIANCE_WIDTH, ATMOSPHERE_IRRADIANCE_HEIGHT),
+        deltaRayleigh(SCATTERING_WIDTH, ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_R),
+        deltaMie(SCATTERING_WIDTH, ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_R),
+        deltaMultiple(SCATTERING_WIDTH, ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_R),
+        deltaDensity(SCATTERING_WIDTH, ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_R),
+        scattering(SCATTERING_WIDTH, ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_R) {}
+
+    float clampRadius(float r) const {
+        return std::min(std::max(r, p.bottomRadius), p.topRadius);
+    }
+
+    float distanceToTop(float r, float mu) const {
+        return std::max(-r * mu + safeSqrt(r * r * (mu * mu - 1.0f) + p.topRadius * p.topRadius), 0.0f);
+    }
+
+    float distanceToBottom(float r, float mu) const {
+        return std::max(-r * mu - safeSqrt(r * r * (mu * mu - 1.0f) + p.bottomRadius * p.bottomRadius), 0.0f);
+    }
+
+    bool rayIntersectsGround(float r, float mu) const {
+        return mu < 0.0f && r * r * (mu * mu - 1.0f) + p.bottomRadius * p.bottomRadius >= 0.0f;
+    }
+
+    float distanceToNearestBoundary(float r, float mu, bool ground) const {
+        return ground ? distanceToBottom(r, mu) : distanceToTop(r, mu);
+    }
+
+    float rayleighDensity(float altitude) const {
+        return std::min(std::exp(-altitude / p.rayleighScaleHeight), 1.0f);
+    }
+
+    float mieDensity(float altitude) const {
+        return std::min(std::exp(-altitude / p.mieScaleHeight), 1.0f);
+    }
+
+    float absorptionDensity(float altitude) const {
+        if (p.absorptionWidth <= 0.0f)
+            return 0.0f;
+        return std::max(1.0f - std::abs(altitude - p.absorptionCenter) / (0.5f * p.absorptionWidth), 0.0f);
+    }
+
+    // --- Transmittance ---
+
+    glm::vec3 computeTransmittanceToTop(float r, float mu) const {
+        const int SAMPLE_COUNT = 500;
+        float dx = distanceToTop(r, mu) / SAMPLE_COUNT;
+        float rayleigh = 0.0f, mie = 0.0f, absorption = 0.0f;
+        for (int i = 0; i <= SAMPLE_COUNT; ++i) {
+            float d = i * dx;
+            float altitude = std::sqrt(d * d + 2.0f * r * mu * d + r * r) - p.bottomRadius;
+            float weight = (i == 0 || i == SAMPLE_COUNT) ? 0.5f : 1.0f;
+            rayleigh += rayleighDensity(altitude) * weight * dx;
+            mie += mieDensity(altitude) * weight * dx;
+            absorption += absorptionDensity(altitude) * weight * dx;
+        }
+        return glm::exp(-(p.rayleighScattering * rayleigh + p.mieExtinction * mie +
+            p.absorptionExtinction * absorption));
+    }
+
+    glm::vec2 transmittanceUv(float r, float mu) const {
+        float rho = safeSqrt(r * r - p.bottomRadius * p.bottomRadius);
+        float d = distanceToTop(r, mu);
+        float dMin = p.topRadius - r;
+        float dMax = rho + horizon;
+        return glm::vec2(coordFromUnitRange((d - dMin) / (dMax - dMin), ATMOSPHERE_TRANSMITTANCE_WIDTH),
+            coordFromUnitRange(rho / horizon, ATMOSPHERE_TRANSMITTANCE_HEIGHT));
+    }
+
+    void rMuFromTransmittanceUv(const glm::vec2& uv, float& r, float& mu) const {
+        float xMu = unitRangeFromCoord(uv.x, ATMOSPHERE_TRANSMITTANCE_WIDTH);
+        float xR = unitRangeFromCoord(uv.y, ATMOSPHERE_TRANSMITTANCE_HEIGHT);
+        float rho = horizon * xR;
+        r = std::sqrt(rho * rho + p.bottomRadius * p.bottomRadius);
+        float dMin = p.topRadius - r;
+        float dMax = rho + horizon;
+        float d = dMin + xMu * (dMax - dMin);
+        mu = d == 0.0f ? 1.0f : clampCosine((horizon * horizon - rho * rho - d * d) / (2.0f * r * d));
+    }
+
+    glm::vec3 transmittanceToTop(float r, float mu) const {
+        return sample(transmittance, transmittanceUv(r, mu));
+    }
+
+    glm::vec3 transmittanceAlong(float r, float mu, float d, bool ground) const {
+        float rD = clampRadius(std::sqrt(d * d + 2.0f * r * mu * d + r * r));
+        float muD = clampCosine((r * mu + d) / rD);
+        if (ground)
+            return glm::min(transmittanceToTop(rD, -muD) / transmittanceToTop(r, -mu), glm::vec3(1.0f));
+        return glm::min(transmittanceToTop(r, mu) / transmittanceToTop(rD, muD), glm::vec3(1.0f));
+    }
+
+    glm::vec3 transmittanceToSun(float r, float muS) const {
+        float sinThetaH = p.bottomRadius / r;
+        float cosThetaH = -std::sqrt(std::max(1.0f - sinThetaH * sinThetaH, 0.0f));
+        float edge = sinThetaH * p.sunAngularRadius;
+        float t = std::min(std::max((muS - cosThetaH + edge) / (2.0f * edge), 0.0f), 1.0f);
+        return transmittanceToTop(r, muS) * (t * t * (3.0f - 2.0f * t));
+    }
+
+    // --- Scattering table parameterization ---
+
+    glm::vec4 scatteringUvwz(float r, float mu, float muS, float nu, bool ground) const {
+        float rho = safeSqrt(r * r - p.bottomRadius * p.bottomRadius);
+        float uR = coordFromUnitRange(rho / horizon, ATMOSPHERE_SCATTERING_R);
+
+        float rMu = r * mu;
+        float discriminant = rMu * rMu - r * r + p.bottomRadius * p.bottomRadius;
+        float uMu;
+        if (ground) {
+            float d = -rMu - safeSqrt(discriminant);
+            float dMin = r - p.bottomRadius;
+            float dMax = rho;
+            uMu = 0.5f - 0.5f * coordFromUnitRange(dMax == dMin ? 0.0f : (d - dMin) / (dMax - dMin),
+                ATMOSPHERE_SCATTERING_MU / 2);
+        }
+        else {
+            float d = -rMu + safeSqrt(discriminant + horizon * horizon);
+            float dMin = p.topRadius - r;
+            float dMax = rho + horizon;
+            uMu = 0.5f + 0.5f * coordFromUnitRange((d - dMin) / (dMax - dMin), ATMOSPHERE_SCATTERING_MU / 2);
+        }
+
+        float d = distanceToTop(p.bottomRadius, muS);
+        float dMin = p.topRadius - p.bottomRadius;
+        float dMax = horizon;
+        float a = (d - dMin) / (dMax - dMin);
+        float A = (distanceToTop(p.bottomRadius, p.muSMin) - dMin) / (dMax - dMin);
+        float uMuS = coordFromUnitRange(std::max(1.0f - a / A, 0.0f) / (1.0f + a), ATMOSPHERE_SCATTERING_MU_S);
+
+        return glm::vec4((nu + 1.0f) / 2.0f, uMuS, uMu, uR);
+    }
+
+    void rMuMuSNuFromScatteringUvwz(const glm::vec4& uvwz, float& r, float& mu, float& muS, float& nu,
+        bool& ground) const {
+        float rho = horizon * unitRangeFromCoord(uvwz.w, ATMOSPHERE_SCATTERING_R);
+        r = std::sqrt(rho * rho + p.bottomRadius * p.bottomRadius);
+
+        if (uvwz.z < 0.5f) {
+            float dMin = r - p.bottomRadius;
+            float dMax = rho;
+            float d = dMin + (dMax - dMin) * unitRangeFromCoord(1.0f - 2.0f * uvwz.z, ATMOSPHERE_SCATTERING_MU / 2);
+            mu = d == 0.0f ? -1.0f : clampCosine(-(rho * rho + d * d) / (2.0f * r * d));
+            ground = true;
+        }
+        else {
+            float dMin = p.topRadius - r;
+            float dMax = rho + horizon;
+            float d = dMin + (dMax - dMin) * unitRangeFromCoord(2.0f * uvwz.z - 1.0f, ATMOSPHERE_SCATTERING_MU / 2);
+            mu = d == 0.0f ? 1.0f : clampCosine((horizon * horizon - rho * rho - d * d) / (2.0f * r * d));
+            ground = false;
+        }
+
+        float xMuS = unitRangeFromCoord(uvwz.y, ATMOSPHERE_SCATTERING_MU_S);
+        float dMin = p.topRadius - p.bottomRadius;
+        float dMax = horizon;
+        float A = (distanceToTop(p.bottomRadius, p.muSMin) - dMin) / (dMax - dMin);
+        float a = (A - xMuS * A) / (1.0f + xMuS * A);
+        float d = dMin + std::min(a, A) * (dMax - dMin);
+        muS = d == 0.0f ? 1.0f : clampCosine((horizon * horizon - d * d) / (2.0f * p.bottomRadius * d));
+
+        nu = clampCosine(uvwz.x * 2.0f - 1.0f);
+    }
+
+    // Texel centre to parameters, with nu clamped to what mu and muS allow
+    void scatteringTexelParameters(int x, int y, int z, float& r, float& mu, float& muS, float& nu,
+        bool& ground) const {
+        float fragNu = (float)(x / ATMOSPHERE_SCATTERING_MU_S);
+        float fragMuS = (float)(x % ATMOSPHERE_SCATTERING_MU_S) + 0.5f;
+        glm::vec4 uvwz(fragNu / (ATMOSPHERE_SCATTERING_NU - 1), fragMuS / ATMOSPHERE_SCATTERING_MU_S,
+            (y + 0.5f) / ATMOSPHERE_SCATTERING_MU, (z + 0.5f) / ATMOSPHERE_SCATTERING_R);
+        rMuMuSNuFromScatteringUvwz(uvwz, r, mu, muS, nu, ground);
+        float spread = std::sqrt((1.0f - mu * mu) * (1.0f - muS * muS));
+        nu = std::min(std::max(nu, mu * muS - spread), mu * muS + spread);
+    }
+
+    template <typename T>
+    T lookupScattering(const Table<T>& table, float r, float mu, float muS, float nu, bool ground) const {
+        glm::vec4 uvwz = scatteringUvwz(r, mu, muS, nu, ground);
+        float texCoordX = uvwz.x * (ATMOSPHERE_SCATTERING_NU - 1);
+        float texX = std::floor(texCoordX);
+        float lerp = texCoordX - texX;
+        glm::vec3 uvw0((texX + uvwz.y) / ATMOSPHERE_SCATTERING_NU, uvwz.z, uvwz.w);
+        glm::vec3 uvw1((texX + 1.0f + uvwz.y) / ATMOSPHERE_SCATTERING_NU, uvwz.z, uvwz.w);
+        return glm::mix(sample(table, uvw0), sample(table, uvw1), lerp);
+    }
+
+    // Radiance of the given order arriving from direction (mu, nu)
+    glm::vec3 scatteringOfOrder(float r, float mu, float muS, float nu, bool ground, int order) const {
+        if (order == 1) {
+            return lookupScattering(deltaRayleigh, r, mu, muS, nu, ground) * rayleighPhase(nu) +
+                lookupScattering(deltaMie, r, mu, muS, nu, ground) * miePhase(p.miePhaseG, nu);
+        }
+        return lookupScattering(deltaMultiple, r, mu, muS, nu, ground);
+    }
+
+    // --- Irradiance table parameterization ---
+
+    glm::vec2 irradianceUv(float r, float muS) const {
+        float xR = (r - p.bottomRadius) / (p.topRadius - p.bottomRadius);
+        float xMuS = muS * 0.5f + 0.5f;
+        return glm::vec2(coordFromUnitRange(xMuS, ATMOSPHERE_IRRADIANCE_WIDTH),
+            coordFromUnitRange(xR, ATMOSPHERE_IRRADIANCE_HEIGHT));
+    }
+
+    void rMuSFromIrradianceUv(const glm::vec2& uv, float& r, float& muS) const {
+        float xMuS = unitRangeFromCoord(uv.x, ATMOSPHERE_IRRADIANCE_WIDTH);
+        float xR = unitRangeFromCoord(uv.y, ATMOSPHERE_IRRADIANCE_HEIGHT);
+        r = p.bottomRadius + xR * (p.topRadius - p.bottomRadius);
+        muS = clampCosine(2.0f * xMuS - 1.0f);
+    }
+
+    // --- The passes ---
+
+    glm::vec3 computeDirectIrradiance(float r, float muS) const {
+        float alpha = p.sunAngularRadius;
+        // Sun disc partly below the horizon
+        float averageCosine = muS < -alpha ? 0.0f
+            : muS > alpha ? muS : (muS + alpha) * (muS + alpha) / (4.0f * alpha);
+        return transmittanceToTop(r, muS) * averageCosine;
+    }
+
+    void computeSingleScattering(float r, float mu, float muS, float nu, bool ground, glm::vec3& rayleigh,
+        glm::vec3& mie) const {
+        const int SAMPLE_COUNT = 50;
+        float dx = distanceToNearestBoundary(r, mu, ground) / SAMPLE_COUNT;
+        rayleigh = glm::vec3(0.0f);
+        mie = glm::vec3(0.0f);
+        for (int i = 0; i <= SAMPLE_COUNT; ++i) {
+            float d = i * dx;
+            float rD = clampRadius(std::sqrt(d * d + 2.0f * r * mu * d + r * r));
+            float muSD = clampCosine((r * muS + d * nu) / rD);
+            glm::vec3 t = transmittanceAlong(r, mu, d, ground) * transmittanceToSun(rD, muSD);
+            float weight = (i == 0 || i == SAMPLE_COUNT) ? 0.5f : 1.0f;
+            rayleigh += t * rayleighDensity(rD - p.bottomRadius) * weight;
+            mie += t * mieDensity(rD - p.bottomRadius) * weight;
+        }
+        rayleigh *= dx * p.rayleighScattering;
+        mie *= dx * p.mieScattering;
+    }
+
+    glm::vec3 computeScatteringDensity(float r, float mu, float muS, float nu, int order) const {
+        glm::vec3 zenith(0.0f, 0.0f, 1.0f);
+        glm::vec3 omega(std::sqrt(1.0f - mu * mu), 0.0f, mu);
+        float sunX = omega.x == 0.0f ? 0.0f : (nu - mu * muS) / omega.x;
+        float sunY = std::sqrt(std::max(1.0f - sunX * sunX - muS * muS, 0.0f));
+        glm::vec3 omegaS(sunX, sunY, muS);
+
+        float dTheta = PI / DENSITY_SAMPLES;
+        float dPhi = PI / DENSITY_SAMPLES;
+        float altitude = r - p.bottomRadius;
+        glm::vec3 rayleighCoefficient = p.rayleighScattering * rayleighDensity(altitude);
+        glm::vec3 mieCoefficient = p.mieScattering * mieDensity(altitude);
+        glm::vec3 result(0.0f);
+        for (int l = 0; l < DENSITY_SAMPLES; ++l) {
+            float theta = (l + 0.5f) * dTheta;
+            float cosTheta = std::cos(theta), sinTheta = std::sin(theta);
+            bool ground = rayIntersectsGround(r, cosTheta);
+
+            // Light bounced off the ground below, lit by the previous order
+            float distanceToGround = 0.0f;
+            glm::vec3 transmittanceToGround(0.0f);
+            if (ground) {
+                distanceToGround = distanceToBottom(r, cosTheta);
+                transmittanceToGround = transmittanceAlong(r, cosTheta, distanceToGround, true) * p.groundAlbedo;
+            }
+
+            for (int m = 0; m < 2 * DENSITY_SAMPLES; ++m) {
+                float phi = (m + 0.5f) * dPhi;
+                glm::vec3 omegaI(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+                float domega = dTheta * dPhi * sinTheta;
+
+                glm::vec3 incident = scatteringOfOrder(r, omegaI.z, muS, glm::dot(omegaS, omegaI), ground, order - 1);
+                if (ground) {
+                    glm::vec3 groundNormal = glm::normalize(zenith * r + omegaI * distanceToGround);
+                    glm::vec3 groundIrradiance = sample(deltaIrradiance,
+                        irradianceUv(p.bottomRadius, glm::dot(groundNormal, omegaS)));
+                    incident += transmittanceToGround * (1.0f / PI) * groundIrradiance;
+                }
+
+                float nu2 = glm::dot(omega, omegaI);
+                result += incident * (rayleighCoefficient * rayleighPhase(nu2) +
+                    mieCoefficient * miePhase(p.miePhaseG, nu2)) * domega;
+            }
+        }
+        return result;
+    }
+
+    glm::vec3 computeMultipleScattering(float r, float mu, float muS, float nu, bool ground) const {
+        const int SAMPLE_COUNT = 50;
+        float dx = distanceToNearestBoundary(r, mu, ground) / SAMPLE_COUNT;
+        glm::vec3 result(0.0f);
+        for (int i = 0; i <= SAMPLE_COUNT; ++i) {
+            float d = i * dx;
+            float rI = clampRadius(std::sqrt(d * d + 2.0f * r * mu * d + r * r));
+            float muI = clampCosine((r * mu + d) / rI);
+            float muSI = clampCosine((r * muS + d * nu) / rI);
+            float weight = (i == 0 || i == SAMPLE_COUNT) ? 0.5f : 1.0f;
+            result += lookupScattering(deltaDensity, rI, muI, muSI, nu, ground) *
+                transmittanceAlong(r, mu, d, ground) * (dx * weight);
+        }
+        return result;
+    }
+
+    glm::vec3 computeIndirectIrradiance(float r, float muS, int order) const {
+        float dPhi = PI / IRRADIANCE_SAMPLES;
+        float dTheta = PI / IRRADIANCE_SAMPLES;
+        glm::vec3 omegaS(std::sqrt(1.0f - muS * muS), 0.0f, muS);
+        glm::vec3 result(0.0f);
+        for (int j = 0; j < IRRADIANCE_SAMPLES / 2; ++j) {
+            float theta = (j + 0.5f) * dTheta;
+            for (int i = 0; i < 2 * IRRADIANCE_SAMPLES; ++i) {
+                float phi = (i + 0.5f) * dPhi;
+                glm::vec3 omega(std::cos(phi) * std::sin(theta), std::sin(phi) * std::sin(theta), std::cos(theta));
+                float domega = dTheta * dPhi * std::sin(theta);
+                result += scatteringOfOrder(r, omega.z, muS, glm::dot(omega, omegaS), false, order) * omega.z * domega;
+            }
+        }
+        return result;
+    }
+
+    void precompute() {
+        {
+            TRACE_SCOPE("atmosphere transmittance");
+            parallelFor(ATMOSPHERE_TRANSMITTANCE_HEIGHT, [&](int y) {
+                for (int x = 0; x < ATMOSPHERE_TRANSMITTANCE_WIDTH; ++x) {
+                    float r, mu;
+                    rMuFromTransmittanceUv(glm::vec2((x + 0.5f) / ATMOSPHERE_TRANSMITTANCE_WIDTH,
+                        (y + 0.5f) / ATMOSPHERE_TRANSMITTANCE_HEIGHT), r, mu);
+                    transmittance.at(x, y) = computeTransmittanceToTop(r, mu);
+                }
+                });
+        }
+
+        // The irradiance table keeps only the sky's share; the shaders add
+        // the sun's themselves
+        for (int y = 0; y < ATMOSPHERE_IRRADIANCE_HEIGHT; ++y) {
+            for (int x = 0; x < ATMOSPHERE_IRRADIANCE_WIDTH; ++x) {
+                float r, muS;
+                rMuSFromIrradianceUv(glm::vec2((x + 0.5f) / ATMOSPHERE_IRRADIANCE_WIDTH,
+                    (y + 0.5f) / ATMOSPHERE_IRRADIANCE_HEIGHT), r, muS);
+                deltaIrradiance.at(x, y) = computeDirectIrradiance(r, muS);
+            }
+        }
+
+        {
+            TRACE_SCOPE("atmosphere single scattering");
+            parallelFor(ATMOSPHERE_SCATTERING_R, [&](int z) {
+                for (int y = 0; y < ATMOSPHERE_SCATTERING_MU; ++y) {
+                    for (int x = 0; x < SCATTERING_WIDTH; ++x) {
+                        float r, mu, muS, nu;
+                        bool ground;
+                        scatteringTexelParameters(x, y, z, r, mu, muS, nu, ground);
+                        glm::vec3 rayleigh, mie;
+                        computeSingleScattering(r, mu, muS, nu, ground, rayleigh, mie);
+                        deltaRayleigh.at(x, y, z) = rayleigh;
+                        deltaMie.at(x, y, z) = mie;
+                        scattering.at(x, y, z) = glm::vec4(rayleigh, mie.r);
+                    }
+                }
+                });
+        }
+
+        for (int order = 2; order <= p.scatteringOrders; ++order) {
+            TRACE_SCOPE("atmosphere scattering order");
+            parallelFor(ATMOSPHERE_SCATTERING_R * ATMOSPHERE_SCATTERING_MU, [&](int row) {
+                int y = row % ATMOSPHERE_SCATTERING_MU, z = row / ATMOSPHERE_SCATTERING_MU;
+                for (int x = 0; x < SCATTERING_WIDTH; ++x) {
+                    float r, mu, muS, nu;
+                    bool ground;
+                    scatteringTexelParameters(x, y, z, r, mu, muS, nu, ground);
+                    deltaDensity.at(x, y, z) = computeScatteringDensity(r, mu, muS, nu, order);
+                }
+                });
+
+            for (int y = 0; y < ATMOSPHERE_IRRADIANCE_HEIGHT; ++y) {
+                for (int x = 0; x < ATMOSPHERE_IRRADIANCE_WIDTH; ++x) {
+                    float r, muS;
+                    rMuSFromIrradianceUv(glm::vec2((x + 0.5f) / ATMOSPHERE_IRRADIANCE_WIDTH,
+                        (y + 0.5f) / ATMOSPHERE_IRRADIANCE_HEIGHT), r, muS);
+                    deltaIrradiance.at(x, y) = computeIndirectIrradiance(r, muS, order - 1);
+                    irradiance.at(x, y) += deltaIrradiance.at(x, y);
+                }
+            }
+
+            // Written after the density pass read the previous order
+            parallelFor(ATMOSPHERE_SCATTERING_R * ATMOSPHERE_SCATTERING_MU, [&](int row) {
+                int y = row % ATMOSPHERE_SCATTERING_MU, z = row / ATMOSPHERE_SCATTERING_MU;
+                for (int x = 0; x < SCATTERING_WIDTH; ++x) {
+                    float r, mu, muS, nu;
+                    bool ground;
+                    scatteringTexelParameters(x, y, z, r, mu, muS, nu, ground);
+                    glm::vec3 multiple = computeMultipleScattering(r, mu, muS, nu, ground);
+                    deltaMultiple.at(x, y, z) = multiple;
+                    scattering.at(x, y, z) += glm::vec4(multiple / rayleighPhase(nu), 0.0f);
+                }
+                });
+        }
+    }
+};
+
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Everything the tables depend on, so a change recomputes them
+std::string cachePath(const AtmosphereParameters& p, const std::string& directory) {
+    float values[] = {
+        p.bottomRadius, p.topRadius, p.rayleighScattering.r, p.rayleighScattering.g, p.rayleighScattering.b,
+        p.rayleighScaleHeight, p.mieScattering.r, p.mieScattering.g, p.mieScattering.b, p.mieExtinction.r,
+        p.mieExtinction.g, p.mieExtinction.b, p.mieScaleHeight, p.miePhaseG, p.absorptionExtinction.r,
+        p.absorptionExtinction.g, p.absorptionExtinction.b, p.absorptionCenter, p.absorptionWidth,
+        p.groundAlbedo.r, p.groundAlbedo.g, p.groundAlbedo.b, p.sunAngularRadius, p.muSMin
+    };
+    int sizes[] = {
+        (int)CACHE_VERSION, p.scatteringOrders, ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT,
+        ATMOSPHERE_IRRADIANCE_WIDTH, ATMOSPHERE_IRRADIANCE_HEIGHT, ATMOSPHERE_SCATTERING_R, ATMOSPHERE_SCATTERING_MU,
+        ATMOSPHERE_SCATTERING_MU_S, ATMOSPHERE_SCATTERING_NU, DENSITY_SAMPLES, IRRADIANCE_SAMPLES
+    };
+    uint64_t hash = fnv1a(values, sizeof(values));
+    hash = fnv1a(sizes, sizeof(sizes), hash);
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+    return directory + "/" + p.name + "-" + hex + ".bin";
+}
+
+bool readTables(const std::string& path, AtmosphereTables& tables) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    uint32_t header[2] = { 0, 0 }; // magic, version
+    file.read((char*)header, sizeof(header));
+    if (!file || header[0] != CACHE_MAGIC || header[1] != CACHE_VERSION)
+        return false;
+    tables.transmittance.resize(TRANSMITTANCE_TEXELS * 3);
+    tables.irradiance.resize(IRRADIANCE_TEXELS * 3);
+    tables.scattering.resize((size_t)SCATTERING_TEXELS * 4);
+    file.read((char*)tables.transmittance.data(), tables.transmittance.size() * sizeof(float));
+    file.read((char*)tables.irradiance.data(), tables.irradiance.size() * sizeof(float));
+    file.read((char*)tables.scattering.data(), tables.scattering.size() * sizeof(float));
+    return (bool)file;
+}
+
+void writeTables(const std::string& path, const AtmosphereTables& tables) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Failed to write atmosphere cache entry: " << path << std::endl;
+        return;
+    }
+    uint32_t header[2] = { CACHE_MAGIC, CACHE_VERSION };
+    file.write((const char*)header, sizeof(header));
+    file.write((const char*)tables.transmittance.data(), tables.transmittance.size() * sizeof(float));
+    file.write((const char*)tables.irradiance.data(), tables.irradiance.size() * sizeof(float));
+    file.write((const char*)tables.scattering.data(), tables.scattering.size() * sizeof(float));
+}
+
+void makeDirectory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+template <typename T>
+std::vector<float> flatten(const Table<T>& table) {
+    const float* first = glm::value_ptr(table.texels[0]);
+    return std::vector<float>(first, first + table.texels.size() * sizeof(T) / sizeof(float));
+}
+
+GLuint createTable2D(int width, int height, const std::vector<float>& texels) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return texture;
+}
+
+} // namespace
+
+bool findAtmosphere(const std::string& body, AtmosphereParameters& parameters) {
+    AtmosphereParameters p; // Earth
+    p.name = body;
+    if (body == "earth") {
+        // the defaults
+    }
+    else if (body == "venus") {
+        // Seen from the cloud tops: thick CO2 over a yellowish sulphuric haze
+        p.bottomRadius = 6052.0f;
+        p.topRadius = 6052.0f + 120.0f;
+        p.rayleighScattering = glm::vec3(8.0e-3f, 18.0e-3f, 42.0e-3f);
+        p.rayleighScaleHeight = 15.9f;
+        p.mieScattering = glm::vec3(12.0e-3f, 10.0e-3f, 6.0e-3f);
+        p.mieExtinction = p.mieScattering * 1.1f;
+        p.mieScaleHeight = 8.0f;
+        p.miePhaseG = 0.7f;
+        p.absorptionExtinction = glm::vec3(0.0f);
+        p.groundAlbedo = glm::vec3(0.7f, 0.6f, 0.4f);
+    }
+    else if (body == "jupiter" || body == "saturn" || body == "uranus" || body == "neptune") {
+        // Hydrogen and helium above the cloud deck; the ice giants' methane
+        // absorbs red
+        bool ice = body == "uranus" || body == "neptune";
+        p.bottomRadius = body == "jupiter" ? 71492.0f : body == "saturn" ? 60268.0f : body == "uranus" ? 25559.0f
+            : 24764.0f;
+        p.rayleighScaleHeight = body == "jupiter" ? 27.0f : body == "saturn" ? 59.5f : body == "uranus" ? 27.7f
+            : 19.7f;
+        p.topRadius = p.bottomRadius + p.rayleighScaleHeight * 12.0f;
+        // Set by the optical depth straight up, a quarter of the Earth's so
+        // the cloud colours show through
+        p.rayleighScattering = glm::vec3(0.01f, 0.025f, 0.06f) / p.rayleighScaleHeight;
+        p.mieScattering = glm::vec3(ice ? 0.015f : 0.05f) / p.rayleighScaleHeight;
+        p.mieExtinction = p.mieScattering * 1.1f;
+        p.mieScaleHeight = p.rayleighScaleHeight * 0.5f;
+        p.miePhaseG = 0.7f;
+        p.absorptionExtinction = ice ? glm::vec3(0.2f, 0.03f, 0.0f) / p.rayleighScaleHeight : glm::vec3(0.0f);
+        p.absorptionCenter = 0.0f;
+        p.absorptionWidth = p.rayleighScaleHeight * 6.0f;
+        p.groundAlbedo = glm::vec3(0.5f);
+    }
+    else {
+        return false;
+    }
+    parameters = p;
+    return true;
+}
+
+AtmosphereTables loadAtmosphereTables(const AtmosphereParameters& parameters, const std::string& cacheDirectory) {
+    TRACE_SCOPE("loadAtmosphereTables");
+    AtmosphereTables tables;
+    std::string path = cacheDirectory.empty() ? "" : cachePath(parameters, cacheDirectory);
+    if (!path.empty() && readTables(path, tables))
+        return tables;
+
+    Model model(parameters);
+    model.precompute();
+    tables.transmittance = flatten(model.transmittance);
+    tables.irradiance = flatten(model.irradiance);
+    tables.scattering = flatten(model.scattering);
+    if (!path.empty()) {
+        makeDirectory(cacheDirectory);
+        writeTables(path, tables);
+    }
+    return tables;
+}
+
+void createAtmosphere(Atmosphere& atmosphere, const AtmosphereParameters& parameters, AtmosphereTables& tables) {
+    TRACE_SCOPE("createAtmosphere");
+    atmosphere.parameters = parameters;
+    atmosphere.transmittanceTexture = createTable2D(ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT,
+        tables.transmittance);
+    atmosphere.irradianceTexture = createTable2D(ATMOSPHERE_IRRADIANCE_WIDTH, ATMOSPHERE_IRRADIANCE_HEIGHT,
+        tables.irradiance);
+
+    // Half floats are plenty for the inscattered light
+    glGenTextures(1, &atmosphere.scatteringTexture);
+    glBindTexture(GL_TEXTURE_3D, atmosphere.scatteringTexture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, SCATTERING_WIDTH, ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_R, 0,
+        GL_RGBA, GL_FLOAT, tables.scattering.data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    tables = AtmosphereTables();
+}
+
+void destroyAtmosphere(Atmosphere& atmosphere) {
+    GLuint textures[] = { atmosphere.transmittanceTexture, atmosphere.irradianceTexture, atmosphere.scatteringTexture };
+    glDeleteTextures(3, textures);
+    atmosphere = Atmosphere();
+}
+
+void bindAtmosphere(const Atmosphere& atmosphere, GLuint program, const glm::vec3& center, float radius) {
+    const AtmosphereParameters& p = atmosphere.parameters;
+    glUniform3fv(glGetUniformLocation(program, "atmosphereCenter"), 1, glm::value_ptr(center));
+    glUniform1f(glGetUniformLocation(program, "atmosphereScale"), p.bottomRadius / radius);
+    glUniform1f(glGetUniformLocation(program, "bottomRadius"), p.bottomRadius);
+    glUniform1f(glGetUniformLocation(program, "topRadius"), p.topRadius);
+    glUniform3fv(glGetUniformLocation(program, "rayleighScattering"), 1, glm::value_ptr(p.rayleighScattering));
+    glUniform3fv(glGetUniformLocation(program, "mieScattering"), 1, glm::value_ptr(p.mieScattering));
+    glUniform1f(glGetUniformLocation(program, "miePhaseG"), p.miePhaseG);
+    glUniform1f(glGetUniformLocation(program, "sunAngularRadius"), p.sunAngularRadius);
+    glUniform1f(glGetUniformLocation(program, "muSMin"), p.muSMin);
+
+    glUniform1i(glGetUniformLocation(program, "transmittanceTable"), 2);
+    glUniform1i(glGetUniformLocation(program, "scatteringTable"), 3);
+    glUniform1i(glGetUniformLocation(program, "irradianceTable"), 4);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, atmosphere.transmittanceTexture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_3D, atmosphere.scatteringTexture);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, atmosphere.irradianceTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
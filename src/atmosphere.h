@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+// Precomputed atmospheric scattering, after Bruneton and Neyret,
+// "Precomputed Atmospheric Scattering" (2008) and Bruneton's 2017
+// reference implementation, whose table parameterizations this follows.
+//
+// Three tables hold everything the shaders need:
+// - transmittance to the top of the atmosphere, by altitude and view angle
+// - the sky irradiance on the ground, by altitude and sun angle
+// - inscattered light, by altitude, view angle, sun angle and the angle
+//   between them: a 4D table stored in a 3D texture with the last two
+//   dimensions side by side. RGB is Rayleigh plus multiple scattering,
+//   alpha the red channel of single Mie scattering, from which the other
+//   two are extrapolated.
+// They are computed on the CPU, spread over all cores, so they work
+// headless and on GL 3.3, and cached on disk keyed by the parameters.
+// Lengths are in km, with the sun's irradiance 1 at the top.
+const int ATMOSPHERE_TRANSMITTANCE_WIDTH = 256;
+const int ATMOSPHERE_TRANSMITTANCE_HEIGHT = 64;
+const int ATMOSPHERE_IRRADIANCE_WIDTH = 64;
+const int ATMOSPHERE_IRRADIANCE_HEIGHT = 16;
+const int ATMOSPHERE_SCATTERING_R = 16;
+const int ATMOSPHERE_SCATTERING_MU = 64;
+const int ATMOSPHERE_SCATTERING_MU_S = 16;
+const int ATMOSPHERE_SCATTERING_NU = 8;
+
+struct AtmosphereParameters {
+    std::string name; // cache file prefix
+    float bottomRadius;
+    float topRadius;
+    glm::vec3 rayleighScattering; // per km at the bottom
+    float rayleighScaleHeight;
+    glm::vec3 mieScattering;
+    glm::vec3 mieExtinction;
+    float mieScaleHeight;
+    float miePhaseG;
+    glm::vec3 absorptionExtinction; // ozone or methane, peak value
+    float absorptionCenter;         // altitude of the peak; density falls
+    float absorptionWidth;          // linearly to zero over half the width
+    glm::vec3 groundAlbedo;
+    float sunAngularRadius;
+    float muSMin; // cosine of the lowest sun angle that still lights the sky
+    int scatteringOrders;
+
+    AtmosphereParameters()
+        : bottomRadius(6360.0f), topRadius(6420.0f), rayleighScattering(5.802e-3f, 13.558e-3f, 33.1e-3f),
+        rayleighScaleHeight(8.0f), mieScattering(3.996e-3f), mieExtinction(4.44e-3f), mieScaleHeight(1.2f),
+        miePhaseG(0.8f), absorptionExtinction(0.65e-3f, 1.881e-3f, 0.085e-3f), absorptionCenter(25.0f),
+        absorptionWidth(30.0f), groundAlbedo(0.1f), sunAngularRadius(0.004675f), muSMin(-0.2f),
+        scatteringOrders(4) {}
+};
+
+// The body's tables on the CPU: RGB transmittance and irradiance, RGBA
+// scattering, row by row.
+struct AtmosphereTables {
+    std::vector<float> transmittance;
+    std::vector<float> irradiance;
+    std::vector<float> scattering;
+};
+
+struct Atmosphere {
+    AtmosphereParameters parameters;
+    GLuint transmittanceTexture;
+    GLuint irradianceTexture;
+    GLuint scatteringTexture;
+
+    Atmosphere() : transmittanceTexture(0), irradianceTexture(0), scatteringTexture(0) {}
+};
+
+// Earth, Venus and the gas giants by texture name; false for the rest.
+bool findAtmosphere(const std::string& body, AtmosphereParameters& parameters);
+
+// Reads the tables from `cacheDirectory`, or computes and stores them there
+// (an empty directory disables the cache). CPU-only and thread-safe.
+AtmosphereTables loadAtmosphereTables(const AtmosphereParameters& parameters, const std::string& cacheDirectory);
+
+// Uploads the tables and frees them. GL thread.
+void createAtmosphere(Atmosphere& atmosphere, const AtmosphereParameters& parameters, AtmosphereTables& tables);
+void destroyAtmosphere(Atmosphere& atmosphere);
+
+// Binds the tables on texture units 2-4 and sets the uniforms
+// atmosphere.glsl reads, for a body of `radius` world units at `center`.
+// `program` must be current.
+void bindAtmosphere(const Atmosphere& atmosphere, GLuint program, const glm::vec3& center, float radius);
@@ -0,0 +1,290 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "tinygltf/json.hpp"
+
+using json = nlohmann::json;
+
+bool loadCameraPath(const std::string& path, CameraPath& cameraPath) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open camera path: " << path << std::endl;
+        return false;
+    }
+
+    cameraPath.name = path;
+    cameraPath.keys.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+        std::istringstream in(line);
+        float t;
+        glm::vec3 pos, target;
+        if (!(in >> t))
+            continue; // blank line
+        if (!(in >> pos.x >> pos.y >> pos.z >> target.x >> target.y >> target.z)) {
+            std::cerr << path << ":" << lineNumber << ": expected 'time px py pz tx ty tz'" << std::endl;
+            return false;
+        }
+        if (!cameraPath.keys.empty() && t <= cameraPath.keys.back().time) {
+            std::cerr << path << ":" << lineNumber << ": key times must increase" << std::endl;
+            return false;
+        }
+        cameraPath.keys.push_back(CameraKey(t, pos, target));
+    }
+
+    if (cameraPath.keys.size() < 2) {
+        std::cerr << "Camera path needs at least two keys: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+CameraPath defaultCameraPath() {
+    CameraPath path;
+    path.name = "default";
+    glm::vec3 sun(0.0f);
+    path.keys.push_back(CameraKey(0.0f, glm::vec3(-500.0f, 100.0f, 0.0f), sun));
+    path.keys.push_back(CameraKey(5.0f, glm::vec3(-150.0f, 20.0f, 150.0f), sun));
+    path.keys.push_back(CameraKey(10.0f, glm::vec3(200.0f, 40.0f, 200.0f), sun));
+    path.keys.push_back(CameraKey(15.0f, glm::vec3(900.0f, 150.0f, -300.0f), sun));
+    path.keys.push_back(CameraKey(20.0f, glm::vec3(0.0f, 600.0f, -1400.0f), sun));
+    path.keys.push_back(CameraKey(25.0f, glm::vec3(-1500.0f, 300.0f, 0.0f), sun));
+    path.keys.push_back(CameraKey(30.0f, glm::vec3(-500.0f, 100.0f, 0.0f), sun));
+    return path;
+}
+
+static glm::vec3 catmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) {
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return 0.5f * ((2.0f * p1) + (-p0 + p2) * t +
+        (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+        (-p0 + 3.0f * p1 - 3.0f * p2 + p3) * t3);
+}
+
+void sampleCameraPath(const CameraPath& cameraPath, float t, glm::vec3& position, glm::vec3& front) {
+    const std::vector<CameraKey>& keys = cameraPath.keys;
+    if (keys.empty())
+        return;
+
+    float time = glm::clamp(keys.front().time + t, keys.front().time, keys.back().time);
+    size_t i = 0;
+    while (i + 2 < keys.size() && keys[i + 1].time <= time)
+        ++i;
+
+    const CameraKey& k1 = keys[i];
+    const CameraKey& k2 = keys[std::min(i + 1, keys.size() - 1)];
+    const CameraKey& k0 = keys[i > 0 ? i - 1 : i];
+    const CameraKey& k3 = keys[std::min(i + 2, keys.size() - 1)];
+
+    float span = k2.time - k1.time;
+    float u = span > 0.0f ? (time - k1.time) / span : 0.0f;
+
+    position = catmullRom(k0.position, k1.position, k2.position, k3.position, u);
+    glm::vec3 target = catmullRom(k0.target, k1.target, k2.target, k3.target, u);
+    glm::vec3 dir = target - position;
+    if (glm::length(dir) > 1e-4f)
+        front = glm::normalize(dir);
+}
+
+// ---------------------------------------------------------------------------
+
+static double millisecondsBetween(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+static void collectQuery(BenchmarkRecorder& recorder, int slot) {
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(recorder.queries[slot][0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(recorder.queries[slot][1], GL_QUERY_RESULT, &end);
+    recorder.timings[recorder.queryFrame[slot]].gpuMs = (double)(end - begin) / 1.0e6;
+    recorder.queryFrame[slot] = -1;
+}
+
+void createBenchmarkRecorder(BenchmarkRecorder& recorder, int warmupFrames) {
+    glGenQueries(BenchmarkRecorder::QUERY_RING * 2, &recorder.queries[0][0]);
+    for (int i = 0; i < BenchmarkRecorder::QUERY_RING; ++i)
+        recorder.queryFrame[i] = -1;
+    recorder.ringHead = 0;
+    recorder.warmupFrames = warmupFrames;
+    recorder.timings.clear();
+    recorder.hasLastFrame = false;
+}
+
+void destroyBenchmarkRecorder(BenchmarkRecorder& recorder) {
+    glDeleteQueries(BenchmarkRecorder::QUERY_RING * 2, &recorder.queries[0][0]);
+}
+
+void beginBenchmarkFrame(BenchmarkRecorder& recorder) {
+    int slot = recorder.ringHead;
+    // Only blocks if the GPU is more than QUERY_RING frames behind
+    if (recorder.queryFrame[slot] >= 0)
+        collectQuery(recorder, slot);
+
+    recorder.frameStart = std::chrono::steady_clock::now();
+    if (!recorder.hasLastFrame) {
+        recorder.lastFrameEnd = recorder.frameStart;
+        recorder.hasLastFrame = true;
+    }
+    glQueryCounter(recorder.queries[slot][0], GL_TIMESTAMP);
+}
+
+void markBenchmarkCpuDone(BenchmarkRecorder& recorder, int frame, float simTime) {
+    int slot = recorder.ringHead;
+    glQueryCounter(recorder.queries[slot][1], GL_TIMESTAMP);
+
+    FrameTiming timing;
+    timing.frame = frame;
+    timing.simTime = simTime;
+    timing.cpuMs = millisecondsBetween(recorder.frameStart, std::chrono::steady_clock::now());
+    recorder.timings.push_back(timing);
+
+    recorder.queryFrame[slot] = (int)recorder.timings.size() - 1;
+    recorder.ringHead = (slot + 1) % BenchmarkRecorder::QUERY_RING;
+}
+
+void endBenchmarkFrame(BenchmarkRecorder& recorder) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!recorder.timings.empty())
+        recorder.timings.back().frameMs = millisecondsBetween(recorder.lastFrameEnd, now);
+    recorder.lastFrameEnd = now;
+
+    // Pick up whatever finished without waiting
+    for (int i = 0; i < BenchmarkRecorder::QUERY_RING; ++i) {
+        if (recorder.queryFrame[i] < 0)
+            continue;
+        GLint available = 0;
+        glGetQueryObjectiv(recorder.queries[i][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+            collectQuery(recorder, i);
+    }
+}
+
+void finishBenchmark(BenchmarkRecorder& recorder) {
+    for (int i = 0; i < BenchmarkRecorder::QUERY_RING; ++i) {
+        if (recorder.queryFrame[i] >= 0)
+            collectQuery(recorder, i);
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0.0;
+    size_t rank = (size_t)std::ceil(p * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+static json summarize(std::vector<double> samples) {
+    json stats;
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double s : samples)
+        sum += s;
+    stats["mean"] = samples.empty() ? 0.0 : sum / samples.size();
+    stats["p50"] = percentile(samples, 0.50);
+    stats["p95"] = percentile(samples, 0.95);
+    stats["p99"] = percentile(samples, 0.99);
+    stats["worst"] = samples.empty() ? 0.0 : samples.back();
+    return stats;
+}
+
+bool writeBenchmarkReport(const BenchmarkRecorder& recorder, const std::string& basePath,
+    const std::string& pathName, int width, int height, float timeStep) {
+    std::vector<double> cpu, gpu, frame;
+    int worstFrame = -1;
+    double worstMs = -1.0;
+    for (size_t i = recorder.warmupFrames; i < recorder.timings.size(); ++i) {
+        const FrameTiming& t = recorder.timings[i];
+        cpu.push_back(t.cpuMs);
+        if (t.gpuMs >= 0.0)
+            gpu.push_back(t.gpuMs);
+        frame.push_back(t.frameMs);
+        if (t.frameMs > worstMs) {
+            worstMs = t.frameMs;
+            worstFrame = t.frame;
+        }
+    }
+
+    json report;
+    report["renderer"] = (const char*)glGetString(GL_RENDERER);
+    report["version"] = (const char*)glGetString(GL_VERSION);
+    report["path"] = pathName;
+    report["width"] = width;
+    report["height"] = height;
+    report["timestep"] = timeStep;
+    report["frames"] = frame.size();
+    report["warmup_frames"] = recorder.warmupFrames;
+    report["cpu_ms"] = summarize(cpu);
+    report["gpu_ms"] = summarize(gpu);
+    report["frame_ms"] = summarize(frame);
+    report["worst_frame"] = worstFrame;
+
+    std::ofstream jsonFile(basePath + ".json");
+    std::ofstream csvFile(basePath + ".csv");
+    if (!jsonFile || !csvFile) {
+        std::cerr << "Failed to write benchmark report: " << basePath << std::endl;
+        return false;
+    }
+    jsonFile << report.dump(2) << std::endl;
+
+    csvFile << "frame,sim_time,cpu_ms,gpu_ms,frame_ms\n";
+    csvFile << std::fixed << std::setprecision(4);
+    for (const FrameTiming& t : recorder.timings)
+        csvFile << t.frame << "," << t.simTime << "," << t.cpuMs << "," << t.gpuMs << "," << t.frameMs << "\n";
+
+    std::cout << std::fixed << std::setprecision(3)
+        << "Benchmark (" << frame.size() << " frames): "
+        << "cpu p50 " << report["cpu_ms"]["p50"].get<double>() << " ms, p99 " << report["cpu_ms"]["p99"].get<double>() << " ms; "
+        << "gpu p50 " << report["gpu_ms"]["p50"].get<double>() << " ms, p99 " << report["gpu_ms"]["p99"].get<double>() << " ms; "
+        << "worst frame " << worstMs << " ms (#" << worstFrame << ")" << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+    return true;
+}
+
+// A metric's p95, or 0 if the report doesn't have it
+static double reportP95(const json& report, const char* metric) {
+    auto entry = report.find(metric);
+    if (entry == report.end() || !entry->is_object())
+        return 0.0;
+    auto p95 = entry->find("p95");
+    return p95 != entry->end() && p95->is_number() ? p95->get<double>() : 0.0;
+}
+
+BenchmarkComparison compareBenchmarkReports(const std::string& reportPath, const std::string& baselinePath,
+    double tolerance) {
+    std::ifstream reportFile(reportPath), baselineFile(baselinePath);
+    if (!reportFile || !baselineFile) {
+        std::cerr << "ERROR: Failed to open benchmark reports for comparison" << std::endl;
+        return BENCHMARK_COMPARE_FAILED;
+    }
+    json report = json::parse(reportFile, nullptr, false);
+    json baseline = json::parse(baselineFile, nullptr, false);
+    if (report.is_discarded() || baseline.is_discarded() || !report.is_object() || !baseline.is_object()) {
+        std::cerr << "ERROR: Malformed benchmark report" << std::endl;
+        return BENCHMARK_COMPARE_FAILED;
+    }
+
+    BenchmarkComparison result = BENCHMARK_OK;
+    const char* metrics[] = { "cpu_ms", "gpu_ms", "frame_ms" };
+    for (const char* metric : metrics) {
+        double base = reportP95(baseline, metric);
+        double now = reportP95(report, metric);
+        if (base > 0.0 && now > base * (1.0 + tolerance)) {
+            std::cerr << "REGRESSION: " << metric << " p95 " << now << " ms vs baseline " << base << " ms" << std::endl;
+            result = BENCHMARK_REGRESSED;
+        }
+    }
+    return result;
+}
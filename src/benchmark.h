@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// One keyframe of a scripted camera flight: where the camera is and what it
+// looks at, at a given simulation time.
+struct CameraKey {
+    float time;
+    glm::vec3 position;
+    glm::vec3 target;
+
+    CameraKey(float t, const glm::vec3& pos, const glm::vec3& tgt) : time(t), position(pos), target(tgt) {}
+};
+
+struct CameraPath {
+    std::string name;
+    std::vector<CameraKey> keys;
+
+    float duration() const { return keys.empty() ? 0.0f : keys.back().time - keys.front().time; }
+};
+
+// Loads a path from a text file with one "time px py pz tx ty tz" key per line
+// ('#' starts a comment). Keys must be sorted by time.
+bool loadCameraPath(const std::string& path, CameraPath& cameraPath);
+
+// Built-in fly-through: sweeps the inner system, passes the gas giants and
+// returns to the start position.
+CameraPath defaultCameraPath();
+
+// Catmull-Rom interpolation of the path at time t (relative to the first key).
+void sampleCameraPath(const CameraPath& cameraPath, float t, glm::vec3& position, glm::vec3& front);
+
+struct FrameTiming {
+    int frame;
+    float simTime;
+    double cpuMs;   // CPU time spent building and submitting the frame
+    double gpuMs;   // GPU time between the frame's first and last command
+    double frameMs; // wall time since the previous frame finished
+
+    FrameTiming() : frame(0), simTime(0.0f), cpuMs(0.0), gpuMs(-1.0), frameMs(0.0) {}
+};
+
+// Records per-frame CPU and GPU timings. GPU times come from GL_TIMESTAMP
+// queries kept in a small ring, so results are collected a few frames late
+// instead of stalling the pipeline.
+struct BenchmarkRecorder {
+    static const int QUERY_RING = 4;
+
+    GLuint queries[QUERY_RING][2];
+    int queryFrame[QUERY_RING]; // index into timings, -1 if free
+    int ringHead;
+    int warmupFrames;
+    std::vector<FrameTiming> timings;
+    std::chrono::steady_clock::time_point frameStart;
+    std::chrono::steady_clock::time_point lastFrameEnd;
+    bool hasLastFrame;
+
+    BenchmarkRecorder() : ringHead(0), warmupFrames(0), hasLastFrame(false) {}
+};
+
+void createBenchmarkRecorder(BenchmarkRecorder& recorder, int warmupFrames);
+void destroyBenchmarkRecorder(BenchmarkRecorder& recorder);
+void beginBenchmarkFrame(BenchmarkRecorder& recorder);
+// cpuDone marks the point where the CPU side of the frame is complete; call it
+// before presenting or reading back so neither is charged to the CPU time.
+void markBenchmarkCpuDone(BenchmarkRecorder& recorder, int frame, float simTime);
+void endBenchmarkFrame(BenchmarkRecorder& recorder);
+// Blocks until every outstanding GPU timing is available.
+void finishBenchmark(BenchmarkRecorder& recorder);
+
+// Writes <basePath>.json (percentile summary) and <basePath>.csv (per-frame
+// samples). Warmup frames are excluded from the summary.
+bool writeBenchmarkReport(const BenchmarkRecorder& recorder, const std::string& basePath,
+    const std::string& pathName, int width, int height, float timeStep);
+
+enum BenchmarkComparison { BENCHMARK_OK, BENCHMARK_REGRESSED, BENCHMARK_COMPARE_FAILED };
+
+// Compares a fresh report against a baseline report: BENCHMARK_REGRESSED if
+// any p95 metric regressed by more than tolerance (0.1 = 10%),
+// BENCHMARK_COMPARE_FAILED if either report can't be read.
+BenchmarkComparison compareBenchmarkReports(const std::string& reportPath, const std::string& baselinePath,
+    double tolerance);
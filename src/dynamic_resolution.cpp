@@ -0,0 +1,65 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+
+void createDynamicResolution(DynamicResolution& dr, float targetMs, float minScale) {
+    dr.enabled = true;
+    dr.targetMs = targetMs;
+    dr.minScale = std::min(minScale, dr.maxScale);
+    dr.scale = dr.maxScale;
+    glGenQueries(DynamicResolution::FRAME_LAG * 2, &dr.queries[0][0]);
+}
+
+void destroyDynamicResolution(DynamicResolution& dr) {
+    if (!dr.enabled)
+        return;
+    glDeleteQueries(DynamicResolution::FRAME_LAG * 2, &dr.queries[0][0]);
+    dr.enabled = false;
+    dr.scale = 1.0f;
+}
+
+static void updateController(DynamicResolution& dr, float gpuMs) {
+    dr.lastGpuMs = gpuMs;
+    // Relative headroom: positive when under budget, so the scale can grow
+    float error = (dr.targetMs - gpuMs) / dr.targetMs;
+    float derivative = dr.hasPrevious ? error - dr.previousError : 0.0f;
+    dr.previousError = error;
+    dr.hasPrevious = true;
+
+    float integral = dr.integral + error;
+    float output = dr.maxScale + dr.kp * error + dr.ki * integral + dr.kd * derivative;
+    float clamped = std::max(dr.minScale, std::min(dr.maxScale, output));
+    // Anti-windup: only accumulate while the output isn't saturated, or while
+    // the error is pulling it back into range
+    if (clamped == output || (output > dr.maxScale) != (error > 0.0f))
+        dr.integral = integral;
+    dr.scale = clamped;
+}
+
+void beginDynamicResolutionFrame(DynamicResolution& dr) {
+    if (!dr.enabled)
+        return;
+
+    // The slot we're about to reuse was issued FRAME_LAG frames ago
+    if (dr.issued[dr.slot]) {
+        GLint available = 0;
+        glGetQueryObjectiv(dr.queries[dr.slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(dr.queries[dr.slot][0], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(dr.queries[dr.slot][1], GL_QUERY_RESULT, &end);
+            updateController(dr, (float)((end - begin) / 1.0e6));
+        }
+        // A late result is dropped rather than waited for; the controller
+        // just gets one fewer sample
+    }
+    glQueryCounter(dr.queries[dr.slot][0], GL_TIMESTAMP);
+}
+
+void endDynamicResolutionFrame(DynamicResolution& dr) {
+    if (!dr.enabled)
+        return;
+    glQueryCounter(dr.queries[dr.slot][1], GL_TIMESTAMP);
+    dr.issued[dr.slot] = true;
+    dr.slot = (dr.slot + 1) % DynamicResolution::FRAME_LAG;
+}
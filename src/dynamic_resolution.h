@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Scales the 3D render resolution to hold a GPU frame-time target.
+//
+// GPU time is measured with a pair of GL_TIMESTAMP queries around the frame
+// (timestamps don't conflict with the profiler's GL_TIME_ELAPSED queries).
+// Results are read FRAME_LAG frames later, once available, and fed to a PID
+// loop whose output is the per-axis render scale. The integral term is frozen
+// while the scale is pinned at a limit so it doesn't wind up.
+struct DynamicResolution {
+    static const int FRAME_LAG = 4;
+
+    bool enabled;
+    float targetMs;
+    float minScale;
+    float maxScale;
+    float kp, ki, kd;
+
+    float scale;       // current per-axis scale, applied to the next frame
+    float lastGpuMs;   // most recent measurement
+    float integral;
+    float previousError;
+    bool hasPrevious;
+
+    GLuint queries[FRAME_LAG][2];
+    bool issued[FRAME_LAG];
+    int slot;
+
+    DynamicResolution()
+        : enabled(false), targetMs(16.0f), minScale(0.5f), maxScale(1.0f),
+        kp(0.4f), ki(0.1f), kd(0.1f),
+        scale(1.0f), lastGpuMs(0.0f), integral(0.0f), previousError(0.0f), hasPrevious(false), slot(0) {
+        for (int i = 0; i < FRAME_LAG; ++i) {
+            queries[i][0] = queries[i][1] = 0;
+            issued[i] = false;
+        }
+    }
+};
+
+void createDynamicResolution(DynamicResolution& dr, float targetMs, float minScale);
+void destroyDynamicResolution(DynamicResolution& dr);
+
+// Reads the oldest measurement (if ready), updates the scale and opens this
+// frame's timing. No-op when disabled.
+void beginDynamicResolutionFrame(DynamicResolution& dr);
+void endDynamicResolutionFrame(DynamicResolution& dr);
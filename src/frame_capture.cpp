@@ -0,0 +1,258 @@
+#include "frame_capture.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+static const char* PIPE_WRITE_MODE = "wb";
+#else
+#include <csignal>
+static const char* PIPE_WRITE_MODE = "w";
+#endif
+
+bool createAsyncReadback(AsyncReadback& rb, int width, int height, int ringSize) {
+    rb.width = width;
+    rb.height = height;
+    rb.head = 0;
+    rb.pending = 0;
+    rb.pbos.assign(ringSize, 0);
+    rb.fences.assign(ringSize, nullptr);
+    rb.frameIndices.assign(ringSize, 0);
+    rb.frameTimes.assign(ringSize, 0.0f);
+
+    glGenBuffers(ringSize, rb.pbos.data());
+    for (GLuint pbo : rb.pbos) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return glGetError() == GL_NO_ERROR;
+}
+
+void destroyAsyncReadback(AsyncReadback& rb) {
+    for (GLsync fence : rb.fences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    if (!rb.pbos.empty())
+        glDeleteBuffers((GLsizei)rb.pbos.size(), rb.pbos.data());
+    rb.pbos.clear();
+    rb.fences.clear();
+    rb.pending = 0;
+}
+
+static void collectSlot(AsyncReadback& rb, int slot, const HeadlessFrameCallback& onFrame) {
+    TraceScope scope("collect readback");
+    glClientWaitSync(rb.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(rb.fences[slot]);
+    rb.fences[slot] = nullptr;
+
+    HeadlessFrame frame;
+    frame.index = rb.frameIndices[slot];
+    frame.time = rb.frameTimes[slot];
+    frame.width = rb.width;
+    frame.height = rb.height;
+    frame.pixels.resize((size_t)rb.width * rb.height * 4);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbos[slot]);
+    const unsigned char* mapped = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+        (GLsizeiptr)frame.pixels.size(), GL_MAP_READ_BIT);
+    if (mapped) {
+        // Flip while copying out so rows end up top-first
+        size_t rowSize = (size_t)rb.width * 4;
+        for (int y = 0; y < rb.height; ++y)
+            memcpy(&frame.pixels[y * rowSize], mapped + (rb.height - 1 - y) * rowSize, rowSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else {
+        std::cerr << "ERROR: Failed to map readback buffer for frame " << frame.index << std::endl;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    rb.pending--;
+    scope.end();
+    if (mapped && onFrame)
+        onFrame(frame);
+}
+
+void queueReadback(AsyncReadback& rb, GLuint fbo, int frameIndex, float frameTime,
+    const HeadlessFrameCallback& onFrame) {
+    int ringSize = (int)rb.pbos.size();
+    if (rb.pending == ringSize)
+        collectSlot(rb, (rb.head - rb.pending + ringSize) % ringSize, onFrame);
+
+    int slot = rb.head;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbos[slot]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, rb.width, rb.height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    rb.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb.frameIndices[slot] = frameIndex;
+    rb.frameTimes[slot] = frameTime;
+    rb.head = (rb.head + 1) % ringSize;
+    rb.pending++;
+}
+
+void pollReadback(AsyncReadback& rb, const HeadlessFrameCallback& onFrame, bool wait) {
+    int ringSize = (int)rb.pbos.size();
+    while (rb.pending > 0) {
+        int oldest = (rb.head - rb.pending + ringSize) % ringSize;
+        if (!wait) {
+            GLenum status = glClientWaitSync(rb.fences[oldest], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                return;
+        }
+        collectSlot(rb, oldest, onFrame);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+FrameEncoder::FrameEncoder()
+    : width(0), height(0), pipe(nullptr), maxQueued(0), stopping(false), written(0) {}
+
+FrameEncoder::~FrameEncoder() {
+    finish();
+}
+
+bool FrameEncoder::start(const CaptureOptions& opts, int w, int h) {
+    options = opts;
+    width = w;
+    height = h;
+    stopping = false;
+    written = 0;
+
+    int workerCount = options.workerCount;
+    if (!options.pipeCommand.empty()) {
+        pipe = popen(options.pipeCommand.c_str(), PIPE_WRITE_MODE);
+        if (!pipe) {
+            std::cerr << "Failed to start encoder process: " << options.pipeCommand << std::endl;
+            return false;
+        }
+#ifndef _WIN32
+        // An encoder that exits early should fail the write, not kill us
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        // The pipe is a single ordered stream
+        workerCount = 1;
+    }
+    else if (workerCount <= 0) {
+        workerCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    }
+
+    maxQueued = (size_t)workerCount * 2;
+    for (int i = 0; i < workerCount; ++i)
+        workers.emplace_back(&FrameEncoder::workerLoop, this);
+
+    std::cout << "Capturing " << width << "x" << height << " frames to "
+        << (pipe ? options.pipeCommand : options.outputPattern)
+        << " with " << workerCount << " encoder thread(s)" << std::endl;
+    return true;
+}
+
+void FrameEncoder::submit(HeadlessFrame& frame) {
+    std::unique_lock<std::mutex> lock(mutex);
+    queueSpace.wait(lock, [&] { return queue.size() < maxQueued; });
+    queue.emplace_back();
+    HeadlessFrame& queued = queue.back();
+    queued.index = frame.index;
+    queued.time = frame.time;
+    queued.width = frame.width;
+    queued.height = frame.height;
+    queued.pixels.swap(frame.pixels);
+    lock.unlock();
+    queueReady.notify_one();
+}
+
+void FrameEncoder::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueReady.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+    workers.clear();
+
+    if (pipe) {
+        pclose(pipe);
+        pipe = nullptr;
+    }
+}
+
+void FrameEncoder::workerLoop() {
+    setTraceThreadName("frame encoder");
+    for (;;) {
+        HeadlessFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queueReady.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+        queueSpace.notify_one();
+
+        if (encode(frame)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            written++;
+        }
+    }
+}
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && std::equal(suffix.rbegin(), suffix.rend(), text.rbegin(),
+        [](char a, char b) { return tolower(a) == tolower(b); });
+}
+
+bool validCapturePattern(const std::string& pattern) {
+    if (!endsWith(pattern, ".ppm"))
+        return false;
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%')
+            continue;
+        if (++i < pattern.size() && pattern[i] == '%')
+            continue;
+        // Flags, width and precision, then d or i
+        while (i < pattern.size() && strchr("-+ #0", pattern[i]))
+            ++i;
+        while (i < pattern.size() && isdigit((unsigned char)pattern[i]))
+            ++i;
+        if (i < pattern.size() && pattern[i] == '.') {
+            ++i;
+            while (i < pattern.size() && isdigit((unsigned char)pattern[i]))
+                ++i;
+        }
+        if (i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i'))
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+bool FrameEncoder::encode(const HeadlessFrame& frame) {
+    TRACE_SCOPE("encode frame");
+    if (pipe) {
+        size_t bytes = frame.pixels.size();
+        if (fwrite(frame.pixels.data(), 1, bytes, pipe) != bytes) {
+            std::cerr << "ERROR: Encoder pipe closed at frame " << frame.index << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), options.outputPattern.c_str(), frame.index);
+
+    // The pattern was checked by validCapturePattern; writeFramePPM reports failures
+    return writeFramePPM(path, frame);
+}
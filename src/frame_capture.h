@@ -0,0 +1,88 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "headless.h"
+
+// Ring of pixel-pack buffers used to read frames back without stalling.
+// glReadPixels writes into slot N while slots N-1.. are still being transferred;
+// a slot is only mapped once its fence has signalled (or the ring is full).
+struct AsyncReadback {
+    int width;
+    int height;
+    std::vector<GLuint> pbos;
+    std::vector<GLsync> fences;
+    std::vector<int> frameIndices;
+    std::vector<float> frameTimes;
+    int head;    // next slot to write
+    int pending; // slots in flight
+
+    AsyncReadback() : width(0), height(0), head(0), pending(0) {}
+};
+
+bool createAsyncReadback(AsyncReadback& rb, int width, int height, int ringSize);
+void destroyAsyncReadback(AsyncReadback& rb);
+
+// Starts an asynchronous read of fbo into the next ring slot. If every slot is
+// still in flight, the oldest one is waited for and handed to onFrame first.
+void queueReadback(AsyncReadback& rb, GLuint fbo, int frameIndex, float frameTime,
+    const HeadlessFrameCallback& onFrame);
+
+// Hands finished frames to onFrame in submission order. With wait=false this
+// never blocks; with wait=true it drains the whole ring.
+void pollReadback(AsyncReadback& rb, const HeadlessFrameCallback& onFrame, bool wait);
+
+struct CaptureOptions {
+    std::string outputPattern; // printf-style, e.g. "frames/frame_%05d.ppm"
+    std::string pipeCommand;   // if set, raw RGBA frames are piped to this process instead
+    int workerCount;
+    int ringSize;
+
+    CaptureOptions() : workerCount(0), ringSize(3) {}
+};
+
+// True for a .ppm path pattern with exactly one %d (or %i) conversion and
+// nothing else for printf to expand, e.g. "frames/frame_%05d.ppm".
+bool validCapturePattern(const std::string& pattern);
+
+// Worker pool that writes frames to PPM files or streams them, in order, to
+// an encoder process (which can produce PNG, video, ...).
+class FrameEncoder {
+public:
+    FrameEncoder();
+    ~FrameEncoder();
+
+    bool start(const CaptureOptions& options, int width, int height);
+    // Takes ownership of frame.pixels. Blocks if the workers fall too far behind
+    // so memory use stays bounded.
+    void submit(HeadlessFrame& frame);
+    // Waits for all queued frames to be written and stops the workers.
+    void finish();
+
+    int framesWritten() const { return written; }
+
+private:
+    void workerLoop();
+    bool encode(const HeadlessFrame& frame);
+
+    CaptureOptions options;
+    int width;
+    int height;
+    FILE* pipe;
+    std::vector<std::thread> workers;
+    std::deque<HeadlessFrame> queue;
+    std::mutex mutex;
+    std::condition_variable queueReady;
+    std::condition_variable queueSpace;
+    size_t maxQueued;
+    bool stopping;
+    int written;
+};
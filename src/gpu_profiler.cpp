@@ -0,0 +1,299 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "shader_program.h"
+#include "vertex_format.h"
+
+static const char* overlayVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec3 aColor;
+out vec3 Color;
+void main() {
+    Color = aColor;
+    gl_Position = vec4(aPos, 0.0, 1.0);
+}
+)";
+
+static const char* overlayFragmentShaderSource = R"(
+#version 330 core
+in vec3 Color;
+out vec4 FragColor;
+void main() {
+    FragColor = vec4(Color, 1.0);
+}
+)";
+
+// 3x5 pixel glyphs for the overlay labels, rows top to bottom. Lowercase
+// text is drawn with the capitals.
+struct Glyph {
+    char c;
+    const char* rows;
+};
+static const Glyph glyphs[] = {
+    { '0', "111101101101111" }, { '1', "010110010010111" }, { '2', "111001111100111" },
+    { '3', "111001111001111" }, { '4', "101101111001001" }, { '5', "111100111001111" },
+    { '6', "111100111101111" }, { '7', "111001001001001" }, { '8', "111101111101111" },
+    { '9', "111101111001111" }, { 'a', "010101111101101" }, { 'b', "110101110101110" },
+    { 'c', "011100100100011" }, { 'd', "110101101101110" }, { 'e', "111100110100111" },
+    { 'f', "111100110100100" }, { 'g', "011100101101011" }, { 'h', "101101111101101" },
+    { 'i', "111010010010111" }, { 'j', "001001001101010" }, { 'k', "101101110101101" },
+    { 'l', "100100100100111" }, { 'm', "101111111101101" }, { 'n', "110101101101101" },
+    { 'o', "010101101101010" }, { 'p', "110101110100100" }, { 'q', "010101101110011" },
+    { 'r', "110101110101101" }, { 's', "011100010001110" }, { 't', "111010010010010" },
+    { 'u', "101101101101111" }, { 'v', "101101101101010" }, { 'w', "101101111111101" },
+    { 'x', "101101010101101" }, { 'y', "101101010010010" }, { 'z', "111001010100111" },
+    { '.', "000000000000010" }, { '-', "000000111000000" }, { '_', "000000000000111" },
+};
+static const int GLYPH_WIDTH = 3, GLYPH_HEIGHT = 5;
+
+// Evenly spread hues, so every pass gets its own colour however many there are
+static void passColor(size_t pass, size_t passCount, float color[3]) {
+    float hue = (float)pass / (float)passCount * 6.0f;
+    for (int i = 0; i < 3; ++i) {
+        // Hue to RGB, at 0.65 saturation and 0.95 value
+        float k = std::fmod(hue + (i == 0 ? 5.0f : i == 1 ? 3.0f : 1.0f), 6.0f);
+        float ramp = std::min(std::max(std::min(k, 4.0f - k), 0.0f), 1.0f);
+        color[i] = 0.95f * (1.0f - 0.65f * ramp);
+    }
+}
+
+void createGpuProfiler(GpuProfiler& profiler, const std::vector<std::string>& passNames) {
+    size_t passCount = passNames.size();
+    profiler.passNames = passNames;
+    profiler.queries.assign(GpuProfiler::FRAME_LAG * passCount, 0);
+    profiler.issued.assign(GpuProfiler::FRAME_LAG * passCount, 0);
+    profiler.history.assign(GpuProfiler::HISTORY * passCount, 0.0f);
+    profiler.historyCount.assign(passCount, 0);
+    profiler.historyHead.assign(passCount, 0);
+    glGenQueries((GLsizei)profiler.queries.size(), profiler.queries.data());
+    profiler.lastLog = std::chrono::steady_clock::now();
+    profiler.enabled = true;
+
+    profiler.overlayProgram = buildProgram("profiler_overlay", overlayVertexShaderSource, overlayFragmentShaderSource);
+
+    glGenVertexArrays(1, &profiler.overlayVAO);
+    glGenBuffers(1, &profiler.overlayVBO);
+    glBindVertexArray(profiler.overlayVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, profiler.overlayVBO);
+    applyVertexLayout(VertexLayout(5 * sizeof(float))
+        .add(0, 2, GL_FLOAT, GL_FALSE, 0)
+        .add(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(float)));
+}
+
+void destroyGpuProfiler(GpuProfiler& profiler) {
+    if (!profiler.queries.empty())
+        glDeleteQueries((GLsizei)profiler.queries.size(), profiler.queries.data());
+    profiler.queries.clear();
+    glDeleteVertexArrays(1, &profiler.overlayVAO);
+    glDeleteBuffers(1, &profiler.overlayVBO);
+    glDeleteProgram(profiler.overlayProgram);
+    profiler.enabled = false;
+}
+
+void beginProfilerFrame(GpuProfiler& profiler) {
+    if (!profiler.enabled)
+        return;
+
+    size_t passCount = profiler.passNames.size();
+    profiler.slot = (int)(profiler.frameCount % GpuProfiler::FRAME_LAG);
+
+    // The queries in this slot were issued FRAME_LAG frames ago
+    for (size_t pass = 0; pass < passCount; ++pass) {
+        size_t q = profiler.slot * passCount + pass;
+        if (!profiler.issued[q])
+            continue;
+        profiler.issued[q] = 0;
+
+        GLint available = 0;
+        glGetQueryObjectiv(profiler.queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            // Never wait: a lost sample is better than a pipeline stall
+            profiler.droppedSamples++;
+            continue;
+        }
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(profiler.queries[q], GL_QUERY_RESULT, &ns);
+        profiler.history[pass * GpuProfiler::HISTORY + profiler.historyHead[pass]] = (float)(ns / 1.0e6);
+        profiler.historyHead[pass] = (profiler.historyHead[pass] + 1) % GpuProfiler::HISTORY;
+        if (profiler.historyCount[pass] < GpuProfiler::HISTORY)
+            profiler.historyCount[pass]++;
+    }
+
+    if (profiler.logInterval > 0.0f) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<float>(now - profiler.lastLog).count() >= profiler.logInterval) {
+            std::cout << profilerSummary(profiler) << std::endl;
+            profiler.lastLog = now;
+        }
+    }
+}
+
+void endProfilerFrame(GpuProfiler& profiler) {
+    if (!profiler.enabled)
+        return;
+    if (profiler.activePass >= 0)
+        endProfilerPass(profiler);
+    profiler.frameCount++;
+}
+
+void beginProfilerPass(GpuProfiler& profiler, int pass) {
+    if (!profiler.enabled)
+        return;
+    if (profiler.activePass >= 0)
+        endProfilerPass(profiler);
+    size_t q = profiler.slot * profiler.passNames.size() + pass;
+    glBeginQuery(GL_TIME_ELAPSED, profiler.queries[q]);
+    profiler.issued[q] = 1;
+    profiler.activePass = pass;
+}
+
+void endProfilerPass(GpuProfiler& profiler) {
+    if (!profiler.enabled || profiler.activePass < 0)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    profiler.activePass = -1;
+}
+
+float profilerPassAverage(const GpuProfiler& profiler, int pass) {
+    int count = profiler.historyCount[pass];
+    if (count == 0)
+        return 0.0f;
+    // Until the ring has wrapped only the first `count` entries are written
+    float sum = 0.0f;
+    const float* samples = &profiler.history[pass * GpuProfiler::HISTORY];
+    for (int i = 0; i < count; ++i)
+        sum += samples[i];
+    return sum / count;
+}
+
+float profilerTotalAverage(const GpuProfiler& profiler) {
+    float total = 0.0f;
+    for (size_t pass = 0; pass < profiler.passNames.size(); ++pass)
+        total += profilerPassAverage(profiler, (int)pass);
+    return total;
+}
+
+std::string profilerSummary(const GpuProfiler& profiler) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3) << "GPU ms:";
+    for (size_t pass = 0; pass < profiler.passNames.size(); ++pass)
+        out << " " << profiler.passNames[pass] << " " << profilerPassAverage(profiler, (int)pass) << " |";
+    out << " total " << profilerTotalAverage(profiler);
+    if (profiler.droppedSamples > 0)
+        out << " (" << profiler.droppedSamples << " late samples dropped)";
+    return out.str();
+}
+
+static void pushQuad(std::vector<float>& v, float x0, float y0, float x1, float y1, const float* c) {
+    const float corners[6][2] = { {x0, y0}, {x1, y0}, {x1, y1}, {x0, y0}, {x1, y1}, {x0, y1} };
+    for (int i = 0; i < 6; ++i) {
+        v.push_back(corners[i][0]);
+        v.push_back(corners[i][1]);
+        v.push_back(c[0]);
+        v.push_back(c[1]);
+        v.push_back(c[2]);
+    }
+}
+
+static void pushText(std::vector<float>& v, float x, float y, const std::string& text, float scale, float px,
+    float py, const float* c) {
+    float advance = (GLYPH_WIDTH + 1) * scale;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char ch = (char)tolower((unsigned char)text[i]);
+        for (const Glyph& glyph : glyphs) {
+            if (glyph.c != ch)
+                continue;
+            for (int row = 0; row < GLYPH_HEIGHT; ++row) {
+                for (int col = 0; col < GLYPH_WIDTH; ++col) {
+                    if (glyph.rows[row * GLYPH_WIDTH + col] != '1')
+                        continue;
+                    float x0 = x + (i * advance + col * scale) * px;
+                    float y0 = y - row * scale * py;
+                    pushQuad(v, x0, y0, x0 + scale * px, y0 - scale * py, c);
+                }
+            }
+            break;
+        }
+    }
+}
+
+void drawProfilerOverlay(GpuProfiler& profiler, int framebufferWidth, int framebufferHeight, float budgetMs) {
+    if (!profiler.enabled || !profiler.overlayVisible || framebufferWidth <= 0 || framebufferHeight <= 0)
+        return;
+
+    // Layout in pixels, converted to NDC
+    const float margin = 10.0f, textScale = 2.0f, gap = 4.0f, chartWidth = 300.0f, padding = 8.0f;
+    const float rowHeight = GLYPH_HEIGHT * textScale;
+    const float charWidth = (GLYPH_WIDTH + 1) * textScale;
+    float px = 2.0f / framebufferWidth;
+    float py = 2.0f / framebufferHeight;
+    float left = -1.0f + margin * px;
+    float top = 1.0f - margin * py;
+
+    size_t passCount = profiler.passNames.size();
+    size_t labelLength = 5; // "total"
+    for (const std::string& name : profiler.passNames)
+        labelLength = std::max(labelLength, name.size());
+    float chartLeft = left + (labelLength * charWidth + padding) * px;
+    float valueLeft = chartLeft + (chartWidth + padding) * px;
+    float right = valueLeft + 9 * charWidth * px; // "00.000 ms"
+
+    std::vector<float> vertices;
+    const float background[3] = { 0.05f, 0.05f, 0.08f };
+    const float marker[3] = { 1.0f, 1.0f, 1.0f };
+    const float text[3] = { 0.85f, 0.85f, 0.85f };
+    size_t rows = passCount + 1;
+    pushQuad(vertices, left - 4 * px, top + 4 * py, right + 4 * px, top - (rows * (rowHeight + gap) + 4) * py,
+        background);
+
+    // One labelled row per pass, then the stacked total
+    std::ostringstream value;
+    value << std::fixed << std::setprecision(3);
+    float stackX = chartLeft;
+    float totalY = top - passCount * (rowHeight + gap) * py;
+    for (size_t pass = 0; pass < passCount; ++pass) {
+        float color[3];
+        passColor(pass, passCount, color);
+        float ms = profilerPassAverage(profiler, (int)pass);
+        // Bars over budget stop at the edge of the chart; the number says how far
+        float width = std::min(ms / budgetMs, 1.0f) * chartWidth * px;
+        float stackWidth = std::min(width, chartLeft + chartWidth * px - stackX);
+        float y = top - pass * (rowHeight + gap) * py;
+        pushText(vertices, left, y, profiler.passNames[pass], textScale, px, py, color);
+        pushQuad(vertices, chartLeft, y, chartLeft + width, y - rowHeight * py, color);
+        if (stackWidth > 0.0f)
+            pushQuad(vertices, stackX, totalY, stackX + stackWidth, totalY - rowHeight * py, color);
+        stackX += stackWidth;
+        value.str("");
+        value << ms << " ms";
+        pushText(vertices, valueLeft, y, value.str(), textScale, px, py, text);
+    }
+    pushText(vertices, left, totalY, "total", textScale, px, py, text);
+    value.str("");
+    value << profilerTotalAverage(profiler) << " ms";
+    pushText(vertices, valueLeft, totalY, value.str(), textScale, px, py, text);
+    float budgetX = chartLeft + chartWidth * px;
+    pushQuad(vertices, budgetX - px, top, budgetX + px, totalY - rowHeight * py, marker);
+
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+    // Bar colours are display values; write them without sRGB encoding
+    GLboolean srgb = glIsEnabled(GL_FRAMEBUFFER_SRGB);
+    glDisable(GL_FRAMEBUFFER_SRGB);
+    glUseProgram(profiler.overlayProgram);
+    glBindVertexArray(profiler.overlayVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, profiler.overlayVBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STREAM_DRAW);
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(vertices.size() / 5));
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+    if (srgb)
+        glEnable(GL_FRAMEBUFFER_SRGB);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Per-pass GPU timing with GL_TIME_ELAPSED queries. Each frame uses its own
+// set of query objects from a ring of FRAME_LAG sets, so results are read
+// FRAME_LAG frames later when they are already available and never stall.
+struct GpuProfiler {
+    static const int FRAME_LAG = 4;
+    static const int HISTORY = 60; // frames in the rolling average
+
+    bool enabled;
+    bool overlayVisible;
+    std::vector<std::string> passNames;
+    std::vector<GLuint> queries;  // [slot * passCount + pass]
+    std::vector<char> issued;     // same layout as queries
+    std::vector<float> history;   // [pass * HISTORY + sample]
+    std::vector<int> historyCount;
+    std::vector<int> historyHead;
+    int slot;
+    int activePass;
+    unsigned long long frameCount;
+    unsigned long long droppedSamples;
+
+    float logInterval; // seconds, <= 0 disables log lines
+    std::chrono::steady_clock::time_point lastLog;
+
+    GLuint overlayProgram;
+    GLuint overlayVAO;
+    GLuint overlayVBO;
+
+    GpuProfiler()
+        : enabled(false), overlayVisible(false), slot(0), activePass(-1),
+        frameCount(0), droppedSamples(0), logInterval(2.0f),
+        overlayProgram(0), overlayVAO(0), overlayVBO(0) {}
+};
+
+void createGpuProfiler(GpuProfiler& profiler, const std::vector<std::string>& passNames);
+void destroyGpuProfiler(GpuProfiler& profiler);
+
+// Collects the results of the oldest frame in the ring and starts a new one.
+void beginProfilerFrame(GpuProfiler& profiler);
+void endProfilerFrame(GpuProfiler& profiler);
+
+// Passes cannot nest (GL allows one active GL_TIME_ELAPSED query).
+void beginProfilerPass(GpuProfiler& profiler, int pass);
+void endProfilerPass(GpuProfiler& profiler);
+
+// Rolling average over the last HISTORY frames, in milliseconds.
+float profilerPassAverage(const GpuProfiler& profiler, int pass);
+float profilerTotalAverage(const GpuProfiler& profiler);
+std::string profilerSummary(const GpuProfiler& profiler);
+
+// Chart in the top-left corner: one row per pass with its name, a bar in
+// the pass's own colour and the rolling average in ms, then the passes
+// stacked into a total. The full width is budgetMs, with a marker there.
+void drawProfilerOverlay(GpuProfiler& profiler, int framebufferWidth, int framebufferHeight, float budgetMs);
@@ -0,0 +1,250 @@
+#include "headless.h"
+#include "scene_depth.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <GLFW/glfw3.h>
+
+#ifdef HEADLESS_USE_EGL
+#include <EGL/eglext.h>
+
+static bool hasExtension(const char* extensions, const char* name) {
+    if (!extensions)
+        return false;
+    size_t len = strlen(name);
+    const char* p = extensions;
+    while ((p = strstr(p, name)) != nullptr) {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+            return true;
+        p += len;
+    }
+    return false;
+}
+
+static EGLDisplay openEGLDisplay() {
+    // Prefer the Mesa surfaceless platform: it needs neither X11 nor a DRM node,
+    // so llvmpipe works inside containers and on CI runners.
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display != EGL_NO_DISPLAY)
+            return display;
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static bool createEGLContext(HeadlessContext& ctx) {
+    ctx.display = openEGLDisplay();
+    EGLint major, minor;
+    if (ctx.display == EGL_NO_DISPLAY || !eglInitialize(ctx.display, &major, &minor)) {
+        std::cerr << "Failed to initialize EGL display" << std::endl;
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(ctx.display, configAttribs, &config, 1, &numConfigs) || numConfigs < 1) {
+        std::cerr << "Failed to choose an EGL config" << std::endl;
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "EGL does not support desktop OpenGL" << std::endl;
+        return false;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    ctx.context = eglCreateContext(ctx.display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (ctx.context == EGL_NO_CONTEXT) {
+        std::cerr << "Failed to create EGL context" << std::endl;
+        return false;
+    }
+
+    // Everything is drawn into our own FBO, so a surface is only needed when the
+    // driver cannot make a context current without one.
+    if (!hasExtension(eglQueryString(ctx.display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        ctx.surface = eglCreatePbufferSurface(ctx.display, config, pbufferAttribs);
+        if (ctx.surface == EGL_NO_SURFACE) {
+            std::cerr << "Failed to create EGL pbuffer surface" << std::endl;
+            return false;
+        }
+    }
+
+    if (!eglMakeCurrent(ctx.display, ctx.surface, ctx.surface, ctx.context)) {
+        std::cerr << "Failed to make EGL context current" << std::endl;
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        std::cerr << "Failed to initialize GLAD" << std::endl;
+        return false;
+    }
+    return true;
+}
+#else
+static bool createHiddenWindowContext(HeadlessContext& ctx) {
+    if (!glfwInit()) {
+        std::cerr << "Failed to initialize GLFW" << std::endl;
+        return false;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    ctx.hiddenWindow = glfwCreateWindow(1, 1, "Solar System (headless)", nullptr, nullptr);
+    if (!ctx.hiddenWindow) {
+        std::cerr << "Failed to create hidden GLFW window" << std::endl;
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(ctx.hiddenWindow);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        std::cerr << "Failed to initialize GLAD" << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool createHeadlessContext(HeadlessContext& ctx, int width, int height) {
+    ctx.width = width;
+    ctx.height = height;
+
+#ifdef HEADLESS_USE_EGL
+    bool created = createEGLContext(ctx);
+#else
+    bool created = createHiddenWindowContext(ctx);
+#endif
+    if (!created) {
+        destroyHeadlessContext(ctx);
+        return false;
+    }
+
+    std::cout << "Headless renderer: " << glGetString(GL_RENDERER)
+        << " (" << glGetString(GL_VERSION) << "), " << width << "x" << height << std::endl;
+
+    glGenRenderbuffers(1, &ctx.colorRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx.colorRBO);
+    // sRGB storage: with GL_FRAMEBUFFER_SRGB enabled shaders write linear
+    // colour and the hardware encodes it
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+
+    glGenRenderbuffers(1, &ctx.depthRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx.depthRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, SCENE_DEPTH_FORMAT, width, height);
+
+    glGenFramebuffers(1, &ctx.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ctx.colorRBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, ctx.depthRBO);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "ERROR: Headless framebuffer is incomplete" << std::endl;
+        destroyHeadlessContext(ctx);
+        return false;
+    }
+
+    bindHeadlessFramebuffer(ctx);
+    return true;
+}
+
+void destroyHeadlessContext(HeadlessContext& ctx) {
+    if (ctx.fbo) {
+        glDeleteFramebuffers(1, &ctx.fbo);
+        glDeleteRenderbuffers(1, &ctx.colorRBO);
+        glDeleteRenderbuffers(1, &ctx.depthRBO);
+        ctx.fbo = ctx.colorRBO = ctx.depthRBO = 0;
+    }
+
+#ifdef HEADLESS_USE_EGL
+    if (ctx.display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (ctx.surface != EGL_NO_SURFACE)
+            eglDestroySurface(ctx.display, ctx.surface);
+        if (ctx.context != EGL_NO_CONTEXT)
+            eglDestroyContext(ctx.display, ctx.context);
+        eglTerminate(ctx.display);
+        ctx.display = EGL_NO_DISPLAY;
+        ctx.context = EGL_NO_CONTEXT;
+        ctx.surface = EGL_NO_SURFACE;
+    }
+#endif
+
+    if (ctx.hiddenWindow) {
+        glfwDestroyWindow(ctx.hiddenWindow);
+        glfwTerminate();
+        ctx.hiddenWindow = nullptr;
+    }
+}
+
+void bindHeadlessFramebuffer(const HeadlessContext& ctx) {
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx.fbo);
+    glViewport(0, 0, ctx.width, ctx.height);
+}
+
+void readHeadlessFrame(const HeadlessContext& ctx, HeadlessFrame& frame) {
+    frame.width = ctx.width;
+    frame.height = ctx.height;
+    frame.pixels.resize((size_t)ctx.width * ctx.height * 4);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, ctx.fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, ctx.width, ctx.height, GL_RGBA, GL_UNSIGNED_BYTE, frame.pixels.data());
+
+    // GL returns the bottom row first
+    size_t rowSize = (size_t)ctx.width * 4;
+    std::vector<unsigned char> row(rowSize);
+    for (int y = 0; y < ctx.height / 2; ++y) {
+        unsigned char* top = &frame.pixels[y * rowSize];
+        unsigned char* bottom = &frame.pixels[(ctx.height - 1 - y) * rowSize];
+        memcpy(row.data(), top, rowSize);
+        memcpy(top, bottom, rowSize);
+        memcpy(bottom, row.data(), rowSize);
+    }
+}
+
+GLADloadproc headlessProcLoader() {
+#ifdef HEADLESS_USE_EGL
+    return (GLADloadproc)eglGetProcAddress;
+#else
+    return (GLADloadproc)glfwGetProcAddress;
+#endif
+}
+
+bool writeFramePPM(const std::string& path, const HeadlessFrame& frame) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+    file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+    for (size_t i = 0; i < frame.pixels.size(); i += 4)
+        file.write((const char*)&frame.pixels[i], 3);
+    // A full disk only shows up in the stream state, often not until close
+    file.close();
+    if (!file) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#if defined(__linux__)
+#define HEADLESS_USE_EGL 1
+#include <EGL/egl.h>
+#endif
+
+struct GLFWwindow;
+
+// Offscreen GL context plus the framebuffer the scene is rendered into.
+// On Linux the context is a surfaceless EGL context (works with Mesa's llvmpipe
+// on machines without a GPU); elsewhere an invisible GLFW window is used.
+struct HeadlessContext {
+    int width;
+    int height;
+#ifdef HEADLESS_USE_EGL
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface; // only used when EGL_KHR_surfaceless_context is missing
+#endif
+    GLFWwindow* hiddenWindow;
+    GLuint fbo;
+    GLuint colorRBO;
+    GLuint depthRBO;
+
+    HeadlessContext()
+        : width(0), height(0),
+#ifdef HEADLESS_USE_EGL
+        display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE),
+#endif
+        hiddenWindow(nullptr), fbo(0), colorRBO(0), depthRBO(0) {}
+};
+
+// One frame read back from the offscreen framebuffer. Pixels are tightly packed
+// sRGB-encoded RGBA8, top row first. Callbacks may take the pixels by swapping them out.
+struct HeadlessFrame {
+    int index;
+    float time;
+    int width;
+    int height;
+    std::vector<unsigned char> pixels;
+
+    HeadlessFrame() : index(0), time(0.0f), width(0), height(0) {}
+};
+
+typedef std::function<void(HeadlessFrame&)> HeadlessFrameCallback;
+
+// Creates the context, makes it current, loads GL through glad and builds a
+// width x height framebuffer. Returns false (and logs) on failure.
+bool createHeadlessContext(HeadlessContext& ctx, int width, int height);
+void destroyHeadlessContext(HeadlessContext& ctx);
+
+// The proc loader glad was initialised with, for entry points it doesn't cover.
+GLADloadproc headlessProcLoader();
+
+// Binds the offscreen framebuffer and sets the viewport to cover it.
+void bindHeadlessFramebuffer(const HeadlessContext& ctx);
+
+// Synchronously reads the offscreen framebuffer into frame.pixels.
+void readHeadlessFrame(const HeadlessContext& ctx, HeadlessFrame& frame);
+
+// Writes a frame as a binary PPM (no alpha). Handy for golden-image diffs.
+bool writeFramePPM(const std::string& path, const HeadlessFrame& frame);
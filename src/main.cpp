@@ -1,7 +1,12 @@
 // Include necessary headers
+#include <algorithm>
 #include <iostream>
 #include <vector>
+#include <cfloat>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <future>
 #include <string>
 
 #include <glad/glad.h>
@@ -11,13 +16,93 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "tinygltf/stb_image.h"
+#include "headless.h"
+#include "frame_capture.h"
+#include "benchmark.h"
+#include "gpu_profiler.h"
+#include "trace.h"
+#include "shader_program.h"
+#include "shader_library.h"
+#include "texture.h"
+#include "post_process.h"
+#include "dynamic_resolution.h"
+#include "temporal_aa.h"
+#include "star_catalog.h"
+#include "star_field.h"
+#include "star_skybox.h"
+#include "orbit_lines.h"
+#include "wide_lines.h"
+#include "trails.h"
+#include "mesh.h"
+#include "meshlets.h"
+#include "terrain.h"
+#include "atmosphere.h"
+#include "transparency.h"
+#include "scene_depth.h"
 
 // Constants for screen dimensions
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
+// Analytic shadow casters passed per body, see shadows.glsl
+const int SHADOW_OCCLUDERS = 4;
+const int SHADOW_RING_BANDS = 4;
+
+// Current render target size (window framebuffer or headless FBO)
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+
+// Command line options
+struct RunOptions {
+    bool headless;
+    int width;
+    int height;
+    int frames;        // headless: number of frames to render (0 = automatic)
+    float timeStep;    // headless: fixed simulation step in seconds
+    float startTime;   // headless: simulation time of the first frame
+    float endTime;     // headless: if > startTime, overrides frames
+    std::string snapshotPath; // headless: write the last frame here (PPM)
+    CaptureOptions capture;   // headless: frame-sequence output
+    std::string benchmarkPath;  // headless: report base name (.json/.csv)
+    std::string cameraPathFile; // benchmark: scripted camera path, built-in if empty
+    std::string baselinePath;   // benchmark: report to compare against
+    int warmupFrames;
+    float regressionTolerance;
+    bool profile;               // per-pass GPU timings (log + overlay)
+    std::string tracePath;      // CPU trace written on exit (and with T)
+    std::string shaderCacheDir; // linked program binaries, empty = disabled
+    BloomQuality bloom;
+    float dynamicResTargetMs;   // > 0 enables dynamic resolution
+    float dynamicResMinScale;
+    bool taa;                   // temporal anti-aliasing / upscaling
+    std::string starCatalogPath; // .csv or baked; procedural if empty
+    std::string bakeStarsPath;   // write the star catalog baked and exit
+    float starLimitMagnitude;
+    int starChunks;              // resident star chunk budget
+    bool starSkybox;             // bake distant stars into a cubemap
+    int skyboxSize;
+    float skyboxRadius;
+    int minorBodies;             // extra orbits drawn in the main belt
+    float trailSeconds;          // planet trail length, 0 = off
+    MeshletCulling meshletCulling;
+    std::string terrainBodies;   // comma-separated planet names given terrain
+    std::string tessellatedBodies; // same, given a tessellated, displaced sphere
+    std::string terrainDemDir;   // <name>.png elevation maps for both
+    std::string atmosphereBodies; // same, given an atmosphere (those findAtmosphere knows)
+    std::string atmosphereCacheDir; // precomputed tables, empty = always recompute
+    bool shadows;                // eclipses and ring shadows
+    TransparencyMode transparency; // how rings and atmospheres blend
+
+    RunOptions() : headless(false), width(SCR_WIDTH), height(SCR_HEIGHT),
+        frames(0), timeStep(1.0f / 60.0f), startTime(0.0f), endTime(-1.0f),
+        warmupFrames(30), regressionTolerance(0.1f), profile(false),
+        shaderCacheDir("shader_cache"), bloom(BLOOM_MEDIUM),
+        dynamicResTargetMs(0.0f), dynamicResMinScale(0.5f), taa(false),
+        starLimitMagnitude(6.5f), starChunks(256), starSkybox(false), skyboxSize(1024), skyboxRadius(4000.0f),
+        minorBodies(0), trailSeconds(8.0f), meshletCulling(MESHLET_CULLING_GPU),
+        atmosphereCacheDir("atmosphere_cache"), shadows(true), transparency(TRANSPARENCY_WEIGHTED) {}
+};
+
 // Camera variables - closer but still can see the system clearly
 glm::vec3 cameraPos = glm::vec3(-500.0f, 100.0f, 0.0f);
 glm::vec3 cameraFront = glm::normalize(glm::vec3(1.0f, -0.1f, 0.0f)); // Looking towards positive x-axis
@@ -29,6 +114,7 @@ float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 float cameraSpeed = 200.0f; // Increased movement speed
+float cameraSpeedScale = 1.0f; // slower close to terrain
 
 // Timing
 float deltaTime = 0.0f;
@@ -37,16 +123,26 @@ float lastFrame = 0.0f;
 // Planets rotation
 float planetRotation = 0.0f; // Start with planets on the same side
 
+// GPU profiler passes, in draw order
+enum RenderPass {
+    PASS_STARS, PASS_SUN, PASS_PLANETS, PASS_ORBITS, PASS_TRAILS, PASS_RINGS, PASS_ATMOSPHERES, PASS_TRANSPARENCY,
+    PASS_TAA, PASS_BLOOM, PASS_TONEMAP, PASS_COUNT
+};
+const char* renderPassNames[PASS_COUNT] = {
+    "stars", "sun", "planets", "orbits", "trails", "rings", "atmospheres", "transparency", "taa", "bloom", "tonemap"
+};
+bool showProfilerOverlay = true; // toggled with P
+std::string traceOutputPath = "trace.json"; // written with T
+
 // Function prototypes
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void processInput(GLFWwindow* window, float deltaTime);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void generateSphere(float radius, unsigned int rings, unsigned int sectors,
     std::vector<float>& vertices, std::vector<unsigned int>& indices);
-void checkShaderCompilation(GLuint shader);
-void checkProgramLinking(GLuint program);
-void generateCircle(float radius, int segments, std::vector<float>& vertices);
-unsigned int loadTexture(const std::string& path);
+bool parseCommandLine(int argc, char** argv, RunOptions& options);
+bool loadStars(StarCatalog& catalog, const std::string& path);
 
 void generateRing(float innerRadius, float outerRadius, int segments,
     std::vector<float>& vertices, std::vector<unsigned int>& indices);
@@ -54,6 +150,7 @@ void generateRing(float innerRadius, float outerRadius, int segments,
 // --------------------- Ring generation function (with texture coords) -----------------------
 void generateRing(float innerRadius, float outerRadius, int segments,
     std::vector<float>& vertices, std::vector<unsigned int>& indices) {
+    TRACE_SCOPE("generateRing");
     float angleIncrement = 2.0f * glm::pi<float>() / segments;
 
     for (int i = 0; i <= segments; ++i) {
@@ -108,186 +205,1247 @@ void generateRing(float innerRadius, float outerRadius, int segments,
 }
 // ---------------------------------------------------------------------------
 
-// Orbit Vertex Shader
-const char* orbitVertexShaderSource = R"(
-#version 330 core
-layout (location = 0) in vec3 aPos;
+// ------------------------------- Shader library -------------------------------
+// Shared snippets, pulled into the effects below with #include. Feature macros
+// (LIT, TEXTURED, ...) come from the variant being built, see shader_library.h.
+
+// Final colour encoding. Normally an sRGB framebuffer encodes in hardware;
+// SRGB_OUTPUT is the fallback for windows without one and uses the same curve.
+const char* outputShaderSource = R"(
+vec4 encodeOutput(vec3 color) {
+#ifdef SRGB_OUTPUT
+    vec3 low = color * 12.92;
+    vec3 high = 1.055 * pow(color, vec3(1.0/2.4)) - 0.055;
+    return vec4(mix(high, low, step(color, vec3(0.0031308))), 1.0);
+#else
+    return vec4(color, 1.0);
+#endif
+}
+)";
+
+// Eclipses and ring shadows, worked out analytically: the sun is a disc of
+// sunRadius around lightPos, the bodies that may cover part of it from here
+// are passed as spheres, and a ringed body's rings as annuli in a plane.
+// The sizes are defined ahead of this.
+const char* shadowShaderSource = R"(
+uniform vec3 lightPos;
+uniform float sunRadius;
+uniform int occluderCount;
+uniform vec4 occluders[SHADOW_OCCLUDERS]; // world centre, radius
+uniform int ringBandCount;
+uniform vec3 ringCenter;
+uniform vec3 ringNormal;
+uniform vec3 ringBands[SHADOW_RING_BANDS]; // inner, outer radius, opacity
+
+// Share of the sun's disc seen from `position`, 0-1
+float sunVisibility(vec3 position) {
+    vec3 toSun = lightPos - position;
+    float sunDistance = length(toSun);
+    toSun /= sunDistance;
+    float sunAngle = asin(min(sunRadius / sunDistance, 1.0));
+
+    // Covered fully once the occluder's disc is centred over the sun's, up
+    // to the ratio of their areas, and not at all once they stop touching
+    float visibility = 1.0;
+    for (int i = 0; i < occluderCount; ++i) {
+        vec3 toOccluder = occluders[i].xyz - position;
+        float occluderDistance = length(toOccluder);
+        float occluderAngle = asin(min(occluders[i].w / occluderDistance, 1.0));
+        float separation = acos(clamp(dot(toOccluder / occluderDistance, toSun), -1.0, 1.0));
+        float overlap = 1.0 - smoothstep(abs(sunAngle - occluderAngle), sunAngle + occluderAngle, separation);
+        visibility *= 1.0 - overlap * min(occluderAngle * occluderAngle / (sunAngle * sunAngle), 1.0);
+    }
+
+    // Each band stops its opacity's share of the light; edges blur by the
+    // sun's disc projected onto the ring plane
+    float facing = dot(toSun, ringNormal);
+    if (ringBandCount > 0 && abs(facing) > 1e-4) {
+        float t = dot(ringCenter - position, ringNormal) / facing;
+        if (t > 0.0) {
+            float rho = distance(position + toSun * t, ringCenter);
+            float blur = t * sunAngle / abs(facing);
+            float covered = 0.0;
+            for (int i = 0; i < ringBandCount; ++i) {
+                covered += smoothstep(ringBands[i].x - blur, ringBands[i].x + blur, rho) *
+                    (1.0 - smoothstep(ringBands[i].y - blur, ringBands[i].y + blur, rho)) * ringBands[i].z;
+            }
+            visibility *= 1.0 - min(covered, 1.0);
+        }
+    }
+    return visibility;
+}
+)";
+
+// Lambert lighting from a point light at lightPos
+const char* lightingShaderSource = R"(
+#ifndef AMBIENT_STRENGTH
+#define AMBIENT_STRENGTH 0.03
+#endif
+
+#include "shadows.glsl"
+
+vec3 lambert(vec3 albedo, vec3 position, vec3 normal) {
+    vec3 ambient = AMBIENT_STRENGTH * albedo;
+    vec3 lightDir = normalize(lightPos - position);
+    float diff = max(dot(normalize(normal), lightDir), 0.0) * sunVisibility(position);
+    return ambient + diff * albedo;
+}
+)";
+
+// Camera and model matrices. Instanced variants read the model matrix from
+// attributes 3-6 instead of a uniform. With VELOCITY the unjittered
+// view-projections and last frame's model matrix are available too; instances
+// are assumed not to move.
+const char* transformShaderSource = R"(
+uniform mat4 view;
+uniform mat4 projection;
+
+#ifdef INSTANCED
+layout (location = 3) in mat4 aModel;
+mat4 modelMatrix() { return aModel; }
+#else
 uniform mat4 model;
+mat4 modelMatrix() { return model; }
+#endif
+
+#ifdef VELOCITY
+uniform mat4 currViewProjection;
+uniform mat4 prevViewProjection;
+#ifdef INSTANCED
+mat4 previousModelMatrix() { return aModel; }
+#else
+uniform mat4 prevModel;
+mat4 previousModelMatrix() { return prevModel; }
+#endif
+#endif
+)";
+
+// Decode for PackedVertex (vertex_format.h): positions are snorm16 within the
+// mesh bounds, normals octahedral snorm16.
+const char* packedVertexShaderSource = R"(
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 decodePosition(vec3 p) {
+    return positionOffset + p * positionScale;
+}
+
+vec3 decodeNormal(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+)";
+
+// Motion vectors for temporal AA: how far the fragment moved on screen since
+// last frame, in UV units, from unjittered clip positions. Impostors move
+// with their sphere centre; the sky computes its own per fragment.
+const char* velocityShaderSource = R"(
+uniform mat4 currViewProjection;
+uniform mat4 prevViewProjection;
+
+layout (location = 1) out vec2 Velocity;
+
+#if defined(IMPOSTOR)
+flat in vec3 PrevSphereCenter;
+#elif !defined(SKY)
+in vec4 CurrClip;
+in vec4 PrevClip;
+#endif
+
+void writeVelocity(vec4 currClip, vec4 prevClip) {
+    Velocity = (currClip.xy / currClip.w - prevClip.xy / prevClip.w) * 0.5;
+}
+)";
+
+// Ray-sphere intersection for impostors. Reconstructs the surface position,
+// normal, texture coordinates (matching generateSphere) and depth. Needs
+// depth.glsl included first.
+const char* impostorShaderSource = R"(
 uniform mat4 view;
 uniform mat4 projection;
-void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+uniform vec3 viewPos;
+
+in vec3 QuadPos;
+flat in vec3 SphereCenter;
+flat in float SphereRadius;
+flat in mat3 SphereRotation;
+
+bool traceImpostor(out vec3 position, out vec3 normal, out vec2 uv) {
+    vec3 rayDir = normalize(QuadPos - viewPos);
+    vec3 oc = viewPos - SphereCenter;
+    float b = dot(oc, rayDir);
+    float h = b * b - (dot(oc, oc) - SphereRadius * SphereRadius);
+    if (h < 0.0)
+        return false;
+    position = viewPos + rayDir * (-b - sqrt(h));
+    normal = (position - SphereCenter) / SphereRadius;
+
+    vec3 local = normalize(SphereRotation * normal);
+    uv = vec2(fract(atan(local.z, local.x) / 6.28318531 + 1.0), asin(clamp(local.y, -1.0, 1.0)) / 3.14159265 + 0.5);
+
+    vec4 clip = projection * view * vec4(position, 1.0);
+    gl_FragDepth = windowDepth(clip);
+    return true;
 }
 )";
 
-// Orbit Fragment Shader (No gamma needed for simple line, but we can still apply)
-const char* orbitFragmentShaderSource = R"(
-#version 330 core
-out vec4 FragColor;
-uniform vec3 orbitColor;
-void main() {
-    FragColor = vec4(orbitColor, 1.0);
-    FragColor = vec4(pow(FragColor.rgb, vec3(1.0/2.2)), 1.0);
+// Lighting through a precomputed atmosphere (atmosphere.h): sunlight dimmed
+// on its way down, sky light from the irradiance table, and the light
+// scattered in and absorbed between the camera and the point. Lengths are
+// in km from the body's centre; the table sizes are defined ahead of this.
+// Scaled by pi so a clear sky lights a surface as brightly as lambert().
+// Ports of the reference implementation's runtime functions.
+const char* atmosphereShaderSource = R"(
+#ifndef IMPOSTOR
+uniform vec3 viewPos;
+#endif
+uniform vec3 atmosphereCenter; // world space
+uniform float atmosphereScale; // km per world unit
+uniform float bottomRadius;
+uniform float topRadius;
+uniform vec3 rayleighScattering;
+uniform vec3 mieScattering;
+uniform float miePhaseG;
+uniform float sunAngularRadius;
+uniform float muSMin;
+uniform sampler2D transmittanceTable;
+uniform sampler3D scatteringTable;
+uniform sampler2D irradianceTable;
+
+const float ATMOSPHERE_PI = 3.14159265;
+
+float safeSqrt(float a) {
+    return sqrt(max(a, 0.0));
+}
+
+float coordFromUnitRange(float x, int size) {
+    return 0.5 / float(size) + x * (1.0 - 1.0 / float(size));
+}
+
+float distanceToTop(float r, float mu) {
+    return max(-r * mu + safeSqrt(r * r * (mu * mu - 1.0) + topRadius * topRadius), 0.0);
+}
+
+bool rayIntersectsGround(float r, float mu) {
+    return mu < 0.0 && r * r * (mu * mu - 1.0) + bottomRadius * bottomRadius >= 0.0;
+}
+
+vec3 transmittanceToTop(float r, float mu) {
+    float horizon = sqrt(topRadius * topRadius - bottomRadius * bottomRadius);
+    float rho = safeSqrt(r * r - bottomRadius * bottomRadius);
+    float dMin = topRadius - r;
+    float dMax = rho + horizon;
+    vec2 uv = vec2(coordFromUnitRange((distanceToTop(r, mu) - dMin) / (dMax - dMin), TRANSMITTANCE_WIDTH),
+        coordFromUnitRange(rho / horizon, TRANSMITTANCE_HEIGHT));
+    return texture(transmittanceTable, uv).rgb;
+}
+
+vec3 transmittanceAlong(float r, float mu, float d, bool ground) {
+    float rD = clamp(sqrt(d * d + 2.0 * r * mu * d + r * r), bottomRadius, topRadius);
+    float muD = clamp((r * mu + d) / rD, -1.0, 1.0);
+    if (ground)
+        return min(transmittanceToTop(rD, -muD) / transmittanceToTop(r, -mu), vec3(1.0));
+    return min(transmittanceToTop(r, mu) / transmittanceToTop(rD, muD), vec3(1.0));
+}
+
+vec3 transmittanceToSun(float r, float muS) {
+    float sinThetaH = bottomRadius / r;
+    float cosThetaH = -sqrt(max(1.0 - sinThetaH * sinThetaH, 0.0));
+    return transmittanceToTop(r, muS) *
+        smoothstep(-sinThetaH * sunAngularRadius, sinThetaH * sunAngularRadius, muS - cosThetaH);
+}
+
+// Rayleigh and multiple scattering, with single Mie extrapolated from the
+// alpha channel
+vec3 scattering(float r, float mu, float muS, float nu, bool ground, out vec3 singleMie) {
+    float horizon = sqrt(topRadius * topRadius - bottomRadius * bottomRadius);
+    float rho = safeSqrt(r * r - bottomRadius * bottomRadius);
+    float uR = coordFromUnitRange(rho / horizon, SCATTERING_R);
+
+    float rMu = r * mu;
+    float discriminant = rMu * rMu - r * r + bottomRadius * bottomRadius;
+    float uMu;
+    if (ground) {
+        float d = -rMu - safeSqrt(discriminant);
+        float dMin = r - bottomRadius;
+        float dMax = rho;
+        uMu = 0.5 - 0.5 * coordFromUnitRange(dMax == dMin ? 0.0 : (d - dMin) / (dMax - dMin), SCATTERING_MU / 2);
+    } else {
+        float d = -rMu + safeSqrt(discriminant + horizon * horizon);
+        float dMin = topRadius - r;
+        float dMax = rho + horizon;
+        uMu = 0.5 + 0.5 * coordFromUnitRange((d - dMin) / (dMax - dMin), SCATTERING_MU / 2);
+    }
+
+    float d = distanceToTop(bottomRadius, muS);
+    float dMin = topRadius - bottomRadius;
+    float dMax = horizon;
+    float a = (d - dMin) / (dMax - dMin);
+    float A = (distanceToTop(bottomRadius, muSMin) - dMin) / (dMax - dMin);
+    float uMuS = coordFromUnitRange(max(1.0 - a / A, 0.0) / (1.0 + a), SCATTERING_MU_S);
+
+    float texCoordX = (nu + 1.0) / 2.0 * float(SCATTERING_NU - 1);
+    float texX = floor(texCoordX);
+    float lerp = texCoordX - texX;
+    vec4 combined = mix(texture(scatteringTable, vec3((texX + uMuS) / float(SCATTERING_NU), uMu, uR)),
+        texture(scatteringTable, vec3((texX + 1.0 + uMuS) / float(SCATTERING_NU), uMu, uR)), lerp);
+
+    singleMie = combined.r == 0.0 ? vec3(0.0) : combined.rgb * combined.a / combined.r *
+        (rayleighScattering.r / mieScattering.r) * (mieScattering / rayleighScattering);
+    return combined.rgb;
+}
+
+float rayleighPhase(float nu) {
+    return 3.0 / (16.0 * ATMOSPHERE_PI) * (1.0 + nu * nu);
+}
+
+float miePhase(float nu) {
+    float g = miePhaseG;
+    float k = 3.0 / (8.0 * ATMOSPHERE_PI) * (1.0 - g * g) / (2.0 + g * g);
+    return k * (1.0 + nu * nu) / pow(1.0 + g * g - 2.0 * g * nu, 1.5);
+}
+
+vec3 atmosphereSpace(vec3 world) {
+    return (world - atmosphereCenter) * atmosphereScale;
+}
+
+// Treated as parallel over the body, from its centre
+vec3 atmosphereSunDirection() {
+    return normalize(lightPos - atmosphereCenter);
+}
+
+// Sky seen along `viewRay` from `camera`, to the top of the atmosphere or
+// the ground
+vec3 skyRadiance(vec3 camera, vec3 viewRay, vec3 sunDirection, out vec3 transmittance) {
+    float r = length(camera);
+    float rMu = dot(camera, viewRay);
+    float toTop = -rMu - safeSqrt(rMu * rMu - r * r + topRadius * topRadius);
+    if (toTop > 0.0) {
+        camera += viewRay * toTop;
+        r = topRadius;
+        rMu += toTop;
+    } else if (r > topRadius) {
+        transmittance = vec3(1.0);
+        return vec3(0.0);
+    }
+    float mu = rMu / r;
+    float muS = dot(camera, sunDirection) / r;
+    float nu = dot(viewRay, sunDirection);
+    bool ground = rayIntersectsGround(r, mu);
+    transmittance = ground ? vec3(0.0) : transmittanceToTop(r, mu);
+    vec3 singleMie;
+    vec3 rayleigh = scattering(r, mu, muS, nu, ground, singleMie);
+    return rayleigh * rayleighPhase(nu) + singleMie * miePhase(nu);
+}
+
+// Light scattered in between `camera` and `point`, and what reaches the
+// camera of the light leaving the point
+vec3 skyRadianceToPoint(vec3 camera, vec3 point, vec3 sunDirection, out vec3 transmittance) {
+    vec3 viewRay = normalize(point - camera);
+    float r = length(camera);
+    float rMu = dot(camera, viewRay);
+    float toTop = -rMu - safeSqrt(rMu * rMu - r * r + topRadius * topRadius);
+    if (toTop > 0.0) {
+        camera += viewRay * toTop;
+        r = topRadius;
+        rMu += toTop;
+    }
+    float mu = rMu / r;
+    float muS = dot(camera, sunDirection) / r;
+    float nu = dot(viewRay, sunDirection);
+    float d = length(point - camera);
+    bool ground = rayIntersectsGround(r, mu);
+    transmittance = transmittanceAlong(r, mu, d, ground);
+
+    vec3 singleMie, singleMieP;
+    vec3 rayleigh = scattering(r, mu, muS, nu, ground, singleMie);
+    float rP = clamp(sqrt(d * d + 2.0 * r * mu * d + r * r), bottomRadius, topRadius);
+    float muP = (r * mu + d) / rP;
+    float muSP = (r * muS + d * nu) / rP;
+    rayleigh -= transmittance * scattering(rP, muP, muSP, nu, ground, singleMieP);
+    singleMie -= transmittance * singleMieP;
+    // Hides artifacts with the sun below the horizon
+    singleMie *= smoothstep(0.0, 0.01, muS);
+    return max(rayleigh * rayleighPhase(nu) + singleMie * miePhase(nu), vec3(0.0));
+}
+
+// Replaces lambert() for bodies with an atmosphere
+vec3 atmosphereLighting(vec3 albedo, vec3 position, vec3 normal) {
+    vec3 sunDirection = atmosphereSunDirection();
+    vec3 point = atmosphereSpace(position);
+    // Relief and the sphere's facets stray outside the tables
+    float r = clamp(length(point), bottomRadius, topRadius);
+    point = normalize(point) * r;
+    vec3 up = point / r;
+    float muS = dot(up, sunDirection);
+    normal = normalize(normal);
+
+    float visibility = sunVisibility(position);
+    vec3 sun = transmittanceToSun(r, muS) * max(dot(normal, sunDirection), 0.0) * visibility;
+    vec2 uv = vec2(coordFromUnitRange(muS * 0.5 + 0.5, IRRADIANCE_WIDTH),
+        coordFromUnitRange((r - bottomRadius) / (topRadius - bottomRadius), IRRADIANCE_HEIGHT));
+    vec3 sky = texture(irradianceTable, uv).rgb * (1.0 + dot(normal, up)) * 0.5 * visibility;
+    vec3 radiance = albedo * (AMBIENT_STRENGTH + sun + sky * ATMOSPHERE_PI);
+
+    vec3 transmittance;
+    vec3 inscatter = skyRadianceToPoint(atmosphereSpace(viewPos), point, sunDirection, transmittance);
+    return radiance * transmittance + inscatter * ATMOSPHERE_PI;
 }
 )";
 
-// Planet Vertex Shader
-const char* vertexShaderSource = R"(
+// Surface effect: everything except the sun and orbits. Unlit untextured is
+// a flat colour; planets are lit and textured; rings are textured,
+// shadowed and translucent, but unlit.
+const char* surfaceVertexShaderSource = R"(
 #version 330 core
+#include "transform.glsl"
+
+#ifdef IMPOSTOR
+// Drawn as a 4-vertex triangle strip, no vertex attributes
+out vec3 QuadPos;
+flat out vec3 SphereCenter;
+flat out float SphereRadius;
+flat out mat3 SphereRotation;
+#ifdef VELOCITY
+flat out vec3 PrevSphereCenter;
+#endif
+#else
+#include "packed_vertex.glsl"
+
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 1) in vec2 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#ifdef VELOCITY
+out vec4 CurrClip;
+out vec4 PrevClip;
+#endif
+#endif
 
 void main() {
-    FragPos   = vec3(model * vec4(aPos, 1.0));
-    Normal    = mat3(transpose(inverse(model))) * aNormal;
+    mat4 world = modelMatrix();
+#ifdef IMPOSTOR
+    SphereCenter = world[3].xyz;
+    SphereRadius = length(world[0].xyz);
+    // Inverse of a rotation with uniform scale, up to that scale
+    SphereRotation = transpose(mat3(world));
+
+    // Camera-facing quad, oversized so the perspective silhouette fits
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec3 right = vec3(view[0][0], view[1][0], view[2][0]);
+    vec3 up = vec3(view[0][1], view[1][1], view[2][1]);
+    QuadPos = SphereCenter + (right * corner.x + up * corner.y) * SphereRadius * 1.5;
+    gl_Position = projection * view * vec4(QuadPos, 1.0);
+#ifdef VELOCITY
+    PrevSphereCenter = previousModelMatrix()[3].xyz;
+#endif
+#else
+    vec3 position = decodePosition(aPos);
+    vec3 normal = decodeNormal(aNormal);
+    FragPos = vec3(world * vec4(position, 1.0));
+#ifdef LIT
+    Normal = mat3(transpose(inverse(world))) * normal;
+#else
+    Normal = normal;
+#endif
     TexCoords = aTexCoords;
     gl_Position = projection * view * vec4(FragPos, 1.0);
+#ifdef VELOCITY
+    CurrClip = currViewProjection * vec4(FragPos, 1.0);
+    PrevClip = prevViewProjection * previousModelMatrix() * vec4(position, 1.0);
+#endif
+#endif
 }
 )";
 
-// Planet Fragment Shader with gamma correction
-const char* fragmentShaderSource = R"(
+const char* surfaceFragmentShaderSource = R"(
 #version 330 core
-out vec4 FragColor;
-
+#include "output.glsl"
+#include "shadows.glsl"
+#include "depth.glsl"
+#ifdef LIT
+#include "lighting.glsl"
+#endif
+#ifdef IMPOSTOR
+#include "impostor.glsl"
+#endif
+#ifdef ATMOSPHERE
+#include "atmosphere.glsl"
+#endif
+#ifndef IMPOSTOR
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+#endif
+#ifdef VELOCITY
+#include "velocity.glsl"
+#endif
+
+#ifdef TRANSPARENT
+#include "transparency.glsl"
+uniform float opacity;
+#else
+layout (location = 0) out vec4 FragColor;
+#endif
+
+#ifdef TEXTURED
+uniform sampler2D baseTexture;
+#else
+uniform vec3 color;
+#endif
+
+void main() {
+#ifdef IMPOSTOR
+    vec3 position, normal;
+    vec2 uv;
+    if (!traceImpostor(position, normal, uv))
+        discard;
+#else
+    vec3 position = FragPos;
+    vec3 normal = Normal;
+    vec2 uv = TexCoords;
+#endif
+
+#ifdef TEXTURED
+    vec3 albedo = texture(baseTexture, uv).rgb;
+#else
+    vec3 albedo = color;
+#endif
+
+#if defined(ATMOSPHERE)
+    vec3 shaded = atmosphereLighting(albedo, position, normal);
+#elif defined(LIT)
+    vec3 shaded = lambert(albedo, position, normal);
+#else
+    vec3 shaded = albedo * sunVisibility(position);
+#endif
+#ifdef TRANSPARENT
+    writeTransparent(vec4(shaded, 1.0) * opacity, gl_FragCoord.z, 1.0 / gl_FragCoord.w);
+#else
+    FragColor = encodeOutput(shaded);
+#endif
+
+#ifdef VELOCITY
+#ifdef IMPOSTOR
+    vec3 previousPosition = position - SphereCenter + PrevSphereCenter;
+    writeVelocity(currViewProjection * vec4(position, 1.0), prevViewProjection * vec4(previousPosition, 1.0));
+#else
+    writeVelocity(CurrClip, PrevClip);
+#endif
+#endif
+}
+)";
+
+// Sun effect: surface vertex shader plus a "boiling" texture distortion
+const char* sunFragmentShaderSource = R"(
+#version 330 core
+#include "output.glsl"
+
+#ifndef DISTORTION_STRENGTH
+#define DISTORTION_STRENGTH 0.02
+#endif
+// Well above 1.0 so the sun blooms in the HDR target
+#ifndef SUN_BRIGHTNESS
+#define SUN_BRIGHTNESS 3.0
+#endif
+
+layout (location = 0) out vec4 FragColor;
+
+in vec2 TexCoords;
+#ifdef VELOCITY
+#include "velocity.glsl"
+#endif
+
+uniform sampler2D baseTexture;
+uniform float time;
+
+void main() {
+    float uOffset = sin(time * 0.5 + TexCoords.t * 10.0) * DISTORTION_STRENGTH;
+    float vOffset = cos(time * 0.7 + TexCoords.s * 10.0) * DISTORTION_STRENGTH;
+    vec2 distortedUV = TexCoords + vec2(uOffset, vOffset);
+
+    vec3 baseColor = texture(baseTexture, distortedUV).rgb;
+    FragColor = encodeOutput(baseColor * SUN_BRIGHTNESS);
+#ifdef VELOCITY
+    writeVelocity(CurrClip, PrevClip);
+#endif
+}
+)";
+
+// Star sprites. The apparent magnitude comes from the distance to the camera.
+// Brighter stars get bigger sprites and the intensity makes up the rest, so
+// the light a star adds follows its flux. Stars past the far plane are pinned
+// just inside it. Only stars whose distance from shellCenter is within
+// shellRange are drawn (see StarShell).
+const char* starVertexShaderSource = R"(
+#version 330 core
+#include "transform.glsl"
+#include "depth.glsl"
+
+#ifndef STAR_SIZE
+#define STAR_SIZE 2.0
+#endif
+#ifndef MAX_STAR_SIZE
+#define MAX_STAR_SIZE 6.0
+#endif
+// Linear peak intensity of a star at the limiting magnitude
+#ifndef FAINT_INTENSITY
+#define FAINT_INTENSITY 0.5
+#endif
+// Flux cap relative to the limit (6 magnitudes), keeps the brightest sane
+#define MAX_FLUX 250.0
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in float aMagnitude;
+layout (location = 2) in vec4 aColor;
 
-uniform sampler2D texture1;
-uniform vec3 lightPos;
 uniform vec3 viewPos;
+uniform float limitingMagnitude;
+uniform float pointScale; // render resolution / output resolution
+uniform vec3 shellCenter;
+uniform vec2 shellRange;
+
+out vec3 StarColor;
+#ifdef VELOCITY
+out vec4 CurrClip;
+out vec4 PrevClip;
+#endif
 
 void main() {
-    // Ambient lighting
-    float ambientStrength = 0.03;
-    vec3 ambient = ambientStrength * texture(texture1, TexCoords).rgb;
+    vec4 world = modelMatrix() * vec4(aPos, 1.0);
+    float distance = max(length(world.xyz - viewPos), 1.0);
+    float magnitude = aMagnitude + 5.0 * log2(distance / REFERENCE_DISTANCE) / log2(10.0);
+    // 10^(0.4 * (limit - m))
+    float flux = min(exp2(1.32877 * (limitingMagnitude - magnitude)), MAX_FLUX);
+    float grow = clamp(sqrt(sqrt(flux)), 1.0, MAX_STAR_SIZE / STAR_SIZE);
+    gl_PointSize = max(1.0, STAR_SIZE * grow * pointScale);
+    StarColor = aColor.rgb * FAINT_INTENSITY * flux / (grow * grow);
+
+    gl_Position = projection * view * world;
+    gl_Position = insideFarPlane(gl_Position);
+    float shellDistance = length(world.xyz - shellCenter);
+    if (shellDistance < shellRange.x || shellDistance >= shellRange.y)
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // clipped
+#ifdef VELOCITY
+    CurrClip = currViewProjection * world;
+    PrevClip = prevViewProjection * previousModelMatrix() * vec4(aPos, 1.0);
+#endif
+}
+)";
+
+const char* starFragmentShaderSource = R"(
+#version 330 core
+#include "output.glsl"
 
+in vec3 StarColor;
 
-    // Diffuse lighting
-    vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * texture(texture1, TexCoords).rgb;
+layout (location = 0) out vec4 FragColor;
+#ifdef VELOCITY
+#include "velocity.glsl"
+#endif
 
-    vec3 result = ambient + diffuse;
-    FragColor = vec4(result, 1.0);
-    // Gamma correction
-    FragColor = vec4(pow(FragColor.rgb, vec3(1.0/2.2)), 1.0);
+void main() {
+    // Round sprite with a soft edge
+    vec2 p = gl_PointCoord * 2.0 - 1.0;
+    float r2 = dot(p, p);
+    if (r2 > 1.0)
+        discard;
+    FragColor = encodeOutput(StarColor * exp(-2.0 * r2));
+#ifdef VELOCITY
+    writeVelocity(CurrClip, PrevClip);
+#endif
 }
 )";
 
-// Sun Vertex Shader
-const char* sunVertexShaderSource = R"(
+// Baked distant stars, see star_skybox.h. A fullscreen triangle at the far
+// plane; the direction is interpolated homogeneously, which is exact across
+// the screen.
+const char* skyboxVertexShaderSource = R"(
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal; 
-layout (location = 2) in vec2 aTexCoords;
+#include "depth.glsl"
+uniform mat4 inverseViewProjection; // rotation only, jittered like the scene
 
-out vec2 TexCoords;
+out vec4 FarPoint;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+void main() {
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(pos, FAR_PLANE_Z, 1.0);
+    FarPoint = inverseViewProjection * gl_Position;
+}
+)";
+
+const char* skyboxFragmentShaderSource = R"(
+#version 330 core
+#include "output.glsl"
+
+in vec4 FarPoint;
+
+layout (location = 0) out vec4 FragColor;
+#ifdef VELOCITY
+#include "velocity.glsl"
+#endif
+
+uniform samplerCube sky;
 
 void main() {
-    TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vec3 direction = FarPoint.xyz / FarPoint.w;
+    FragColor = encodeOutput(texture(sky, direction).rgb);
+#ifdef VELOCITY
+    // Infinitely far: only the camera rotation moves it
+    writeVelocity(currViewProjection * vec4(direction, 0.0), prevViewProjection * vec4(direction, 0.0));
+#endif
 }
 )";
 
-// Sun Fragment Shader (with brightness factor + gamma)
-const char* sunFragmentShaderSource = R"(
+// Screen-space wide lines, see wide_lines.h. The including vertex shader
+// defines linePoint() and calls lineVertex() with the segment and corner
+// it's drawing.
+const char* lineShaderSource = R"(
+uniform vec2 viewportSize; // render target, pixels
+uniform float lineWidth;   // render target pixels
+
+noperspective out float LineOffset; // pixels from the centre line
+out float LineOpacity;
+
+// World position and opacity of point `index` of the current line
+vec4 linePoint(int index);
+
+vec2 toPixels(vec4 clip) {
+    return clip.xy / clip.w * 0.5 * viewportSize;
+}
+
+// Segment `segment` runs from point segment to segment + 1 of a line with
+// `count` points; closed lines wrap around. Corners 0-5 are two triangles.
+void lineVertex(int segment, int corner, int count, bool closed) {
+    const float NEAR_W = 1e-3;
+    int end = (corner == 2 || corner == 3 || corner == 5) ? 1 : 0;
+    float side = (corner == 1 || corner == 4 || corner == 5) ? 1.0 : -1.0;
+    int here = segment + end;
+    int there = segment + 1 - end;
+    int beyond = end == 0 ? segment - 1 : segment + 2;
+    if (closed) {
+        here %= count;
+        there %= count;
+        beyond = (beyond + count) % count;
+    }
+    bool joined = closed || (beyond >= 0 && beyond < count);
+
+    mat4 viewProjection = projection * view;
+    vec4 point = linePoint(here);
+    vec3 world = point.xyz;
+    vec3 otherWorld = linePoint(there).xyz;
+    vec4 clip = viewProjection * vec4(world, 1.0);
+    vec4 otherClip = viewProjection * vec4(otherWorld, 1.0);
+
+    // Clip against a plane just in front of the eye before projecting
+    if (clip.w < NEAR_W && otherClip.w < NEAR_W) {
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        LineOffset = 0.0;
+        LineOpacity = 0.0;
+        return;
+    }
+    if (clip.w < NEAR_W) {
+        world = mix(world, otherWorld, (NEAR_W - clip.w) / (otherClip.w - clip.w));
+        clip = viewProjection * vec4(world, 1.0);
+        joined = false;
+    }
+    if (otherClip.w < NEAR_W)
+        otherClip = mix(clip, otherClip, (NEAR_W - clip.w) / (otherClip.w - clip.w));
+
+    // Direction of travel along the segment, and its normal
+    vec2 pixel = toPixels(clip);
+    vec2 along = pixel - toPixels(otherClip);
+    along = length(along) > 1e-4 ? normalize(along) * (end == 1 ? 1.0 : -1.0) : vec2(1.0, 0.0);
+    vec2 normal = vec2(-along.y, along.x);
+    vec2 offset = normal;
+    if (joined) {
+        vec4 beyondClip = viewProjection * vec4(linePoint(beyond).xyz, 1.0);
+        vec2 toBeyond = toPixels(beyondClip) - pixel;
+        if (beyondClip.w >= NEAR_W && length(toBeyond) > 1e-4) {
+            // Mitre along the bisector, limited so hairpins don't spike
+            vec2 neighbour = normalize(toBeyond) * (end == 1 ? 1.0 : -1.0);
+            vec2 tangent = along + neighbour;
+            if (length(tangent) > 1e-3) {
+                tangent = normalize(tangent);
+                vec2 mitre = vec2(-tangent.y, tangent.x);
+                offset = mitre / max(dot(mitre, normal), 0.5);
+            }
+        }
+    }
+
+    // A pixel of padding for the coverage falloff; thin lines keep a
+    // one-pixel footprint and fade instead
+    float halfExtent = max(lineWidth, 1.0) * 0.5 + 1.0;
+    clip.xy += offset * side * halfExtent / (0.5 * viewportSize) * clip.w;
+    gl_Position = clip;
+    LineOffset = side * halfExtent;
+    LineOpacity = point.w * min(lineWidth, 1.0);
+}
+)";
+
+// Shared by every line effect: coverage of the pixel by the line, from its
+// distance to the centre line
+const char* lineFragmentShaderSource = R"(
 #version 330 core
-out vec4 FragColor;
+#include "output.glsl"
 
-in vec2 TexCoords;
+uniform float lineWidth;
 
-uniform sampler2D sunTexture;
-uniform float time;
+noperspective in float LineOffset;
+in float LineOpacity;
+in vec3 LineColor;
+
+layout (location = 0) out vec4 FragColor;
 
 void main() {
-    // Distortion parameters for "boiling"
-    float distortionStrength = 0.02;
-    float uOffset = sin(time * 0.5 + TexCoords.t * 10.0) * distortionStrength;
-    float vOffset = cos(time * 0.7 + TexCoords.s * 10.0) * distortionStrength;
-    vec2 distortedUV = TexCoords + vec2(uOffset, vOffset);
+    float halfWidth = max(lineWidth, 1.0) * 0.5;
+    float alpha = clamp(halfWidth + 0.5 - abs(LineOffset), 0.0, 1.0) * LineOpacity;
+    if (alpha <= 0.0)
+        discard;
+    FragColor = vec4(encodeOutput(LineColor).rgb, alpha);
+}
+)";
+
+// Orbit paths from orbital elements, see orbit_lines.h. No vertex
+// attributes: gl_VertexID picks the orbit, the segment and its corner.
+const char* orbitVertexShaderSource = R"(
+#version 330 core
+#include "transform.glsl"
+#include "line.glsl"
+
+uniform samplerBuffer orbitElements; // major axis, minor axis, centre, colour
+uniform isamplerBuffer orbitSegments;
+
+out vec3 LineColor;
 
-    // 
-    vec4 baseColor = texture(sunTexture, distortedUV);
-    FragColor = baseColor * 1.5;
-    // Gamma correction
-    FragColor = vec4(pow(FragColor.rgb, vec3(1.0/2.2)), 1.0);
+int segments;
+vec3 majorAxis, minorAxis, center;
+
+vec4 linePoint(int index) {
+    // Eccentric anomaly
+    float anomaly = 6.28318531 * float(index) / float(segments);
+    return vec4(majorAxis * cos(anomaly) + minorAxis * sin(anomaly) + center, 1.0);
+}
+
+void main() {
+    int orbit = gl_VertexID / ORBIT_STRIDE;
+    int vertex = gl_VertexID - orbit * ORBIT_STRIDE;
+    segments = texelFetch(orbitSegments, orbit).r;
+    majorAxis = texelFetch(orbitElements, orbit * 4).xyz;
+    minorAxis = texelFetch(orbitElements, orbit * 4 + 1).xyz;
+    center = texelFetch(orbitElements, orbit * 4 + 2).xyz;
+    LineColor = texelFetch(orbitElements, orbit * 4 + 3).rgb;
+    lineVertex(vertex / 6, vertex % 6, segments, true);
 }
 )";
 
-// Star Vertex Shader
-const char* starVertexShaderSource = R"(
+// Trails, see trails.h. Segments of every trail in turn, oldest point first.
+const char* trailVertexShaderSource = R"(
 #version 330 core
-layout (location = 0) in vec3 aPos;
+#include "transform.glsl"
+#include "line.glsl"
 
-uniform mat4 view;
-uniform mat4 projection;
+uniform samplerBuffer trailPositions; // [slot * trailObjects + object]
+uniform samplerBuffer trailColors;
+uniform int trailObjects;
+uniform int trailLength; // slots in the ring
+uniform int trailHead;   // slot of the newest sample
+uniform int trailCount;  // samples per trail
+
+out vec3 LineColor;
+
+int object;
+
+vec4 linePoint(int index) {
+    int slot = (trailHead - (trailCount - 1 - index) + trailLength) % trailLength;
+    float fade = float(index) / float(trailCount - 1);
+    return vec4(texelFetch(trailPositions, slot * trailObjects + object).xyz, fade * fade);
+}
 
 void main() {
-    gl_Position = projection * view * vec4(aPos, 1.0);
+    int vertices = (trailCount - 1) * 6;
+    object = gl_VertexID / vertices;
+    int vertex = gl_VertexID - object * vertices;
+    LineColor = texelFetch(trailColors, object).rgb;
+    lineVertex(vertex / 6, vertex % 6, trailCount, false);
 }
 )";
 
-// Star Fragment Shader (gamma corrected)
-const char* starFragmentShaderSource = R"(
+// Terrain quadrants, see terrain.h. Grid points are displaced by the node's
+// height tile, morphed onto the parent's grid with distance, and lit with
+// normals from the neighbouring heights (the tile border covers the edges).
+const char* terrainVertexShaderSource = R"(
 #version 330 core
-out vec4 FragColor;
+#include "transform.glsl"
+
+layout (location = 0) in vec3 aGrid;  // x, y within the quadrant, 1 on skirts
+layout (location = 1) in vec4 aNode;  // face x, y of the node's corner, size, face
+layout (location = 2) in vec4 aTile;  // layer, quadrant x, y, skirt depth
+layout (location = 3) in vec2 aMorph; // morph start and end distance
+
+uniform sampler2DArray heightTiles;
+uniform vec3 cameraLocal;
 
-uniform vec3 starColor;
+out vec3 FragPos;
+out vec3 Normal;
+out vec3 LocalPos;
+#ifdef VELOCITY
+out vec4 CurrClip;
+out vec4 PrevClip;
+#endif
+
+// Same as terrain.cpp
+const vec3 FACE_NORMAL[6] = vec3[6](vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1),
+    vec3(0, 0, -1));
+const vec3 FACE_X[6] = vec3[6](vec3(0, 0, -1), vec3(0, 0, 1), vec3(1, 0, 0), vec3(1, 0, 0), vec3(1, 0, 0),
+    vec3(-1, 0, 0));
+const vec3 FACE_Y[6] = vec3[6](vec3(0, 1, 0), vec3(0, 1, 0), vec3(0, 0, -1), vec3(0, 0, 1), vec3(0, 1, 0),
+    vec3(0, 1, 0));
+
+int face;
+
+// Point `grid` (in node grid quads) on the surface, in body space
+vec3 surfacePoint(vec2 grid) {
+    vec2 warped = tan((aNode.xy + grid * (aNode.z / TERRAIN_GRID)) * 0.78539816);
+    vec3 dir = normalize(FACE_NORMAL[face] + FACE_X[face] * warped.x + FACE_Y[face] * warped.y);
+    float height = texture(heightTiles, vec3((grid + 1.5) / TERRAIN_TILE_SIZE, aTile.x)).r;
+    return dir * (1.0 + height);
+}
 
 void main() {
-    FragColor = vec4(starColor, 1.0);
-    // Gamma correction
-    FragColor = vec4(pow(FragColor.rgb, vec3(1.0/2.2)), 1.0);
+    face = int(aNode.w);
+    vec2 grid = aGrid.xy + aTile.yz;
+    float morph = clamp((distance(surfacePoint(grid), cameraLocal) - aMorph.x) / (aMorph.y - aMorph.x), 0.0, 1.0);
+    grid -= mod(grid, 2.0) * morph;
+
+    vec3 local = surfacePoint(grid);
+    vec3 normal = normalize(cross(surfacePoint(grid + vec2(1.0, 0.0)) - surfacePoint(grid - vec2(1.0, 0.0)),
+        surfacePoint(grid + vec2(0.0, 1.0)) - surfacePoint(grid - vec2(0.0, 1.0))));
+    if (dot(normal, local) < 0.0)
+        normal = -normal;
+    LocalPos = local;
+    local -= normalize(local) * aGrid.z * aTile.w;
+
+    mat4 world = modelMatrix();
+    FragPos = vec3(world * vec4(local, 1.0));
+    Normal = mat3(transpose(inverse(world))) * normal;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+#ifdef VELOCITY
+    CurrClip = currViewProjection * vec4(FragPos, 1.0);
+    PrevClip = prevViewProjection * previousModelMatrix() * vec4(local, 1.0);
+#endif
 }
 )";
 
-// Ring Shaders with gamma correction
-const char* ringVertexShaderSource = R"(
+// Lit and textured like the planets. The texture coordinates are worked out
+// per pixel; of two longitudes with their seams half a turn apart, the one
+// without a jump there sets the mip level.
+const char* terrainFragmentShaderSource = R"(
 #version 330 core
+#include "output.glsl"
+#include "lighting.glsl"
+#ifdef ATMOSPHERE
+#include "atmosphere.glsl"
+#endif
+#ifdef VELOCITY
+#include "velocity.glsl"
+#endif
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec3 LocalPos;
+
+layout (location = 0) out vec4 FragColor;
+
+uniform sampler2D baseTexture;
+
+void main() {
+    vec3 dir = normalize(LocalPos);
+    float longitude = atan(dir.z, dir.x) / 6.28318531;
+    float latitude = asin(clamp(dir.y, -1.0, 1.0)) / 3.14159265 + 0.5;
+    float u0 = fract(longitude + 1.0);
+    float u1 = fract(longitude + 0.5);
+    float dx = abs(dFdx(u0)) <= abs(dFdx(u1)) ? dFdx(u0) : dFdx(u1);
+    float dy = abs(dFdy(u0)) <= abs(dFdy(u1)) ? dFdy(u0) : dFdy(u1);
+    vec3 albedo = textureGrad(baseTexture, vec2(u0, latitude), vec2(dx, dFdx(latitude)), vec2(dy, dFdy(latitude))).rgb;
+#ifdef ATMOSPHERE
+    FragColor = encodeOutput(atmosphereLighting(albedo, FragPos, Normal));
+#else
+    FragColor = encodeOutput(lambert(albedo, FragPos, Normal));
+#endif
+#ifdef VELOCITY
+    writeVelocity(CurrClip, PrevClip);
+#endif
+}
+)";
+
+// Planet sphere refined by tessellation (GL 4.0) and displaced by a height
+// map. Each edge is split by its length on screen, from its endpoints alone,
+// so neighbouring patches agree; patches outside the frustum or past the
+// horizon get no triangles at all.
+const char* displacedVertexShaderSource = R"(
+#version 400 core
+#include "packed_vertex.glsl"
+
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+out vec3 ControlPos;
+out vec2 ControlTexCoords;
+
+void main() {
+    ControlPos = decodePosition(aPos);
+    ControlTexCoords = aTexCoords;
+}
+)";
+
+const char* displacedTessControlShaderSource = R"(
+#version 400 core
+#include "transform.glsl"
+
+layout (vertices = 3) out;
+
+in vec3 ControlPos[];
+in vec2 ControlTexCoords[];
+out vec3 EvalPos[];
+out vec2 EvalTexCoords[];
+
+uniform vec3 cameraLocal;    // body space, like the positions
+uniform float pixelsPerUnit; // projected size of a unit at distance one
+uniform float heightScale;
+
+float edgeLevel(vec3 a, vec3 b) {
+    float pixels = distance(a, b) * pixelsPerUnit / max(distance((a + b) * 0.5, cameraLocal), 1e-6);
+    return clamp(pixels / TESSELLATION_EDGE_PIXELS, 1.0, float(gl_MaxTessGenLevel));
+}
+
+bool culled() {
+    vec3 dir[3] = vec3[3](normalize(ControlPos[0]), normalize(ControlPos[1]), normalize(ControlPos[2]));
+    float spread = acos(min(min(dot(dir[0], dir[1]), dot(dir[1], dir[2])), dot(dir[2], dir[0])));
+    float low = 1.0 - heightScale;
+    float high = (1.0 + heightScale) / cos(spread); // covers the bulge between vertices
+
+    // Past the horizon of the lowest ground, plus the furthest the highest
+    // peaks can see over it
+    float cameraDistance = length(cameraLocal);
+    if (cameraDistance > low) {
+        float horizon = acos(low / cameraDistance) + acos(low / high) + spread;
+        vec3 toCamera = cameraLocal / cameraDistance;
+        if (acos(min(min(dot(dir[0], toCamera), dot(dir[1], toCamera)), dot(dir[2], toCamera))) > horizon)
+            return true;
+    }
+
+    // All corners, low and high, outside one of the side or near planes
+    mat4 clip = projection * view * modelMatrix();
+    ivec4 insideSides = ivec4(0);
+    bool insideNear = false;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            vec4 p = clip * vec4(dir[i] * (j == 0 ? low : high), 1.0);
+            insideSides |= ivec4(greaterThanEqual(vec4(p.w + p.x, p.w - p.x, p.w + p.y, p.w - p.y), vec4(0.0)));
+            insideNear = insideNear || p.z >= -p.w;
+        }
+    }
+    return any(equal(insideSides, ivec4(0))) || !insideNear;
+}
+
+void main() {
+    EvalPos[gl_InvocationID] = ControlPos[gl_InvocationID];
+    EvalTexCoords[gl_InvocationID] = ControlTexCoords[gl_InvocationID];
+    if (gl_InvocationID != 0)
+        return;
+
+    if (culled()) {
+        gl_TessLevelOuter[0] = gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = 0.0;
+        gl_TessLevelInner[0] = 0.0;
+        return;
+    }
+    // Outer level i is the edge opposite vertex i
+    gl_TessLevelOuter[0] = edgeLevel(ControlPos[1], ControlPos[2]);
+    gl_TessLevelOuter[1] = edgeLevel(ControlPos[2], ControlPos[0]);
+    gl_TessLevelOuter[2] = edgeLevel(ControlPos[0], ControlPos[1]);
+    gl_TessLevelInner[0] = max(max(gl_TessLevelOuter[0], gl_TessLevelOuter[1]), gl_TessLevelOuter[2]);
+}
+)";
+
+const char* displacedTessEvaluationShaderSource = R"(
+#version 400 core
+#include "transform.glsl"
+
+layout (triangles, fractional_odd_spacing, ccw) in;
+
+in vec3 EvalPos[];
+in vec2 EvalTexCoords[];
+
+uniform sampler2D heightMap;
+uniform float heightScale;
+uniform vec3 cameraLocal;
+uniform float pixelsPerUnit;
+
+out vec3 FragPos;
+out vec3 Normal;  // the sphere's, bent per pixel by the height map
+out vec3 Tangent; // towards increasing u
 out vec2 TexCoords;
+#ifdef VELOCITY
+out vec4 CurrClip;
+out vec4 PrevClip;
+#endif
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+void main() {
+    precise vec3 position = gl_TessCoord.x * EvalPos[0] + gl_TessCoord.y * EvalPos[1] + gl_TessCoord.z * EvalPos[2];
+    precise vec2 uv = gl_TessCoord.x * EvalTexCoords[0] + gl_TessCoord.y * EvalTexCoords[1] +
+        gl_TessCoord.z * EvalTexCoords[2];
+    vec3 dir = normalize(position);
+
+    // About one texel per vertex spacing. Depends on the point alone, so
+    // vertices on a shared edge sample alike in both patches.
+    float spacing = TESSELLATION_EDGE_PIXELS * distance(dir, cameraLocal) / pixelsPerUnit;
+    float lod = log2(max(spacing * float(textureSize(heightMap, 0).x) / 6.28318531, 1.0));
+    float height = heightScale * (textureLod(heightMap, uv, lod).r * 2.0 - 1.0);
+    vec3 local = dir * (1.0 + height);
+
+    mat4 world = modelMatrix();
+    FragPos = vec3(world * vec4(local, 1.0));
+    Normal = mat3(world) * dir;
+    Tangent = mat3(world) * vec3(-dir.z, 0.0, dir.x);
+    TexCoords = uv;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+#ifdef VELOCITY
+    CurrClip = currViewProjection * vec4(FragPos, 1.0);
+    PrevClip = prevViewProjection * previousModelMatrix() * vec4(local, 1.0);
+#endif
+}
+)";
+
+const char* displacedFragmentShaderSource = R"(
+#version 400 core
+#include "output.glsl"
+#include "lighting.glsl"
+#ifdef ATMOSPHERE
+#include "atmosphere.glsl"
+#endif
+#ifdef VELOCITY
+#include "velocity.glsl"
+#endif
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec3 Tangent;
+in vec2 TexCoords;
+
+layout (location = 0) out vec4 FragColor;
+
+uniform sampler2D baseTexture;
+uniform sampler2D heightMap;
+uniform float heightScale;
+
+// Slope of the height map at this pixel's mip level. A turn of u is the
+// latitude circle, half a turn of v pole to pole, both in radii.
+vec3 displacedNormal() {
+    vec3 up = normalize(Normal);
+    vec3 east = Tangent - up * dot(Tangent, up);
+    if (dot(east, east) < 1e-12)
+        return up; // pole
+    east = normalize(east);
+    vec3 north = cross(east, up);
+
+    float lod = max(textureQueryLod(heightMap, TexCoords).y, 0.0);
+    vec2 texel = exp2(lod) / vec2(textureSize(heightMap, 0));
+    float du = textureLod(heightMap, TexCoords + vec2(texel.x, 0.0), lod).r -
+        textureLod(heightMap, TexCoords - vec2(texel.x, 0.0), lod).r;
+    float dv = textureLod(heightMap, TexCoords + vec2(0.0, texel.y), lod).r -
+        textureLod(heightMap, TexCoords - vec2(0.0, texel.y), lod).r;
+    float circle = 6.28318531 * max(cos((TexCoords.y - 0.5) * 3.14159265), 0.01);
+    vec2 slope = heightScale * vec2(du / (texel.x * circle), dv / (texel.y * 3.14159265));
+    return normalize(up - east * slope.x - north * slope.y);
+}
 
 void main() {
-    TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vec3 albedo = texture(baseTexture, TexCoords).rgb;
+#ifdef ATMOSPHERE
+    FragColor = encodeOutput(atmosphereLighting(albedo, FragPos, displacedNormal()));
+#else
+    FragColor = encodeOutput(lambert(albedo, FragPos, displacedNormal()));
+#endif
+#ifdef VELOCITY
+    writeVelocity(CurrClip, PrevClip);
+#endif
 }
 )";
 
-const char* ringFragmentShaderSource = R"(
+// The sky around a body with an atmosphere, a translucent layer over what
+// is behind: colour is the light scattered in, alpha one less the mean
+// transmittance. Drawn on a quad around the atmosphere, or over the whole
+// screen from close by. Depth is where the ray leaves the atmosphere, so
+// anything nearer - the body itself included - keeps its own aerial
+// perspective; layers sort by the middle of the path through it.
+const char* atmosphereVertexShaderSource = R"(
 #version 330 core
-out vec4 FragColor;
+#include "transform.glsl"
+#include "depth.glsl"
 
-in vec2 TexCoords;
-uniform sampler2D ringTexture;
+uniform vec3 viewPos;
+uniform vec3 atmosphereCenter;
+uniform float shellRadius; // world units
+uniform mat4 inverseViewProjection;
+
+out vec4 RayEnd; // homogeneous, world space
+
+void main() {
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    if (distance(viewPos, atmosphereCenter) < shellRadius * 1.5) {
+        gl_Position = vec4(corner, FAR_PLANE_Z, 1.0);
+        RayEnd = inverseViewProjection * gl_Position;
+        return;
+    }
+    vec3 right = vec3(view[0][0], view[1][0], view[2][0]);
+    vec3 up = vec3(view[0][1], view[1][1], view[2][1]);
+    RayEnd = vec4(atmosphereCenter + (right * corner.x + up * corner.y) * shellRadius * 1.5, 1.0);
+    gl_Position = projection * view * RayEnd;
+}
+)";
+
+const char* atmosphereFragmentShaderSource = R"(
+#version 330 core
+#include "lighting.glsl"
+#include "atmosphere.glsl"
+#include "depth.glsl"
+#include "transparency.glsl"
+
+uniform mat4 view;
+uniform mat4 projection;
+
+in vec4 RayEnd;
 
 void main() {
-    vec4 texColor = texture(ringTexture, TexCoords);
-    FragColor = texColor;
-    // Gamma correction
-    FragColor = vec4(pow(FragColor.rgb, vec3(1.0/2.2)), 1.0);
+    vec3 viewRay = normalize(RayEnd.xyz / RayEnd.w - viewPos);
+    vec3 camera = atmosphereSpace(viewPos);
+    float b = dot(camera, viewRay);
+    float c = dot(camera, camera);
+    float h = b * b - c + topRadius * topRadius;
+    float exit = -b + sqrt(max(h, 0.0));
+    if (h < 0.0 || exit < 0.0)
+        discard;
+    // Slightly inside the ground, to cover the gap at the sphere's facets
+    float lowest = bottomRadius * 0.998;
+    if (b < 0.0 && b * b - c + lowest * lowest >= 0.0 && c > lowest * lowest)
+        discard;
+
+    vec3 transmittance;
+    vec3 radiance = skyRadiance(camera, viewRay, atmosphereSunDirection(), transmittance);
+
+    float entry = max(-b - sqrt(h), 0.0);
+    vec4 exitClip = projection * view * vec4(viewPos + viewRay * (exit / atmosphereScale), 1.0);
+    vec4 middleClip = projection * view * vec4(viewPos + viewRay * ((entry + exit) * 0.5 / atmosphereScale), 1.0);
+    float depth = clamp(windowDepth(exitClip), 0.0, 1.0);
+    gl_FragDepth = depth;
+    writeTransparent(vec4(radiance * ATMOSPHERE_PI, 1.0 - dot(transmittance, vec3(1.0 / 3.0))), depth, middleClip.w);
 }
 )";
 
@@ -298,195 +1456,202 @@ struct Planet {
     glm::vec3 color;
     float tilt;
     unsigned int textureID;
-    GLuint orbitVAO;
-    GLuint orbitVBO;
-    int orbitVertexCount;
     std::string texturePath;
+    MotionHistory motion;
 
     Planet(float dist, float sz, float orbSpeed, const glm::vec3& col, float tl, const std::string& texPath)
         : distance(dist), size(sz), orbitSpeed(orbSpeed), color(col), tilt(tl),
-        textureID(0), orbitVAO(0), orbitVBO(0), orbitVertexCount(0),
-        texturePath(texPath) {}
+        textureID(0), texturePath(texPath) {}
 };
 
 struct RingSet {
     float innerRadius;
     float outerRadius;
-    GLuint VAO;
-    GLuint VBO;
-    GLuint EBO;
-    int indexCount;
-    RingSet(float inR, float outR) : innerRadius(inR), outerRadius(outR), VAO(0), VBO(0), EBO(0), indexCount(0) {}
+    float opacity;
+    Mesh mesh;
+    RingSet(float inR, float outR, float op) : innerRadius(inR), outerRadius(outR), opacity(op) {}
 };
 
-int main() {
-    // Initialize GLFW
-    if (!glfwInit()) {
-        std::cerr << "Failed to initialize GLFW" << std::endl;
+int main(int argc, char** argv) {
+    RunOptions options;
+    if (!parseCommandLine(argc, argv, options))
         return -1;
+
+    setTraceThreadName("main");
+    if (!options.tracePath.empty()) {
+        traceOutputPath = options.tracePath;
+        startTracing();
+    }
+    TraceScope startupScope("startup");
+
+    // Offline conversion, no window needed
+    if (!options.bakeStarsPath.empty()) {
+        StarCatalog catalog;
+        if (!loadStars(catalog, options.starCatalogPath) || !writeStarCatalog(catalog, options.bakeStarsPath))
+            return -1;
+        std::cout << "Baked " << catalog.starCount << " stars in " << catalog.nodes.size() << " chunks to "
+            << options.bakeStarsPath << std::endl;
+        return 0;
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLFWwindow* window = nullptr;
+    HeadlessContext headless;
 
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Solar System", nullptr, nullptr);
-    if (!window) {
-        std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+    if (options.headless) {
+        if (!createHeadlessContext(headless, options.width, options.height))
+            return -1;
+        framebufferWidth = options.width;
+        framebufferHeight = options.height;
     }
-    glfwMakeContextCurrent(window);
+    else {
+        // Initialize GLFW
+        if (!glfwInit()) {
+            std::cerr << "Failed to initialize GLFW" << std::endl;
+            return -1;
+        }
 
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE);
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        std::cerr << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        window = glfwCreateWindow(options.width, options.height, "Solar System", nullptr, nullptr);
+        if (!window) {
+            std::cerr << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+            std::cerr << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
     }
 
-    // Compile orbit shaders
-    GLuint orbitVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(orbitVertexShader, 1, &orbitVertexShaderSource, nullptr);
-    glCompileShader(orbitVertexShader);
-    checkShaderCompilation(orbitVertexShader);
-
-    GLuint orbitFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(orbitFragmentShader, 1, &orbitFragmentShaderSource, nullptr);
-    glCompileShader(orbitFragmentShader);
-    checkShaderCompilation(orbitFragmentShader);
-
-    GLuint orbitShaderProgram = glCreateProgram();
-    glAttachShader(orbitShaderProgram, orbitVertexShader);
-    glAttachShader(orbitShaderProgram, orbitFragmentShader);
-    glLinkProgram(orbitShaderProgram);
-    checkProgramLinking(orbitShaderProgram);
-    glDeleteShader(orbitVertexShader);
-    glDeleteShader(orbitFragmentShader);
-
-    // Compile planet shaders
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-    glCompileShader(vertexShader);
-    checkShaderCompilation(vertexShader);
-
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-    glCompileShader(fragmentShader);
-    checkShaderCompilation(fragmentShader);
-
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    checkProgramLinking(shaderProgram);
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    // Compile sun shaders
-    GLuint sunVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(sunVertexShader, 1, &sunVertexShaderSource, nullptr);
-    glCompileShader(sunVertexShader);
-    checkShaderCompilation(sunVertexShader);
-
-    GLuint sunFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(sunFragmentShader, 1, &sunFragmentShaderSource, nullptr);
-    glCompileShader(sunFragmentShader);
-    checkShaderCompilation(sunFragmentShader);
-
-    GLuint sunShaderProgram = glCreateProgram();
-    glAttachShader(sunShaderProgram, sunVertexShader);
-    glAttachShader(sunShaderProgram, sunFragmentShader);
-    glLinkProgram(sunShaderProgram);
-    checkProgramLinking(sunShaderProgram);
-    glDeleteShader(sunVertexShader);
-    glDeleteShader(sunFragmentShader);
-
-    // Compile stars shaders
-    GLuint starVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(starVertexShader, 1, &starVertexShaderSource, nullptr);
-    glCompileShader(starVertexShader);
-    checkShaderCompilation(starVertexShader);
-
-    GLuint starFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(starFragmentShader, 1, &starFragmentShaderSource, nullptr);
-    glCompileShader(starFragmentShader);
-    checkShaderCompilation(starFragmentShader);
-
-    GLuint starShaderProgram = glCreateProgram();
-    glAttachShader(starShaderProgram, starVertexShader);
-    glAttachShader(starShaderProgram, starFragmentShader);
-    glLinkProgram(starShaderProgram);
-    checkProgramLinking(starShaderProgram);
-    glDeleteShader(starVertexShader);
-    glDeleteShader(starFragmentShader);
-
-    // Compile ring shaders
-    GLuint ringVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(ringVertexShader, 1, &ringVertexShaderSource, nullptr);
-    glCompileShader(ringVertexShader);
-    checkShaderCompilation(ringVertexShader);
-
-    GLuint ringFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(ringFragmentShader, 1, &ringFragmentShaderSource, nullptr);
-    glCompileShader(ringFragmentShader);
-    checkShaderCompilation(ringFragmentShader);
-
-    GLuint ringShaderProgram = glCreateProgram();
-    glAttachShader(ringShaderProgram, ringVertexShader);
-    glAttachShader(ringShaderProgram, ringFragmentShader);
-    glLinkProgram(ringShaderProgram);
-    checkProgramLinking(ringShaderProgram);
-    glDeleteShader(ringVertexShader);
-    glDeleteShader(ringFragmentShader);
+    // The scene is lit in linear HDR and the tone-mapping resolve writes to an
+    // sRGB framebuffer, which does the encode. The headless target is always
+    // sRGB; a window might not be, in which case the resolve encodes instead.
+    bool hardwareSrgb = options.headless;
+    if (!options.headless) {
+        GLint encoding = GL_LINEAR;
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT,
+            GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING, &encoding);
+        hardwareSrgb = encoding == GL_SRGB;
+    }
+    if (hardwareSrgb)
+        glEnable(GL_FRAMEBUFFER_SRGB);
+    else
+        std::cout << "Default framebuffer is not sRGB capable, encoding in the resolve pass" << std::endl;
 
-    // Generate sphere data
-    std::vector<float> sphereVertices;
-    std::vector<unsigned int> sphereIndices;
-    generateSphere(1.0f, 50, 50, sphereVertices, sphereIndices);
+    initSceneDepth();
+
+    TraceScope shaderScope("submit shaders");
+    initShaderCache(options.shaderCacheDir);
+    initParallelShaderCompile(options.headless ? headlessProcLoader() : (GLADloadproc)glfwGetProcAddress);
 
-    GLuint sphereVAO, sphereVBO, sphereEBO;
-    glGenVertexArrays(1, &sphereVAO);
-    glGenBuffers(1, &sphereVBO);
-    glGenBuffers(1, &sphereEBO);
-
-    glBindVertexArray(sphereVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glBufferData(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(float), sphereVertices.data(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(unsigned int), sphereIndices.data(), GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-
-    // Generate fewer, more spread-out stars
-    std::vector<float> starVertices;
-    int numStars = 5000; // reduced from 8000
-    for (int i = 0; i < numStars; ++i) {
-        float x = ((rand() % 16000) - 8000);
-        float y = ((rand() % 16000) - 8000);
-        float z = ((rand() % 16000) - 8000);
-        starVertices.push_back(x);
-        starVertices.push_back(y);
-        starVertices.push_back(z);
-    }
-
-    GLuint starsVAO, starsVBO;
-    glGenVertexArrays(1, &starsVAO);
-    glGenBuffers(1, &starsVBO);
-
-    glBindVertexArray(starsVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, starsVBO);
-    glBufferData(GL_ARRAY_BUFFER, starVertices.size() * sizeof(float), starVertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    // Linked lists change how the translucent effects are built, so this
+    // has to know whether they're supported first
+    Transparency transparency;
+    if (!createTransparency(transparency, options.transparency))
+        return -1;
+    std::string transparencyConstants =
+        transparency.mode == TRANSPARENCY_LINKED_LIST ? transparencyListShaderConstants : "";
+
+    ShaderLibrary shaders;
+    addShaderSource(shaders, "output.glsl", outputShaderSource);
+    addShaderSource(shaders, "depth.glsl", sceneDepthShaderSource());
+    addShaderSource(shaders, "shadows.glsl", "#define SHADOW_OCCLUDERS " + std::to_string(SHADOW_OCCLUDERS) +
+        "\n#define SHADOW_RING_BANDS " + std::to_string(SHADOW_RING_BANDS) + "\n" + shadowShaderSource);
+    addShaderSource(shaders, "lighting.glsl", lightingShaderSource);
+    addShaderSource(shaders, "transform.glsl", transformShaderSource);
+    addShaderSource(shaders, "packed_vertex.glsl", packedVertexShaderSource);
+    addShaderSource(shaders, "impostor.glsl", impostorShaderSource);
+    addShaderSource(shaders, "velocity.glsl", velocityShaderSource);
+    addShaderSource(shaders, "line.glsl", lineShaderSource);
+    addShaderSource(shaders, "atmosphere.glsl",
+        "#define TRANSMITTANCE_WIDTH " + std::to_string(ATMOSPHERE_TRANSMITTANCE_WIDTH) +
+        "\n#define TRANSMITTANCE_HEIGHT " + std::to_string(ATMOSPHERE_TRANSMITTANCE_HEIGHT) +
+        "\n#define IRRADIANCE_WIDTH " + std::to_string(ATMOSPHERE_IRRADIANCE_WIDTH) +
+        "\n#define IRRADIANCE_HEIGHT " + std::to_string(ATMOSPHERE_IRRADIANCE_HEIGHT) +
+        "\n#define SCATTERING_R " + std::to_string(ATMOSPHERE_SCATTERING_R) +
+        "\n#define SCATTERING_MU " + std::to_string(ATMOSPHERE_SCATTERING_MU) +
+        "\n#define SCATTERING_MU_S " + std::to_string(ATMOSPHERE_SCATTERING_MU_S) +
+        "\n#define SCATTERING_NU " + std::to_string(ATMOSPHERE_SCATTERING_NU) + "\n" + atmosphereShaderSource);
+    addShaderSource(shaders, "transparency.glsl", transparencyShaderSource);
+    int surfaceEffect = addShaderEffect(shaders, "surface", surfaceVertexShaderSource, surfaceFragmentShaderSource,
+        SHADER_LIT | SHADER_TEXTURED | SHADER_INSTANCED | SHADER_IMPOSTOR | SHADER_SRGB_OUTPUT | SHADER_VELOCITY |
+        SHADER_ATMOSPHERE | SHADER_TRANSPARENT, transparencyConstants);
+    int sunEffect = addShaderEffect(shaders, "sun", surfaceVertexShaderSource, sunFragmentShaderSource,
+        SHADER_TEXTURED | SHADER_SRGB_OUTPUT | SHADER_VELOCITY);
+    int starEffect = addShaderEffect(shaders, "stars", starVertexShaderSource, starFragmentShaderSource,
+        SHADER_SRGB_OUTPUT | SHADER_VELOCITY, "#define REFERENCE_DISTANCE " + std::to_string(STAR_REFERENCE_DISTANCE) + "\n");
+    int skyboxEffect = addShaderEffect(shaders, "skybox", skyboxVertexShaderSource, skyboxFragmentShaderSource,
+        SHADER_SRGB_OUTPUT | SHADER_VELOCITY, "#define SKY 1\n");
+    int orbitEffect = addShaderEffect(shaders, "orbits", orbitVertexShaderSource, lineFragmentShaderSource,
+        SHADER_SRGB_OUTPUT, "#define ORBIT_STRIDE " + std::to_string(ORBIT_STRIDE) + "\n");
+    int trailEffect = addShaderEffect(shaders, "trails", trailVertexShaderSource, lineFragmentShaderSource,
+        SHADER_SRGB_OUTPUT);
+    int terrainEffect = addShaderEffect(shaders, "terrain", terrainVertexShaderSource, terrainFragmentShaderSource,
+        SHADER_SRGB_OUTPUT | SHADER_VELOCITY | SHADER_ATMOSPHERE,
+        "#define TERRAIN_GRID " + std::to_string(TERRAIN_GRID) +
+        "\n#define TERRAIN_TILE_SIZE " + std::to_string(TERRAIN_TILE_SIZE) + "\n");
+    int displacedEffect = addShaderEffect(shaders, "displaced", displacedVertexShaderSource,
+        displacedFragmentShaderSource, SHADER_SRGB_OUTPUT | SHADER_VELOCITY | SHADER_ATMOSPHERE,
+        "#define TESSELLATION_EDGE_PIXELS 8.0\n");
+    setShaderEffectTessellation(shaders, displacedEffect, displacedTessControlShaderSource,
+        displacedTessEvaluationShaderSource);
+    int atmosphereEffect = addShaderEffect(shaders, "atmosphere", atmosphereVertexShaderSource,
+        atmosphereFragmentShaderSource, 0, transparencyConstants);
+
+    // Bits every variant is built with. The HDR target stores linear colour, so
+    // scene shaders never encode. Temporal AA needs every opaque scene draw to
+    // write motion vectors; translucent ones keep those of what is behind.
+    unsigned outputFeatures = 0;
+    if (options.taa)
+        outputFeatures |= SHADER_VELOCITY;
+    const unsigned planetFeatures = outputFeatures | SHADER_LIT | SHADER_TEXTURED;
+    const unsigned impostorFeatures = planetFeatures | SHADER_IMPOSTOR;
+    const unsigned ringFeatures = SHADER_TEXTURED | SHADER_TRANSPARENT;
+    const unsigned sunFeatures = outputFeatures | SHADER_TEXTURED;
+    const unsigned starFeatures = outputFeatures;
+
+    // Issue the compiles and links for the variants we know we'll draw with,
+    // but don't look at the results until they're needed, so the driver works
+    // while we load the scene. Anything else is compiled on first use.
+    prepareShaderVariant(shaders, orbitEffect, outputFeatures);
+    if (options.trailSeconds > 0.0f)
+        prepareShaderVariant(shaders, trailEffect, outputFeatures);
+    prepareShaderVariant(shaders, surfaceEffect, planetFeatures);
+    prepareShaderVariant(shaders, surfaceEffect, impostorFeatures);
+    prepareShaderVariant(shaders, surfaceEffect, ringFeatures);
+    prepareShaderVariant(shaders, sunEffect, sunFeatures);
+    prepareShaderVariant(shaders, starEffect, starFeatures);
+    if (options.starSkybox)
+        prepareShaderVariant(shaders, skyboxEffect, starFeatures);
+    if (!options.terrainBodies.empty())
+        prepareShaderVariant(shaders, terrainEffect, outputFeatures);
+    bool tessellation = !options.tessellatedBodies.empty() && GLAD_GL_VERSION_4_0;
+    if (!options.tessellatedBodies.empty() && !tessellation)
+        std::cout << "Tessellation needs GL 4.0, planets stay plain spheres" << std::endl;
+    if (tessellation)
+        prepareShaderVariant(shaders, displacedEffect, outputFeatures);
+    if (!options.atmosphereBodies.empty()) {
+        prepareShaderVariant(shaders, surfaceEffect, planetFeatures | SHADER_ATMOSPHERE);
+        prepareShaderVariant(shaders, surfaceEffect, impostorFeatures | SHADER_ATMOSPHERE);
+        prepareShaderVariant(shaders, atmosphereEffect, 0);
+        if (!options.terrainBodies.empty())
+            prepareShaderVariant(shaders, terrainEffect, outputFeatures | SHADER_ATMOSPHERE);
+        if (tessellation)
+            prepareShaderVariant(shaders, displacedEffect, outputFeatures | SHADER_ATMOSPHERE);
+    }
+    shaderScope.end();
 
     // Double scale
     float distanceScale = (2000.0f / 30.05f) * 2.0f;
@@ -503,317 +1668,940 @@ int main() {
         Planet(30.05f * distanceScale,0.4f,0.36f, glm::vec3(0.3f,0.5f,0.9f),28.3f, "textures/neptune.jpg")
     };
 
+    // Decode textures on worker threads; only the upload needs the context
+    std::vector<std::future<DecodedImage>> planetImages;
     for (auto& planet : planets) {
-        planet.textureID = loadTexture(planet.texturePath);
+        planetImages.push_back(std::async(std::launch::async, decodeTexture, planet.texturePath));
     }
+    // Planets are named after their texture; the ones listed get terrain, or
+    // failing that a displaced sphere, whose height map is baked up front
+    auto planetName = [](const Planet& planet) {
+        std::string file = planet.texturePath.substr(planet.texturePath.find_last_of('/') + 1);
+        return file.substr(0, file.find('.'));
+        };
+    auto listed = [](const std::string& list, const std::string& name) {
+        return ("," + list + ",").find("," + name + ",") != std::string::npos;
+        };
+    const float displacementAmplitude = 0.01f; // of the radius, like the terrain
+    std::vector<bool> hasTerrain(planets.size(), false);
+    std::vector<bool> hasDisplacement(planets.size(), false);
+    std::vector<std::future<Heightmap>> terrainDems(planets.size());
+    std::vector<std::future<Heightmap>> displacementMaps(planets.size());
+    for (size_t i = 0; i < planets.size(); ++i) {
+        std::string name = planetName(planets[i]);
+        std::string demPath = options.terrainDemDir.empty() ? "" : options.terrainDemDir + "/" + name + ".png";
+        hasTerrain[i] = listed(options.terrainBodies, name);
+        hasDisplacement[i] = !hasTerrain[i] && tessellation && listed(options.tessellatedBodies, name);
+        if (hasTerrain[i] && !demPath.empty())
+            terrainDems[i] = std::async(std::launch::async, decodeHeightmap, demPath);
+        if (hasDisplacement[i]) {
+            displacementMaps[i] = std::async(std::launch::async, [=]() {
+                TerrainHeights heights;
+                heights.seed = (unsigned)i + 1;
+                heights.amplitude = displacementAmplitude;
+                heights.octaves = 10; // about the map's resolution
+                if (!demPath.empty())
+                    heights.dem = decodeHeightmap(demPath);
+                return bakeTerrainHeightmap(heights, 2048, 1024);
+                });
+        }
+    }
+    // Atmosphere tables are read from the cache, or computed, in the background
+    std::vector<AtmosphereParameters> atmosphereParameters(planets.size());
+    std::vector<std::future<AtmosphereTables>> atmosphereTables(planets.size());
+    for (size_t i = 0; i < planets.size(); ++i) {
+        std::string name = planetName(planets[i]);
+        if (!listed(options.atmosphereBodies, name))
+            continue;
+        if (!findAtmosphere(name, atmosphereParameters[i])) {
+            std::cout << "No atmosphere for " << name << std::endl;
+            continue;
+        }
+        atmosphereTables[i] = std::async(std::launch::async, loadAtmosphereTables, atmosphereParameters[i],
+            options.atmosphereCacheDir);
+    }
+    std::future<DecodedImage> ringImage = std::async(std::launch::async, decodeTexture, std::string("textures/saturn.jpg"));
+    std::future<DecodedImage> sunImage = std::async(std::launch::async, decodeTexture, std::string("textures/sun.jpg"));
+    StarCatalog starCatalog;
+    std::future<bool> starCatalogLoaded = std::async(std::launch::async, loadStars, std::ref(starCatalog),
+        options.starCatalogPath);
 
-    for (auto& planet : planets) {
-        std::vector<float> orbitVertices;
-        int segments = 200;
-        generateCircle(planet.distance, segments, orbitVertices);
-        planet.orbitVertexCount = segments;
-
-        glGenVertexArrays(1, &planet.orbitVAO);
-        glGenBuffers(1, &planet.orbitVBO);
-
-        glBindVertexArray(planet.orbitVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, planet.orbitVBO);
-        glBufferData(GL_ARRAY_BUFFER, orbitVertices.size() * sizeof(float), orbitVertices.data(), GL_STATIC_DRAW);
+    TraceScope meshScope("build meshes");
 
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
+    // Generate sphere data
+    std::vector<float> sphereVertices;
+    std::vector<unsigned int> sphereIndices;
+    generateSphere(1.0f, 50, 50, sphereVertices, sphereIndices);
+    Mesh sphereMesh;
+    createMesh(sphereMesh, "sphere", sphereVertices, sphereIndices);
+    MeshletCuller meshletCuller;
+    createMeshletCuller(meshletCuller, options.meshletCulling);
+    Meshlets sphereMeshlets;
+    createMeshlets(sphereMeshlets, sphereMesh, sphereVertices, sphereIndices, meshletCuller);
+
+    // Planet orbits are circles in the ecliptic; minor bodies fill the gap
+    // between Mars and Jupiter
+    std::vector<OrbitElements> orbits;
+    for (auto& planet : planets)
+        orbits.push_back(OrbitElements(planet.distance));
+    generateMinorBodyOrbits(orbits, options.minorBodies, 2.2f * distanceScale, 3.3f * distanceScale, 7);
+    OrbitLines orbitLines;
+    createOrbitLines(orbitLines, orbits);
+    const float orbitLineWidth = 1.5f; // output pixels
+
+    // A fading trail behind each planet, in its colour
+    Trails trails;
+    if (options.trailSeconds > 0.0f) {
+        std::vector<glm::vec3> trailColors;
+        for (auto& planet : planets)
+            trailColors.push_back(planet.color);
+        createTrails(trails, trailColors, 256, options.trailSeconds);
     }
-
-    unsigned int ringTextureID = loadTexture("textures/saturn.jpg");
+    const float trailLineWidth = 2.5f;
 
     float sizeMultiplier = 20.0f; // doubled planets size
 
     // Saturn Rings
     std::vector<RingSet> saturnRings = {
-        RingSet(1.1f,1.5f),
-        RingSet(1.6f,1.8f),
-        RingSet(1.85f,1.9f)
+        RingSet(1.1f,1.5f,0.9f),
+        RingSet(1.6f,1.8f,0.7f),
+        RingSet(1.85f,1.9f,0.5f)
     };
 
     for (auto& ring : saturnRings) {
         std::vector<float> ringVertices;
         std::vector<unsigned int> ringIndices;
         generateRing(ring.innerRadius, ring.outerRadius, 100, ringVertices, ringIndices);
-
-        glGenVertexArrays(1, &ring.VAO);
-        glGenBuffers(1, &ring.VBO);
-        glGenBuffers(1, &ring.EBO);
-
-        glBindVertexArray(ring.VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, ring.VBO);
-        glBufferData(GL_ARRAY_BUFFER, ringVertices.size() * sizeof(float), ringVertices.data(), GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ring.EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, ringIndices.size() * sizeof(unsigned int), ringIndices.data(), GL_STATIC_DRAW);
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-
-        ring.indexCount = (int)ringIndices.size();
+        createMesh(ring.mesh, "ring", ringVertices, ringIndices);
     }
 
     // Adjust Jupiter's ring size
-    RingSet jupiterRing(1.8f, 2.0f); // Increased from (1.1f, 1.2f)
-    RingSet uranusRing(1.1f, 1.2f);
-    RingSet neptuneRing(1.1f, 1.2f);
+    RingSet jupiterRing(1.8f, 2.0f, 0.4f); // Increased from (1.1f, 1.2f)
+    RingSet uranusRing(1.1f, 1.2f, 0.6f);
+    RingSet neptuneRing(1.1f, 1.2f, 0.5f);
 
-    auto createRingVAO = [&](RingSet& r) {
+    auto createRingMesh = [&](RingSet& r) {
         std::vector<float> rv;
         std::vector<unsigned int> ri;
         generateRing(r.innerRadius, r.outerRadius, 100, rv, ri);
-        glGenVertexArrays(1, &r.VAO);
-        glGenBuffers(1, &r.VBO);
-        glGenBuffers(1, &r.EBO);
-
-        glBindVertexArray(r.VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, r.VBO);
-        glBufferData(GL_ARRAY_BUFFER, rv.size() * sizeof(float), rv.data(), GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r.EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, ri.size() * sizeof(unsigned int), ri.data(), GL_STATIC_DRAW);
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-
-        r.indexCount = (int)ri.size();
+        createMesh(r.mesh, "ring", rv, ri);
         };
 
-    createRingVAO(jupiterRing);
-    createRingVAO(uranusRing);
-    createRingVAO(neptuneRing);
+    createRingMesh(jupiterRing);
+    createRingMesh(uranusRing);
+    createRingMesh(neptuneRing);
+
+    // Ring bands by planet, in the ring models' units, for ring shadows
+    std::vector<std::vector<glm::vec3>> planetRingBands(planets.size());
+    auto ringBand = [](const RingSet& r) { return glm::vec3(r.innerRadius, r.outerRadius, r.opacity); };
+    for (auto& ring : saturnRings)
+        planetRingBands[5].push_back(ringBand(ring));
+    planetRingBands[4].push_back(ringBand(jupiterRing));
+    planetRingBands[6].push_back(ringBand(uranusRing));
+    planetRingBands[7].push_back(ringBand(neptuneRing));
+
+    // Procedural unless a DEM was found
+    std::vector<Terrain> terrains(planets.size());
+    for (size_t i = 0; i < planets.size(); ++i) {
+        if (!hasTerrain[i])
+            continue;
+        TerrainHeights heights;
+        heights.seed = (unsigned)i + 1;
+        if (terrainDems[i].valid()) {
+            heights.dem = terrainDems[i].get();
+            if (heights.dem.samples.empty())
+                std::cout << "No elevation map for " << planetName(planets[i]) << ", terrain is procedural"
+                    << std::endl;
+        }
+        createTerrain(terrains[i], heights, 512, 12);
+    }
+
+    meshScope.end();
+
+    std::vector<unsigned int> displacementTextures(planets.size(), 0);
+    std::vector<Atmosphere> atmospheres(planets.size());
+    for (size_t i = 0; i < planets.size(); ++i) {
+        DecodedImage image = planetImages[i].get();
+        planets[i].textureID = uploadTexture(image);
+        if (displacementMaps[i].valid())
+            displacementTextures[i] = uploadHeightmap(displacementMaps[i].get());
+        if (atmosphereTables[i].valid()) {
+            AtmosphereTables tables = atmosphereTables[i].get();
+            createAtmosphere(atmospheres[i], atmosphereParameters[i], tables);
+        }
+    }
+    DecodedImage ringDecoded = ringImage.get();
+    unsigned int ringTextureID = uploadTexture(ringDecoded);
+    DecodedImage sunDecoded = sunImage.get();
+    unsigned int sunTextureID = uploadTexture(sunDecoded);
+
+    if (!starCatalogLoaded.get())
+        return -1;
+    StarField starField;
+    starField.limitingMagnitude = options.starLimitMagnitude;
+    createStarField(starField, starCatalog, options.starChunks);
+    StarSkybox starSkybox;
+    if (options.starSkybox && !createStarSkybox(starSkybox, options.skyboxSize, options.skyboxRadius))
+        return -1;
 
-    unsigned int sunTextureID = loadTexture("textures/sun.jpg");
+    // First use of the programs; blocks only if the driver is still compiling.
+    // Samplers are left at their default of texture unit 0.
+    GLuint orbitShaderProgram = getShaderVariant(shaders, orbitEffect, outputFeatures);
+    GLuint trailShaderProgram = options.trailSeconds > 0.0f ? getShaderVariant(shaders, trailEffect, outputFeatures) : 0;
+    GLuint sunShaderProgram = getShaderVariant(shaders, sunEffect, sunFeatures);
+    GLuint ringShaderProgram = getShaderVariant(shaders, surfaceEffect, ringFeatures);
+    GLuint starShaderProgram = getShaderVariant(shaders, starEffect, starFeatures);
+    GLuint skyboxShaderProgram = options.starSkybox ? getShaderVariant(shaders, skyboxEffect, starFeatures) : 0;
+    GLuint atmosphereShaderProgram =
+        options.atmosphereBodies.empty() ? 0 : getShaderVariant(shaders, atmosphereEffect, 0);
+    getShaderVariant(shaders, surfaceEffect, planetFeatures);
+    getShaderVariant(shaders, surfaceEffect, impostorFeatures);
 
     float sunScale = 40.0f; // sun scaled by factor of 2
     float globalOrbitSpeedFactor = 0.05f;
     float globalSelfRotationSpeedFactor = 0.1f;
 
     glEnable(GL_DEPTH_TEST);
+    // Star sprites set their own size
+    glEnable(GL_PROGRAM_POINT_SIZE);
 
-    glUseProgram(shaderProgram);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texture1"), 0);
-
-    glUseProgram(sunShaderProgram);
-    glUniform1i(glGetUniformLocation(sunShaderProgram, "sunTexture"), 0);
     GLint sunTimeLoc = glGetUniformLocation(sunShaderProgram, "time");
 
-    glUseProgram(ringShaderProgram);
-    glUniform1i(glGetUniformLocation(ringShaderProgram, "ringTexture"), 0);
+    // Planets smaller than this on screen are drawn as ray-traced impostors
+    // instead of a 2500-triangle sphere
+    const float impostorPixelRadius = 4.0f;
+    // and larger than this are tessellated, if listed
+    const float tessellationPixelRadius = 100.0f;
 
     float sunRotationSpeed = 5.0f;
 
-    while (!glfwWindowShouldClose(window)) {
-        float currentFrame = (float)glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+    PostProcess post;
+    if (!createPostProcess(post, framebufferWidth, framebufferHeight, options.bloom, !hardwareSrgb, options.taa))
+        return -1;
+
+    TemporalAA taa;
+    if (options.taa && !createTemporalAA(taa, framebufferWidth, framebufferHeight))
+        return -1;
+    MotionHistory sunMotion;
+
+    DynamicResolution dynamicRes;
+    if (options.dynamicResTargetMs > 0.0f)
+        createDynamicResolution(dynamicRes, options.dynamicResTargetMs, options.dynamicResMinScale);
 
-        planetRotation += deltaTime * 1.0f;
+    GpuProfiler profiler;
+    if (options.profile) {
+        createGpuProfiler(profiler, std::vector<std::string>(renderPassNames, renderPassNames + PASS_COUNT));
+        profiler.overlayVisible = !options.headless;
+    }
 
-        processInput(window, deltaTime);
+    // Camera height over the nearest terrain in world units, from the last frame
+    float terrainAltitudeWorld = FLT_MAX;
 
-        glClearColor(0.0f, 0.0f, 0.02f, 1.0f);
+    auto renderFrame = [&](float currentFrame) {
+        TRACE_SCOPE("render frame");
+        beginProfilerFrame(profiler);
+        beginDynamicResolutionFrame(dynamicRes);
+
+        resizePostProcess(post, framebufferWidth, framebufferHeight);
+        post.renderScale = dynamicRes.scale;
+        beginPostProcess(post);
+
+        // The background is specified as a display value; linearise it for
+        // the HDR target
+        const glm::vec3 background(0.0f, 0.0f, 0.02f / 12.92f);
+        glClearColor(background.r, background.g, background.b, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (post.sceneVelocity) {
+            const GLfloat noMotion[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            glClearBufferfv(GL_COLOR, 1, noMotion);
+        }
+
+        // Close to terrain the near plane comes in and flying slows down. Reversed
+        // Z keeps the depth precision; without it the far plane comes in too
+        float nearPlane = 0.1f;
+        cameraSpeedScale = 1.0f;
+        if (terrainAltitudeWorld < FLT_MAX) {
+            nearPlane = glm::clamp(terrainAltitudeWorld * 0.5f, 0.0005f, 0.1f);
+            cameraSpeedScale = glm::clamp(terrainAltitudeWorld / 50.0f, 0.001f, 1.0f);
+        }
+        terrainAltitudeWorld = FLT_MAX;
 
         glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 10000.0f);
+        beginTemporalAAFrame(taa, view,
+            sceneProjection(glm::radians(60.0f), (float)framebufferWidth / (float)framebufferHeight, nearPlane,
+                sceneFarPlane(nearPlane, 10000.0f)),
+            post.renderWidth, post.renderHeight);
+        // Sub-pixel jittered when temporal AA is on
+        glm::mat4 projection = taa.jitteredProjection;
+        glm::mat4 viewProjection = projection * view;
+
+        // Camera matrices, plus the unjittered ones motion vectors are computed with
+        auto setCamera = [&](GLuint program) {
+            glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+            glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+            glUniformMatrix4fv(glGetUniformLocation(program, "currViewProjection"), 1, GL_FALSE, glm::value_ptr(taa.viewProjection));
+            glUniformMatrix4fv(glGetUniformLocation(program, "prevViewProjection"), 1, GL_FALSE, glm::value_ptr(taa.previousViewProjection));
+            };
+        // Model matrix and last frame's, for programs with velocity output
+        auto setModel = [&](GLuint program, const glm::mat4& model, MotionHistory& motion) {
+            glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+            glm::mat4 previous = advanceMotion(motion, model);
+            glUniformMatrix4fv(glGetUniformLocation(program, "prevModel"), 1, GL_FALSE, glm::value_ptr(previous));
+            };
 
         // Draw stars
+        TraceScope passScope("draw stars");
+        beginProfilerPass(profiler, PASS_STARS);
+        updateStarField(starField, starCatalog, cameraPos);
         glUseProgram(starShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(starShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(starShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform3f(glGetUniformLocation(starShaderProgram, "starColor"), 1.0f, 1.0f, 1.0f);
-
-        glBindVertexArray(starsVAO);
-        glPointSize(2.0f);
-        glDrawArrays(GL_POINTS, 0, numStars);
+        // Stars never move, only the camera does
+        glUniformMatrix4fv(glGetUniformLocation(starShaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+        glUniformMatrix4fv(glGetUniformLocation(starShaderProgram, "prevModel"), 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+        glUniform3fv(glGetUniformLocation(starShaderProgram, "viewPos"), 1, glm::value_ptr(cameraPos));
+        glUniform1f(glGetUniformLocation(starShaderProgram, "limitingMagnitude"), starField.limitingMagnitude);
+        auto setStarShell = [&](const StarShell& shell) {
+            glUniform3fv(glGetUniformLocation(starShaderProgram, "shellCenter"), 1, glm::value_ptr(shell.center));
+            glUniform2f(glGetUniformLocation(starShaderProgram, "shellRange"), shell.minDistance, shell.maxDistance);
+            };
+
+        StarShell liveStars;
+        if (starSkybox.enabled) {
+            bool distantStarsChanged = starShellChangedSince(starField, starCatalog,
+                StarShell(starSkybox.bakedFrom, starSkybox.radius, FLT_MAX), starSkybox.bakedUploads);
+            if (starSkyboxNeedsBake(starSkybox, cameraPos, distantStarsChanged)) {
+                StarShell distant(cameraPos, starSkybox.radius, FLT_MAX);
+                setStarShell(distant);
+                // Same angular sprite size as on screen: texels per radian over output pixels per radian
+                glUniform1f(glGetUniformLocation(starShaderProgram, "pointScale"),
+                    starSkybox.faceSize * std::tan(glm::radians(30.0f)) / post.height);
+                bakeStarSkybox(starSkybox, cameraPos, starField.uploads, background,
+                    [&](const glm::mat4& faceView, const glm::mat4& faceProjection) {
+                        glm::mat4 faceViewProjection = faceProjection * faceView;
+                        glUniformMatrix4fv(glGetUniformLocation(starShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(faceView));
+                        glUniformMatrix4fv(glGetUniformLocation(starShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(faceProjection));
+                        prepareStarDraw(starField, starCatalog, cameraPos, faceViewProjection, distant);
+                        drawStarField(starField);
+                    });
+            }
 
-        // Draw orbits
-        glUseProgram(orbitShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(orbitShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(orbitShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform3f(glGetUniformLocation(orbitShaderProgram, "orbitColor"), 1.0f, 1.0f, 1.0f);
-
-        for (auto& planet : planets) {
-            glm::mat4 orbitModel(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(orbitShaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(orbitModel));
-            glBindVertexArray(planet.orbitVAO);
-            glDrawArrays(GL_LINE_LOOP, 0, planet.orbitVertexCount);
+            glm::mat4 rotation = projection * glm::mat4(glm::mat3(view));
+            glUseProgram(skyboxShaderProgram);
+            setCamera(skyboxShaderProgram);
+            glUniformMatrix4fv(glGetUniformLocation(skyboxShaderProgram, "inverseViewProjection"), 1, GL_FALSE,
+                glm::value_ptr(glm::inverse(rotation)));
+            drawStarSkybox(starSkybox, skyboxShaderProgram);
+            glUseProgram(starShaderProgram);
+            liveStars = StarShell(starSkybox.bakedFrom, 0.0f, starSkybox.radius);
         }
 
+        setCamera(starShaderProgram);
+        setStarShell(liveStars);
+        // Keep stars the same size on screen at any render scale
+        glUniform1f(glGetUniformLocation(starShaderProgram, "pointScale"), (float)post.renderHeight / post.height);
+        prepareStarDraw(starField, starCatalog, cameraPos, taa.viewProjection, liveStars);
+        drawStarField(starField);
+
         // Draw sun
+        passScope.next("draw sun");
+        beginProfilerPass(profiler, PASS_SUN);
         glUseProgram(sunShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(sunShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(sunShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        setCamera(sunShaderProgram);
 
         glm::mat4 sunModel = glm::mat4(1.0f);
         sunModel = glm::rotate(sunModel, glm::radians(sunRotationSpeed * currentFrame), glm::vec3(0.0f, 1.0f, 0.0f));
         sunModel = glm::scale(sunModel, glm::vec3(sunScale));
-        glUniformMatrix4fv(glGetUniformLocation(sunShaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(sunModel));
+        setModel(sunShaderProgram, sunModel, sunMotion);
         glUniform1f(sunTimeLoc, currentFrame);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, sunTextureID);
 
-        glBindVertexArray(sphereVAO);
-        glDrawElements(GL_TRIANGLES, (GLsizei)sphereIndices.size(), GL_UNSIGNED_INT, 0);
+        drawMeshlets(meshletCuller, sphereMesh, sphereMeshlets, sunShaderProgram, sunModel, viewProjection, cameraPos);
 
         // Draw planets
-        glUseProgram(shaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightPos"), 1, glm::value_ptr(glm::vec3(0.0f)));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, glm::value_ptr(cameraPos));
-
-        int modelLoc = glGetUniformLocation(shaderProgram, "model");
-
-        glm::mat4 saturnModel;
-        glm::mat4 jupiterModel, uranusModel, neptuneModel;
+        passScope.next("draw planets");
+        beginProfilerPass(profiler, PASS_PLANETS);
+        // Pick the cheapest program per planet; switching only when it changes
+        GLuint shaderProgram = 0;
+        auto useSurfaceProgram = [&](GLuint program) {
+            if (program == shaderProgram)
+                return;
+            shaderProgram = program;
+            glUseProgram(shaderProgram);
+            setCamera(shaderProgram);
+            glUniform3fv(glGetUniformLocation(shaderProgram, "lightPos"), 1, glm::value_ptr(glm::vec3(0.0f)));
+            glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, glm::value_ptr(cameraPos));
+            };
+        auto usePlanetVariant = [&](unsigned features) {
+            useSurfaceProgram(getShaderVariant(shaders, surfaceEffect, features));
+            };
+        float pixelsPerUnit = post.renderHeight * 0.5f / std::tan(glm::radians(30.0f));
+
+        // Orbit position and tilt of every planet, before spin and size;
+        // each one's shadows depend on where the others are
+        std::vector<glm::mat4> orbitModels(planets.size());
+        std::vector<glm::vec3> planetCenters(planets.size());
+        for (size_t i = 0; i < planets.size(); ++i) {
+            float angle = planetRotation * planets[i].orbitSpeed * globalOrbitSpeedFactor;
+            glm::mat4 orbit = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f));
+            orbit = glm::translate(orbit, glm::vec3(planets[i].distance, 0.0f, 0.0f));
+            orbitModels[i] = glm::rotate(orbit, glm::radians(planets[i].tilt), glm::vec3(0.0f, 0.0f, 1.0f));
+            planetCenters[i] = glm::vec3(orbitModels[i][3]);
+        }
+        // Ring models share the planet's tilt but not its spin or size
+        glm::mat4 jupiterModel = glm::scale(orbitModels[4], glm::vec3(sizeMultiplier));
+        glm::mat4 saturnModel = glm::scale(orbitModels[5], glm::vec3(sizeMultiplier));
+        glm::mat4 uranusModel = glm::scale(orbitModels[6], glm::vec3(sizeMultiplier));
+        glm::mat4 neptuneModel = glm::scale(orbitModels[7], glm::vec3(sizeMultiplier));
+
+        // Shadow casters for a planet, or for its rings: the other planets
+        // that can cover part of the sun from somewhere on it, the deepest
+        // first, plus its rings or, for the rings, the planet itself
+        auto setShadows = [&](GLuint program, size_t body, bool rings) {
+            if (!options.shadows) {
+                glUniform1i(glGetUniformLocation(program, "occluderCount"), 0);
+                glUniform1i(glGetUniformLocation(program, "ringBandCount"), 0);
+                return;
+            }
+            glm::vec3 center = planetCenters[body];
+            float extent = rings ? planetRingBands[body].back().y * sizeMultiplier
+                : planets[body].size * sizeMultiplier;
+            float sunDistance = glm::length(center);
+            float sunAngle = std::asin(std::min(sunScale / sunDistance, 1.0f));
+            std::vector<std::pair<float, glm::vec4>> casters;
+            if (rings)
+                casters.push_back(std::make_pair(-FLT_MAX, glm::vec4(center, planets[body].size * sizeMultiplier)));
+            for (size_t j = 0; j < planets.size(); ++j) {
+                glm::vec3 toCaster = planetCenters[j] - center;
+                float casterDistance = glm::length(toCaster);
+                if (j == body || casterDistance >= sunDistance)
+                    continue;
+                float casterRadius = planets[j].size * sizeMultiplier;
+                float casterAngle = std::asin(std::min(casterRadius / casterDistance, 1.0f));
+                float separation = std::acos(glm::clamp(glm::dot(toCaster / casterDistance, -center / sunDistance),
+                    -1.0f, 1.0f));
+                // Angle left between the discs, less what moving across the body can close
+                float clearance = separation - sunAngle - casterAngle - extent / casterDistance - extent / sunDistance;
+                if (clearance < 0.0f)
+                    casters.push_back(std::make_pair(clearance, glm::vec4(planetCenters[j], casterRadius)));
+            }
+            std::sort(casters.begin(), casters.end(),
+                [](const std::pair<float, glm::vec4>& a, const std::pair<float, glm::vec4>& b) {
+                    return a.first < b.first;
+                });
+            int occluderCount = std::min((int)casters.size(), SHADOW_OCCLUDERS);
+            glm::vec4 occluders[SHADOW_OCCLUDERS];
+            for (int k = 0; k < occluderCount; ++k)
+                occluders[k] = casters[k].second;
+            glUniform1f(glGetUniformLocation(program, "sunRadius"), sunScale);
+            glUniform1i(glGetUniformLocation(program, "occluderCount"), occluderCount);
+            glUniform4fv(glGetUniformLocation(program, "occluders"), occluderCount, glm::value_ptr(occluders[0]));
+
+            const std::vector<glm::vec3>& bands = planetRingBands[body];
+            int bandCount = rings ? 0 : std::min((int)bands.size(), SHADOW_RING_BANDS);
+            glm::vec3 worldBands[SHADOW_RING_BANDS];
+            for (int k = 0; k < bandCount; ++k)
+                worldBands[k] = glm::vec3(glm::vec2(bands[k]) * sizeMultiplier, bands[k].z);
+            glm::vec3 ringNormal = glm::normalize(glm::mat3(orbitModels[body]) * glm::vec3(0.0f, 1.0f, 0.0f));
+            glUniform1i(glGetUniformLocation(program, "ringBandCount"), bandCount);
+            glUniform3fv(glGetUniformLocation(program, "ringCenter"), 1, glm::value_ptr(center));
+            glUniform3fv(glGetUniformLocation(program, "ringNormal"), 1, glm::value_ptr(ringNormal));
+            glUniform3fv(glGetUniformLocation(program, "ringBands"), bandCount, glm::value_ptr(worldBands[0]));
+            };
 
         for (size_t i = 0; i < planets.size(); ++i) {
             auto& planet = planets[i];
-            glm::mat4 model(1.0f);
-            float angle = planetRotation * planet.orbitSpeed * globalOrbitSpeedFactor;
-            model = glm::rotate(model, angle, glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::translate(model, glm::vec3(planet.distance, 0.0f, 0.0f));
-            model = glm::rotate(model, glm::radians(planet.tilt), glm::vec3(0.0f, 0.0f, 1.0f));
-
+            glm::mat4 model = orbitModels[i];
             float rotationAngle = currentFrame * planet.orbitSpeed * globalSelfRotationSpeedFactor;
             model = glm::rotate(model, rotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
             model = glm::scale(model, glm::vec3(planet.size * sizeMultiplier));
 
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+            float radius = planet.size * sizeMultiplier;
+            float distance = glm::length(glm::vec3(model[3]) - cameraPos);
+            bool impostor = radius * pixelsPerUnit < impostorPixelRadius * distance;
+            Terrain* terrain = hasTerrain[i] ? &terrains[i] : nullptr;
+            if (terrain) {
+                glm::vec3 cameraLocal = glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f));
+                terrainAltitudeWorld = std::min(terrainAltitudeWorld, terrainAltitude(*terrain, cameraLocal) * radius);
+                if (impostor)
+                    terrain = nullptr;
+                else
+                    updateTerrain(*terrain, cameraLocal, viewProjection * model, pixelsPerUnit);
+            }
+            bool displaced = hasDisplacement[i] && radius * pixelsPerUnit > tessellationPixelRadius * distance;
+            unsigned atmosphereFeature = atmospheres[i].scatteringTexture ? SHADER_ATMOSPHERE : 0;
+            if (terrain)
+                useSurfaceProgram(getShaderVariant(shaders, terrainEffect, outputFeatures | atmosphereFeature));
+            else if (displaced)
+                useSurfaceProgram(getShaderVariant(shaders, displacedEffect, outputFeatures | atmosphereFeature));
+            else
+                usePlanetVariant((impostor ? impostorFeatures : planetFeatures) | atmosphereFeature);
+            setModel(shaderProgram, model, planet.motion);
+            setShadows(shaderProgram, i, false);
+            if (atmosphereFeature)
+                bindAtmosphere(atmospheres[i], shaderProgram, planetCenters[i], radius);
+            if (trails.objectCount)
+                setTrailPosition(trails, (int)i, glm::vec3(model[3]));
 
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, planet.textureID);
 
-            glBindVertexArray(sphereVAO);
-            glDrawElements(GL_TRIANGLES, (GLsizei)sphereIndices.size(), GL_UNSIGNED_INT, 0);
-
-            // Save planet base models for ring alignment
-            if (i == 5) {
-                glm::mat4 satBase(1.0f);
-                satBase = glm::rotate(satBase, angle, glm::vec3(0.0f, 1.0f, 0.0f));
-                satBase = glm::translate(satBase, glm::vec3(planet.distance, 0.0f, 0.0f));
-                satBase = glm::rotate(satBase, glm::radians(planet.tilt), glm::vec3(0.0f, 0.0f, 1.0f));
-                satBase = glm::scale(satBase, glm::vec3(sizeMultiplier));
-                saturnModel = satBase;
+            if (terrain) {
+                drawTerrain(*terrain, shaderProgram);
             }
-            if (i == 4) {
-                glm::mat4 jupBase(1.0f);
-                jupBase = glm::rotate(jupBase, angle, glm::vec3(0.0f, 1.0f, 0.0f));
-                jupBase = glm::translate(jupBase, glm::vec3(planet.distance, 0.0f, 0.0f));
-                jupBase = glm::rotate(jupBase, glm::radians(planet.tilt), glm::vec3(0.0f, 0.0f, 1.0f));
-                jupBase = glm::scale(jupBase, glm::vec3(sizeMultiplier));
-                jupiterModel = jupBase;
+            else if (displaced) {
+                glm::vec3 cameraLocal = glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f));
+                glUniform3fv(glGetUniformLocation(shaderProgram, "cameraLocal"), 1, glm::value_ptr(cameraLocal));
+                glUniform1f(glGetUniformLocation(shaderProgram, "pixelsPerUnit"), pixelsPerUnit);
+                glUniform1f(glGetUniformLocation(shaderProgram, "heightScale"), displacementAmplitude);
+                glUniform1i(glGetUniformLocation(shaderProgram, "heightMap"), 1);
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, displacementTextures[i]);
+                glActiveTexture(GL_TEXTURE0);
+                drawMesh(sphereMesh, shaderProgram, GL_PATCHES);
             }
-            if (i == 6) {
-                glm::mat4 uraBase(1.0f);
-                uraBase = glm::rotate(uraBase, angle, glm::vec3(0.0f, 1.0f, 0.0f));
-                uraBase = glm::translate(uraBase, glm::vec3(planet.distance, 0.0f, 0.0f));
-                uraBase = glm::rotate(uraBase, glm::radians(planet.tilt), glm::vec3(0.0f, 0.0f, 1.0f));
-                uraBase = glm::scale(uraBase, glm::vec3(sizeMultiplier));
-                uranusModel = uraBase;
+            else if (impostor) {
+                glBindVertexArray(sphereMesh.VAO);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
             }
-            if (i == 7) {
-                glm::mat4 nepBase(1.0f);
-                nepBase = glm::rotate(nepBase, angle, glm::vec3(0.0f, 1.0f, 0.0f));
-                nepBase = glm::translate(nepBase, glm::vec3(planet.distance, 0.0f, 0.0f));
-                nepBase = glm::rotate(nepBase, glm::radians(planet.tilt), glm::vec3(0.0f, 0.0f, 1.0f));
-                nepBase = glm::scale(nepBase, glm::vec3(sizeMultiplier));
-                neptuneModel = nepBase;
+            else {
+                drawMeshlets(meshletCuller, sphereMesh, sphereMeshlets, shaderProgram, model, viewProjection, cameraPos);
             }
         }
 
+        // Draw orbits, blended over everything opaque
+        passScope.next("draw orbits");
+        beginProfilerPass(profiler, PASS_ORBITS);
+        updateOrbitLines(orbitLines, cameraPos, taa.viewProjection, pixelsPerUnit);
+        glUseProgram(orbitShaderProgram);
+        setCamera(orbitShaderProgram);
+        setLineUniforms(orbitShaderProgram, orbitLineWidth, post.renderWidth, post.renderHeight, post.height);
+        beginLineDraw();
+        drawOrbitLines(orbitLines, orbitShaderProgram);
+
+        // Draw trails
+        passScope.next("draw trails");
+        beginProfilerPass(profiler, PASS_TRAILS);
+        if (trails.objectCount) {
+            updateTrails(trails, planetRotation);
+            glUseProgram(trailShaderProgram);
+            setCamera(trailShaderProgram);
+            setLineUniforms(trailShaderProgram, trailLineWidth, post.renderWidth, post.renderHeight, post.height);
+            drawTrails(trails, trailShaderProgram);
+        }
+        endLineDraw();
+
+        // Translucent layers go to order-independent targets: drawn in any
+        // order, no sorting, overlaps still right
+        beginTransparency(transparency, post);
+
         // Draw Saturn's rings
+        passScope.next("draw rings");
+        beginProfilerPass(profiler, PASS_RINGS);
         glUseProgram(ringShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(ringShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(ringShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        setCamera(ringShaderProgram);
+        bindTransparency(transparency, ringShaderProgram);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, ringTextureID);
+        GLint ringModelLoc = glGetUniformLocation(ringShaderProgram, "model");
+        auto drawRing = [&](const RingSet& ring) {
+            glUniform1f(glGetUniformLocation(ringShaderProgram, "opacity"), ring.opacity);
+            drawMesh(ring.mesh, ringShaderProgram);
+            };
 
-        glUniformMatrix4fv(glGetUniformLocation(ringShaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(saturnModel));
-        for (auto& r : saturnRings) {
-            glBindVertexArray(r.VAO);
-            glDrawElements(GL_TRIANGLES, r.indexCount, GL_UNSIGNED_INT, 0);
-        }
+        glUniformMatrix4fv(ringModelLoc, 1, GL_FALSE, glm::value_ptr(saturnModel));
+        setShadows(ringShaderProgram, 5, true);
+        for (auto& r : saturnRings)
+            drawRing(r);
 
         // Jupiter ring (now larger)
-        glUniformMatrix4fv(glGetUniformLocation(ringShaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(jupiterModel));
-        glBindVertexArray(jupiterRing.VAO);
-        glDrawElements(GL_TRIANGLES, jupiterRing.indexCount, GL_UNSIGNED_INT, 0);
+        glUniformMatrix4fv(ringModelLoc, 1, GL_FALSE, glm::value_ptr(jupiterModel));
+        setShadows(ringShaderProgram, 4, true);
+        drawRing(jupiterRing);
 
         // Uranus ring
-        glUniformMatrix4fv(glGetUniformLocation(ringShaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(uranusModel));
-        glBindVertexArray(uranusRing.VAO);
-        glDrawElements(GL_TRIANGLES, uranusRing.indexCount, GL_UNSIGNED_INT, 0);
+        glUniformMatrix4fv(ringModelLoc, 1, GL_FALSE, glm::value_ptr(uranusModel));
+        setShadows(ringShaderProgram, 6, true);
+        drawRing(uranusRing);
 
         // Neptune ring
-        glUniformMatrix4fv(glGetUniformLocation(ringShaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(neptuneModel));
-        glBindVertexArray(neptuneRing.VAO);
-        glDrawElements(GL_TRIANGLES, neptuneRing.indexCount, GL_UNSIGNED_INT, 0);
+        glUniformMatrix4fv(ringModelLoc, 1, GL_FALSE, glm::value_ptr(neptuneModel));
+        setShadows(ringShaderProgram, 7, true);
+        drawRing(neptuneRing);
+
+        // Draw atmospheres
+        passScope.next("draw atmospheres");
+        beginProfilerPass(profiler, PASS_ATMOSPHERES);
+        if (atmosphereShaderProgram) {
+            glUseProgram(atmosphereShaderProgram);
+            setCamera(atmosphereShaderProgram);
+            glUniform3fv(glGetUniformLocation(atmosphereShaderProgram, "lightPos"), 1, glm::value_ptr(glm::vec3(0.0f)));
+            glUniform3fv(glGetUniformLocation(atmosphereShaderProgram, "viewPos"), 1, glm::value_ptr(cameraPos));
+            glUniformMatrix4fv(glGetUniformLocation(atmosphereShaderProgram, "inverseViewProjection"), 1, GL_FALSE,
+                glm::value_ptr(glm::inverse(viewProjection)));
+            bindTransparency(transparency, atmosphereShaderProgram);
+            glBindVertexArray(sphereMesh.VAO);
+            for (size_t i = 0; i < planets.size(); ++i) {
+                if (!atmospheres[i].scatteringTexture)
+                    continue;
+                const AtmosphereParameters& parameters = atmospheres[i].parameters;
+                float radius = planets[i].size * sizeMultiplier;
+                bindAtmosphere(atmospheres[i], atmosphereShaderProgram, planetCenters[i], radius);
+                glUniform1f(glGetUniformLocation(atmosphereShaderProgram, "shellRadius"),
+                    radius * parameters.topRadius / parameters.bottomRadius);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            }
+        }
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-    }
+        // Blend them over the scene
+        passScope.next("composite transparency");
+        beginProfilerPass(profiler, PASS_TRANSPARENCY);
+        endTransparency(transparency, post);
+        passScope.end();
+
+        beginProfilerPass(profiler, PASS_TAA);
+        applyTemporalAA(taa, post);
+        beginProfilerPass(profiler, PASS_BLOOM);
+        applyBloom(post);
+        beginProfilerPass(profiler, PASS_TONEMAP);
+        resolvePostProcess(post);
+        endProfilerPass(profiler);
+
+        // UI goes straight to the output framebuffer
+        if (!options.headless)
+            profiler.overlayVisible = showProfilerOverlay;
+        drawProfilerOverlay(profiler, framebufferWidth, framebufferHeight, 1000.0f / 60.0f);
+        endDynamicResolutionFrame(dynamicRes);
+        endProfilerFrame(profiler);
+        };
 
-    // Cleanup
-    glDeleteVertexArrays(1, &sphereVAO);
-    glDeleteBuffers(1, &sphereVBO);
-    glDeleteBuffers(1, &sphereEBO);
+    int exitCode = 0;
+
+    if (options.headless) {
+        bool capturing = !options.capture.outputPattern.empty() || !options.capture.pipeCommand.empty();
+        FrameEncoder encoder;
+        AsyncReadback readback;
+        if (capturing && (!encoder.start(options.capture, headless.width, headless.height) ||
+            !createAsyncReadback(readback, headless.width, headless.height, options.capture.ringSize))) {
+            std::cerr << "ERROR: Failed to set up frame capture" << std::endl;
+            encoder.finish();
+            destroyAsyncReadback(readback);
+            return -1;
+        }
+        int framesSubmitted = 0;
+
+        // Camera and clock are fully scripted while benchmarking so runs are
+        // reproducible
+        bool benchmarking = !options.benchmarkPath.empty();
+        CameraPath cameraPath = defaultCameraPath();
+        BenchmarkRecorder recorder;
+        if (benchmarking) {
+            if (!options.cameraPathFile.empty() && !loadCameraPath(options.cameraPathFile, cameraPath))
+                return -1;
+            if (options.frames == 0)
+                options.frames = options.warmupFrames + (int)std::ceil(cameraPath.duration() / options.timeStep) + 1;
+            createBenchmarkRecorder(recorder, options.warmupFrames);
+        }
+        if (options.frames == 0)
+            options.frames = 1;
+
+        // Frames are handed to this callback as soon as they are read back;
+        // batch jobs and image tests hook in here.
+        HeadlessFrameCallback onFrame = [&](HeadlessFrame& frame) {
+            if (!options.snapshotPath.empty() && frame.index == options.frames - 1)
+                writeFramePPM(options.snapshotPath, frame);
+            if (capturing) {
+                encoder.submit(frame);
+                framesSubmitted++;
+            }
+            };
+
+        startupScope.end();
+
+        HeadlessFrame frame;
+        for (int i = 0; i < options.frames; ++i) {
+            TraceScope updateScope("update");
+            // Fixed timestep: the simulation clock only depends on the frame index
+            float currentFrame = options.startTime + i * options.timeStep;
+            deltaTime = options.timeStep;
+            planetRotation = currentFrame;
+
+            if (benchmarking) {
+                float pathTime = std::max(0.0f, (i - options.warmupFrames) * options.timeStep);
+                sampleCameraPath(cameraPath, pathTime, cameraPos, cameraFront);
+                beginBenchmarkFrame(recorder);
+            }
+            updateScope.end();
 
-    glDeleteVertexArrays(1, &starsVAO);
-    glDeleteBuffers(1, &starsVBO);
+            bindHeadlessFramebuffer(headless);
+            renderFrame(currentFrame);
 
-    for (auto& planet : planets) {
-        glDeleteVertexArrays(1, &planet.orbitVAO);
-        glDeleteBuffers(1, &planet.orbitVBO);
-        glDeleteTextures(1, &planet.textureID);
+            if (benchmarking)
+                markBenchmarkCpuDone(recorder, i, currentFrame);
+
+            if (capturing) {
+                queueReadback(readback, headless.fbo, i, currentFrame, onFrame);
+                pollReadback(readback, onFrame, false);
+            }
+            else if (!options.snapshotPath.empty() && i == options.frames - 1) {
+                frame.index = i;
+                frame.time = currentFrame;
+                readHeadlessFrame(headless, frame);
+                onFrame(frame);
+            }
+
+            if (benchmarking) {
+                glFlush();
+                endBenchmarkFrame(recorder);
+            }
+        }
+
+        if (capturing) {
+            pollReadback(readback, onFrame, true);
+            destroyAsyncReadback(readback);
+            encoder.finish();
+            std::cout << "Captured " << encoder.framesWritten() << " frames" << std::endl;
+            if (encoder.framesWritten() < framesSubmitted) {
+                std::cerr << "ERROR: " << framesSubmitted - encoder.framesWritten() << " of " << framesSubmitted
+                    << " frames were not written" << std::endl;
+                exitCode = -1;
+            }
+        }
+
+        if (benchmarking) {
+            finishBenchmark(recorder);
+            if (!writeBenchmarkReport(recorder, options.benchmarkPath, cameraPath.name,
+                headless.width, headless.height, options.timeStep))
+                exitCode = -1;
+            else if (!options.baselinePath.empty()) {
+                BenchmarkComparison comparison = compareBenchmarkReports(options.benchmarkPath + ".json",
+                    options.baselinePath, options.regressionTolerance);
+                if (comparison == BENCHMARK_REGRESSED)
+                    exitCode = 2;
+                else if (comparison == BENCHMARK_COMPARE_FAILED)
+                    exitCode = 3;
+            }
+            destroyBenchmarkRecorder(recorder);
+        }
     }
+    else {
+        startupScope.end();
+
+        while (!glfwWindowShouldClose(window)) {
+            // Nothing to draw into while minimised, and no aspect ratio to
+            // project with; resume without a time jump
+            if (framebufferWidth == 0 || framebufferHeight == 0) {
+                glfwWaitEvents();
+                lastFrame = (float)glfwGetTime();
+                continue;
+            }
+
+            TraceScope updateScope("update");
+            float currentFrame = (float)glfwGetTime();
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+
+            planetRotation += deltaTime * 1.0f;
 
-    for (auto& r : saturnRings) {
-        glDeleteVertexArrays(1, &r.VAO);
-        glDeleteBuffers(1, &r.VBO);
-        glDeleteBuffers(1, &r.EBO);
+            processInput(window, deltaTime);
+            updateScope.end();
+
+            renderFrame(currentFrame);
+
+            if (profiler.enabled && profiler.frameCount % 30 == 0) {
+                std::string title = "Solar System - GPU " + std::to_string(profilerTotalAverage(profiler)) + " ms";
+                if (dynamicRes.enabled)
+                    title += " - " + std::to_string((int)(dynamicRes.scale * 100.0f + 0.5f)) + "% res";
+                glfwSetWindowTitle(window, title.c_str());
+            }
+
+            {
+                TRACE_SCOPE("swap buffers");
+                glfwSwapBuffers(window);
+            }
+            glfwPollEvents();
+        }
     }
 
-    glDeleteVertexArrays(1, &jupiterRing.VAO);
-    glDeleteBuffers(1, &jupiterRing.VBO);
-    glDeleteBuffers(1, &jupiterRing.EBO);
+    // Cleanup
+    destroyGpuProfiler(profiler);
+    destroyTemporalAA(taa);
+    destroyTransparency(transparency);
+    destroyPostProcess(post);
+    destroyDynamicResolution(dynamicRes);
+
+    destroyMeshlets(sphereMeshlets);
+    for (auto& terrain : terrains)
+        destroyTerrain(terrain);
+    destroyMeshletCuller(meshletCuller);
+    destroyMesh(sphereMesh);
+
+    if (starSkybox.enabled)
+        std::cout << "Star skybox baked " << starSkybox.bakeCount << " times" << std::endl;
+    destroyStarSkybox(starSkybox);
+    destroyStarField(starField);
+    destroyOrbitLines(orbitLines);
+    destroyTrails(trails);
 
-    glDeleteVertexArrays(1, &uranusRing.VAO);
-    glDeleteBuffers(1, &uranusRing.VBO);
-    glDeleteBuffers(1, &uranusRing.EBO);
+    for (auto& planet : planets) {
+        glDeleteTextures(1, &planet.textureID);
+    }
+    glDeleteTextures((GLsizei)displacementTextures.size(), displacementTextures.data());
+    for (auto& atmosphere : atmospheres)
+        destroyAtmosphere(atmosphere);
 
-    glDeleteVertexArrays(1, &neptuneRing.VAO);
-    glDeleteBuffers(1, &neptuneRing.VBO);
-    glDeleteBuffers(1, &neptuneRing.EBO);
+    for (auto& r : saturnRings)
+        destroyMesh(r.mesh);
+    destroyMesh(jupiterRing.mesh);
+    destroyMesh(uranusRing.mesh);
+    destroyMesh(neptuneRing.mesh);
 
-    glDeleteProgram(shaderProgram);
-    glDeleteProgram(sunShaderProgram);
-    glDeleteProgram(starShaderProgram);
-    glDeleteProgram(ringShaderProgram);
-    glDeleteProgram(orbitShaderProgram);
+    destroyShaderLibrary(shaders);
 
     glDeleteTextures(1, &sunTextureID);
     glDeleteTextures(1, &ringTextureID);
 
-    glfwTerminate();
-    return 0;
+    if (options.headless)
+        destroyHeadlessContext(headless);
+    else
+        glfwTerminate();
+
+    if (!options.tracePath.empty())
+        writeTrace(options.tracePath);
+    return exitCode;
+}
+
+bool parseCommandLine(int argc, char** argv, RunOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless")
+            options.headless = true;
+        else if (arg == "--width" && hasValue)
+            options.width = atoi(argv[++i]);
+        else if (arg == "--height" && hasValue)
+            options.height = atoi(argv[++i]);
+        else if (arg == "--frames" && hasValue)
+            options.frames = atoi(argv[++i]);
+        else if (arg == "--timestep" && hasValue)
+            options.timeStep = (float)atof(argv[++i]);
+        else if (arg == "--snapshot" && hasValue)
+            options.snapshotPath = argv[++i];
+        else if (arg == "--start-time" && hasValue)
+            options.startTime = (float)atof(argv[++i]);
+        else if (arg == "--end-time" && hasValue)
+            options.endTime = (float)atof(argv[++i]);
+        else if (arg == "--capture" && hasValue) {
+            options.capture.outputPattern = argv[++i];
+            options.headless = true;
+        }
+        else if (arg == "--encode-pipe" && hasValue) {
+            options.capture.pipeCommand = argv[++i];
+            options.headless = true;
+        }
+        else if (arg == "--encode-threads" && hasValue)
+            options.capture.workerCount = atoi(argv[++i]);
+        else if (arg == "--readback-ring" && hasValue)
+            options.capture.ringSize = atoi(argv[++i]);
+        else if (arg == "--benchmark" && hasValue) {
+            options.benchmarkPath = argv[++i];
+            options.headless = true;
+        }
+        else if (arg == "--bench-path" && hasValue)
+            options.cameraPathFile = argv[++i];
+        else if (arg == "--bench-warmup" && hasValue)
+            options.warmupFrames = atoi(argv[++i]);
+        else if (arg == "--bench-baseline" && hasValue)
+            options.baselinePath = argv[++i];
+        else if (arg == "--bench-tolerance" && hasValue)
+            options.regressionTolerance = (float)atof(argv[++i]);
+        else if (arg == "--profile")
+            options.profile = true;
+        else if (arg == "--trace" && hasValue)
+            options.tracePath = argv[++i];
+        else if (arg == "--shader-cache" && hasValue)
+            options.shaderCacheDir = argv[++i];
+        else if (arg == "--no-shader-cache")
+            options.shaderCacheDir.clear();
+        else if (arg == "--bloom" && hasValue && parseBloomQuality(argv[i + 1], options.bloom))
+            ++i;
+        else if (arg == "--dynamic-res" && hasValue)
+            options.dynamicResTargetMs = (float)atof(argv[++i]);
+        else if (arg == "--min-scale" && hasValue)
+            options.dynamicResMinScale = (float)atof(argv[++i]);
+        else if (arg == "--taa")
+            options.taa = true;
+        else if (arg == "--star-catalog" && hasValue)
+            options.starCatalogPath = argv[++i];
+        else if (arg == "--bake-stars" && hasValue)
+            options.bakeStarsPath = argv[++i];
+        else if (arg == "--star-limit" && hasValue)
+            options.starLimitMagnitude = (float)atof(argv[++i]);
+        else if (arg == "--star-chunks" && hasValue)
+            options.starChunks = atoi(argv[++i]);
+        else if (arg == "--star-skybox")
+            options.starSkybox = true;
+        else if (arg == "--skybox-size" && hasValue)
+            options.skyboxSize = atoi(argv[++i]);
+        else if (arg == "--skybox-radius" && hasValue)
+            options.skyboxRadius = (float)atof(argv[++i]);
+        else if (arg == "--minor-bodies" && hasValue)
+            options.minorBodies = std::max(0, atoi(argv[++i]));
+        else if (arg == "--trail-seconds" && hasValue)
+            options.trailSeconds = (float)atof(argv[++i]);
+        else if (arg == "--meshlet-culling" && hasValue && parseMeshletCulling(argv[i + 1], options.meshletCulling))
+            ++i;
+        else if (arg == "--terrain" && hasValue)
+            options.terrainBodies = argv[++i];
+        else if (arg == "--tessellate" && hasValue)
+            options.tessellatedBodies = argv[++i];
+        else if (arg == "--terrain-dem" && hasValue)
+            options.terrainDemDir = argv[++i];
+        else if (arg == "--atmosphere" && hasValue)
+            options.atmosphereBodies = argv[++i];
+        else if (arg == "--atmosphere-cache" && hasValue)
+            options.atmosphereCacheDir = argv[++i];
+        else if (arg == "--no-shadows")
+            options.shadows = false;
+        else if (arg == "--oit" && hasValue && parseTransparencyMode(argv[i + 1], options.transparency))
+            ++i;
+        else {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            std::cerr << "Usage: " << argv[0] << " [--headless] [--width N] [--height N]"
+                " [--frames N] [--timestep S] [--start-time S] [--end-time S] [--snapshot out.ppm]"
+                " [--capture frame_%05d.ppm | --encode-pipe CMD] [--encode-threads N]"
+                " [--readback-ring N] [--benchmark report] [--bench-path path.txt] [--bench-warmup N]"
+                " [--bench-baseline base.json] [--bench-tolerance 0.1] [--profile] [--trace trace.json]"
+                " [--shader-cache dir | --no-shader-cache] [--bloom off|low|medium|high]"
+                " [--dynamic-res target_ms] [--min-scale 0.5] [--taa]"
+                " [--star-catalog stars.csv|stars.bin] [--bake-stars out.bin] [--star-limit 6.5]"
+                " [--star-chunks 256] [--star-skybox] [--skybox-size 1024] [--skybox-radius 4000]"
+                " [--minor-bodies N] [--trail-seconds 8] [--meshlet-culling off|cpu|gpu]"
+                " [--terrain earth,mars] [--tessellate earth,mars] [--terrain-dem dir]"
+                " [--atmosphere earth,venus] [--atmosphere-cache dir] [--no-shadows]"
+                " [--oit weighted|linked-list]" << std::endl;
+            return false;
+        }
+    }
+    if (options.endTime > options.startTime && options.timeStep > 0.0f)
+        options.frames = (int)std::ceil((options.endTime - options.startTime) / options.timeStep);
+    if (options.capture.ringSize < 1)
+        options.capture.ringSize = 1;
+    if (!options.capture.outputPattern.empty() && !validCapturePattern(options.capture.outputPattern)) {
+        std::cerr << "--capture needs a .ppm pattern with one integer conversion, e.g. frames/frame_%05d.ppm"
+            << std::endl;
+        return false;
+    }
+    if (options.width <= 0 || options.height <= 0 || options.frames < 0 || options.warmupFrames < 0) {
+        std::cerr << "Width and height must be positive, frame counts non-negative" << std::endl;
+        return false;
+    }
+    return true;
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
+    framebufferWidth = width;
+    framebufferHeight = height;
     glViewport(0, 0, width, height);
 }
 
@@ -854,11 +2642,28 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     cameraFront = glm::normalize(front);
 }
 
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        showProfilerOverlay = !showProfilerOverlay;
+
+    // T starts recording a CPU trace; pressing it again writes it out
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        if (isTracing()) {
+            writeTrace(traceOutputPath);
+            stopTracing();
+        }
+        else {
+            std::cout << "Recording CPU trace, press T again to write " << traceOutputPath << std::endl;
+            startTracing();
+        }
+    }
+}
+
 void processInput(GLFWwindow* window, float deltaTime) {
     extern glm::vec3 cameraPos, cameraFront, cameraUp;
-    extern float cameraSpeed;
+    extern float cameraSpeed, cameraSpeedScale;
 
-    float velocity = cameraSpeed * deltaTime;
+    float velocity = cameraSpeed * cameraSpeedScale * deltaTime;
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         cameraPos += cameraFront * velocity;
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -880,6 +2685,7 @@ void processInput(GLFWwindow* window, float deltaTime) {
 void generateSphere(float radius, unsigned int rings, unsigned int sectors,
     std::vector<float>& vertices,
     std::vector<unsigned int>& indices) {
+    TRACE_SCOPE("generateSphere");
     const float PI = 3.14159265359f;
     float const R = 1.0f / (float)(rings - 1);
     float const S = 1.0f / (float)(sectors - 1);
@@ -918,70 +2724,15 @@ void generateSphere(float radius, unsigned int rings, unsigned int sectors,
     }
 }
 
-void generateCircle(float radius, int segments, std::vector<float>& vertices) {
-    const float PI = 3.14159265359f;
-    float angleIncrement = 2.0f * PI / segments;
-    for (int i = 0; i < segments; ++i) {
-        float angle = i * angleIncrement;
-        float x = radius * cos(angle);
-        float z = radius * sin(angle);
-        vertices.push_back(x);
-        vertices.push_back(0.0f);
-        vertices.push_back(z);
-    }
-}
-
-void checkShaderCompilation(GLuint shader) {
-    GLint success;
-    GLchar infoLog[512];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        std::cerr << "ERROR: Shader Compilation Failed\n" << infoLog << std::endl;
-    }
-}
-
-void checkProgramLinking(GLuint program) {
-    GLint success;
-    GLchar infoLog[512];
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(program, 512, NULL, infoLog);
-        std::cerr << "ERROR: Program Linking Failed\n" << infoLog << std::endl;
-    }
-}
-
-unsigned int loadTexture(const std::string& path) {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
-    if (data) {
-        GLenum format;
-        if (nrChannels == 1)
-            format = GL_RED;
-        else if (nrChannels == 3)
-            format = GL_RGB;
-        else if (nrChannels == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, (GLint)format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else {
-        std::cout << "Failed to load texture: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+// The catalog from --star-catalog, or a procedural one filling the same
+// volume the old random points did
+bool loadStars(StarCatalog& catalog, const std::string& path) {
+    // Stars per chunk; also the granularity of streaming
+    const int chunkSize = 4096;
+    if (!path.empty())
+        return loadStarCatalog(catalog, path, chunkSize);
+    std::vector<StarVertex> stars;
+    generateStarCatalog(stars, 200000, 8000.0f, 1);
+    buildStarCatalog(catalog, stars, chunkSize);
+    return true;
 }
@@ -0,0 +1,41 @@
+#include "mesh.h"
+
+#include "mesh_optimizer.h"
+
+void createMesh(Mesh& mesh, const char* name, std::vector<float>& vertices, std::vector<unsigned int>& indices) {
+    optimizeMesh(name, vertices, 8, indices);
+    std::vector<PackedVertex> packed;
+    packVertices(vertices, packed, mesh.bounds);
+    PackedIndices packedIndices;
+    packIndices(indices, packed.size(), packedIndices);
+
+    glGenVertexArrays(1, &mesh.VAO);
+    glGenBuffers(1, &mesh.VBO);
+    glGenBuffers(1, &mesh.EBO);
+    glBindVertexArray(mesh.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+    glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, packedIndices.data.size(), packedIndices.data.data(), GL_STATIC_DRAW);
+    applyVertexLayout(packedVertexLayout());
+    glBindVertexArray(0);
+
+    mesh.indexCount = packedIndices.count;
+    mesh.indexType = packedIndices.type;
+}
+
+void destroyMesh(Mesh& mesh) {
+    glDeleteVertexArrays(1, &mesh.VAO);
+    glDeleteBuffers(1, &mesh.VBO);
+    glDeleteBuffers(1, &mesh.EBO);
+    mesh.VAO = mesh.VBO = mesh.EBO = 0;
+    mesh.indexCount = 0;
+}
+
+void drawMesh(const Mesh& mesh, GLuint program, GLenum mode) {
+    setMeshBounds(program, mesh.bounds);
+    glBindVertexArray(mesh.VAO);
+    if (mode == GL_PATCHES)
+        glPatchParameteri(GL_PATCH_VERTICES, 3);
+    glDrawElements(mode, mesh.indexCount, mesh.indexType, 0);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "vertex_format.h"
+
+// Static indexed triangle mesh on the GPU, in the packed vertex format.
+struct Mesh {
+    GLuint VAO;
+    GLuint VBO;
+    GLuint EBO;
+    GLsizei indexCount;
+    GLenum indexType;
+    MeshBounds bounds;
+
+    Mesh() : VAO(0), VBO(0), EBO(0), indexCount(0), indexType(GL_UNSIGNED_INT) {}
+};
+
+// Optimizes (mesh_optimizer.h), packs and uploads interleaved position /
+// normal / texcoord floats. `name` is only for the log.
+void createMesh(Mesh& mesh, const char* name, std::vector<float>& vertices, std::vector<unsigned int>& indices);
+void destroyMesh(Mesh& mesh);
+
+// Sets the decode uniforms on `program` (current) and draws. Tessellated
+// programs draw the triangles as 3-vertex GL_PATCHES.
+void drawMesh(const Mesh& mesh, GLuint program, GLenum mode = GL_TRIANGLES);
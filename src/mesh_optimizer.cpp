@@ -0,0 +1,283 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <glm/glm.hpp>
+
+#include "trace.h"
+
+namespace {
+
+// FIFO post-transform cache: hits don't refresh an entry
+struct CacheSimulator {
+    std::vector<unsigned int> entered; // time + 1 each vertex entered, 0 = never
+    unsigned int time;
+    int size;
+
+    CacheSimulator(size_t vertexCount, int cacheSize) : entered(vertexCount, 0), time(0), size(cacheSize) {}
+
+    bool access(unsigned int vertex) {
+        if (entered[vertex] && time + 1 - entered[vertex] <= (unsigned int)size)
+            return false;
+        entered[vertex] = ++time;
+        return true;
+    }
+
+    void flush() {
+        time += size;
+    }
+};
+
+struct Cluster {
+    size_t first; // triangle
+    size_t count;
+    float facing;
+};
+
+glm::vec3 vertexPosition(const std::vector<float>& vertices, int stride, unsigned int vertex) {
+    const float* p = &vertices[(size_t)vertex * stride];
+    return glm::vec3(p[0], p[1], p[2]);
+}
+
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, int cacheSize) {
+    VertexCacheStats stats;
+    if (indices.empty())
+        return stats;
+    CacheSimulator cache(vertexCount, cacheSize);
+    std::vector<char> used(vertexCount, 0);
+    size_t misses = 0, usedCount = 0;
+    for (unsigned int index : indices) {
+        misses += cache.access(index);
+        if (!used[index]) {
+            used[index] = 1;
+            ++usedCount;
+        }
+    }
+    stats.acmr = (float)misses / (indices.size() / 3);
+    stats.atvr = (float)misses / usedCount;
+    return stats;
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, int cacheSize,
+    std::vector<unsigned int>* clusters) {
+    TRACE_SCOPE("optimizeVertexCache");
+    size_t triangleCount = indices.size() / 3;
+    if (clusters)
+        clusters->clear();
+    if (triangleCount == 0)
+        return;
+
+    // Triangles using each vertex
+    std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+        ++adjacencyOffset[index + 1];
+    for (size_t v = 0; v < vertexCount; ++v)
+        adjacencyOffset[v + 1] += adjacencyOffset[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+    std::vector<unsigned int> live(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        live[v] = adjacencyOffset[v + 1] - adjacencyOffset[v];
+
+    std::vector<unsigned int> cacheTime(vertexCount, 0);
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<unsigned int> deadEnds;
+    std::vector<unsigned int> candidates;
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    unsigned int time = cacheSize + 1;
+    size_t cursor = 0; // next vertex to try when the dead-end stack runs dry
+
+    int fan = 0;
+    if (clusters)
+        clusters->push_back(0);
+    while (fan >= 0) {
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (unsigned int a = adjacencyOffset[fan]; a < adjacencyOffset[fan + 1]; ++a) {
+            unsigned int triangle = adjacency[a];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = 1;
+            for (int corner = 0; corner < 3; ++corner) {
+                unsigned int v = indices[triangle * 3 + corner];
+                result.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cacheTime[v] > (unsigned int)cacheSize)
+                    cacheTime[v] = time++;
+            }
+        }
+
+        // Next fan: the oldest candidate that will still be cached after
+        // its own triangles are emitted
+        int next = -1;
+        int bestPriority = -1;
+        for (unsigned int v : candidates) {
+            if (live[v] == 0)
+                continue;
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= (unsigned int)cacheSize)
+                priority = (int)(time - cacheTime[v]);
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                next = (int)v;
+            }
+        }
+
+        if (next < 0) {
+            // Dead end: back up through recently used vertices, then scan
+            while (!deadEnds.empty()) {
+                unsigned int v = deadEnds.back();
+                deadEnds.pop_back();
+                if (live[v] > 0) {
+                    next = (int)v;
+                    break;
+                }
+            }
+            while (next < 0 && cursor < vertexCount) {
+                if (live[cursor] > 0) {
+                    next = (int)cursor;
+                    // Nothing of this run is in the cache any more
+                    if (clusters && result.size() / 3 > clusters->back())
+                        clusters->push_back((unsigned int)(result.size() / 3));
+                }
+                ++cursor;
+            }
+        }
+        fan = next;
+    }
+    indices.swap(result);
+}
+
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<float>& vertices, int stride,
+    const std::vector<unsigned int>& clusters, int cacheSize, float threshold) {
+    TRACE_SCOPE("optimizeOverdraw");
+    size_t triangleCount = indices.size() / 3;
+    size_t vertexCount = vertices.size() / stride;
+    if (triangleCount == 0)
+        return;
+    float meshAcmr = analyzeVertexCache(indices, vertexCount, cacheSize).acmr;
+
+    // Soft boundaries: start a new cluster wherever the current one has
+    // already reached the mesh's cache efficiency
+    std::vector<Cluster> split;
+    CacheSimulator cache(vertexCount, cacheSize);
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        size_t start = clusters[c];
+        size_t misses = 0;
+        cache.flush();
+        for (size_t t = start; t < end; ++t) {
+            for (int corner = 0; corner < 3; ++corner)
+                misses += cache.access(indices[t * 3 + corner]);
+            size_t count = t + 1 - start;
+            if (t + 1 < end && (float)misses / count <= meshAcmr * threshold) {
+                split.push_back({ start, count, 0.0f });
+                start = t + 1;
+                misses = 0;
+                cache.flush();
+            }
+        }
+        if (end > start)
+            split.push_back({ start, end - start, 0.0f });
+    }
+
+    // How much each cluster faces away from the centre
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> centers(split.size(), glm::vec3(0.0f));
+    std::vector<glm::vec3> normals(split.size(), glm::vec3(0.0f));
+    std::vector<float> areas(split.size(), 0.0f);
+    for (size_t c = 0; c < split.size(); ++c) {
+        for (size_t t = split[c].first; t < split[c].first + split[c].count; ++t) {
+            glm::vec3 a = vertexPosition(vertices, stride, indices[t * 3]);
+            glm::vec3 b = vertexPosition(vertices, stride, indices[t * 3 + 1]);
+            glm::vec3 d = vertexPosition(vertices, stride, indices[t * 3 + 2]);
+            glm::vec3 normal = glm::cross(b - a, d - a);
+            float area = glm::length(normal);
+            centers[c] += (a + b + d) / 3.0f * area;
+            normals[c] += normal;
+            areas[c] += area;
+        }
+        meshCenter += centers[c];
+        meshArea += areas[c];
+    }
+    if (meshArea > 0.0f)
+        meshCenter /= meshArea;
+    for (size_t c = 0; c < split.size(); ++c) {
+        if (areas[c] <= 0.0f || glm::length(normals[c]) <= 0.0f)
+            continue;
+        split[c].facing = glm::dot(centers[c] / areas[c] - meshCenter, glm::normalize(normals[c]));
+    }
+    std::stable_sort(split.begin(), split.end(), [](const Cluster& a, const Cluster& b) {
+        return a.facing > b.facing;
+        });
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (const auto& cluster : split)
+        result.insert(result.end(), indices.begin() + cluster.first * 3, indices.begin() + (cluster.first + cluster.count) * 3);
+    indices.swap(result);
+}
+
+void optimizeVertexFetch(std::vector<float>& vertices, int stride, std::vector<unsigned int>& indices) {
+    TRACE_SCOPE("optimizeVertexFetch");
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertices.size() / stride, unused);
+    std::vector<float> result;
+    result.reserve(vertices.size());
+    unsigned int next = 0;
+    for (unsigned int& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = next++;
+            result.insert(result.end(), vertices.begin() + (size_t)index * stride,
+                vertices.begin() + ((size_t)index + 1) * stride);
+        }
+        index = remap[index];
+    }
+    vertices.swap(result);
+}
+
+void optimizeMesh(const char* name, std::vector<float>& vertices, int stride, std::vector<unsigned int>& indices) {
+    TRACE_SCOPE("optimizeMesh");
+    size_t vertexCount = vertices.size() / stride;
+    VertexCacheStats before = analyzeVertexCache(indices, vertexCount);
+
+    std::vector<unsigned int> clusters;
+    optimizeVertexCache(indices, vertexCount, VERTEX_CACHE_SIZE, &clusters);
+    optimizeOverdraw(indices, vertices, stride, clusters);
+    optimizeVertexFetch(vertices, stride, indices);
+
+    VertexCacheStats after = analyzeVertexCache(indices, vertices.size() / stride);
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(3) << "Mesh " << name << ": " << vertices.size() / stride
+        << " vertices, " << indices.size() / 3 << " triangles, ACMR " << before.acmr << " -> " << after.acmr
+        << ", ATVR " << before.atvr << " -> " << after.atvr;
+    std::cout << report.str() << std::endl;
+}
+
+void packIndices(const std::vector<unsigned int>& indices, size_t vertexCount, PackedIndices& packed) {
+    packed.count = (GLsizei)indices.size();
+    if (vertexCount <= 0x10000) {
+        packed.type = GL_UNSIGNED_SHORT;
+        packed.data.resize(indices.size() * sizeof(unsigned short));
+        unsigned short* out = (unsigned short*)packed.data.data();
+        for (size_t i = 0; i < indices.size(); ++i)
+            out[i] = (unsigned short)indices[i];
+    }
+    else {
+        packed.type = GL_UNSIGNED_INT;
+        packed.data.resize(indices.size() * sizeof(unsigned int));
+        std::copy(indices.begin(), indices.end(), (unsigned int*)packed.data.data());
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Triangle and vertex ordering for indexed meshes, after Sander, Nehab and
+// Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw" (Tipsify). Vertices are interleaved floats, `stride` floats
+// each, with the position first.
+
+// Post-transform cache efficiency under a simulated FIFO cache: vertex
+// shader runs per triangle (ACMR, 0.5 is ideal for big regular meshes) and
+// per vertex used (ATVR, 1.0 is ideal).
+struct VertexCacheStats {
+    float acmr;
+    float atvr;
+
+    VertexCacheStats() : acmr(0.0f), atvr(0.0f) {}
+};
+
+const int VERTEX_CACHE_SIZE = 16;
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount,
+    int cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorders triangles to reuse recently transformed vertices. If `clusters`
+// is given it receives the first triangle of each run that started from a
+// dead end (where the cache was effectively flushed).
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE,
+    std::vector<unsigned int>* clusters = nullptr);
+
+// Splits the cache-ordered triangles into smaller clusters where that costs
+// little locality (cluster ACMR within `threshold` of the mesh's) and draws
+// the clusters facing away from the mesh centre first, as they tend to
+// occlude the rest.
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<float>& vertices, int stride,
+    const std::vector<unsigned int>& clusters, int cacheSize = VERTEX_CACHE_SIZE, float threshold = 1.05f);
+
+// Renumbers vertices in the order the indices first use them, so vertex
+// fetches walk memory forwards. Unused vertices are dropped.
+void optimizeVertexFetch(std::vector<float>& vertices, int stride, std::vector<unsigned int>& indices);
+
+// All of the above, logging the cache statistics before and after.
+void optimizeMesh(const char* name, std::vector<float>& vertices, int stride, std::vector<unsigned int>& indices);
+
+// Index data in the narrowest GL type that can address every vertex.
+struct PackedIndices {
+    std::vector<unsigned char> data;
+    GLenum type;
+    GLsizei count;
+
+    PackedIndices() : type(GL_UNSIGNED_INT), count(0) {}
+};
+
+void packIndices(const std::vector<unsigned int>& indices, size_t vertexCount, PackedIndices& packed);
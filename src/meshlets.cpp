@@ -0,0 +1,270 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "scene_depth.h"
+#include "shader_program.h"
+
+static const char* cullComputeShaderSource = R"(
+#version 430 core
+layout (local_size_x = 64) in;
+
+struct Meshlet {
+    vec4 sphere;
+    vec4 cone;
+    uvec4 range;
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 0) readonly buffer Clusters { Meshlet clusters[]; };
+layout (std430, binding = 1) writeonly buffer Commands { DrawCommand commands[]; };
+
+uniform vec4 frustumPlanes[5];
+uniform vec3 cameraPosition;
+uniform uint clusterCount;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= clusterCount)
+        return;
+    Meshlet m = clusters[i];
+
+    bool visible = true;
+    for (int p = 0; p < 5; ++p) {
+        vec4 plane = frustumPlanes[p];
+        if (dot(plane.xyz, m.sphere.xyz) + plane.w < -m.sphere.w * length(plane.xyz))
+            visible = false;
+    }
+    vec3 toCluster = m.sphere.xyz - cameraPosition;
+    if (dot(toCluster, m.cone.xyz) >= m.cone.w * length(toCluster) + m.sphere.w)
+        visible = false;
+
+    commands[i] = DrawCommand(m.range.y, visible ? 1u : 0u, m.range.x, 0, 0u);
+}
+)";
+
+void createMeshletCuller(MeshletCuller& culler, MeshletCulling mode) {
+    culler = MeshletCuller();
+    culler.mode = mode;
+    if (mode != MESHLET_CULLING_GPU)
+        return;
+    if (GLAD_GL_VERSION_4_3)
+        culler.program = buildComputeProgram("meshlet_cull", cullComputeShaderSource);
+    if (!culler.program) {
+        std::cout << "Meshlet culling: no compute shaders, culling on the CPU" << std::endl;
+        culler.mode = MESHLET_CULLING_CPU;
+        return;
+    }
+    culler.planesLoc = glGetUniformLocation(culler.program, "frustumPlanes");
+    culler.cameraLoc = glGetUniformLocation(culler.program, "cameraPosition");
+    culler.countLoc = glGetUniformLocation(culler.program, "clusterCount");
+}
+
+void destroyMeshletCuller(MeshletCuller& culler) {
+    if (culler.mode == MESHLET_CULLING_CPU && culler.submittedTriangles > 0)
+        std::cout << "Meshlet culling drew " << culler.drawnTriangles * 100 / culler.submittedTriangles
+            << "% of triangles" << std::endl;
+    glDeleteProgram(culler.program);
+    culler.program = 0;
+}
+
+// Bounding sphere and normal cone of the triangles in [first, first + count)
+static Meshlet boundMeshlet(const std::vector<float>& vertices, const std::vector<unsigned int>& indices,
+    size_t first, size_t count, float positionError) {
+    Meshlet meshlet = Meshlet();
+    meshlet.firstIndex = (GLuint)first;
+    meshlet.indexCount = (GLuint)count;
+
+    glm::vec3 low = glm::make_vec3(&vertices[indices[first] * 8]), high = low;
+    for (size_t i = first; i < first + count; ++i) {
+        glm::vec3 p = glm::make_vec3(&vertices[indices[i] * 8]);
+        low = glm::min(low, p);
+        high = glm::max(high, p);
+    }
+    glm::vec3 center = (low + high) * 0.5f;
+    float radius = 0.0f;
+    for (size_t i = first; i < first + count; ++i)
+        radius = std::max(radius, glm::length(glm::make_vec3(&vertices[indices[i] * 8]) - center));
+    meshlet.sphere = glm::vec4(center, radius + positionError);
+
+    std::vector<glm::vec3> normals;
+    glm::vec3 sum(0.0f);
+    for (size_t i = first; i < first + count; i += 3) {
+        const float* v[3] = { &vertices[indices[i] * 8], &vertices[indices[i + 1] * 8], &vertices[indices[i + 2] * 8] };
+        glm::vec3 p0 = glm::make_vec3(v[0]);
+        glm::vec3 n = glm::cross(glm::make_vec3(v[1]) - p0, glm::make_vec3(v[2]) - p0);
+        float length = glm::length(n);
+        if (length <= 0.0f)
+            continue;
+        n /= length;
+        // The winding isn't meaningful without face culling; the vertex
+        // normals say which side is out
+        if (glm::dot(n, glm::make_vec3(v[0] + 3) + glm::make_vec3(v[1] + 3) + glm::make_vec3(v[2] + 3)) < 0.0f)
+            n = -n;
+        normals.push_back(n);
+        sum += n;
+    }
+
+    meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 2.0f);
+    if (normals.empty() || glm::length(sum) <= 0.0f)
+        return meshlet;
+    glm::vec3 axis = glm::normalize(sum);
+    float minDot = 1.0f;
+    for (const auto& n : normals)
+        minDot = std::min(minDot, glm::dot(n, axis));
+    // Normals lie within acos(minDot) of the axis; beyond 90 degrees some
+    // triangle always faces the camera
+    if (minDot > 0.0f)
+        meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+    return meshlet;
+}
+
+void createMeshlets(Meshlets& meshlets, const Mesh& mesh, const std::vector<float>& vertices,
+    const std::vector<unsigned int>& indices, const MeshletCuller& culler) {
+    meshlets = Meshlets();
+    if (culler.mode == MESHLET_CULLING_OFF || indices.empty())
+        return;
+
+    // Quantized positions (vertex_format.h) are off by up to half a step
+    float positionError = glm::length(mesh.bounds.halfExtent) / 32767.0f;
+
+    // Greedy scan over the triangles in cache order, which already keeps
+    // neighbours together
+    std::vector<int> lastMeshlet(vertices.size() / 8, -1);
+    size_t first = 0;
+    int vertexCount = 0;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        int current = (int)meshlets.clusters.size();
+        int added = 0;
+        for (int k = 0; k < 3; ++k)
+            added += lastMeshlet[indices[i + k]] != current ? 1 : 0;
+        if (vertexCount + added > MESHLET_MAX_VERTICES || (i - first) / 3 + 1 > (size_t)MESHLET_MAX_TRIANGLES) {
+            meshlets.clusters.push_back(boundMeshlet(vertices, indices, first, i - first, positionError));
+            first = i;
+            vertexCount = 0;
+            ++current;
+        }
+        for (int k = 0; k < 3; ++k) {
+            if (lastMeshlet[indices[i + k]] != current) {
+                lastMeshlet[indices[i + k]] = current;
+                ++vertexCount;
+            }
+        }
+    }
+    meshlets.clusters.push_back(boundMeshlet(vertices, indices, first, indices.size() - first, positionError));
+    std::cout << "Meshlets: " << meshlets.clusters.size() << " clusters, culled on the "
+        << (culler.mode == MESHLET_CULLING_GPU ? "GPU" : "CPU") << std::endl;
+
+    if (culler.mode == MESHLET_CULLING_GPU) {
+        glGenBuffers(1, &meshlets.clusterBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshlets.clusterBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, meshlets.clusters.size() * sizeof(Meshlet), meshlets.clusters.data(),
+            GL_STATIC_DRAW);
+        glGenBuffers(1, &meshlets.commandBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshlets.commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, meshlets.clusters.size() * 5 * sizeof(GLuint), nullptr,
+            GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+}
+
+void destroyMeshlets(Meshlets& meshlets) {
+    glDeleteBuffers(1, &meshlets.clusterBuffer);
+    glDeleteBuffers(1, &meshlets.commandBuffer);
+    meshlets.clusterBuffer = meshlets.commandBuffer = 0;
+    meshlets.clusters.clear();
+}
+
+static bool meshletVisible(const Meshlet& meshlet, const glm::vec4 planes[5], const glm::vec3& camera) {
+    glm::vec3 center(meshlet.sphere);
+    for (int p = 0; p < 5; ++p) {
+        if (glm::dot(glm::vec3(planes[p]), center) + planes[p].w < -meshlet.sphere.w * glm::length(glm::vec3(planes[p])))
+            return false;
+    }
+    glm::vec3 toCluster = center - camera;
+    return glm::dot(toCluster, glm::vec3(meshlet.cone)) < meshlet.cone.w * glm::length(toCluster) + meshlet.sphere.w;
+}
+
+void drawMeshlets(MeshletCuller& culler, const Mesh& mesh, Meshlets& meshlets, GLuint program,
+    const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec3& cameraPos) {
+    if (culler.mode == MESHLET_CULLING_OFF || meshlets.clusters.empty()) {
+        drawMesh(mesh, program);
+        return;
+    }
+
+    // Everything in mesh space: frustum planes of the full transform and the
+    // camera brought back through the model matrix
+    glm::mat4 m = glm::transpose(viewProjection * model);
+    const glm::vec4 planes[5] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], frustumNearPlane(m) };
+    glm::vec3 camera = glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f));
+
+    if (culler.mode == MESHLET_CULLING_GPU) {
+        glUseProgram(culler.program);
+        glUniform4fv(culler.planesLoc, 5, glm::value_ptr(planes[0]));
+        glUniform3fv(culler.cameraLoc, 1, glm::value_ptr(camera));
+        glUniform1ui(culler.countLoc, (GLuint)meshlets.clusters.size());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, meshlets.clusterBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, meshlets.commandBuffer);
+        glDispatchCompute(((GLuint)meshlets.clusters.size() + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+        glUseProgram(program);
+        setMeshBounds(program, mesh.bounds);
+        glBindVertexArray(mesh.VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, meshlets.commandBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, mesh.indexType, nullptr, (GLsizei)meshlets.clusters.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return;
+    }
+
+    // Visible clusters next to each other in the index buffer merge into one
+    // range
+    size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    meshlets.drawCount.clear();
+    meshlets.drawOffset.clear();
+    GLuint rangeEnd = 0;
+    for (const auto& meshlet : meshlets.clusters) {
+        culler.submittedTriangles += meshlet.indexCount / 3;
+        if (!meshletVisible(meshlet, planes, camera))
+            continue;
+        culler.drawnTriangles += meshlet.indexCount / 3;
+        if (!meshlets.drawCount.empty() && rangeEnd == meshlet.firstIndex) {
+            meshlets.drawCount.back() += meshlet.indexCount;
+        }
+        else {
+            meshlets.drawCount.push_back(meshlet.indexCount);
+            meshlets.drawOffset.push_back((const void*)(meshlet.firstIndex * indexSize));
+        }
+        rangeEnd = meshlet.firstIndex + meshlet.indexCount;
+    }
+    if (meshlets.drawCount.empty())
+        return;
+
+    setMeshBounds(program, mesh.bounds);
+    glBindVertexArray(mesh.VAO);
+    glMultiDrawElements(GL_TRIANGLES, meshlets.drawCount.data(), mesh.indexType, meshlets.drawOffset.data(),
+        (GLsizei)meshlets.drawCount.size());
+}
+
+bool parseMeshletCulling(const std::string& text, MeshletCulling& mode) {
+    if (text == "off")
+        mode = MESHLET_CULLING_OFF;
+    else if (text == "cpu")
+        mode = MESHLET_CULLING_CPU;
+    else if (text == "gpu")
+        mode = MESHLET_CULLING_GPU;
+    else
+        return false;
+    return true;
+}
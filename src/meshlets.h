@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+// Meshlets: a mesh's triangles split into small clusters, each with a
+// bounding sphere and a cone bounding its triangle normals, so clusters that
+// are off screen or face entirely away from the camera can be skipped
+// before rasterization.
+//
+// Clusters are runs of the mesh's own (cache-optimized) index buffer, so
+// culling only picks ranges to draw and needs no extra geometry. The limits
+// match what mesh shader hardware likes; here they keep the bounds tight.
+const int MESHLET_MAX_VERTICES = 64;
+const int MESHLET_MAX_TRIANGLES = 124;
+
+enum MeshletCulling { MESHLET_CULLING_OFF, MESHLET_CULLING_CPU, MESHLET_CULLING_GPU };
+
+// std430 layout, shared with the culling compute shader.
+struct Meshlet {
+    glm::vec4 sphere; // centre, radius (mesh space)
+    glm::vec4 cone;   // normal axis, sine of the half-angle (2 if it can't be culled)
+    GLuint firstIndex;
+    GLuint indexCount;
+    GLuint padding[2];
+};
+
+struct Meshlets {
+    std::vector<Meshlet> clusters;
+    std::vector<GLsizei> drawCount; // CPU culling: visible ranges
+    std::vector<const void*> drawOffset;
+
+    GLuint clusterBuffer; // GPU culling: clusters in, draw commands out
+    GLuint commandBuffer;
+
+    Meshlets() : clusterBuffer(0), commandBuffer(0) {}
+};
+
+// How culling runs. GPU culling writes one indirect draw command per cluster
+// from a compute shader and needs GL 4.3; without it the CPU tests the
+// clusters and draws the visible runs with glMultiDrawElements.
+struct MeshletCuller {
+    MeshletCulling mode;
+    GLuint program;
+    GLint planesLoc;
+    GLint cameraLoc;
+    GLint countLoc;
+    long long submittedTriangles; // CPU culling only
+    long long drawnTriangles;
+
+    MeshletCuller()
+        : mode(MESHLET_CULLING_OFF), program(0), planesLoc(-1), cameraLoc(-1), countLoc(-1), submittedTriangles(0),
+        drawnTriangles(0) {}
+};
+
+// Falls back from GPU to CPU culling when compute shaders are unavailable.
+void createMeshletCuller(MeshletCuller& culler, MeshletCulling mode);
+void destroyMeshletCuller(MeshletCuller& culler);
+
+// Splits the triangles of `mesh`, given the vertices and indices createMesh
+// left behind (8 floats per vertex). Facing comes from the vertex normals, as
+// meshes are drawn without face culling; only use it on closed meshes.
+void createMeshlets(Meshlets& meshlets, const Mesh& mesh, const std::vector<float>& vertices,
+    const std::vector<unsigned int>& indices, const MeshletCuller& culler);
+void destroyMeshlets(Meshlets& meshlets);
+
+// drawMesh with the clusters outside the frustum (side and near planes) or
+// facing away from `cameraPos` skipped. `program` must be current; the model
+// matrix may rotate, translate and scale uniformly.
+void drawMeshlets(MeshletCuller& culler, const Mesh& mesh, Meshlets& meshlets, GLuint program,
+    const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec3& cameraPos);
+
+bool parseMeshletCulling(const std::string& text, MeshletCulling& mode);
@@ -0,0 +1,166 @@
+#include "orbit_lines.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#include <glm/gtc/constants.hpp>
+
+#include "scene_depth.h"
+#include "trace.h"
+
+// Perifocal basis: P towards periapsis, Q 90 degrees ahead in the direction
+// of motion. The standard formulas are for a Z-up ecliptic; the scene is Y-up
+// with prograde orbits turning from +X towards -Z, so (x, y, z) -> (x, z, -y).
+static void perifocalBasis(const OrbitElements& orbit, glm::vec3& p, glm::vec3& q) {
+    float cosNode = std::cos(orbit.ascendingNode), sinNode = std::sin(orbit.ascendingNode);
+    float cosPeri = std::cos(orbit.argumentOfPeriapsis), sinPeri = std::sin(orbit.argumentOfPeriapsis);
+    float cosIncl = std::cos(orbit.inclination), sinIncl = std::sin(orbit.inclination);
+    glm::vec3 eclipticP(cosNode * cosPeri - sinNode * sinPeri * cosIncl,
+        sinNode * cosPeri + cosNode * sinPeri * cosIncl,
+        sinPeri * sinIncl);
+    glm::vec3 eclipticQ(-cosNode * sinPeri - sinNode * cosPeri * cosIncl,
+        -sinNode * sinPeri + cosNode * cosPeri * cosIncl,
+        cosPeri * sinIncl);
+    p = glm::vec3(eclipticP.x, eclipticP.z, -eclipticP.y);
+    q = glm::vec3(eclipticQ.x, eclipticQ.z, -eclipticQ.y);
+}
+
+void createOrbitLines(OrbitLines& lines, const std::vector<OrbitElements>& orbits) {
+    for (auto& axis : lines.axes)
+        axis.clear();
+    // gl_VertexID has to fit in an int
+    size_t count = std::min(orbits.size(), (size_t)(INT_MAX / ORBIT_STRIDE));
+    if (count < orbits.size())
+        std::cerr << "WARNING: Only the first " << count << " of " << orbits.size() << " orbits are drawn" << std::endl;
+    std::vector<glm::vec4> texels;
+    texels.reserve(count * 4);
+    for (size_t index = 0; index < count; ++index) {
+        const OrbitElements& orbit = orbits[index];
+        glm::vec3 p, q;
+        perifocalBasis(orbit, p, q);
+        float a = orbit.semiMajorAxis;
+        float e = std::min(std::max(orbit.eccentricity, 0.0f), 0.99f);
+        float b = a * std::sqrt(1.0f - e * e);
+        // Focus at the origin: the ellipse centre sits a*e behind it
+        lines.axes[0].push_back(glm::vec4(p * a, a));
+        lines.axes[1].push_back(glm::vec4(q * b, b));
+        lines.axes[2].push_back(glm::vec4(-p * a * e, 0.0f));
+        for (int i = 0; i < 3; ++i)
+            texels.push_back(lines.axes[i].back());
+        texels.push_back(glm::vec4(orbit.color, 1.0f));
+    }
+    lines.segments.assign(count, ORBIT_MIN_SEGMENTS);
+
+    glGenBuffers(1, &lines.elementsBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, lines.elementsBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(glm::vec4), texels.data(), GL_STATIC_DRAW);
+    glGenTextures(1, &lines.elementsTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, lines.elementsTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lines.elementsBuffer);
+
+    glGenBuffers(1, &lines.segmentsBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, lines.segmentsBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, lines.segments.size() * sizeof(int), lines.segments.data(), GL_DYNAMIC_DRAW);
+    glGenTextures(1, &lines.segmentsTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, lines.segmentsTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, lines.segmentsBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    // Core profile draws need a VAO even with no attributes
+    glGenVertexArrays(1, &lines.VAO);
+}
+
+void destroyOrbitLines(OrbitLines& lines) {
+    glDeleteTextures(1, &lines.elementsTexture);
+    glDeleteTextures(1, &lines.segmentsTexture);
+    glDeleteBuffers(1, &lines.elementsBuffer);
+    glDeleteBuffers(1, &lines.segmentsBuffer);
+    glDeleteVertexArrays(1, &lines.VAO);
+    lines.elementsTexture = lines.segmentsTexture = lines.elementsBuffer = lines.segmentsBuffer = lines.VAO = 0;
+    for (auto& axis : lines.axes)
+        axis.clear();
+    lines.segments.clear();
+}
+
+// Side and near planes, like the star chunks
+static bool sphereInFrustum(const glm::vec3& center, float radius, const glm::mat4& viewProjection) {
+    glm::mat4 m = glm::transpose(viewProjection);
+    const glm::vec4 planes[5] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], frustumNearPlane(m) };
+    for (const auto& plane : planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius * glm::length(glm::vec3(plane)))
+            return false;
+    }
+    return true;
+}
+
+void updateOrbitLines(OrbitLines& lines, const glm::vec3& cameraPos, const glm::mat4& viewProjection,
+    float pixelsPerUnit) {
+    TRACE_SCOPE("update orbit lines");
+    lines.drawFirst.clear();
+    lines.drawCount.clear();
+    lines.drawnVertices = 0;
+    for (int i = 0; i < (int)lines.segments.size(); ++i) {
+        glm::vec3 major(lines.axes[0][i]), minor(lines.axes[1][i]), center(lines.axes[2][i]);
+        float a = lines.axes[0][i].w, b = lines.axes[1][i].w;
+        if (!sphereInFrustum(center, a, viewProjection))
+            continue;
+
+        // Distance to the nearest point of the orbit, treating it as an
+        // annulus between the semi-axes in its plane
+        glm::vec3 normal = glm::normalize(glm::cross(major, minor));
+        glm::vec3 offset = cameraPos - center;
+        float height = glm::dot(offset, normal);
+        float inPlane = glm::length(offset - normal * height);
+        float across = std::max(std::max(b - inPlane, inPlane - a), 0.0f);
+        float distance = std::max(std::sqrt(across * across + height * height), 1e-3f);
+
+        // A chord over 2*pi/n of a circle of radius a misses the arc by
+        // a * (pi/n)^2 / 2
+        float radiusPixels = a * pixelsPerUnit / distance;
+        float needed = glm::pi<float>() * std::sqrt(radiusPixels / (2.0f * lines.maxErrorPixels));
+        int segments = ORBIT_MIN_SEGMENTS;
+        while (segments < needed && segments < ORBIT_MAX_SEGMENTS)
+            segments *= 2;
+        lines.segments[i] = segments;
+
+        lines.drawFirst.push_back(i * ORBIT_STRIDE);
+        lines.drawCount.push_back(segments * LINE_VERTICES_PER_SEGMENT);
+        lines.drawnVertices += segments * LINE_VERTICES_PER_SEGMENT;
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, lines.segmentsBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, lines.segments.size() * sizeof(int), lines.segments.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void drawOrbitLines(const OrbitLines& lines, GLuint program) {
+    if (lines.drawFirst.empty())
+        return;
+    glUniform1i(glGetUniformLocation(program, "orbitElements"), 0);
+    glUniform1i(glGetUniformLocation(program, "orbitSegments"), 1);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, lines.elementsTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, lines.segmentsTexture);
+    glBindVertexArray(lines.VAO);
+    glMultiDrawArrays(GL_TRIANGLES, lines.drawFirst.data(), lines.drawCount.data(), (GLsizei)lines.drawFirst.size());
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void generateMinorBodyOrbits(std::vector<OrbitElements>& orbits, int count, float innerRadius, float outerRadius,
+    unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const float twoPi = glm::two_pi<float>();
+    for (int i = 0; i < count; ++i) {
+        float a = innerRadius + (outerRadius - innerRadius) * unit(rng);
+        // Mostly near-circular and close to the ecliptic
+        float e = 0.3f * unit(rng) * unit(rng);
+        float inclination = glm::radians(25.0f) * unit(rng) * unit(rng);
+        orbits.push_back(OrbitElements(a, e, inclination, twoPi * unit(rng), twoPi * unit(rng), glm::vec3(0.06f)));
+    }
+}
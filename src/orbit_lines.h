@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "wide_lines.h"
+
+// Keplerian orbit shape. Angles in radians, relative to the XZ plane (+Y is
+// ecliptic north) with the reference direction along +X.
+struct OrbitElements {
+    float semiMajorAxis;
+    float eccentricity;
+    float inclination;
+    float ascendingNode;       // longitude of the ascending node
+    float argumentOfPeriapsis;
+    glm::vec3 color;
+
+    OrbitElements(float a, float e = 0.0f, float i = 0.0f, float node = 0.0f, float periapsis = 0.0f,
+        const glm::vec3& c = glm::vec3(1.0f))
+        : semiMajorAxis(a), eccentricity(e), inclination(i), ascendingNode(node), argumentOfPeriapsis(periapsis), color(c) {}
+};
+
+const int ORBIT_MIN_SEGMENTS = 16;
+const int ORBIT_MAX_SEGMENTS = 4096;
+// Vertex IDs reserved per orbit: orbit i starts at i * ORBIT_STRIDE
+const int ORBIT_STRIDE = ORBIT_MAX_SEGMENTS * LINE_VERTICES_PER_SEGMENT;
+
+// All orbit paths in one draw, with no vertex buffers.
+//
+// Each orbit is four texels of a texture buffer: the ellipse's two semi-axis
+// vectors, its centre and its colour. The vertex shader turns gl_VertexID
+// into (orbit, segment, corner), evaluates the ellipse at the eccentric
+// anomalies it needs and hands them to the wide line code (wide_lines.h).
+// Every frame each orbit gets a power-of-two segment count, just enough to
+// keep the chord error under maxErrorPixels where it passes closest to the
+// camera. Orbits outside the frustum get none. The counts go to a second
+// texture buffer and everything is drawn with one glMultiDrawArrays.
+// Powers of two keep earlier vertices in place when the count
+// changes, so refining doesn't shimmer.
+struct OrbitLines {
+    float maxErrorPixels;
+    std::vector<glm::vec4> axes[3]; // semi-major vector, semi-minor vector, centre (w: semi-axis length)
+    std::vector<int> segments;
+    std::vector<GLint> drawFirst;
+    std::vector<GLsizei> drawCount;
+    int drawnVertices;
+
+    GLuint elementsBuffer;
+    GLuint elementsTexture; // RGBA32F, 4 texels per orbit
+    GLuint segmentsBuffer;
+    GLuint segmentsTexture; // R32I, 1 texel per orbit
+    GLuint VAO;
+
+    OrbitLines()
+        : maxErrorPixels(0.5f), drawnVertices(0), elementsBuffer(0), elementsTexture(0), segmentsBuffer(0),
+        segmentsTexture(0), VAO(0) {}
+};
+
+void createOrbitLines(OrbitLines& lines, const std::vector<OrbitElements>& orbits);
+void destroyOrbitLines(OrbitLines& lines);
+
+// Picks segment counts for this camera and builds the draw list.
+void updateOrbitLines(OrbitLines& lines, const glm::vec3& cameraPos, const glm::mat4& viewProjection,
+    float pixelsPerUnit);
+
+// Binds the elements and segment counts on texture units 0 and 1 and draws
+// with `program`, which samples them as `orbitElements` and `orbitSegments`
+// (see the orbit effect).
+void drawOrbitLines(const OrbitLines& lines, GLuint program);
+
+// Random main-belt-like orbits between `innerRadius` and `outerRadius`.
+void generateMinorBodyOrbits(std::vector<OrbitElements>& orbits, int count, float innerRadius, float outerRadius,
+    unsigned seed);
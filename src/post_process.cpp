@@ -0,0 +1,396 @@
+#include "post_process.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "scene_depth.h"
+#include "shader_program.h"
+#include "trace.h"
+
+// Fullscreen triangle from gl_VertexID, drawn with glDrawArrays(GL_TRIANGLES, 0, 3)
+const char* fullscreenVertexShaderSource = R"(
+#version 330 core
+out vec2 TexCoords;
+void main() {
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    TexCoords = pos;
+    gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+// Dual-filter downsample: centre plus four diagonal taps half a source texel
+// out, each bilinear, so 5 fetches cover a 4x4 footprint. With PREFILTER the
+// first pass also keeps only what is above the bloom threshold (soft knee).
+static const char* downsampleFragmentShaderSource = R"(
+#version 330 core
+in vec2 TexCoords;
+out vec4 FragColor;
+uniform sampler2D source;
+uniform vec2 halfTexel;
+uniform float threshold;
+// Maps the output to the rendered region of the source and keeps bilinear
+// taps from reading outside it
+uniform vec2 uvScale;
+uniform vec2 uvMax;
+
+vec3 prefilter(vec3 c) {
+#ifdef PREFILTER
+    float knee = threshold * 0.5;
+    float brightness = max(c.r, max(c.g, c.b));
+    float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+    soft = soft * soft / (4.0 * knee + 1e-4);
+    return c * max(soft, brightness - threshold) / max(brightness, 1e-4);
+#else
+    return c;
+#endif
+}
+
+vec3 tap(vec2 uv) {
+    return prefilter(texture(source, min(uv, uvMax)).rgb);
+}
+
+void main() {
+    vec2 uv = TexCoords * uvScale;
+    vec3 sum = tap(uv) * 4.0;
+    sum += tap(uv - halfTexel);
+    sum += tap(uv + halfTexel);
+    sum += tap(uv + vec2(halfTexel.x, -halfTexel.y));
+    sum += tap(uv - vec2(halfTexel.x, -halfTexel.y));
+    FragColor = vec4(sum / 8.0, 1.0);
+}
+)";
+
+// Dual-filter upsample: 8 bilinear taps in a tent around the pixel. Added on
+// top of the next larger level with additive blending.
+static const char* upsampleFragmentShaderSource = R"(
+#version 330 core
+in vec2 TexCoords;
+out vec4 FragColor;
+uniform sampler2D source;
+uniform vec2 halfTexel;
+
+void main() {
+    vec2 h = halfTexel;
+    vec3 sum = texture(source, TexCoords + vec2(-h.x * 2.0, 0.0)).rgb;
+    sum += texture(source, TexCoords + vec2(-h.x, h.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2(0.0, h.y * 2.0)).rgb;
+    sum += texture(source, TexCoords + vec2(h.x, h.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2(h.x * 2.0, 0.0)).rgb;
+    sum += texture(source, TexCoords + vec2(h.x, -h.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2(0.0, -h.y * 2.0)).rgb;
+    sum += texture(source, TexCoords + vec2(-h.x, -h.y)).rgb * 2.0;
+    FragColor = vec4(sum / 12.0, 1.0);
+}
+)";
+
+// Upsamples the rendered region, adds bloom, applies exposure and tone maps.
+// When rendering below native resolution a contrast-limited sharpen (clamped
+// to the neighbourhood so it can't ring) restores some of the lost detail.
+// The curve is the identity up to SHOULDER and rolls off smoothly towards 1
+// above it, so ordinary lit surfaces look as they did in LDR and only
+// highlights are compressed.
+static const char* resolveFragmentShaderSource = R"(
+#version 330 core
+in vec2 TexCoords;
+out vec4 FragColor;
+uniform sampler2D scene;
+uniform sampler2D bloom;
+uniform float bloomIntensity;
+uniform float exposure;
+uniform vec2 uvScale;
+uniform vec2 uvMax;
+uniform vec2 texelSize;
+uniform float sharpness;
+
+#define SHOULDER 0.8
+
+vec3 tonemap(vec3 c) {
+    vec3 over = max(c - SHOULDER, 0.0);
+    return min(c, vec3(SHOULDER)) + over * (1.0 - SHOULDER) / (over + (1.0 - SHOULDER));
+}
+
+void main() {
+    vec2 uv = min(TexCoords * uvScale, uvMax);
+    vec3 color = texture(scene, uv).rgb;
+    if (sharpness > 0.0) {
+        vec3 n = texture(scene, min(uv + vec2(0.0, texelSize.y), uvMax)).rgb;
+        vec3 s = texture(scene, uv - vec2(0.0, texelSize.y)).rgb;
+        vec3 e = texture(scene, min(uv + vec2(texelSize.x, 0.0), uvMax)).rgb;
+        vec3 w = texture(scene, uv - vec2(texelSize.x, 0.0)).rgb;
+        vec3 lo = min(color, min(min(n, s), min(e, w)));
+        vec3 hi = max(color, max(max(n, s), max(e, w)));
+        color = clamp(color + (4.0 * color - n - s - e - w) * sharpness, lo, hi);
+    }
+#ifdef BLOOM
+    color += texture(bloom, TexCoords).rgb * bloomIntensity;
+#endif
+    color = tonemap(color * exposure);
+#ifdef SRGB_OUTPUT
+    color = mix(1.055 * pow(color, vec3(1.0/2.4)) - 0.055, color * 12.92, step(color, vec3(0.0031308)));
+#endif
+    FragColor = vec4(color, 1.0);
+}
+)";
+
+static int bloomLevelCount(BloomQuality quality) {
+    switch (quality) {
+    case BLOOM_LOW: return 3;
+    case BLOOM_MEDIUM: return 5;
+    case BLOOM_HIGH: return 7;
+    default: return 0;
+    }
+}
+
+static GLuint createColorTexture(int width, int height) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+static void destroyTargets(PostProcess& post) {
+    glDeleteFramebuffers(1, &post.sceneFBO);
+    glDeleteTextures(1, &post.sceneColor);
+    glDeleteTextures(1, &post.sceneVelocity);
+    glDeleteRenderbuffers(1, &post.sceneDepth);
+    post.sceneFBO = post.sceneColor = post.sceneVelocity = post.sceneDepth = 0;
+    for (auto& level : post.bloomLevels) {
+        glDeleteFramebuffers(1, &level.fbo);
+        glDeleteTextures(1, &level.texture);
+    }
+    post.bloomLevels.clear();
+}
+
+static bool createTargets(PostProcess& post, bool velocityBuffer) {
+    post.sceneColor = createColorTexture(post.width, post.height);
+    glGenRenderbuffers(1, &post.sceneDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, post.sceneDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, SCENE_DEPTH_FORMAT, post.width, post.height);
+
+    glGenFramebuffers(1, &post.sceneFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, post.sceneFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, post.sceneColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, post.sceneDepth);
+    if (velocityBuffer) {
+        glGenTextures(1, &post.sceneVelocity);
+        glBindTexture(GL_TEXTURE_2D, post.sceneVelocity);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, post.width, post.height, 0, GL_RG, GL_HALF_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, post.sceneVelocity, 0);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+    }
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // The chain starts at half resolution; stop before a level gets degenerate
+    int width = post.width, height = post.height;
+    for (int i = 0; i < bloomLevelCount(post.quality); ++i) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        if (i > 0 && (width < 2 || height < 2))
+            break;
+        BloomLevel level;
+        level.width = width;
+        level.height = height;
+        level.texture = createColorTexture(width, height);
+        glGenFramebuffers(1, &level.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level.texture, 0);
+        complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        post.bloomLevels.push_back(level);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (!complete)
+        std::cerr << "ERROR: HDR framebuffer is incomplete" << std::endl;
+    return complete;
+}
+
+bool createPostProcess(PostProcess& post, int width, int height, BloomQuality quality, bool encodeSrgb,
+    bool velocityBuffer) {
+    TRACE_SCOPE("createPostProcess");
+    post.width = width;
+    post.height = height;
+    post.quality = quality;
+
+    std::string resolveDefines;
+    if (quality != BLOOM_OFF)
+        resolveDefines += "#define BLOOM 1\n";
+    if (encodeSrgb)
+        resolveDefines += "#define SRGB_OUTPUT 1\n";
+    post.resolveProgram = buildProgram("post_resolve", fullscreenVertexShaderSource, resolveFragmentShaderSource,
+        resolveDefines);
+    glUseProgram(post.resolveProgram);
+    glUniform1i(glGetUniformLocation(post.resolveProgram, "scene"), 0);
+    glUniform1i(glGetUniformLocation(post.resolveProgram, "bloom"), 1);
+
+    if (quality != BLOOM_OFF) {
+        post.prefilterProgram = buildProgram("bloom_prefilter", fullscreenVertexShaderSource,
+            downsampleFragmentShaderSource, "#define PREFILTER 1\n");
+        post.downsampleProgram = buildProgram("bloom_downsample", fullscreenVertexShaderSource,
+            downsampleFragmentShaderSource);
+        post.upsampleProgram = buildProgram("bloom_upsample", fullscreenVertexShaderSource,
+            upsampleFragmentShaderSource);
+    }
+
+    glGenVertexArrays(1, &post.emptyVAO);
+    return createTargets(post, velocityBuffer);
+}
+
+void destroyPostProcess(PostProcess& post) {
+    destroyTargets(post);
+    glDeleteProgram(post.prefilterProgram);
+    glDeleteProgram(post.downsampleProgram);
+    glDeleteProgram(post.upsampleProgram);
+    glDeleteProgram(post.resolveProgram);
+    glDeleteVertexArrays(1, &post.emptyVAO);
+    post.prefilterProgram = post.downsampleProgram = post.upsampleProgram = post.resolveProgram = post.emptyVAO = 0;
+}
+
+void resizePostProcess(PostProcess& post, int width, int height) {
+    if (width == post.width && height == post.height)
+        return;
+    if (width <= 0 || height <= 0)
+        return; // minimised
+    post.width = width;
+    post.height = height;
+    bool velocityBuffer = post.sceneVelocity != 0;
+    destroyTargets(post);
+    createTargets(post, velocityBuffer);
+}
+
+void beginPostProcess(PostProcess& post) {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &post.outputFBO);
+    glGetIntegerv(GL_VIEWPORT, post.outputViewport);
+    float scale = std::max(0.1f, std::min(1.0f, post.renderScale));
+    post.renderWidth = std::max(1, (int)(post.width * scale + 0.5f));
+    post.renderHeight = std::max(1, (int)(post.height * scale + 0.5f));
+    post.resolvedColor = 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, post.sceneFBO);
+    glViewport(0, 0, post.renderWidth, post.renderHeight);
+}
+
+void setPostProcessInput(PostProcess& post, GLuint texture) {
+    post.resolvedColor = texture;
+}
+
+static GLuint colorInput(const PostProcess& post) {
+    return post.resolvedColor ? post.resolvedColor : post.sceneColor;
+}
+
+// UV scale and clamp for reading the rendered region of the colour input
+static void setRegionUniforms(const PostProcess& post, GLuint program) {
+    int regionWidth = post.resolvedColor ? post.width : post.renderWidth;
+    int regionHeight = post.resolvedColor ? post.height : post.renderHeight;
+    glUniform2f(glGetUniformLocation(program, "uvScale"),
+        (float)regionWidth / post.width, (float)regionHeight / post.height);
+    glUniform2f(glGetUniformLocation(program, "uvMax"),
+        (regionWidth - 0.5f) / post.width, (regionHeight - 0.5f) / post.height);
+}
+
+static void drawFullscreen(PostProcess& post) {
+    glBindVertexArray(post.emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void applyBloom(PostProcess& post) {
+    if (post.bloomLevels.empty())
+        return;
+    TRACE_SCOPE("bloom");
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Down: scene -> level 0 (prefiltered) -> level 1 -> ...
+    int sourceWidth = post.width, sourceHeight = post.height;
+    GLuint source = colorInput(post);
+    for (size_t i = 0; i < post.bloomLevels.size(); ++i) {
+        BloomLevel& level = post.bloomLevels[i];
+        GLuint program = i == 0 ? post.prefilterProgram : post.downsampleProgram;
+        glUseProgram(program);
+        glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+        glViewport(0, 0, level.width, level.height);
+        glBindTexture(GL_TEXTURE_2D, source);
+        glUniform2f(glGetUniformLocation(program, "halfTexel"), 0.5f / sourceWidth, 0.5f / sourceHeight);
+        if (i == 0) {
+            glUniform1f(glGetUniformLocation(program, "threshold"), post.bloomThreshold);
+            setRegionUniforms(post, program);
+        }
+        else {
+            glUniform2f(glGetUniformLocation(program, "uvScale"), 1.0f, 1.0f);
+            glUniform2f(glGetUniformLocation(program, "uvMax"), 1.0f, 1.0f);
+        }
+        drawFullscreen(post);
+        source = level.texture;
+        sourceWidth = level.width;
+        sourceHeight = level.height;
+    }
+
+    // Up: each level is blurred into the next larger one, added on top
+    glUseProgram(post.upsampleProgram);
+    GLint halfTexelLoc = glGetUniformLocation(post.upsampleProgram, "halfTexel");
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (size_t i = post.bloomLevels.size() - 1; i > 0; --i) {
+        BloomLevel& from = post.bloomLevels[i];
+        BloomLevel& to = post.bloomLevels[i - 1];
+        glBindFramebuffer(GL_FRAMEBUFFER, to.fbo);
+        glViewport(0, 0, to.width, to.height);
+        glBindTexture(GL_TEXTURE_2D, from.texture);
+        glUniform2f(halfTexelLoc, 0.5f / from.width, 0.5f / from.height);
+        drawFullscreen(post);
+    }
+    glDisable(GL_BLEND);
+
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+}
+
+void resolvePostProcess(PostProcess& post) {
+    TRACE_SCOPE("tonemap");
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)post.outputFBO);
+    glViewport(post.outputViewport[0], post.outputViewport[1], post.outputViewport[2], post.outputViewport[3]);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(post.resolveProgram);
+    // Each level holds itself plus everything smaller, so normalise by count
+    float intensity = post.bloomLevels.empty() ? 0.0f : post.bloomIntensity / post.bloomLevels.size();
+    glUniform1f(glGetUniformLocation(post.resolveProgram, "bloomIntensity"), intensity);
+    glUniform1f(glGetUniformLocation(post.resolveProgram, "exposure"), post.exposure);
+    setRegionUniforms(post, post.resolveProgram);
+    glUniform2f(glGetUniformLocation(post.resolveProgram, "texelSize"), 1.0f / post.width, 1.0f / post.height);
+    float upscale = 1.0f - (float)post.renderWidth / post.width;
+    glUniform1f(glGetUniformLocation(post.resolveProgram, "sharpness"), post.sharpness * std::min(1.0f, upscale * 2.0f));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, colorInput(post));
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, post.bloomLevels.empty() ? 0 : post.bloomLevels[0].texture);
+    glActiveTexture(GL_TEXTURE0);
+    drawFullscreen(post);
+
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+}
+
+bool parseBloomQuality(const std::string& text, BloomQuality& quality) {
+    if (text == "off")
+        quality = BLOOM_OFF;
+    else if (text == "low")
+        quality = BLOOM_LOW;
+    else if (text == "medium")
+        quality = BLOOM_MEDIUM;
+    else if (text == "high")
+        quality = BLOOM_HIGH;
+    else
+        return false;
+    return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Bloom cost/quality trade-off. Levels are successive half-resolution mips of
+// the dual-filter chain; more levels give a wider glare.
+enum BloomQuality { BLOOM_OFF, BLOOM_LOW, BLOOM_MEDIUM, BLOOM_HIGH };
+
+struct BloomLevel {
+    int width;
+    int height;
+    GLuint texture;
+    GLuint fbo;
+
+    BloomLevel() : width(0), height(0), texture(0), fbo(0) {}
+};
+
+// HDR scene target plus the bloom chain and tone-mapping resolve.
+//
+// The scene is drawn in linear light into an RGBA16F texture. Bloom takes
+// the bright parts through a Kawase-style dual-filter chain (each downsample
+// and upsample is a single pass of 5 or 8 bilinear taps), starting at half
+// resolution or lower, so its cost stays a small fraction of the frame. The
+// resolve pass adds the bloom, tone maps and writes to whatever framebuffer
+// was bound when beginPostProcess was called.
+//
+// With a renderScale below 1 the scene only covers the bottom-left
+// renderWidth x renderHeight part of the target (no reallocation when the
+// scale changes). The bloom prefilter and the resolve read just that region,
+// and the resolve upsamples it to the output with a sharpening filter.
+struct PostProcess {
+    int width;
+    int height;
+    float renderScale;
+    int renderWidth;
+    int renderHeight;
+    float sharpness; // applied in proportion to how far below 1 the scale is
+    BloomQuality quality;
+    float bloomThreshold; // linear luminance where glare starts
+    float bloomIntensity;
+    float exposure;
+
+    GLuint sceneFBO;
+    GLuint sceneColor;    // RGBA16F texture
+    GLuint sceneVelocity; // RG16F screen-space motion, attachment 1 (0 if unused)
+    GLuint sceneDepth;    // renderbuffer
+    GLuint resolvedColor; // full-resolution replacement for the scene region, see setPostProcessInput
+    std::vector<BloomLevel> bloomLevels;
+
+    GLuint prefilterProgram; // first downsample, with the threshold
+    GLuint downsampleProgram;
+    GLuint upsampleProgram;
+    GLuint resolveProgram;
+    GLuint emptyVAO; // fullscreen triangles are generated from gl_VertexID
+
+    GLint outputFBO;
+    GLint outputViewport[4];
+
+    PostProcess()
+        : width(0), height(0), renderScale(1.0f), renderWidth(0), renderHeight(0), sharpness(0.5f),
+        quality(BLOOM_MEDIUM), bloomThreshold(1.0f), bloomIntensity(0.6f), exposure(1.0f),
+        sceneFBO(0), sceneColor(0), sceneVelocity(0), sceneDepth(0), resolvedColor(0),
+        prefilterProgram(0), downsampleProgram(0), upsampleProgram(0), resolveProgram(0), emptyVAO(0), outputFBO(0) {
+        outputViewport[0] = outputViewport[1] = outputViewport[2] = outputViewport[3] = 0;
+    }
+};
+
+// `encodeSrgb` makes the resolve pass apply the sRGB curve itself, for
+// outputs that are not sRGB framebuffers. `velocityBuffer` adds the motion
+// vector attachment; scene shaders must then write location 1.
+bool createPostProcess(PostProcess& post, int width, int height, BloomQuality quality, bool encodeSrgb,
+    bool velocityBuffer = false);
+void destroyPostProcess(PostProcess& post);
+// Reallocates the targets if the size changed.
+void resizePostProcess(PostProcess& post, int width, int height);
+
+// Remembers the bound framebuffer and viewport as the output and binds the
+// HDR scene target, with the viewport set to the scaled render region.
+void beginPostProcess(PostProcess& post);
+// Makes bloom and the resolve read a full-size texture (e.g. the temporal AA
+// output) instead of the scene region for the rest of this frame.
+void setPostProcessInput(PostProcess& post, GLuint texture);
+// Builds the bloom chain from the scene target. No-op with BLOOM_OFF.
+void applyBloom(PostProcess& post);
+// Tone maps scene + bloom into the output framebuffer and leaves it bound.
+void resolvePostProcess(PostProcess& post);
+
+// Vertex shader for passes drawn with post.emptyVAO and glDrawArrays(GL_TRIANGLES, 0, 3).
+// Outputs TexCoords covering [0, 1].
+extern const char* fullscreenVertexShaderSource;
+
+bool parseBloomQuality(const std::string& text, BloomQuality& quality);
@@ -0,0 +1,68 @@
+#include "scene_depth.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+static bool reversed = false;
+
+// The ratio of the default 0.1 to 10000 range, which 24-bit classic depth
+// handled fine
+static const float CLASSIC_MAX_FAR_NEAR_RATIO = 1e5f;
+
+void initSceneDepth() {
+    reversed = GLAD_GL_VERSION_4_5 != 0;
+    if (reversed) {
+        glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glClearDepth(0.0);
+        glDepthFunc(GL_GREATER);
+        std::cout << "Depth: reversed Z" << std::endl;
+    }
+    else {
+        std::cout << "Depth: no glClipControl, far plane follows the near plane" << std::endl;
+    }
+}
+
+bool reversedDepth() {
+    return reversed;
+}
+
+float sceneFarPlane(float nearPlane, float farPlane) {
+    return reversed ? farPlane : std::min(farPlane, nearPlane * CLASSIC_MAX_FAR_NEAR_RATIO);
+}
+
+glm::mat4 sceneProjection(float fovy, float aspect, float nearPlane, float farPlane) {
+    // Swapping the planes of a zero-to-one projection maps near to 1, far to 0
+    if (reversed)
+        return glm::perspectiveRH_ZO(fovy, aspect, farPlane, nearPlane);
+    return glm::perspective(fovy, aspect, nearPlane, farPlane);
+}
+
+glm::vec4 frustumNearPlane(const glm::mat4& transposed) {
+    return reversed ? transposed[3] - transposed[2] : transposed[3] + transposed[2];
+}
+
+std::string sceneDepthShaderSource() {
+    std::string source = reversed ? "#define REVERSED_DEPTH 1\n" : "";
+    return source + R"(
+#ifdef REVERSED_DEPTH
+#define FAR_PLANE_Z 0.00001
+float windowDepth(vec4 clip) { return clip.z / clip.w; }
+bool inFront(float depth, float other) { return depth > other; }
+#else
+#define FAR_PLANE_Z 0.99999
+float windowDepth(vec4 clip) { return clip.z / clip.w * 0.5 + 0.5; }
+bool inFront(float depth, float other) { return depth < other; }
+#endif
+
+vec4 insideFarPlane(vec4 clip) {
+#ifdef REVERSED_DEPTH
+    clip.z = max(clip.z, clip.w * FAR_PLANE_Z);
+#else
+    clip.z = min(clip.z, clip.w * FAR_PLANE_Z);
+#endif
+    return clip;
+}
+)";
+}
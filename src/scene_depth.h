@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Depth conventions for the scene.
+//
+// With glClipControl (GL 4.5) the scene uses reversed Z: a float depth
+// buffer with the near plane at depth 1 and the far plane at 0. Float
+// precision then follows the 1/z of perspective depth, so resolution stays
+// roughly constant relative to distance, even with the near plane a few
+// metres off the ground and the far plane past Neptune. Without it the
+// classic [-1, 1] range is kept and sceneFarPlane pulls the far plane in
+// along with the near plane instead.
+
+// Format of every depth target the scene renders into or copies depth to
+const GLenum SCENE_DEPTH_FORMAT = GL_DEPTH_COMPONENT32F;
+
+// Picks the convention and sets the clip control, depth function and clear
+// value to match. Call once, after the GL functions are loaded.
+void initSceneDepth();
+bool reversedDepth();
+
+// Far plane for a near plane, bounded in the classic convention so the
+// far/near ratio never exceeds the one of the default 0.1 to `farPlane`.
+float sceneFarPlane(float nearPlane, float farPlane);
+glm::mat4 sceneProjection(float fovy, float aspect, float nearPlane, float farPlane);
+
+// The near clipping plane of the transpose of a (model)viewProjection,
+// alongside the usual m[3] +- m[0] and m[3] +- m[1].
+glm::vec4 frustumNearPlane(const glm::mat4& transposed);
+
+// depth.glsl for scene effects: FAR_PLANE_Z (clip z/w just inside the far
+// plane), windowDepth(clip) for gl_FragDepth, insideFarPlane(clip) and
+// inFront(depth, other).
+std::string sceneDepthShaderSource();
@@ -0,0 +1,144 @@
+#include "shader_library.h"
+
+#include <cctype>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+
+#include "trace.h"
+
+static const char* featureNames[SHADER_FEATURE_COUNT] = {
+    "LIT", "TEXTURED", "INSTANCED", "IMPOSTOR", "SRGB_OUTPUT", "VELOCITY", "ATMOSPHERE", "TRANSPARENT"
+};
+
+void addShaderSource(ShaderLibrary& library, const std::string& name, const std::string& source) {
+    library.sources[name] = source;
+}
+
+int addShaderEffect(ShaderLibrary& library, const std::string& name, const char* vertexSource,
+    const char* fragmentSource, unsigned features, const std::string& constants) {
+    ShaderEffect effect;
+    effect.name = name;
+    effect.vertexSource = vertexSource;
+    effect.fragmentSource = fragmentSource;
+    effect.features = features;
+    effect.constants = constants;
+    library.effects.push_back(effect);
+    return (int)library.effects.size() - 1;
+}
+
+void setShaderEffectTessellation(ShaderLibrary& library, int effect, const char* controlSource,
+    const char* evaluationSource) {
+    library.effects[effect].tessControlSource = controlSource;
+    library.effects[effect].tessEvaluationSource = evaluationSource;
+}
+
+// Replaces `#include "name"` lines with the named source, recursively. Each
+// source is pasted at most once per stage, so includes act like include guards.
+// #line directives keep compiler errors pointing at the right file and line:
+// source string 0 is the effect itself, n is the n-th library source.
+static bool expandIncludes(const ShaderLibrary& library, const std::string& text, int sourceNumber,
+    std::set<std::string>& included, std::string& out) {
+    std::istringstream in(text);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+            out += line;
+            out += '\n';
+            continue;
+        }
+
+        size_t open = line.find('"', start);
+        size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+        if (close == std::string::npos) {
+            std::cerr << "ERROR: Malformed shader include: " << line << std::endl;
+            return false;
+        }
+        std::string name = line.substr(open + 1, close - open - 1);
+        std::map<std::string, std::string>::const_iterator source = library.sources.find(name);
+        if (source == library.sources.end()) {
+            std::cerr << "ERROR: Unknown shader include \"" << name << "\"" << std::endl;
+            return false;
+        }
+        if (!included.insert(name).second)
+            continue;
+
+        int includeNumber = 1 + (int)std::distance(library.sources.begin(), source);
+        out += "#line 1 " + std::to_string(includeNumber) + "\n";
+        if (!expandIncludes(library, source->second, includeNumber, included, out))
+            return false;
+        out += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceNumber) + "\n";
+    }
+    return true;
+}
+
+static std::string variantDefines(const ShaderEffect& effect, unsigned features) {
+    std::string defines;
+    for (int i = 0; i < SHADER_FEATURE_COUNT; ++i) {
+        if (features & (1u << i))
+            defines += std::string("#define ") + featureNames[i] + " 1\n";
+    }
+    // Keep error line numbers in the effect's own source correct
+    return defines + effect.constants + "#line 2 0\n";
+}
+
+std::string shaderVariantName(const ShaderLibrary& library, int effect, unsigned features) {
+    std::string name = library.effects[effect].name;
+    for (int i = 0; i < SHADER_FEATURE_COUNT; ++i) {
+        if (!(features & (1u << i)))
+            continue;
+        name += '+';
+        for (const char* c = featureNames[i]; *c; ++c)
+            name += (char)tolower(*c);
+    }
+    return name;
+}
+
+static ShaderProgram& findOrSubmitVariant(ShaderLibrary& library, int effect, unsigned features) {
+    const ShaderEffect& fx = library.effects[effect];
+    features &= fx.features;
+    std::pair<int, unsigned> key(effect, features);
+    std::map<std::pair<int, unsigned>, ShaderProgram>::iterator found = library.variants.find(key);
+    if (found != library.variants.end())
+        return found->second;
+
+    TRACE_SCOPE("build shader variant");
+    ShaderProgram& program = library.variants[key];
+    std::string name = shaderVariantName(library, effect, features);
+    std::string vs, fs, tcs, tes;
+    std::set<std::string> vsIncluded, fsIncluded, tcsIncluded, tesIncluded;
+    bool tessellated = !fx.tessControlSource.empty();
+    if (!expandIncludes(library, fx.vertexSource, 0, vsIncluded, vs) ||
+        !expandIncludes(library, fx.fragmentSource, 0, fsIncluded, fs) ||
+        (tessellated && (!expandIncludes(library, fx.tessControlSource, 0, tcsIncluded, tcs) ||
+            !expandIncludes(library, fx.tessEvaluationSource, 0, tesIncluded, tes)))) {
+        std::cerr << "ERROR: Could not expand shader variant " << name << std::endl;
+        // Leave the variant at program 0 rather than compile half a shader
+        program.name = name;
+        program.resolved = true;
+        return program;
+    }
+    submitProgram(program, name, vs.c_str(), fs.c_str(), variantDefines(fx, features),
+        tessellated ? tcs.c_str() : nullptr, tessellated ? tes.c_str() : nullptr);
+    return program;
+}
+
+void prepareShaderVariant(ShaderLibrary& library, int effect, unsigned features) {
+    findOrSubmitVariant(library, effect, features);
+}
+
+GLuint getShaderVariant(ShaderLibrary& library, int effect, unsigned features) {
+    return resolveProgram(findOrSubmitVariant(library, effect, features));
+}
+
+void destroyShaderLibrary(ShaderLibrary& library) {
+    for (auto& variant : library.variants) {
+        resolveProgram(variant.second);
+        glDeleteProgram(variant.second.id);
+    }
+    library.variants.clear();
+}
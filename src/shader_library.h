@@ -0,0 +1,72 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "shader_program.h"
+
+// Feature bits a variant is specialised for. Each set bit becomes a
+// `#define <NAME> 1` in both stages, so the shader branches at compile time
+// instead of on uniforms.
+enum ShaderFeature {
+    SHADER_LIT = 1 << 0,         // Lambert lighting from lightPos
+    SHADER_TEXTURED = 1 << 1,    // base colour from a texture instead of `color`
+    SHADER_INSTANCED = 1 << 2,   // model matrix from attributes 3-6, not a uniform
+    SHADER_IMPOSTOR = 1 << 3,    // ray-traced sphere on a camera-facing quad
+    SHADER_SRGB_OUTPUT = 1 << 4, // encode to sRGB in the shader
+    SHADER_VELOCITY = 1 << 5,    // write screen-space motion to location 1
+    SHADER_ATMOSPHERE = 1 << 6,  // light through a precomputed atmosphere, see atmosphere.h
+    SHADER_TRANSPARENT = 1 << 7, // order-independent translucent output, see transparency.h
+    SHADER_FEATURE_COUNT = 8
+};
+
+// A vertex/fragment pair plus the features it understands. Requested bits
+// outside `features` are ignored, so callers can pass global bits (like the
+// output encoding) to every effect.
+struct ShaderEffect {
+    std::string name;
+    std::string vertexSource;
+    std::string fragmentSource;
+    std::string tessControlSource; // both empty unless tessellated
+    std::string tessEvaluationSource;
+    unsigned features;
+    std::string constants; // extra #defines, e.g. tuning values
+
+    ShaderEffect() : features(0) {}
+};
+
+// Includable sources, effects, and every variant compiled so far.
+struct ShaderLibrary {
+    std::map<std::string, std::string> sources;
+    std::vector<ShaderEffect> effects;
+    std::map<std::pair<int, unsigned>, ShaderProgram> variants;
+};
+
+// Makes `source` available to `#include "name"` in effects and other sources.
+void addShaderSource(ShaderLibrary& library, const std::string& name, const std::string& source);
+
+// Registers an effect and returns its handle for the calls below.
+int addShaderEffect(ShaderLibrary& library, const std::string& name, const char* vertexSource,
+    const char* fragmentSource, unsigned features, const std::string& constants = "");
+
+// Adds tessellation stages to an effect (GL 4.0); its variants then draw
+// GL_PATCHES. Call before the first variant is prepared.
+void setShaderEffectTessellation(ShaderLibrary& library, int effect, const char* controlSource,
+    const char* evaluationSource);
+
+// Starts compiling a variant without waiting for it. Use at startup for
+// variants known to be needed so they compile in parallel.
+void prepareShaderVariant(ShaderLibrary& library, int effect, unsigned features);
+
+// Returns the program for an effect/feature combination, compiling it on
+// first use. Subsequent calls are a map lookup.
+GLuint getShaderVariant(ShaderLibrary& library, int effect, unsigned features);
+
+// e.g. "surface+lit+textured"; also used as the shader cache entry name.
+std::string shaderVariantName(const ShaderLibrary& library, int effect, unsigned features);
+
+void destroyShaderLibrary(ShaderLibrary& library);
@@ -0,0 +1,316 @@
+#include "shader_program.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "trace.h"
+
+static const uint32_t CACHE_MAGIC = 0x42505353; // "SSPB"
+
+// From KHR_parallel_shader_compile; glad is generated without extensions
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+static std::string cacheDirectory;
+static std::string driverSignature;
+static bool cacheEnabled = false;
+static bool parallelCompile = false;
+
+static uint64_t fnv1a(const std::string& text, uint64_t hash = 14695981039346656037ull) {
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static std::string glString(GLenum name) {
+    const GLubyte* value = glGetString(name);
+    return value ? (const char*)value : "";
+}
+
+static void makeDirectory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+void initShaderCache(const std::string& directory) {
+    cacheEnabled = false;
+    if (directory.empty())
+        return;
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (!glad_glGetProgramBinary || !glad_glProgramBinary || formats == 0) {
+        std::cout << "Shader cache disabled: driver has no program binary formats" << std::endl;
+        return;
+    }
+
+    cacheDirectory = directory;
+    makeDirectory(cacheDirectory);
+    // Binaries are only valid for the exact driver that produced them
+    driverSignature = glString(GL_VENDOR) + "|" + glString(GL_RENDERER) + "|" + glString(GL_VERSION);
+    cacheEnabled = true;
+}
+
+static bool hasGLExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const GLubyte* extension = glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (extension && strcmp((const char*)extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool initParallelShaderCompile(GLADloadproc loader) {
+    parallelCompile = false;
+    const char* entryPoint = nullptr;
+    if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+        entryPoint = "glMaxShaderCompilerThreadsKHR";
+    else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+        entryPoint = "glMaxShaderCompilerThreadsARB";
+    if (!entryPoint) {
+        std::cout << "Parallel shader compile unavailable, programs will link on first use" << std::endl;
+        return false;
+    }
+
+    PFNGLMAXSHADERCOMPILERTHREADSPROC maxCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSPROC)loader(entryPoint);
+    if (maxCompilerThreads)
+        maxCompilerThreads(0xFFFFFFFF); // let the driver pick
+    parallelCompile = true;
+    return true;
+}
+
+static std::string injectDefines(const char* source, const std::string& defines) {
+    std::string text = source;
+    if (defines.empty())
+        return text;
+    size_t version = text.find("#version");
+    size_t lineEnd = version == std::string::npos ? std::string::npos : text.find('\n', version);
+    if (lineEnd == std::string::npos)
+        return defines + text;
+    return text.substr(0, lineEnd + 1) + defines + text.substr(lineEnd + 1);
+}
+
+static std::string cachePath(const std::string& name, const std::string& vs, const std::string& fs,
+    const std::string& tcs, const std::string& tes) {
+    uint64_t hash = fnv1a(driverSignature);
+    hash = fnv1a(vs, hash);
+    hash = fnv1a("\x1f", hash);
+    hash = fnv1a(fs, hash);
+    if (!tcs.empty()) {
+        hash = fnv1a("\x1f", hash);
+        hash = fnv1a(tcs, hash);
+        hash = fnv1a("\x1f", hash);
+        hash = fnv1a(tes, hash);
+    }
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+    return cacheDirectory + "/" + name + "-" + hex + ".bin";
+}
+
+static bool loadCachedProgram(const std::string& path, GLuint program) {
+    TRACE_SCOPE("load program binary");
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    uint32_t header[3] = { 0, 0, 0 }; // magic, format, length
+    file.read((char*)header, sizeof(header));
+    if (!file || header[0] != CACHE_MAGIC || header[2] == 0)
+        return false;
+    std::vector<char> binary(header[2]);
+    file.read(binary.data(), binary.size());
+    if (!file)
+        return false;
+
+    glProgramBinary(program, (GLenum)header[1], binary.data(), (GLsizei)binary.size());
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success != 0;
+}
+
+static void storeCachedProgram(const std::string& path, GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Failed to write shader cache entry: " << path << std::endl;
+        return;
+    }
+    uint32_t header[3] = { CACHE_MAGIC, (uint32_t)format, (uint32_t)length };
+    file.write((const char*)header, sizeof(header));
+    file.write(binary.data(), binary.size());
+}
+
+static GLuint compileShader(GLenum type, const std::string& source) {
+    const char* text = source.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &text, nullptr);
+    glCompileShader(shader);
+    return shader;
+}
+
+// Checks, detaches and deletes one stage once the program is linked
+static void releaseShader(GLuint program, GLuint& shader) {
+    if (!shader)
+        return;
+    checkShaderCompilation(shader);
+    glDetachShader(program, shader);
+    glDeleteShader(shader);
+    shader = 0;
+}
+
+void submitProgram(ShaderProgram& program, const std::string& name, const char* vertexSource,
+    const char* fragmentSource, const std::string& defines, const char* tessControlSource,
+    const char* tessEvaluationSource) {
+    TRACE_SCOPE("submitProgram");
+    std::string vs = injectDefines(vertexSource, defines);
+    std::string fs = injectDefines(fragmentSource, defines);
+    bool tessellated = tessControlSource && tessEvaluationSource;
+    std::string tcs = tessellated ? injectDefines(tessControlSource, defines) : "";
+    std::string tes = tessellated ? injectDefines(tessEvaluationSource, defines) : "";
+
+    program = ShaderProgram();
+    program.name = name;
+    program.id = glCreateProgram();
+    if (cacheEnabled) {
+        program.cachePath = cachePath(name, vs, fs, tcs, tes);
+        if (loadCachedProgram(program.cachePath, program.id)) {
+            program.resolved = true;
+            return;
+        }
+        // Missing, stale or rejected after a driver update: fall through and
+        // rebuild from source into a fresh program object
+        glDeleteProgram(program.id);
+        program.id = glCreateProgram();
+        glProgramParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    program.vertexShader = compileShader(GL_VERTEX_SHADER, vs);
+    if (tessellated) {
+        program.tessControlShader = compileShader(GL_TESS_CONTROL_SHADER, tcs);
+        program.tessEvaluationShader = compileShader(GL_TESS_EVALUATION_SHADER, tes);
+    }
+    program.fragmentShader = compileShader(GL_FRAGMENT_SHADER, fs);
+
+    // Linking doesn't need the compile results up front; a failed stage just
+    // makes the link fail, and all are reported in resolveProgram
+    glAttachShader(program.id, program.vertexShader);
+    if (tessellated) {
+        glAttachShader(program.id, program.tessControlShader);
+        glAttachShader(program.id, program.tessEvaluationShader);
+    }
+    glAttachShader(program.id, program.fragmentShader);
+    glLinkProgram(program.id);
+}
+
+bool isProgramReady(const ShaderProgram& program) {
+    if (program.resolved || !parallelCompile)
+        return true;
+    GLint done = 0;
+    glGetProgramiv(program.id, GL_COMPLETION_STATUS_KHR, &done);
+    return done != 0;
+}
+
+GLuint resolveProgram(ShaderProgram& program) {
+    if (program.resolved)
+        return program.id;
+    TraceScope scope(isProgramReady(program) ? "resolveProgram" : "wait for program");
+
+    releaseShader(program.id, program.vertexShader);
+    releaseShader(program.id, program.tessControlShader);
+    releaseShader(program.id, program.tessEvaluationShader);
+    releaseShader(program.id, program.fragmentShader);
+    checkProgramLinking(program.id);
+
+    GLint linked = 0;
+    glGetProgramiv(program.id, GL_LINK_STATUS, &linked);
+    if (cacheEnabled && linked)
+        storeCachedProgram(program.cachePath, program.id);
+    program.resolved = true;
+    return program.id;
+}
+
+GLuint buildProgram(const std::string& name, const char* vertexSource, const char* fragmentSource,
+    const std::string& defines) {
+    TRACE_SCOPE("buildProgram");
+    ShaderProgram program;
+    submitProgram(program, name, vertexSource, fragmentSource, defines);
+    return resolveProgram(program);
+}
+
+GLuint buildComputeProgram(const std::string& name, const char* source) {
+    TRACE_SCOPE("buildComputeProgram");
+    GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    checkShaderCompilation(shader);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    checkProgramLinking(program);
+    glDetachShader(program, shader);
+    glDeleteShader(shader);
+
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        std::cerr << "Compute program " << name << " failed to build" << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void checkShaderCompilation(GLuint shader) {
+    // The status query is where the driver actually finishes compiling
+    TRACE_SCOPE("checkShaderCompilation");
+    GLint success;
+    GLchar infoLog[512];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        std::cerr << "ERROR: Shader Compilation Failed\n" << infoLog << std::endl;
+    }
+}
+
+void checkProgramLinking(GLuint program) {
+    TRACE_SCOPE("checkProgramLinking");
+    GLint success;
+    GLchar infoLog[512];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cerr << "ERROR: Program Linking Failed\n" << infoLog << std::endl;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+
+#include <glad/glad.h>
+
+// Compiles and links a vertex/fragment program. `defines` is inserted right
+// after the #version line of every stage (e.g. "#define TEXTURED 1\n").
+//
+// When the driver supports program binaries, linked programs are stored in
+// the shader cache directory keyed by a hash of the sources, the defines and
+// the driver's vendor/renderer/version strings, and later launches load them
+// with glProgramBinary. A binary the driver rejects is recompiled and
+// replaced transparently.
+GLuint buildProgram(const std::string& name, const char* vertexSource, const char* fragmentSource,
+    const std::string& defines = "");
+
+// Compiles and links a compute program (GL 4.3). Not cached; returns 0 if it
+// fails.
+GLuint buildComputeProgram(const std::string& name, const char* source);
+
+// A program whose compile and link have been issued but not yet checked.
+// Status queries force the driver to finish the work, so they are deferred to
+// resolveProgram; with KHR_parallel_shader_compile the driver compiles on its
+// own threads in the meantime.
+struct ShaderProgram {
+    std::string name;
+    GLuint id;
+    GLuint vertexShader;
+    GLuint tessControlShader; // 0 without tessellation
+    GLuint tessEvaluationShader;
+    GLuint fragmentShader;
+    std::string cachePath; // where to store the binary once linked
+    bool resolved;
+
+    ShaderProgram()
+        : id(0), vertexShader(0), tessControlShader(0), tessEvaluationShader(0), fragmentShader(0),
+        resolved(false) {}
+};
+
+// Same as buildProgram but returns straight after glLinkProgram. A shader
+// cache hit is resolved immediately. With both tessellation sources (GL 4.0)
+// the program draws GL_PATCHES.
+void submitProgram(ShaderProgram& program, const std::string& name, const char* vertexSource,
+    const char* fragmentSource, const std::string& defines = "", const char* tessControlSource = nullptr,
+    const char* tessEvaluationSource = nullptr);
+
+// True once the driver has finished compiling and linking. Never blocks; always
+// true when parallel compile is unsupported (resolve then does the work).
+bool isProgramReady(const ShaderProgram& program);
+
+// Waits for the program if needed, checks and logs compile/link errors, stores
+// the binary in the shader cache and returns the program id. Idempotent.
+GLuint resolveProgram(ShaderProgram& program);
+
+// Must be called with a current context before the first buildProgram.
+// An empty directory disables the cache.
+void initShaderCache(const std::string& directory);
+
+// Enables KHR/ARB_parallel_shader_compile when the driver exposes it and lets
+// it use as many compiler threads as it likes. glad doesn't load extension
+// entry points, hence the loader. Returns whether parallel compile is active.
+bool initParallelShaderCompile(GLADloadproc loader);
+
+void checkShaderCompilation(GLuint shader);
+void checkProgramLinking(GLuint program);
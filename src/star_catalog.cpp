@@ -0,0 +1,356 @@
+#include "star_catalog.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "trace.h"
+
+static const uint32_t CATALOG_MAGIC = 0x54415453; // "STAT"
+static const uint32_t CATALOG_VERSION = 1;
+// Deeper than this the remaining (faintest) stars of a node are dropped
+static const int MAX_DEPTH = 16;
+
+// Catalog stars are placed at INNER_RADIUS + distance * UNITS_PER_PARSEC
+// from the Sun, so even the nearest are well outside Neptune's orbit
+static const float INNER_RADIUS = 5000.0f;
+static const float UNITS_PER_PARSEC = 5.0f;
+
+static_assert(sizeof(StarVertex) == 20, "StarVertex is written to disk as-is");
+static_assert(sizeof(StarNode) == 60, "StarNode is written to disk as-is");
+
+uint32_t starColorFromIndex(float bv) {
+    bv = std::max(-0.4f, std::min(2.0f, bv));
+    // Ballesteros' B-V to temperature, then a fit of the blackbody colour
+    float t = 4600.0f * (1.0f / (0.92f * bv + 1.7f) + 1.0f / (0.92f * bv + 0.62f)) / 100.0f;
+    float r, g, b;
+    if (t <= 66.0f) {
+        r = 255.0f;
+        g = 99.4708025861f * std::log(t) - 161.1195681661f;
+    }
+    else {
+        r = 329.698727446f * std::pow(t - 60.0f, -0.1332047592f);
+        g = 288.1221695283f * std::pow(t - 60.0f, -0.0755148492f);
+    }
+    if (t >= 66.0f)
+        b = 255.0f;
+    else if (t <= 19.0f)
+        b = 0.0f;
+    else
+        b = 138.5177312231f * std::log(t - 10.0f) - 305.0447927307f;
+
+    // The fit gives display values; store linear, normalised to the brightest channel
+    float c[3] = { r, g, b };
+    float peak = 0.0f;
+    for (float& v : c) {
+        v = std::pow(std::max(0.0f, std::min(255.0f, v)) / 255.0f, 2.2f);
+        peak = std::max(peak, v);
+    }
+    uint32_t packed = 0xFF000000u;
+    for (int i = 0; i < 3; ++i)
+        packed |= (uint32_t)(c[i] / peak * 255.0f + 0.5f) << (i * 8);
+    return packed;
+}
+
+void generateStarCatalog(std::vector<StarVertex>& stars, int count, float extent, unsigned seed) {
+    TRACE_SCOPE("generateStarCatalog");
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::uniform_real_distribution<float> unit(1e-6f, 1.0f);
+    std::normal_distribution<float> colorIndex(0.65f, 0.4f);
+
+    // Number of stars brighter than m grows as 10^(0.35 m), up to FAINTEST
+    const float FAINTEST = 8.5f;
+    const float slope = 0.35f * std::log(10.0f);
+
+    stars.resize(count);
+    for (auto& star : stars) {
+        star.position[0] = position(rng);
+        star.position[1] = position(rng);
+        star.position[2] = position(rng);
+        star.magnitude = FAINTEST + std::log(unit(rng)) / slope;
+        star.color = starColorFromIndex(colorIndex(rng));
+    }
+}
+
+static void splitCsvLine(const std::string& line, std::vector<std::string>& fields) {
+    fields.clear();
+    std::string field;
+    std::istringstream stream(line);
+    while (std::getline(stream, field, ',')) {
+        if (!field.empty() && field.back() == '\r')
+            field.pop_back();
+        if (field.size() >= 2 && field.front() == '"' && field.back() == '"')
+            field = field.substr(1, field.size() - 2);
+        fields.push_back(field);
+    }
+}
+
+bool loadStarCatalogCsv(const std::string& path, std::vector<StarVertex>& stars) {
+    TRACE_SCOPE("loadStarCatalogCsv");
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open star catalog: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    std::vector<std::string> fields;
+    std::getline(file, line);
+    splitCsvLine(line, fields);
+    auto column = [&](const char* name) {
+        auto it = std::find(fields.begin(), fields.end(), name);
+        return it == fields.end() ? -1 : (int)(it - fields.begin());
+        };
+    int x = column("x"), y = column("y"), z = column("z"), mag = column("mag"), ci = column("ci");
+    int ra = column("ra"), dec = column("dec"), parallax = column("parallax");
+    int gmag = column("phot_g_mean_mag"), bpRp = column("bp_rp");
+    bool hyg = x >= 0 && y >= 0 && z >= 0 && mag >= 0;
+    bool gaia = ra >= 0 && dec >= 0 && parallax >= 0 && gmag >= 0;
+    if (!hyg && !gaia) {
+        std::cerr << "Star catalog " << path << " needs x,y,z,mag or ra,dec,parallax,phot_g_mean_mag columns" << std::endl;
+        return false;
+    }
+
+    size_t skipped = 0;
+    while (std::getline(file, line)) {
+        splitCsvLine(line, fields);
+        auto value = [&](int index, float& out) {
+            if (index < 0 || index >= (int)fields.size() || fields[index].empty())
+                return false;
+            out = (float)atof(fields[index].c_str());
+            return true;
+            };
+
+        // Equatorial direction and distance from the Sun in parsecs
+        float ex, ey, ez, distance, magnitude, color = 0.65f;
+        if (hyg) {
+            if (!value(x, ex) || !value(y, ey) || !value(z, ez) || !value(mag, magnitude)) {
+                ++skipped;
+                continue;
+            }
+            distance = std::sqrt(ex * ex + ey * ey + ez * ez);
+            value(ci, color);
+        }
+        else {
+            float raDeg, decDeg, parallaxMas;
+            if (!value(ra, raDeg) || !value(dec, decDeg) || !value(parallax, parallaxMas) ||
+                !value(gmag, magnitude) || parallaxMas <= 0.0f) {
+                ++skipped;
+                continue;
+            }
+            float a = raDeg * 0.0174532925f, d = decDeg * 0.0174532925f;
+            distance = 1000.0f / parallaxMas;
+            ex = std::cos(d) * std::cos(a) * distance;
+            ey = std::cos(d) * std::sin(a) * distance;
+            ez = std::sin(d) * distance;
+            // Rough conversion to B-V
+            if (value(bpRp, color))
+                color *= 0.79f;
+        }
+        if (distance <= 0.0f)
+            continue; // the Sun itself
+
+        // Celestial north is up (+y)
+        float radius = INNER_RADIUS + distance * UNITS_PER_PARSEC;
+        float scale = radius / distance;
+        StarVertex star;
+        star.position[0] = ex * scale;
+        star.position[1] = ez * scale;
+        star.position[2] = -ey * scale;
+        star.magnitude = magnitude - 5.0f * std::log10(radius / STAR_REFERENCE_DISTANCE);
+        star.color = starColorFromIndex(color);
+        stars.push_back(star);
+    }
+    if (skipped > 0)
+        std::cout << "Star catalog " << path << ": skipped " << skipped << " incomplete rows" << std::endl;
+    return true;
+}
+
+static int octant(const StarVertex& star, const float center[3]) {
+    return (star.position[0] >= center[0] ? 1 : 0) | (star.position[1] >= center[1] ? 2 : 0) |
+        (star.position[2] >= center[2] ? 4 : 0);
+}
+
+// `stars[begin, end)` is sorted bright to faint and lies inside the node
+static int buildNode(StarCatalog& catalog, std::vector<StarVertex>& stars, size_t begin, size_t end,
+    const float center[3], float halfSize, int depth, size_t& dropped) {
+    int index = (int)catalog.nodes.size();
+    catalog.nodes.push_back(StarNode());
+    size_t take = std::min(end - begin, (size_t)catalog.chunkSize);
+    {
+        StarNode& node = catalog.nodes[index];
+        std::copy(center, center + 3, node.center);
+        node.halfSize = halfSize;
+        node.brightest = stars[begin].magnitude;
+        node.firstStar = (uint32_t)catalog.stars.size();
+        node.starCount = (uint32_t)take;
+        std::fill(node.children, node.children + 8, -1);
+    }
+    catalog.stars.insert(catalog.stars.end(), stars.begin() + begin, stars.begin() + begin + take);
+    begin += take;
+    if (begin == end)
+        return index;
+    if (depth == MAX_DEPTH) {
+        dropped += end - begin;
+        return index;
+    }
+
+    // A stable sort by octant keeps each octant's stars sorted by magnitude
+    std::stable_sort(stars.begin() + begin, stars.begin() + end, [&](const StarVertex& a, const StarVertex& b) {
+        return octant(a, center) < octant(b, center);
+        });
+    float childHalf = halfSize * 0.5f;
+    while (begin < end) {
+        int o = octant(stars[begin], center);
+        size_t last = begin;
+        while (last < end && octant(stars[last], center) == o)
+            ++last;
+        float childCenter[3] = {
+            center[0] + ((o & 1) ? childHalf : -childHalf),
+            center[1] + ((o & 2) ? childHalf : -childHalf),
+            center[2] + ((o & 4) ? childHalf : -childHalf)
+        };
+        int child = buildNode(catalog, stars, begin, last, childCenter, childHalf, depth + 1, dropped);
+        catalog.nodes[index].children[o] = child;
+        begin = last;
+    }
+    return index;
+}
+
+void buildStarCatalog(StarCatalog& catalog, std::vector<StarVertex>& stars, int chunkSize) {
+    TRACE_SCOPE("buildStarCatalog");
+    catalog = StarCatalog();
+    catalog.chunkSize = (uint32_t)std::max(1, chunkSize);
+    if (stars.empty())
+        return;
+
+    float lo[3] = { 1e30f, 1e30f, 1e30f }, hi[3] = { -1e30f, -1e30f, -1e30f };
+    for (const auto& star : stars) {
+        for (int i = 0; i < 3; ++i) {
+            lo[i] = std::min(lo[i], star.position[i]);
+            hi[i] = std::max(hi[i], star.position[i]);
+        }
+    }
+    float center[3], halfSize = 0.0f;
+    for (int i = 0; i < 3; ++i) {
+        center[i] = (lo[i] + hi[i]) * 0.5f;
+        halfSize = std::max(halfSize, (hi[i] - lo[i]) * 0.5f);
+    }
+
+    std::stable_sort(stars.begin(), stars.end(), [](const StarVertex& a, const StarVertex& b) {
+        return a.magnitude < b.magnitude;
+        });
+    catalog.stars.reserve(stars.size());
+    size_t dropped = 0;
+    buildNode(catalog, stars, 0, stars.size(), center, halfSize * 1.001f + 1e-3f, 0, dropped);
+    catalog.starCount = (uint32_t)catalog.stars.size();
+    if (dropped > 0)
+        std::cout << "Star catalog: dropped " << dropped << " faint stars in over-full leaves" << std::endl;
+
+    std::vector<StarVertex>().swap(stars);
+}
+
+bool writeStarCatalog(const StarCatalog& catalog, const std::string& path) {
+    if (catalog.stars.size() != catalog.starCount) {
+        std::cerr << "Only in-memory star catalogs can be written" << std::endl;
+        return false;
+    }
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Failed to write star catalog: " << path << std::endl;
+        return false;
+    }
+    uint32_t header[5] = { CATALOG_MAGIC, CATALOG_VERSION, catalog.chunkSize, (uint32_t)catalog.nodes.size(), catalog.starCount };
+    file.write((const char*)header, sizeof(header));
+    file.write((const char*)catalog.nodes.data(), catalog.nodes.size() * sizeof(StarNode));
+    file.write((const char*)catalog.stars.data(), catalog.stars.size() * sizeof(StarVertex));
+    return (bool)file;
+}
+
+bool openStarCatalog(StarCatalog& catalog, const std::string& path) {
+    TRACE_SCOPE("openStarCatalog");
+    catalog = StarCatalog();
+    std::ifstream file(path, std::ios::binary);
+    uint32_t header[5] = { 0, 0, 0, 0, 0 }; // magic, version, chunk size, nodes, stars
+    file.read((char*)header, sizeof(header));
+    if (!file || header[0] != CATALOG_MAGIC || header[1] != CATALOG_VERSION) {
+        std::cerr << "Not a baked star catalog: " << path << std::endl;
+        return false;
+    }
+    // Check the counts against the file before trusting them with an allocation
+    uint64_t nodeBytes = (uint64_t)header[3] * sizeof(StarNode);
+    uint64_t starBytes = (uint64_t)header[4] * sizeof(StarVertex);
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = (uint64_t)file.tellg();
+    file.seekg(sizeof(header));
+    if (!file || fileSize < sizeof(header) + nodeBytes + starBytes) {
+        std::cerr << "Truncated star catalog: " << path << std::endl;
+        return false;
+    }
+
+    // The star field sizes its slots by the chunk size
+    if (header[2] == 0) {
+        std::cerr << "Corrupt star catalog: " << path << " (chunk size 0)" << std::endl;
+        return false;
+    }
+
+    catalog.chunkSize = header[2];
+    catalog.nodes.resize(header[3]);
+    file.read((char*)catalog.nodes.data(), nodeBytes);
+    if (!file) {
+        std::cerr << "Truncated star catalog: " << path << std::endl;
+        return false;
+    }
+    catalog.starCount = header[4];
+
+    // Chunks must fit a star field slot, and children always come after
+    // their parent, which also rules out cycles
+    for (size_t i = 0; i < catalog.nodes.size(); ++i) {
+        const StarNode& node = catalog.nodes[i];
+        bool valid = node.firstStar <= catalog.starCount && node.starCount <= catalog.starCount - node.firstStar &&
+            node.starCount <= catalog.chunkSize;
+        for (int child : node.children)
+            valid = valid && (child == -1 || (child > (int)i && (size_t)child < catalog.nodes.size()));
+        if (!valid) {
+            std::cerr << "Corrupt star catalog: " << path << " (node " << i << ")" << std::endl;
+            return false;
+        }
+    }
+    catalog.starDataOffset = sizeof(header) + nodeBytes;
+    catalog.path = path;
+    return true;
+}
+
+bool loadStarCatalog(StarCatalog& catalog, const std::string& path, int chunkSize) {
+    size_t dot = path.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension != ".csv")
+        return openStarCatalog(catalog, path);
+
+    std::vector<StarVertex> stars;
+    if (!loadStarCatalogCsv(path, stars))
+        return false;
+    buildStarCatalog(catalog, stars, chunkSize);
+    return true;
+}
+
+bool readStarChunk(const StarCatalog& catalog, const StarNode& node, std::vector<StarVertex>& stars) {
+    stars.resize(node.starCount);
+    if (catalog.path.empty()) {
+        std::copy(catalog.stars.begin() + node.firstStar, catalog.stars.begin() + node.firstStar + node.starCount,
+            stars.begin());
+        return true;
+    }
+
+    TRACE_SCOPE("read star chunk");
+    std::ifstream file(catalog.path, std::ios::binary);
+    file.seekg(catalog.starDataOffset + (uint64_t)node.firstStar * sizeof(StarVertex));
+    file.read((char*)stars.data(), stars.size() * sizeof(StarVertex));
+    return (bool)file;
+}
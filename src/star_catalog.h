@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scene distance at which StarVertex::magnitude is measured. The magnitude
+// seen from distance d is magnitude + 5 log10(d / STAR_REFERENCE_DISTANCE).
+const float STAR_REFERENCE_DISTANCE = 1000.0f;
+
+// One star as drawn and as stored in a baked catalog.
+struct StarVertex {
+    float position[3];
+    float magnitude; // apparent magnitude from STAR_REFERENCE_DISTANCE
+    uint32_t color;  // linear RGBA8, brightest channel 255
+};
+
+// Octree node of a catalog. Each node holds (up to the chunk size) the
+// brightest stars in its cube that no ancestor already holds, sorted bright
+// to faint; the rest go to its children. A node's stars are one contiguous
+// chunk, so refining the tree adds fainter and fainter stars.
+struct StarNode {
+    float center[3];
+    float halfSize;
+    float brightest;     // magnitude of its first star
+    uint32_t firstStar;
+    uint32_t starCount;
+    int32_t children[8]; // -1 where there are no stars
+};
+
+// Node table plus where the star chunks come from: a baked file (only the
+// table is kept in memory, chunks are read on demand) or an in-memory array.
+struct StarCatalog {
+    std::vector<StarNode> nodes; // nodes[0] is the root
+    std::string path;
+    std::vector<StarVertex> stars;
+    uint32_t starCount;
+    uint32_t chunkSize;
+    uint64_t starDataOffset;     // file offset of star 0
+
+    StarCatalog() : starCount(0), chunkSize(0), starDataOffset(0) {}
+};
+
+// Random stars in a cube of half-size `extent` around the origin, with a
+// power-law magnitude distribution and main-sequence-like colours.
+void generateStarCatalog(std::vector<StarVertex>& stars, int count, float extent, unsigned seed);
+
+// HYG-style (x, y, z in parsecs, mag, ci) or Gaia-style (ra, dec, parallax,
+// phot_g_mean_mag, bp_rp) CSV with a header row. Stars are placed beyond the
+// planets in the direction they appear from the Sun, keeping their apparent
+// magnitude from there.
+bool loadStarCatalogCsv(const std::string& path, std::vector<StarVertex>& stars);
+
+// Sorts `stars` into an octree and takes ownership of them.
+void buildStarCatalog(StarCatalog& catalog, std::vector<StarVertex>& stars, int chunkSize);
+
+bool writeStarCatalog(const StarCatalog& catalog, const std::string& path);
+
+// Reads just the node table of a baked catalog.
+bool openStarCatalog(StarCatalog& catalog, const std::string& path);
+
+// Loads a .csv (built in memory) or a baked catalog.
+bool loadStarCatalog(StarCatalog& catalog, const std::string& path, int chunkSize);
+
+// Copies one node's stars. Safe to call from worker threads.
+bool readStarChunk(const StarCatalog& catalog, const StarNode& node, std::vector<StarVertex>& stars);
+
+// Linear RGBA8 colour of a star with B-V colour index `bv`.
+uint32_t starColorFromIndex(float bv);
@@ -0,0 +1,234 @@
+#include "star_field.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+#include "scene_depth.h"
+#include "trace.h"
+#include "vertex_format.h"
+
+namespace {
+
+struct WantedNode {
+    int node;
+    float brightest; // apparent magnitude of its brightest star, at best
+};
+
+}
+
+void createStarField(StarField& field, const StarCatalog& catalog, int maxResidentChunks) {
+    field.slotCapacity = (int)catalog.chunkSize;
+    field.slots.assign(std::max(1, maxResidentChunks), StarField::Slot());
+    field.nodeSlot.assign(catalog.nodes.size(), -1);
+
+    glGenVertexArrays(1, &field.VAO);
+    glGenBuffers(1, &field.VBO);
+    glBindVertexArray(field.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, field.VBO);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)field.slots.size() * field.slotCapacity * sizeof(StarVertex), nullptr,
+        GL_DYNAMIC_DRAW);
+    applyVertexLayout(VertexLayout(sizeof(StarVertex))
+        .add(0, 3, GL_FLOAT, GL_FALSE, offsetof(StarVertex, position))
+        .add(1, 1, GL_FLOAT, GL_FALSE, offsetof(StarVertex, magnitude))
+        .add(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(StarVertex, color)));
+    glBindVertexArray(0);
+
+    std::cout << "Star catalog: " << catalog.starCount << " stars in " << catalog.nodes.size() << " chunks, "
+        << field.slots.size() << " resident at most" << std::endl;
+}
+
+void destroyStarField(StarField& field) {
+    // Outstanding reads only touch their own vectors; let them finish
+    for (auto& request : field.pending)
+        request.second.wait();
+    field.pending.clear();
+    glDeleteVertexArrays(1, &field.VAO);
+    glDeleteBuffers(1, &field.VBO);
+    field.VAO = field.VBO = 0;
+    field.slots.clear();
+    field.nodeSlot.clear();
+}
+
+static float distanceToNode(const StarNode& node, const glm::vec3& point) {
+    glm::vec3 center(node.center[0], node.center[1], node.center[2]);
+    glm::vec3 outside = glm::max(glm::abs(point - center) - glm::vec3(node.halfSize), glm::vec3(0.0f));
+    return glm::length(outside);
+}
+
+static float farthestInNode(const StarNode& node, const glm::vec3& point) {
+    glm::vec3 center(node.center[0], node.center[1], node.center[2]);
+    return glm::length(glm::abs(point - center) + glm::vec3(node.halfSize));
+}
+
+// Magnitude change from STAR_REFERENCE_DISTANCE to `distance`
+static float distanceModulus(float distance) {
+    return 5.0f * std::log10(std::max(distance, 1.0f) / STAR_REFERENCE_DISTANCE);
+}
+
+// Side and near planes only: stars beyond the far plane are still drawn
+static bool nodeInFrustum(const StarNode& node, const glm::mat4& viewProjection) {
+    glm::mat4 m = glm::transpose(viewProjection);
+    const glm::vec4 planes[5] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], frustumNearPlane(m) };
+    for (const auto& plane : planes) {
+        float extent = node.halfSize * (std::abs(plane.x) + std::abs(plane.y) + std::abs(plane.z));
+        float side = plane.x * node.center[0] + plane.y * node.center[1] + plane.z * node.center[2] + plane.w;
+        if (side < -extent)
+            return false;
+    }
+    return true;
+}
+
+static bool nodeInShell(const StarNode& node, const StarShell& shell) {
+    return farthestInNode(node, shell.center) >= shell.minDistance &&
+        distanceToNode(node, shell.center) < shell.maxDistance;
+}
+
+static int acquireSlot(StarField& field) {
+    int best = -1;
+    for (int i = 0; i < (int)field.slots.size(); ++i) {
+        const StarField::Slot& slot = field.slots[i];
+        if (slot.node < 0)
+            return i;
+        // Never evict something wanted this frame
+        if (slot.lastWanted != field.frame && (best < 0 || slot.lastWanted < field.slots[best].lastWanted))
+            best = i;
+    }
+    return best;
+}
+
+static void uploadChunk(StarField& field, int node, const std::vector<StarVertex>& stars) {
+    int index = acquireSlot(field);
+    if (index < 0)
+        return; // pool full of wanted chunks; it will be asked for again
+    StarField::Slot& slot = field.slots[index];
+    if (slot.node >= 0)
+        field.nodeSlot[slot.node] = -1;
+    slot.node = node;
+    slot.lastWanted = field.frame;
+    slot.magnitudes.resize(stars.size());
+    for (size_t i = 0; i < stars.size(); ++i)
+        slot.magnitudes[i] = stars[i].magnitude;
+    field.nodeSlot[node] = index;
+    slot.uploadedAt = ++field.uploads;
+
+    glBindBuffer(GL_ARRAY_BUFFER, field.VBO);
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)index * field.slotCapacity * sizeof(StarVertex),
+        stars.size() * sizeof(StarVertex), stars.data());
+}
+
+void updateStarField(StarField& field, const StarCatalog& catalog, const glm::vec3& cameraPos) {
+    TRACE_SCOPE("update star field");
+    ++field.frame;
+    if (catalog.nodes.empty())
+        return;
+
+    // Nodes whose brightest star could be visible, brightest first
+    std::vector<WantedNode> wanted;
+    std::vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        int index = stack.back();
+        stack.pop_back();
+        const StarNode& node = catalog.nodes[index];
+        float distance = distanceToNode(node, cameraPos);
+        float brightest = node.brightest + distanceModulus(distance);
+        if (brightest > field.limitingMagnitude)
+            continue;
+        wanted.push_back({ index, brightest });
+        for (int child : node.children) {
+            if (child >= 0)
+                stack.push_back(child);
+        }
+    }
+    std::sort(wanted.begin(), wanted.end(), [](const WantedNode& a, const WantedNode& b) {
+        return a.brightest < b.brightest;
+        });
+    if (wanted.size() > field.slots.size())
+        wanted.resize(field.slots.size());
+
+    bool empty = true;
+    for (const auto& w : wanted) {
+        int slot = field.nodeSlot[w.node];
+        if (slot >= 0) {
+            field.slots[slot].lastWanted = field.frame;
+            empty = false;
+        }
+    }
+
+    // Upload reads that have finished
+    for (auto it = field.pending.begin(); it != field.pending.end();) {
+        if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+        std::vector<StarVertex> stars = it->second.get();
+        if (!stars.empty())
+            uploadChunk(field, it->first, stars);
+        it = field.pending.erase(it);
+    }
+
+    // Ask for what's missing. With nothing resident yet (startup) read
+    // synchronously so the first frame isn't starless.
+    for (const auto& w : wanted) {
+        if (field.nodeSlot[w.node] >= 0 || field.pending.count(w.node))
+            continue;
+        const StarNode* node = &catalog.nodes[w.node];
+        if (empty) {
+            std::vector<StarVertex> stars;
+            if (readStarChunk(catalog, *node, stars))
+                uploadChunk(field, w.node, stars);
+        }
+        else if ((int)field.pending.size() < field.maxInFlight) {
+            field.pending[w.node] = std::async(std::launch::async, [&catalog, node]() {
+                std::vector<StarVertex> stars;
+                if (!readStarChunk(catalog, *node, stars))
+                    stars.clear();
+                return stars;
+                });
+        }
+    }
+}
+
+void prepareStarDraw(StarField& field, const StarCatalog& catalog, const glm::vec3& eye,
+    const glm::mat4& viewProjection, const StarShell& shell) {
+    field.drawFirst.clear();
+    field.drawCount.clear();
+    field.drawnStars = 0;
+    for (int index = 0; index < (int)field.slots.size(); ++index) {
+        const StarField::Slot& slot = field.slots[index];
+        if (slot.node < 0 || slot.lastWanted != field.frame)
+            continue;
+        const StarNode& node = catalog.nodes[slot.node];
+        if (!nodeInFrustum(node, viewProjection) || !nodeInShell(node, shell))
+            continue;
+        // Chunks are sorted bright to faint; the nearest a star can be bounds
+        // how faint it can be and still show
+        float faintest = field.limitingMagnitude - distanceModulus(distanceToNode(node, eye));
+        int count = (int)(std::upper_bound(slot.magnitudes.begin(), slot.magnitudes.end(), faintest) -
+            slot.magnitudes.begin());
+        if (count == 0)
+            continue;
+        field.drawFirst.push_back(index * field.slotCapacity);
+        field.drawCount.push_back(count);
+        field.drawnStars += count;
+    }
+}
+
+void drawStarField(const StarField& field) {
+    if (field.drawFirst.empty())
+        return;
+    glBindVertexArray(field.VAO);
+    glMultiDrawArrays(GL_POINTS, field.drawFirst.data(), field.drawCount.data(), (GLsizei)field.drawFirst.size());
+}
+
+bool starShellChangedSince(const StarField& field, const StarCatalog& catalog, const StarShell& shell,
+    unsigned since) {
+    if (field.uploads == since)
+        return false;
+    for (const StarField::Slot& slot : field.slots) {
+        if (slot.node >= 0 && slot.uploadedAt > since && nodeInShell(catalog.nodes[slot.node], shell))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cfloat>
+#include <future>
+#include <map>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "star_catalog.h"
+
+// GPU residency for a star catalog of any size.
+//
+// The vertex buffer is a fixed pool of chunk slots, so GPU memory and the
+// number of stars drawn are bounded no matter how big the catalog is. Each
+// frame the octree is walked from the root and a node is wanted when its
+// brightest star could reach limitingMagnitude from the camera (children
+// only hold fainter stars, so the walk stops there). The brightest wanted
+// nodes fill the pool; missing ones are read on worker threads, a few at a
+// time, and uploaded when ready, evicting the least recently wanted slot.
+// Wanted resident chunks inside the frustum are drawn with one
+// glMultiDrawArrays, each trimmed to the stars bright enough to be seen.
+struct StarField {
+    struct Slot {
+        int node;                      // -1 if free
+        unsigned lastWanted;
+        unsigned uploadedAt;           // `uploads` right after this chunk's upload
+        std::vector<float> magnitudes; // sorted, for trimming the draw
+
+        Slot() : node(-1), lastWanted(0), uploadedAt(0) {}
+    };
+
+    int slotCapacity; // stars per slot (the catalog chunk size)
+    int maxInFlight;
+    float limitingMagnitude;
+    std::vector<Slot> slots;
+    std::vector<int> nodeSlot; // per catalog node, -1 if not resident
+    std::map<int, std::future<std::vector<StarVertex>>> pending;
+    std::vector<GLint> drawFirst;
+    std::vector<GLsizei> drawCount;
+    unsigned frame;
+    unsigned uploads; // chunks uploaded so far, to notice the resident set changing
+    int drawnStars;
+
+    GLuint VAO;
+    GLuint VBO;
+
+    StarField()
+        : slotCapacity(0), maxInFlight(4), limitingMagnitude(6.5f), frame(0), uploads(0), drawnStars(0), VAO(0), VBO(0) {}
+};
+
+// Limits a draw to stars whose distance from `center` is in [minDistance, maxDistance).
+struct StarShell {
+    glm::vec3 center;
+    float minDistance;
+    float maxDistance;
+
+    StarShell() : center(0.0f), minDistance(0.0f), maxDistance(FLT_MAX) {}
+    StarShell(const glm::vec3& c, float minD, float maxD) : center(c), minDistance(minD), maxDistance(maxD) {}
+};
+
+// Attribute layout: 0 position (vec3), 1 magnitude (float), 2 colour (normalised RGBA8).
+void createStarField(StarField& field, const StarCatalog& catalog, int maxResidentChunks);
+void destroyStarField(StarField& field);
+
+// Picks the chunks to keep for this camera, issues reads and uploads
+// finished ones. Once per frame.
+void updateStarField(StarField& field, const StarCatalog& catalog, const glm::vec3& cameraPos);
+
+// Builds the draw list from the chunks kept this frame: those inside the
+// frustum and overlapping `shell`, trimmed to what can be seen from `eye`.
+// The shader must apply the same shell to individual stars.
+void prepareStarDraw(StarField& field, const StarCatalog& catalog, const glm::vec3& eye,
+    const glm::mat4& viewProjection, const StarShell& shell = StarShell());
+void drawStarField(const StarField& field);
+
+// True if a chunk overlapping `shell` was uploaded since `uploads` was
+// `since`, i.e. if drawing the shell now could look different.
+bool starShellChangedSince(const StarField& field, const StarCatalog& catalog, const StarShell& shell,
+    unsigned since);
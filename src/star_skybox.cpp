@@ -0,0 +1,114 @@
+#include "star_skybox.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "scene_depth.h"
+#include "trace.h"
+
+bool createStarSkybox(StarSkybox& skybox, int faceSize, float radius) {
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxSize);
+    skybox.faceSize = std::max(16, std::min(faceSize, (int)maxSize));
+    skybox.radius = radius;
+
+    glGenTextures(1, &skybox.cubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, skybox.cubemap);
+    for (int face = 0; face < 6; ++face) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_R11F_G11F_B10F, skybox.faceSize, skybox.faceSize, 0,
+            GL_RGB, GL_HALF_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    glGenFramebuffers(1, &skybox.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, skybox.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X, skybox.cubemap, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!complete) {
+        std::cerr << "ERROR: Star skybox framebuffer is incomplete" << std::endl;
+        return false;
+    }
+
+    glGenVertexArrays(1, &skybox.emptyVAO);
+    skybox.enabled = true;
+    skybox.valid = false;
+    return true;
+}
+
+void destroyStarSkybox(StarSkybox& skybox) {
+    if (!skybox.enabled)
+        return;
+    glDeleteFramebuffers(1, &skybox.fbo);
+    glDeleteTextures(1, &skybox.cubemap);
+    glDeleteVertexArrays(1, &skybox.emptyVAO);
+    skybox.fbo = skybox.cubemap = skybox.emptyVAO = 0;
+    skybox.enabled = false;
+}
+
+bool starSkyboxNeedsBake(const StarSkybox& skybox, const glm::vec3& cameraPos, bool distantStarsChanged) {
+    if (!skybox.valid || distantStarsChanged)
+        return true;
+    // A texel at the centre of a face spans 2 / faceSize radians
+    float tolerance = skybox.radius * skybox.rebakeTexels * 2.0f / skybox.faceSize;
+    return glm::length(cameraPos - skybox.bakedFrom) > tolerance;
+}
+
+void bakeStarSkybox(StarSkybox& skybox, const glm::vec3& position, unsigned starUploads,
+    const glm::vec3& background, const std::function<void(const glm::mat4&, const glm::mat4&)>& drawFace) {
+    TRACE_SCOPE("bake star skybox");
+    GLint outputFBO = 0, viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &outputFBO);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    // GL cubemap face order and orientation (+X, -X, +Y, -Y, +Z, -Z)
+    static const glm::vec3 forward[6] = {
+        glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0),
+        glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)
+    };
+    static const glm::vec3 up[6] = {
+        glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1),
+        glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0)
+    };
+    glm::mat4 projection = sceneProjection(glm::radians(90.0f), 1.0f, 0.1f, 10000.0f);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, skybox.fbo);
+    glViewport(0, 0, skybox.faceSize, skybox.faceSize);
+    glClearColor(background.r, background.g, background.b, 1.0f);
+    for (int face = 0; face < 6; ++face) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+            skybox.cubemap, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        drawFace(glm::lookAt(position, position + forward[face], up[face]), projection);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)outputFBO);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+
+    skybox.valid = true;
+    skybox.bakedFrom = position;
+    skybox.bakedUploads = starUploads;
+    ++skybox.bakeCount;
+}
+
+void drawStarSkybox(const StarSkybox& skybox, GLuint program) {
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, skybox.cubemap);
+    // Behind everything; nothing needs its depth
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(skybox.emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDepthMask(GL_TRUE);
+}
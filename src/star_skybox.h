@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+// Distant stars baked into an HDR cubemap.
+//
+// Stars at least `radius` from the bake position are rendered once into the
+// six faces and drawn every frame as a single fullscreen skybox pass; only
+// the nearer ones stay live sprites. From a camera `t` away from the bake
+// position the baked stars are off by at most t / radius radians, so the
+// cubemap is re-baked when that reaches rebakeTexels texels, or when the
+// star field has streamed in chunks with stars in the baked shell (nearer
+// chunks streaming in as the camera moves don't count).
+struct StarSkybox {
+    bool enabled;
+    int faceSize;
+    float radius;
+    float rebakeTexels;
+
+    GLuint cubemap; // R11F_G11F_B10F
+    GLuint fbo;
+    GLuint emptyVAO;
+
+    bool valid;
+    glm::vec3 bakedFrom;
+    unsigned bakedUploads; // StarField::uploads when baked
+    int bakeCount;
+
+    StarSkybox()
+        : enabled(false), faceSize(0), radius(4000.0f), rebakeTexels(1.0f), cubemap(0), fbo(0), emptyVAO(0),
+        valid(false), bakedFrom(0.0f), bakedUploads(0), bakeCount(0) {}
+};
+
+bool createStarSkybox(StarSkybox& skybox, int faceSize, float radius);
+void destroyStarSkybox(StarSkybox& skybox);
+
+// `distantStarsChanged`: see starShellChangedSince, for the shell outside
+// `radius` around bakedFrom and bakedUploads
+bool starSkyboxNeedsBake(const StarSkybox& skybox, const glm::vec3& cameraPos, bool distantStarsChanged);
+
+// Clears each face to `background` and calls drawFace with its view and
+// 90 degree projection; drawFace should draw the stars outside the radius.
+// Restores the framebuffer and viewport.
+void bakeStarSkybox(StarSkybox& skybox, const glm::vec3& position, unsigned starUploads,
+    const glm::vec3& background, const std::function<void(const glm::mat4&, const glm::mat4&)>& drawFace);
+
+// Draws a fullscreen triangle at the far plane with the cubemap on texture
+// unit 0. `program` maps gl_VertexID to a direction, see the skybox effect.
+void drawStarSkybox(const StarSkybox& skybox, GLuint program);
@@ -0,0 +1,239 @@
+#include "temporal_aa.h"
+
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "post_process.h"
+#include "shader_program.h"
+#include "trace.h"
+
+// Reprojects the history with the (dilated) velocity, clips it against the
+// current neighbourhood and blends in the new sample. All filtering happens
+// on colour compressed by 1 / (1 + max), so a few very bright pixels (the
+// sun) can't dominate the average and flicker.
+//
+// Render-space sample positions: pixel centre c saw the scene at c + jitter.
+// Each output pixel takes the nearest such sample, weighted by how close it
+// is, so below native resolution the history fills in over several frames.
+static const char* taaFragmentShaderSource = R"(
+#version 330 core
+in vec2 TexCoords;
+out vec4 FragColor;
+uniform sampler2D scene;
+uniform sampler2D velocity;
+uniform sampler2D history;
+uniform vec2 renderSize;  // rendered region, in scene pixels
+uniform vec2 outputScale; // output pixels per scene pixel
+uniform vec2 jitter;      // scene pixels
+uniform float feedback;
+uniform bool historyValid;
+
+#define VARIANCE_GAMMA 1.0
+
+vec3 compress(vec3 c) { return c / (1.0 + max(c.r, max(c.g, c.b))); }
+vec3 expand(vec3 c) { return c / max(1.0 - max(c.r, max(c.g, c.b)), 1e-4); }
+
+vec3 toYCoCg(vec3 c) {
+    return vec3(dot(c, vec3(0.25, 0.5, 0.25)), dot(c, vec3(0.5, 0.0, -0.5)), dot(c, vec3(-0.25, 0.5, -0.25)));
+}
+vec3 fromYCoCg(vec3 c) {
+    return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+ivec2 clampPixel(ivec2 p) {
+    return clamp(p, ivec2(0), ivec2(renderSize) - 1);
+}
+
+// Pulls `c` towards the box centre until it lies inside the box
+vec3 clipToBox(vec3 c, vec3 lo, vec3 hi) {
+    vec3 center = (lo + hi) * 0.5;
+    vec3 extent = max((hi - lo) * 0.5, 1e-5);
+    vec3 offset = c - center;
+    vec3 units = abs(offset / extent);
+    float maxUnit = max(units.x, max(units.y, units.z));
+    return maxUnit > 1.0 ? center + offset / maxUnit : c;
+}
+
+void main() {
+    vec2 renderPos = TexCoords * renderSize;
+    ivec2 pixel = clampPixel(ivec2(floor(renderPos - jitter)));
+    vec2 distance = (renderPos - (vec2(pixel) + 0.5 + jitter)) * outputScale;
+
+    // 3x3 neighbourhood statistics, and the longest motion in it so edges of
+    // moving objects reproject with the object rather than the background
+    vec3 current = vec3(0.0);
+    vec3 m1 = vec3(0.0), m2 = vec3(0.0);
+    vec3 lo = vec3(1e9), hi = vec3(-1e9);
+    vec2 motion = vec2(0.0);
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            ivec2 p = clampPixel(pixel + ivec2(x, y));
+            vec3 c = toYCoCg(compress(texelFetch(scene, p, 0).rgb));
+            if (x == 0 && y == 0)
+                current = c;
+            m1 += c;
+            m2 += c * c;
+            lo = min(lo, c);
+            hi = max(hi, c);
+            vec2 v = texelFetch(velocity, p, 0).xy;
+            if (dot(v, v) > dot(motion, motion))
+                motion = v;
+        }
+    }
+
+    vec2 previousUV = TexCoords - motion;
+    if (!historyValid || any(lessThan(previousUV, vec2(0.0))) || any(greaterThan(previousUV, vec2(1.0)))) {
+        FragColor = vec4(expand(fromYCoCg(current)), 1.0);
+        return;
+    }
+
+    vec3 mean = m1 / 9.0;
+    vec3 sigma = sqrt(max(m2 / 9.0 - mean * mean, 0.0)) * VARIANCE_GAMMA;
+    vec3 boxLo = max(lo, mean - sigma);
+    vec3 boxHi = min(hi, mean + sigma);
+    vec3 previous = toYCoCg(compress(texture(history, previousUV).rgb));
+    previous = clipToBox(previous, boxLo, boxHi);
+
+    // Samples far from the output pixel centre contribute less
+    float confidence = exp(-2.29 * dot(distance, distance));
+    float alpha = (1.0 - feedback) * confidence;
+    FragColor = vec4(expand(fromYCoCg(mix(previous, current, alpha))), 1.0);
+}
+)";
+
+glm::mat4 advanceMotion(MotionHistory& history, const glm::mat4& current) {
+    glm::mat4 previous = history.valid ? history.previous : current;
+    history.previous = current;
+    history.valid = true;
+    return previous;
+}
+
+static float halton(unsigned index, unsigned base) {
+    float result = 0.0f;
+    float f = 1.0f;
+    while (index > 0) {
+        f /= base;
+        result += f * (index % base);
+        index /= base;
+    }
+    return result;
+}
+
+static void destroyHistory(TemporalAA& taa) {
+    glDeleteFramebuffers(2, taa.historyFBO);
+    glDeleteTextures(2, taa.history);
+    taa.historyFBO[0] = taa.historyFBO[1] = 0;
+    taa.history[0] = taa.history[1] = 0;
+}
+
+static bool createHistory(TemporalAA& taa, int width, int height) {
+    taa.width = width;
+    taa.height = height;
+    taa.historyValid = false;
+    glGenTextures(2, taa.history);
+    glGenFramebuffers(2, taa.historyFBO);
+    bool complete = true;
+    for (int i = 0; i < 2; ++i) {
+        glBindTexture(GL_TEXTURE_2D, taa.history[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindFramebuffer(GL_FRAMEBUFFER, taa.historyFBO[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, taa.history[i], 0);
+        complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!complete)
+        std::cerr << "ERROR: TAA history framebuffer is incomplete" << std::endl;
+    return complete;
+}
+
+bool createTemporalAA(TemporalAA& taa, int width, int height) {
+    TRACE_SCOPE("createTemporalAA");
+    taa.program = buildProgram("taa_resolve", fullscreenVertexShaderSource, taaFragmentShaderSource);
+    if (!taa.program)
+        return false;
+    glUseProgram(taa.program);
+    glUniform1i(glGetUniformLocation(taa.program, "scene"), 0);
+    glUniform1i(glGetUniformLocation(taa.program, "velocity"), 1);
+    glUniform1i(glGetUniformLocation(taa.program, "history"), 2);
+    taa.enabled = true;
+    return createHistory(taa, width, height);
+}
+
+void destroyTemporalAA(TemporalAA& taa) {
+    if (!taa.enabled)
+        return;
+    destroyHistory(taa);
+    glDeleteProgram(taa.program);
+    taa.program = 0;
+    taa.enabled = false;
+}
+
+void beginTemporalAAFrame(TemporalAA& taa, const glm::mat4& view, const glm::mat4& projection,
+    int renderWidth, int renderHeight) {
+    glm::mat4 viewProjection = projection * view;
+    taa.previousViewProjection = taa.frameIndex > 0 ? taa.viewProjection : viewProjection;
+    taa.viewProjection = viewProjection;
+
+    if (!taa.enabled) {
+        taa.jitter = glm::vec2(0.0f);
+        taa.jitteredProjection = projection;
+        ++taa.frameIndex;
+        return;
+    }
+
+    // Halton starts at index 1; index 0 would be (0, 0) every cycle
+    unsigned phase = taa.frameIndex % TemporalAA::JITTER_PHASES + 1;
+    taa.jitter = glm::vec2(halton(phase, 2), halton(phase, 3)) - 0.5f;
+    // Moving the image by -jitter makes pixel centre c sample the scene at c + jitter
+    glm::vec3 offset(-2.0f * taa.jitter.x / renderWidth, -2.0f * taa.jitter.y / renderHeight, 0.0f);
+    taa.jitteredProjection = glm::translate(glm::mat4(1.0f), offset) * projection;
+    ++taa.frameIndex;
+}
+
+void applyTemporalAA(TemporalAA& taa, PostProcess& post) {
+    if (!taa.enabled || !post.sceneVelocity)
+        return;
+    TRACE_SCOPE("taa");
+    if (taa.width != post.width || taa.height != post.height) {
+        destroyHistory(taa);
+        createHistory(taa, post.width, post.height);
+    }
+
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, taa.historyFBO[taa.current]);
+    glViewport(0, 0, taa.width, taa.height);
+
+    glUseProgram(taa.program);
+    glUniform2f(glGetUniformLocation(taa.program, "renderSize"), (float)post.renderWidth, (float)post.renderHeight);
+    glUniform2f(glGetUniformLocation(taa.program, "outputScale"),
+        (float)taa.width / post.renderWidth, (float)taa.height / post.renderHeight);
+    glUniform2f(glGetUniformLocation(taa.program, "jitter"), taa.jitter.x, taa.jitter.y);
+    glUniform1f(glGetUniformLocation(taa.program, "feedback"), taa.feedback);
+    glUniform1i(glGetUniformLocation(taa.program, "historyValid"), taa.historyValid ? 1 : 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, post.sceneColor);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, post.sceneVelocity);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, taa.history[1 - taa.current]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(post.emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+
+    setPostProcessInput(post, taa.history[taa.current]);
+    taa.historyValid = true;
+    taa.current = 1 - taa.current;
+}
+
+void resetTemporalAA(TemporalAA& taa) {
+    taa.historyValid = false;
+}
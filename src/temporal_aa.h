@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+struct PostProcess;
+
+// Last frame's model matrix for one object, for motion vectors.
+struct MotionHistory {
+    glm::mat4 previous;
+    bool valid;
+
+    MotionHistory() : previous(1.0f), valid(false) {}
+};
+
+// Returns the matrix recorded last frame (or `current` on the first frame,
+// meaning no object motion) and records `current` for the next one.
+glm::mat4 advanceMotion(MotionHistory& history, const glm::mat4& current);
+
+// Temporal anti-aliasing and upscaling.
+//
+// Each frame the projection is offset by a sub-pixel Halton(2,3) jitter, so
+// over a few frames every pixel is sampled at different positions. The
+// resolve reprojects the accumulated history with the velocity buffer,
+// clamps it to the variance of the current 3x3 neighbourhood (which rejects
+// stale history after disocclusion), and blends in the new sample. The
+// history lives at output resolution, so when the scene renders below it
+// (dynamic resolution) the jittered samples fill in the missing detail over
+// time instead of being stretched.
+struct TemporalAA {
+    static const int JITTER_PHASES = 16;
+
+    bool enabled;
+    int width;
+    int height;
+    GLuint history[2]; // RGBA16F, output resolution
+    GLuint historyFBO[2];
+    int current;       // index written this frame
+    bool historyValid;
+    unsigned frameIndex;
+    float feedback;    // history weight when the new sample is centred on the pixel
+
+    glm::vec2 jitter;  // this frame's offset in render pixels
+    glm::mat4 jitteredProjection;
+    glm::mat4 viewProjection; // unjittered, this frame
+    glm::mat4 previousViewProjection;
+
+    GLuint program;
+
+    TemporalAA()
+        : enabled(false), width(0), height(0), current(0), historyValid(false), frameIndex(0), feedback(0.9f),
+        jitter(0.0f), jitteredProjection(1.0f), viewProjection(1.0f), previousViewProjection(1.0f), program(0) {
+        history[0] = history[1] = 0;
+        historyFBO[0] = historyFBO[1] = 0;
+    }
+};
+
+bool createTemporalAA(TemporalAA& taa, int width, int height);
+void destroyTemporalAA(TemporalAA& taa);
+
+// Picks this frame's jitter and sets jitteredProjection and the view-projection
+// matrices used for motion vectors. When disabled jitteredProjection is just
+// `projection`.
+void beginTemporalAAFrame(TemporalAA& taa, const glm::mat4& view, const glm::mat4& projection,
+    int renderWidth, int renderHeight);
+
+// Resolves the scene region of `post` into the history and makes it the
+// post-process input. Reallocates (and drops the history) on resize.
+void applyTemporalAA(TemporalAA& taa, PostProcess& post);
+
+// Forget the accumulated history, e.g. after a camera cut.
+void resetTemporalAA(TemporalAA& taa);
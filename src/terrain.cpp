@@ -0,0 +1,530 @@
+#include "terrain.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "scene_depth.h"
+#include "trace.h"
+#include "vertex_format.h"
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+
+struct TerrainNode {
+    int face;
+    int level;
+    uint32_t x;
+    uint32_t y;
+};
+
+struct NodeBounds {
+    glm::vec3 center;
+    float radius;
+};
+
+struct Selection {
+    Terrain* terrain;
+    glm::vec3 camera;
+    glm::vec4 planes[5];
+    float ranges[TERRAIN_MAX_LEVEL + 2];
+};
+
+}
+
+// Cube face normal and the directions of its x and y face coordinates.
+// Must match the terrain vertex shader.
+static const double FACE_FRAMES[6][3][3] = {
+    { { 1, 0, 0 }, { 0, 0, -1 }, { 0, 1, 0 } },
+    { { -1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 } },
+    { { 0, 1, 0 }, { 1, 0, 0 }, { 0, 0, -1 } },
+    { { 0, -1, 0 }, { 1, 0, 0 }, { 0, 0, 1 } },
+    { { 0, 0, 1 }, { 1, 0, 0 }, { 0, 1, 0 } },
+    { { 0, 0, -1 }, { -1, 0, 0 }, { 0, 1, 0 } },
+};
+
+// Face coordinates in [-1, 1] to a unit vector. The tangent warp spaces
+// equal steps at equal angles along the axes, so cells vary less in size
+// than with a plain normalize.
+static glm::dvec3 faceDirection(int face, double a, double b) {
+    const double (*frame)[3] = FACE_FRAMES[face];
+    double u = std::tan(a * PI / 4.0), v = std::tan(b * PI / 4.0);
+    return glm::normalize(glm::dvec3(frame[0][0] + frame[1][0] * u + frame[2][0] * v,
+        frame[0][1] + frame[1][1] * u + frame[2][1] * v, frame[0][2] + frame[1][2] * u + frame[2][2] * v));
+}
+
+static uint64_t nodeKey(const TerrainNode& node) {
+    return (uint64_t)node.face << 61 | (uint64_t)node.level << 56 | (uint64_t)node.x << 28 | node.y;
+}
+
+static TerrainNode keyNode(uint64_t key) {
+    return { (int)(key >> 61), (int)(key >> 56 & 31), (uint32_t)(key >> 28 & 0xFFFFFFF),
+        (uint32_t)(key & 0xFFFFFFF) };
+}
+
+static double nodeSize(int level) {
+    return 2.0 / (double)(1u << level);
+}
+
+static TerrainNode childNode(const TerrainNode& node, int quadrant) {
+    return { node.face, node.level + 1, node.x * 2 + (quadrant & 1), node.y * 2 + (quadrant >> 1) };
+}
+
+static uint32_t hashLattice(int x, int y, int z, unsigned seed) {
+    uint32_t h = seed * 0x9E3779B1u;
+    h = (h ^ (uint32_t)x * 0x85EBCA77u) * 0xC2B2AE3Du;
+    h = (h ^ (uint32_t)y * 0x27D4EB2Fu) * 0x165667B1u;
+    h = (h ^ (uint32_t)z * 0x85EBCA77u) * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h;
+}
+
+// Dot product with one of the 12 cube edge directions
+static double gradientDot(uint32_t hash, double x, double y, double z) {
+    switch (hash % 12) {
+    case 0: return x + y;
+    case 1: return -x + y;
+    case 2: return x - y;
+    case 3: return -x - y;
+    case 4: return x + z;
+    case 5: return -x + z;
+    case 6: return x - z;
+    case 7: return -x - z;
+    case 8: return y + z;
+    case 9: return -y + z;
+    case 10: return y - z;
+    default: return -y - z;
+    }
+}
+
+static double fade(double t) {
+    return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);
+}
+
+// Perlin gradient noise, roughly in [-1, 1]
+static double gradientNoise(const glm::dvec3& p, unsigned seed) {
+    glm::dvec3 cell = glm::floor(p);
+    glm::dvec3 f = p - cell;
+    int x = (int)cell.x, y = (int)cell.y, z = (int)cell.z;
+    double corners[8];
+    for (int i = 0; i < 8; ++i) {
+        int dx = i & 1, dy = i >> 1 & 1, dz = i >> 2;
+        corners[i] = gradientDot(hashLattice(x + dx, y + dy, z + dz, seed), f.x - dx, f.y - dy, f.z - dz);
+    }
+    double u = fade(f.x), v = fade(f.y), w = fade(f.z);
+    double x00 = corners[0] + (corners[1] - corners[0]) * u;
+    double x10 = corners[2] + (corners[3] - corners[2]) * u;
+    double x01 = corners[4] + (corners[5] - corners[4]) * u;
+    double x11 = corners[6] + (corners[7] - corners[6]) * u;
+    double y0 = x00 + (x10 - x00) * v;
+    double y1 = x01 + (x11 - x01) * v;
+    return y0 + (y1 - y0) * w;
+}
+
+// Octaves halve in amplitude as they double in frequency, so slopes look
+// alike at every scale
+static double fractalNoise(const glm::dvec3& dir, unsigned seed, int octaves) {
+    double sum = 0.0, amplitude = 1.0, total = 0.0, frequency = 1.5;
+    for (int octave = 0; octave < octaves; ++octave) {
+        sum += amplitude * gradientNoise(dir * frequency, seed + octave * 101u);
+        total += amplitude;
+        amplitude *= 0.5;
+        frequency *= 2.0;
+    }
+    return sum / total * 1.6;
+}
+
+// Bilinear, mapped like the planet textures (see generateSphere)
+static double sampleDem(const Heightmap& dem, const glm::dvec3& dir) {
+    double u = std::atan2(dir.z, dir.x) / (2.0 * PI);
+    u -= std::floor(u);
+    double v = std::asin(std::min(std::max(dir.y, -1.0), 1.0)) / PI + 0.5;
+    double x = u * dem.width - 0.5, y = v * dem.height - 0.5;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    double fx = x - x0, fy = y - y0;
+    auto at = [&](int i, int j) {
+        i = (i % dem.width + dem.width) % dem.width;
+        j = std::min(std::max(j, 0), dem.height - 1);
+        return (double)dem.samples[(size_t)j * dem.width + i];
+        };
+    double bottom = at(x0, y0) + (at(x0 + 1, y0) - at(x0, y0)) * fx;
+    double top = at(x0, y0 + 1) + (at(x0 + 1, y0 + 1) - at(x0, y0 + 1)) * fx;
+    return bottom + (top - bottom) * fy;
+}
+
+float terrainHeight(const TerrainHeights& heights, const glm::dvec3& dir) {
+    double h;
+    if (heights.dem.samples.empty())
+        h = fractalNoise(dir, heights.seed, heights.octaves);
+    else
+        h = sampleDem(heights.dem, dir) * 2.0 - 1.0 +
+            heights.demDetail * fractalNoise(dir, heights.seed, heights.octaves);
+    return (float)(heights.amplitude * std::min(std::max(h, -1.0), 1.0));
+}
+
+Heightmap bakeTerrainHeightmap(const TerrainHeights& heights, int width, int height) {
+    TRACE_SCOPE("bake terrain heightmap");
+    Heightmap map;
+    map.width = width;
+    map.height = height;
+    map.samples.resize((size_t)width * height);
+    auto bakeRows = [&](int first, int last) {
+        for (int j = first; j < last; ++j) {
+            double latitude = ((j + 0.5) / height - 0.5) * PI;
+            for (int i = 0; i < width; ++i) {
+                double longitude = (i + 0.5) / width * 2.0 * PI;
+                glm::dvec3 dir(std::cos(longitude) * std::cos(latitude), std::sin(latitude),
+                    std::sin(longitude) * std::cos(latitude));
+                map.samples[(size_t)j * width + i] = terrainHeight(heights, dir) / heights.amplitude * 0.5f + 0.5f;
+            }
+        }
+        };
+    // A few million noise samples; spread the rows over the cores
+    int jobs = std::max(1, std::min((int)std::thread::hardware_concurrency(), height));
+    std::vector<std::future<void>> bands;
+    for (int job = 1; job < jobs; ++job)
+        bands.push_back(std::async(std::launch::async, bakeRows, height * job / jobs, height * (job + 1) / jobs));
+    bakeRows(0, height / jobs);
+    for (auto& band : bands)
+        band.get();
+    return map;
+}
+
+// Heights at the node's grid points plus a one-sample border, row by row
+static std::vector<float> generateTile(const TerrainHeights& heights, uint64_t key) {
+    TRACE_SCOPE("generate terrain tile");
+    TerrainNode node = keyNode(key);
+    double size = nodeSize(node.level);
+    double x0 = -1.0 + node.x * size, y0 = -1.0 + node.y * size;
+    std::vector<float> tile(TERRAIN_TILE_SIZE * TERRAIN_TILE_SIZE);
+    for (int j = 0; j < TERRAIN_TILE_SIZE; ++j) {
+        for (int i = 0; i < TERRAIN_TILE_SIZE; ++i) {
+            glm::dvec3 dir = faceDirection(node.face, x0 + (i - 1) * size / TERRAIN_GRID,
+                y0 + (j - 1) * size / TERRAIN_GRID);
+            tile[j * TERRAIN_TILE_SIZE + i] = terrainHeight(heights, dir);
+        }
+    }
+    return tile;
+}
+
+// From a 3x3 sample of the node between the lowest and highest possible
+// heights, grown by how far the sphere bulges between samples
+static NodeBounds nodeBounds(const Terrain& terrain, const TerrainNode& node) {
+    double size = nodeSize(node.level);
+    double x0 = -1.0 + node.x * size, y0 = -1.0 + node.y * size;
+    double low = 1.0 - terrain.heights.amplitude, high = 1.0 + terrain.heights.amplitude;
+    glm::dvec3 points[18];
+    glm::dvec3 boxMin(DBL_MAX), boxMax(-DBL_MAX);
+    for (int i = 0; i < 9; ++i) {
+        glm::dvec3 dir = faceDirection(node.face, x0 + size * 0.5 * (i % 3), y0 + size * 0.5 * (i / 3));
+        points[i * 2] = dir * low;
+        points[i * 2 + 1] = dir * high;
+        boxMin = glm::min(boxMin, glm::min(points[i * 2], points[i * 2 + 1]));
+        boxMax = glm::max(boxMax, glm::max(points[i * 2], points[i * 2 + 1]));
+    }
+    glm::dvec3 center = (boxMin + boxMax) * 0.5;
+    double radius = 0.0;
+    for (const auto& p : points)
+        radius = std::max(radius, glm::length(p - center));
+    radius += high * (1.0 - std::cos(size * PI / 8.0 * std::sqrt(2.0)));
+    return { glm::vec3(center), (float)radius };
+}
+
+// Side and near planes, like the meshlets
+static bool inFrustum(const NodeBounds& bounds, const glm::vec4 planes[5]) {
+    for (int p = 0; p < 5; ++p) {
+        glm::vec3 normal(planes[p]);
+        if (glm::dot(normal, bounds.center) + planes[p].w < -bounds.radius * glm::length(normal))
+            return false;
+    }
+    return true;
+}
+
+static void addQuadrant(Selection& selection, const TerrainNode& node, int slot, int quadrant) {
+    double size = nodeSize(node.level);
+    const int half = TERRAIN_GRID / 2;
+    Terrain::Instance instance;
+    instance.node[0] = (float)(-1.0 + node.x * size);
+    instance.node[1] = (float)(-1.0 + node.y * size);
+    instance.node[2] = (float)size;
+    instance.node[3] = (float)node.face;
+    instance.tile[0] = (float)slot;
+    instance.tile[1] = (float)((quadrant & 1) * half);
+    instance.tile[2] = (float)((quadrant >> 1) * half);
+    instance.tile[3] = (float)(size * PI / 4.0 / TERRAIN_GRID * 2.0); // skirts two quads deep
+    // Roots are never replaced by a parent, so never morph
+    float range = selection.ranges[node.level];
+    instance.morph[0] = node.level == 0 ? 1e30f : range * 0.75f;
+    instance.morph[1] = node.level == 0 ? 2e30f : range;
+    selection.terrain->instances.push_back(instance);
+}
+
+// Draws the node, or its children where they are wanted and resident.
+// False when the node is beyond its level's range and the parent has to
+// cover the area instead.
+static bool selectNode(Selection& selection, const TerrainNode& node, int slot) {
+    Terrain& terrain = *selection.terrain;
+    terrain.slots[slot].lastWanted = terrain.frame;
+    NodeBounds bounds = nodeBounds(terrain, node);
+    float distance = glm::length(bounds.center - selection.camera) - bounds.radius;
+    if (distance > selection.ranges[node.level])
+        return false;
+    if (!inFrustum(bounds, selection.planes))
+        return true;
+    if (node.level == terrain.maxLevel || distance > selection.ranges[node.level + 1]) {
+        for (int quadrant = 0; quadrant < 4; ++quadrant)
+            addQuadrant(selection, node, slot, quadrant);
+        return true;
+    }
+
+    for (int quadrant = 0; quadrant < 4; ++quadrant) {
+        TerrainNode child = childNode(node, quadrant);
+        uint64_t key = nodeKey(child);
+        auto resident = terrain.nodeSlot.find(key);
+        if (resident != terrain.nodeSlot.end()) {
+            if (!selectNode(selection, child, resident->second))
+                addQuadrant(selection, node, slot, quadrant);
+            continue;
+        }
+        // Not there yet: cover it, and ask for it if it would be drawn.
+        // Coarse levels first, then nearest.
+        NodeBounds childBounds = nodeBounds(terrain, child);
+        if (!inFrustum(childBounds, selection.planes))
+            continue;
+        float childDistance = glm::length(childBounds.center - selection.camera) - childBounds.radius;
+        float range = selection.ranges[child.level];
+        if (childDistance <= range)
+            terrain.requests.push_back({ child.level + std::max(childDistance, 0.0f) / range * 0.99f, key });
+        addQuadrant(selection, node, slot, quadrant);
+    }
+    return true;
+}
+
+// Free slot or the least recently wanted one, never one wanted this frame
+static int acquireSlot(Terrain& terrain) {
+    int best = -1;
+    for (int i = 0; i < (int)terrain.slots.size(); ++i) {
+        const Terrain::Slot& slot = terrain.slots[i];
+        if (slot.node == TERRAIN_NO_NODE)
+            return i;
+        if (slot.lastWanted != terrain.frame && (best < 0 || slot.lastWanted < terrain.slots[best].lastWanted))
+            best = i;
+    }
+    return best;
+}
+
+static void uploadTile(Terrain& terrain, uint64_t key, const std::vector<float>& heights) {
+    int index = acquireSlot(terrain);
+    if (index < 0)
+        return; // all wanted; it will be asked for again
+    Terrain::Slot& slot = terrain.slots[index];
+    if (slot.node != TERRAIN_NO_NODE)
+        terrain.nodeSlot.erase(slot.node);
+    slot.node = key;
+    slot.lastWanted = terrain.frame;
+    terrain.nodeSlot[key] = index;
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, terrain.heightTexture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, index, TERRAIN_TILE_SIZE, TERRAIN_TILE_SIZE, 1, GL_RED, GL_FLOAT,
+        heights.data());
+}
+
+// A quadrant of a node's grid: (x, y, skirt) per vertex, with a skirt hanging
+// from each edge to hide cracks between levels
+static void createGrid(Terrain& terrain) {
+    const int n = TERRAIN_GRID / 2;
+    std::vector<float> vertices;
+    std::vector<unsigned short> indices;
+    auto vertex = [&](int x, int y, int skirt) {
+        vertices.push_back((float)x);
+        vertices.push_back((float)y);
+        vertices.push_back((float)skirt);
+        return (unsigned short)(vertices.size() / 3 - 1);
+        };
+    auto quad = [&](unsigned short a, unsigned short b, unsigned short c, unsigned short d) {
+        indices.insert(indices.end(), { a, b, c, c, b, d });
+        };
+
+    for (int y = 0; y <= n; ++y) {
+        for (int x = 0; x <= n; ++x)
+            vertex(x, y, 0);
+    }
+    for (int y = 0; y < n; ++y) {
+        for (int x = 0; x < n; ++x) {
+            unsigned short i = (unsigned short)(y * (n + 1) + x);
+            quad(i, (unsigned short)(i + 1), (unsigned short)(i + n + 1), (unsigned short)(i + n + 2));
+        }
+    }
+
+    const int edges[4][4] = { { 0, 0, 1, 0 }, { 0, n, 1, 0 }, { 0, 0, 0, 1 }, { n, 0, 0, 1 } }; // start, step
+    for (const auto& edge : edges) {
+        unsigned short previousTop = 0, previousSkirt = 0;
+        for (int i = 0; i <= n; ++i) {
+            int x = edge[0] + edge[2] * i, y = edge[1] + edge[3] * i;
+            unsigned short top = (unsigned short)(y * (n + 1) + x);
+            unsigned short skirt = vertex(x, y, 1);
+            if (i > 0)
+                quad(previousTop, top, previousSkirt, skirt);
+            previousTop = top;
+            previousSkirt = skirt;
+        }
+    }
+    terrain.gridIndexCount = (GLsizei)indices.size();
+
+    glGenVertexArrays(1, &terrain.gridVAO);
+    glGenBuffers(1, &terrain.gridVBO);
+    glGenBuffers(1, &terrain.gridEBO);
+    glGenBuffers(1, &terrain.instanceVBO);
+    glBindVertexArray(terrain.gridVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, terrain.gridVBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    applyVertexLayout(VertexLayout(3 * sizeof(float)).add(0, 3, GL_FLOAT, GL_FALSE, 0));
+    glBindBuffer(GL_ARRAY_BUFFER, terrain.instanceVBO);
+    applyVertexLayout(VertexLayout(sizeof(Terrain::Instance))
+        .add(1, 4, GL_FLOAT, GL_FALSE, offsetof(Terrain::Instance, node), 1)
+        .add(2, 4, GL_FLOAT, GL_FALSE, offsetof(Terrain::Instance, tile), 1)
+        .add(3, 2, GL_FLOAT, GL_FALSE, offsetof(Terrain::Instance, morph), 1));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain.gridEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
+
+void createTerrain(Terrain& terrain, const TerrainHeights& heights, int tileCapacity, int maxLevel) {
+    TRACE_SCOPE("createTerrain");
+    terrain.heights = heights;
+    terrain.maxLevel = std::min(std::max(maxLevel, 0), TERRAIN_MAX_LEVEL);
+    // Finest octave about two grid quads at the deepest level
+    terrain.heights.octaves = terrain.maxLevel + 3;
+
+    GLint maxLayers = 256;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    terrain.slots.assign(std::min(std::max(tileCapacity, 30), (int)maxLayers), Terrain::Slot());
+
+    glGenTextures(1, &terrain.heightTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, terrain.heightTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, TERRAIN_TILE_SIZE, TERRAIN_TILE_SIZE, (GLsizei)terrain.slots.size(),
+        0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    createGrid(terrain);
+
+    // The roots, so there is always something to draw
+    for (int face = 0; face < 6; ++face) {
+        uint64_t key = nodeKey({ face, 0, 0, 0 });
+        uploadTile(terrain, key, generateTile(terrain.heights, key));
+        ++terrain.generatedTiles;
+    }
+
+    std::cout << "Terrain: " << terrain.slots.size() << " tile slots ("
+        << terrain.slots.size() * TERRAIN_TILE_SIZE * TERRAIN_TILE_SIZE * sizeof(float) / 1024 << " KB), "
+        << terrain.maxLevel + 1 << " levels" << (terrain.heights.dem.samples.empty() ? "" : ", from a DEM")
+        << std::endl;
+}
+
+void destroyTerrain(Terrain& terrain) {
+    for (auto& request : terrain.pending)
+        request.second.wait();
+    terrain.pending.clear();
+    if (terrain.heightTexture)
+        std::cout << "Terrain: " << terrain.generatedTiles << " tiles generated" << std::endl;
+    glDeleteTextures(1, &terrain.heightTexture);
+    glDeleteVertexArrays(1, &terrain.gridVAO);
+    glDeleteBuffers(1, &terrain.gridVBO);
+    glDeleteBuffers(1, &terrain.gridEBO);
+    glDeleteBuffers(1, &terrain.instanceVBO);
+    terrain.heightTexture = terrain.gridVAO = terrain.gridVBO = terrain.gridEBO = terrain.instanceVBO = 0;
+    terrain.slots.clear();
+    terrain.nodeSlot.clear();
+    terrain.instances.clear();
+}
+
+void updateTerrain(Terrain& terrain, const glm::vec3& cameraLocal, const glm::mat4& localViewProjection,
+    float pixelsPerUnit) {
+    TRACE_SCOPE("update terrain");
+    ++terrain.frame;
+    terrain.camera = cameraLocal;
+
+    Selection selection;
+    selection.terrain = &terrain;
+    selection.camera = cameraLocal;
+    glm::mat4 m = glm::transpose(localViewProjection);
+    selection.planes[0] = m[3] + m[0];
+    selection.planes[1] = m[3] - m[0];
+    selection.planes[2] = m[3] + m[1];
+    selection.planes[3] = m[3] - m[1];
+    selection.planes[4] = frustumNearPlane(m);
+    // A level is used from where its quads shrink to pixelsPerQuad, which is
+    // where the next level's quads would reach twice that
+    selection.ranges[0] = FLT_MAX;
+    for (int level = 1; level <= TERRAIN_MAX_LEVEL + 1; ++level) {
+        double quadAngle = PI / 2.0 / std::ldexp(1.0, level) / TERRAIN_GRID;
+        selection.ranges[level] = (float)(2.0 * quadAngle * pixelsPerUnit / terrain.pixelsPerQuad);
+    }
+
+    terrain.instances.clear();
+    terrain.requests.clear();
+    for (int face = 0; face < 6; ++face) {
+        TerrainNode root = { face, 0, 0, 0 };
+        selectNode(selection, root, terrain.nodeSlot.at(nodeKey(root)));
+    }
+
+    // Finished tiles, a few per frame to keep frame times steady. They are
+    // drawn from the next frame on.
+    int uploads = 0;
+    for (auto it = terrain.pending.begin(); it != terrain.pending.end() && uploads < terrain.maxUploadsPerFrame;) {
+        if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+        uploadTile(terrain, it->first, it->second.get());
+        ++uploads;
+        it = terrain.pending.erase(it);
+    }
+
+    std::sort(terrain.requests.begin(), terrain.requests.end());
+    for (const auto& request : terrain.requests) {
+        if ((int)terrain.pending.size() >= terrain.maxInFlight)
+            break;
+        uint64_t key = request.second;
+        if (terrain.pending.count(key))
+            continue;
+        const TerrainHeights* heights = &terrain.heights;
+        terrain.pending[key] = std::async(std::launch::async, [heights, key]() {
+            return generateTile(*heights, key);
+            });
+        ++terrain.generatedTiles;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, terrain.instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, terrain.instances.size() * sizeof(Terrain::Instance), terrain.instances.data(),
+        GL_STREAM_DRAW);
+}
+
+float terrainAltitude(const Terrain& terrain, const glm::vec3& cameraLocal) {
+    float distance = glm::length(cameraLocal);
+    if (distance <= 0.0f)
+        return 0.0f;
+    return distance - 1.0f - terrainHeight(terrain.heights, glm::dvec3(cameraLocal) / (double)distance);
+}
+
+void drawTerrain(const Terrain& terrain, GLuint program) {
+    if (terrain.instances.empty())
+        return;
+    glUniform3fv(glGetUniformLocation(program, "cameraLocal"), 1, glm::value_ptr(terrain.camera));
+    glUniform1i(glGetUniformLocation(program, "heightTiles"), 1);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, terrain.heightTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(terrain.gridVAO);
+    glDrawElementsInstanced(GL_TRIANGLES, terrain.gridIndexCount, GL_UNSIGNED_SHORT, nullptr,
+        (GLsizei)terrain.instances.size());
+}
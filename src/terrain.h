@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "texture.h"
+
+// Quadtree terrain on a cube-sphere, after Strugar, "Continuous Distance-
+// Dependent Level of Detail for Rendering Heightmaps" (CDLOD).
+//
+// Each cube face is a quadtree; a node covers a square of the face and has a
+// height tile of TERRAIN_GRID quads (plus a border sample for normals). Every
+// level has a distance range, twice its child's; each frame the tree is
+// walked from the six roots, descending where the camera is within the
+// child's range. A node is drawn as a fixed grid mesh displaced by its tile,
+// with the vertices in the outer quarter of its range morphed onto the
+// parent's grid so neighbouring levels meet without cracks (skirts hide the
+// rest). Nodes are drawn a quadrant at a time, so a node can stand in for a
+// child whose tile isn't there yet, or that isn't wanted, with part of
+// itself.
+//
+// Tiles are generated on worker threads, a few at a time, into a fixed pool
+// of texture array layers, evicting the least recently wanted; GPU memory
+// is bounded by the pool whatever the altitude. The six roots are made up
+// front. Everything is in the body's local space: a unit sphere raised by
+// the heights.
+const int TERRAIN_GRID = 32;                    // quads along a node edge
+const int TERRAIN_TILE_SIZE = TERRAIN_GRID + 3; // height samples along a tile edge, border included
+const int TERRAIN_MAX_LEVEL = 20;
+const uint64_t TERRAIN_NO_NODE = ~0ull;
+
+// Height source, read by the workers. Heights are in units of the radius.
+struct TerrainHeights {
+    unsigned seed;
+    float amplitude;   // largest height above or below the sphere
+    Heightmap dem;     // equirectangular, mapped like the planet texture; empty = procedural
+    float demDetail;   // procedural detail added to a DEM, relative to amplitude
+    int octaves;       // enough to keep adding detail at the deepest level
+
+    TerrainHeights() : seed(1), amplitude(0.01f), demDetail(0.15f), octaves(15) {}
+};
+
+// Height above the unit sphere in direction `dir` (normalized).
+float terrainHeight(const TerrainHeights& heights, const glm::dvec3& dir);
+
+// The heights resampled to an equirectangular map mapped like the planet
+// textures, -amplitude..amplitude stored as 0..1. Thread-safe.
+Heightmap bakeTerrainHeightmap(const TerrainHeights& heights, int width, int height);
+
+struct Terrain {
+    struct Slot {
+        uint64_t node;      // TERRAIN_NO_NODE if free
+        unsigned lastWanted;
+
+        Slot() : node(TERRAIN_NO_NODE), lastWanted(0) {}
+    };
+
+    // Per quadrant drawn, attributes 1-3
+    struct Instance {
+        float node[4];  // face x, y of the node's corner, node size, face
+        float tile[4];  // layer, quadrant x, y in grid quads, skirt depth
+        float morph[2]; // distances where morphing starts and ends
+    };
+
+    TerrainHeights heights;
+    int maxLevel;
+    float pixelsPerQuad; // target size of a grid quad on screen
+    int maxInFlight;
+    int maxUploadsPerFrame;
+    std::vector<Slot> slots;
+    std::unordered_map<uint64_t, int> nodeSlot;
+    std::map<uint64_t, std::future<std::vector<float>>> pending;
+    std::vector<std::pair<float, uint64_t>> requests; // missing tiles this frame, by priority
+    std::vector<Instance> instances;
+    unsigned frame;
+    glm::vec3 camera; // at the last update, body space
+    long long generatedTiles;
+
+    GLuint heightTexture; // R32F array, one layer per slot
+    GLuint gridVAO;
+    GLuint gridVBO;
+    GLuint gridEBO;
+    GLuint instanceVBO;
+    GLsizei gridIndexCount;
+
+    Terrain()
+        : maxLevel(12), pixelsPerQuad(8.0f), maxInFlight(4), maxUploadsPerFrame(8), frame(0), camera(0.0f),
+        generatedTiles(0), heightTexture(0), gridVAO(0), gridVBO(0), gridEBO(0), instanceVBO(0),
+        gridIndexCount(0) {}
+};
+
+// Takes the height source; `tileCapacity` bounds the resident tiles.
+void createTerrain(Terrain& terrain, const TerrainHeights& heights, int tileCapacity, int maxLevel);
+void destroyTerrain(Terrain& terrain);
+
+// Selects the nodes to draw for a camera at `cameraLocal` (body space),
+// issues tile requests and uploads finished ones. `localViewProjection` is
+// viewProjection * model, `pixelsPerUnit` the projected size of one local
+// unit at local distance one (the focal length in pixels, as the scale
+// cancels out). Once per frame per body.
+void updateTerrain(Terrain& terrain, const glm::vec3& cameraLocal, const glm::mat4& localViewProjection,
+    float pixelsPerUnit);
+
+// Camera height over the surface, in units of the radius.
+float terrainAltitude(const Terrain& terrain, const glm::vec3& cameraLocal);
+
+// Binds the height tiles on texture unit 1 and draws the selection with
+// `program` (the terrain effect, sampling them as `heightTiles`).
+void drawTerrain(const Terrain& terrain, GLuint program);
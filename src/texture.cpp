@@ -0,0 +1,102 @@
+#include "texture.h"
+
+#include <cstdint>
+#include <iostream>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "tinygltf/stb_image.h"
+
+#include "trace.h"
+
+DecodedImage decodeTexture(const std::string& path) {
+    TRACE_SCOPE("decodeTexture");
+    DecodedImage image;
+    image.path = path;
+    // Per-thread flag, so decodes on worker threads don't race on the global
+    stbi_set_flip_vertically_on_load_thread(true);
+    image.data = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0);
+    return image;
+}
+
+unsigned int uploadTexture(DecodedImage& image, bool srgb) {
+    TRACE_SCOPE("uploadTexture");
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    if (image.data) {
+        GLenum format = GL_RGB;
+        if (image.channels == 1)
+            format = GL_RED;
+        else if (image.channels == 3)
+            format = GL_RGB;
+        else if (image.channels == 4)
+            format = GL_RGBA;
+
+        // Single-channel images have no sRGB format and are treated as data
+        GLint internalFormat = (GLint)format;
+        if (srgb && format == GL_RGB)
+            internalFormat = GL_SRGB8;
+        else if (srgb && format == GL_RGBA)
+            internalFormat = GL_SRGB8_ALPHA8;
+
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        stbi_image_free(image.data);
+        image.data = nullptr;
+    }
+    else {
+        std::cout << "Failed to load texture: " << image.path << std::endl;
+    }
+
+    return textureID;
+}
+
+Heightmap decodeHeightmap(const std::string& path) {
+    TRACE_SCOPE("decodeHeightmap");
+    Heightmap map;
+    stbi_set_flip_vertically_on_load_thread(true);
+    int channels = 0;
+    stbi_us* data = stbi_load_16(path.c_str(), &map.width, &map.height, &channels, 1);
+    if (!data) {
+        map.width = map.height = 0;
+        return map;
+    }
+    map.samples.resize((size_t)map.width * map.height);
+    for (size_t i = 0; i < map.samples.size(); ++i)
+        map.samples[i] = data[i] / 65535.0f;
+    stbi_image_free(data);
+    return map;
+}
+
+unsigned int uploadHeightmap(const Heightmap& map) {
+    TRACE_SCOPE("uploadHeightmap");
+    std::vector<uint16_t> texels(map.samples.size());
+    for (size_t i = 0; i < texels.size(); ++i)
+        texels[i] = (uint16_t)(map.samples[i] * 65535.0f + 0.5f);
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, map.width, map.height, 0, GL_RED, GL_UNSIGNED_SHORT, texels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return textureID;
+}
+
+unsigned int loadTexture(const std::string& path, bool srgb) {
+    DecodedImage image = decodeTexture(path);
+    return uploadTexture(image, srgb);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Pixels decoded from an image file, not yet uploaded to GL.
+struct DecodedImage {
+    std::string path;
+    int width;
+    int height;
+    int channels;
+    unsigned char* data; // owned, released by uploadTexture
+
+    DecodedImage() : width(0), height(0), channels(0), data(nullptr) {}
+};
+
+// CPU-only and thread-safe, so several images can be decoded on worker threads
+// while the GL thread does other startup work. Rows are flipped bottom-first.
+DecodedImage decodeTexture(const std::string& path);
+
+// Creates a mipmapped, repeating 2D texture from a decoded image and frees its
+// pixels. Must run on the GL thread. Colour images are stored as sRGB so
+// sampling returns linear values; pass srgb = false for data textures.
+unsigned int uploadTexture(DecodedImage& image, bool srgb = true);
+
+unsigned int loadTexture(const std::string& path, bool srgb = true);
+
+// Greyscale elevation image (8 or 16 bits per sample) as heights in [0, 1],
+// flipped like decodeTexture. CPU-only and thread-safe. Empty on failure.
+struct Heightmap {
+    int width;
+    int height;
+    std::vector<float> samples;
+
+    Heightmap() : width(0), height(0) {}
+};
+
+Heightmap decodeHeightmap(const std::string& path);
+
+// Mipmapped 16-bit single-channel texture of the samples, repeating around
+// the longitude and clamped at the poles. Must run on the GL thread.
+unsigned int uploadHeightmap(const Heightmap& map);
@@ -0,0 +1,254 @@
+#include "trace.h"
+
+#if SOLAR_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start;    // ns since trace epoch
+    uint64_t duration; // ns
+};
+
+// Written only by the owning thread. `count` is published with release
+// semantics so a concurrent writeTrace sees complete events only.
+struct TraceChunk {
+    static const int CAPACITY = 4096;
+    TraceEvent events[CAPACITY];
+    std::atomic<int> count;
+    std::atomic<TraceChunk*> next;
+
+    TraceChunk() : count(0), next(nullptr) {}
+};
+
+struct ThreadTraceBuffer {
+    static const int MAX_CHUNKS = 256; // ~1M events per thread and session, then drop
+
+    int tid;
+    std::string name;
+    TraceChunk* head;
+    TraceChunk* tail;
+    int chunkCount;
+    std::atomic<unsigned> dropped;
+    unsigned session; // the tracing session the events are from
+    bool retired;     // its thread has exited
+
+    ThreadTraceBuffer(int id, unsigned sessionId)
+        : tid(id), head(new TraceChunk()), tail(head), chunkCount(1), dropped(0), session(sessionId),
+        retired(false) {}
+};
+
+std::atomic<bool> tracingEnabled(false);
+std::atomic<unsigned> traceSession(0); // bumped by every startTracing
+const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+// Buffers outlive their threads, so events from threads that have already
+// exited can still be written out. A new thread takes over the buffer of an
+// exited one, appending after its events, so short-lived threads (terrain
+// tiles) don't grow the registry. Only a buffer's own thread, or anyone
+// while it is retired, may reset it, and always under registryMutex.
+std::mutex registryMutex;
+std::vector<ThreadTraceBuffer*> registry;
+
+struct LocalTraceBuffer {
+    ThreadTraceBuffer* buffer;
+
+    LocalTraceBuffer() : buffer(nullptr) {}
+    ~LocalTraceBuffer() {
+        if (!buffer)
+            return;
+        std::lock_guard<std::mutex> lock(registryMutex);
+        buffer->retired = true;
+    }
+};
+thread_local LocalTraceBuffer localBuffer;
+
+uint64_t traceNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+// Drops the buffer's events and all chunks but the first. registryMutex
+// must be held.
+void resetBuffer(ThreadTraceBuffer* buffer, unsigned session) {
+    TraceChunk* chunk = buffer->head->next.load(std::memory_order_relaxed);
+    while (chunk) {
+        TraceChunk* next = chunk->next.load(std::memory_order_relaxed);
+        delete chunk;
+        chunk = next;
+    }
+    buffer->head->next.store(nullptr, std::memory_order_relaxed);
+    buffer->head->count.store(0, std::memory_order_relaxed);
+    buffer->tail = buffer->head;
+    buffer->chunkCount = 1;
+    buffer->dropped.store(0, std::memory_order_relaxed);
+    buffer->session = session;
+}
+
+ThreadTraceBuffer* threadBuffer() {
+    if (!localBuffer.buffer) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        unsigned session = traceSession.load();
+        for (ThreadTraceBuffer* buffer : registry) {
+            if (buffer->retired) {
+                buffer->retired = false;
+                buffer->name.clear();
+                if (buffer->session != session)
+                    resetBuffer(buffer, session);
+                localBuffer.buffer = buffer;
+                break;
+            }
+        }
+        if (!localBuffer.buffer) {
+            localBuffer.buffer = new ThreadTraceBuffer((int)registry.size() + 1, session);
+            registry.push_back(localBuffer.buffer);
+        }
+    }
+    return localBuffer.buffer;
+}
+
+void recordEvent(const char* name, uint64_t start, uint64_t end) {
+    ThreadTraceBuffer* buffer = threadBuffer();
+    // First event since tracing restarted: forget the last session's
+    if (buffer->session != traceSession.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        resetBuffer(buffer, traceSession.load());
+    }
+    TraceChunk* chunk = buffer->tail;
+    int index = chunk->count.load(std::memory_order_relaxed);
+    if (index == TraceChunk::CAPACITY) {
+        if (buffer->chunkCount == ThreadTraceBuffer::MAX_CHUNKS) {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        TraceChunk* fresh = new TraceChunk();
+        chunk->next.store(fresh, std::memory_order_release);
+        buffer->tail = chunk = fresh;
+        buffer->chunkCount++;
+        index = 0;
+    }
+    TraceEvent& e = chunk->events[index];
+    e.name = name;
+    e.start = start;
+    e.duration = end - start;
+    chunk->count.store(index + 1, std::memory_order_release);
+}
+
+void writeEscaped(std::ostream& out, const std::string& text) {
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            out << '\\';
+        out << c;
+    }
+}
+
+} // namespace
+
+TraceScope::TraceScope(const char* scopeName) : name(scopeName), start(0), open(false) {
+    if (tracingEnabled.load(std::memory_order_relaxed)) {
+        start = traceNow();
+        open = true;
+    }
+}
+
+void TraceScope::end() {
+    if (!open)
+        return;
+    open = false;
+    recordEvent(name, start, traceNow());
+}
+
+void TraceScope::next(const char* nextName) {
+    end();
+    name = nextName;
+    if (tracingEnabled.load(std::memory_order_relaxed)) {
+        start = traceNow();
+        open = true;
+    }
+}
+
+// Live threads reset their own buffers on their next event, since they may
+// be recording into them right now; retired ones are reset here
+void startTracing() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    unsigned session = traceSession.fetch_add(1) + 1;
+    for (ThreadTraceBuffer* buffer : registry) {
+        if (buffer->retired)
+            resetBuffer(buffer, session);
+    }
+    tracingEnabled.store(true);
+}
+
+void stopTracing() {
+    tracingEnabled.store(false);
+}
+
+bool isTracing() {
+    return tracingEnabled.load();
+}
+
+void setTraceThreadName(const char* name) {
+    ThreadTraceBuffer* buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    buffer->name = name;
+}
+
+bool writeTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Failed to open trace file: " << path << std::endl;
+        return false;
+    }
+
+    size_t eventCount = 0;
+    unsigned dropped = 0;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    char number[64];
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    unsigned session = traceSession.load();
+    for (ThreadTraceBuffer* buffer : registry) {
+        if (buffer->session != session)
+            continue; // not recorded since tracing restarted
+        if (!buffer->name.empty()) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+                << buffer->tid << ",\"args\":{\"name\":\"";
+            writeEscaped(out, buffer->name);
+            out << "\"}}";
+            first = false;
+        }
+        for (TraceChunk* chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            int count = chunk->count.load(std::memory_order_acquire);
+            for (int i = 0; i < count; ++i) {
+                const TraceEvent& e = chunk->events[i];
+                out << (first ? "" : ",\n") << "{\"name\":\"";
+                writeEscaped(out, e.name);
+                snprintf(number, sizeof(number), "%.3f", e.start / 1000.0);
+                out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << number;
+                snprintf(number, sizeof(number), "%.3f", e.duration / 1000.0);
+                out << ",\"dur\":" << number << "}";
+                first = false;
+                eventCount++;
+            }
+        }
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    out << "\n]}\n";
+
+    std::cout << "Wrote " << eventCount << " trace events to " << path;
+    if (dropped > 0)
+        std::cout << " (" << dropped << " dropped, buffers full)";
+    std::cout << std::endl;
+    return true;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+// CPU scope tracing that writes Chrome trace / Perfetto JSON.
+//
+// Each thread records into its own chunked buffer with no locks on the hot
+// path; a scope costs two clock reads and one store while recording, and a
+// single atomic load otherwise. Build with SOLAR_TRACING=0 to compile every
+// scope out entirely.
+#ifndef SOLAR_TRACING
+#define SOLAR_TRACING 1
+#endif
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#if SOLAR_TRACING
+
+#include <cstdint>
+
+// Name must be a string literal (or otherwise outlive the trace).
+class TraceScope {
+public:
+    explicit TraceScope(const char* name);
+    ~TraceScope() { end(); }
+    // Closes the scope early, for sequential sections that share a C++ scope.
+    void end();
+    // Closes the scope and immediately opens the next section under a new name.
+    void next(const char* nextName);
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+    bool open;
+};
+
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+void startTracing();
+void stopTracing();
+bool isTracing();
+// Names the calling thread in the trace viewer.
+void setTraceThreadName(const char* name);
+// Writes everything recorded so far. Safe to call while other threads record.
+bool writeTrace(const std::string& path);
+
+#else
+
+class TraceScope {
+public:
+    explicit TraceScope(const char*) {}
+    void end() {}
+    void next(const char*) {}
+};
+
+#define TRACE_SCOPE(name) ((void)0)
+
+inline void startTracing() {}
+inline void stopTracing() {}
+inline bool isTracing() { return false; }
+inline void setTraceThreadName(const char*) {}
+inline bool writeTrace(const std::string&) { return false; }
+
+#endif
@@ -0,0 +1,93 @@
+#include "trails.h"
+
+#include <algorithm>
+
+#include "trace.h"
+#include "wide_lines.h"
+
+void createTrails(Trails& trails, const std::vector<glm::vec3>& colors, int length, float seconds) {
+    trails.objectCount = (int)colors.size();
+    trails.length = std::max(2, length);
+    trails.interval = seconds / (trails.length - 1);
+    trails.head = 0;
+    trails.count = 0;
+    trails.row.assign(trails.objectCount, glm::vec4(0.0f));
+
+    glGenBuffers(1, &trails.positionBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, trails.positionBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)trails.length * trails.objectCount * sizeof(glm::vec4), nullptr,
+        GL_DYNAMIC_DRAW);
+    glGenTextures(1, &trails.positionTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, trails.positionTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, trails.positionBuffer);
+
+    std::vector<glm::vec4> texels;
+    for (const auto& color : colors)
+        texels.push_back(glm::vec4(color, 1.0f));
+    glGenBuffers(1, &trails.colorBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, trails.colorBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(glm::vec4), texels.data(), GL_STATIC_DRAW);
+    glGenTextures(1, &trails.colorTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, trails.colorTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, trails.colorBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    glGenVertexArrays(1, &trails.VAO);
+}
+
+void destroyTrails(Trails& trails) {
+    glDeleteTextures(1, &trails.positionTexture);
+    glDeleteTextures(1, &trails.colorTexture);
+    glDeleteBuffers(1, &trails.positionBuffer);
+    glDeleteBuffers(1, &trails.colorBuffer);
+    glDeleteVertexArrays(1, &trails.VAO);
+    trails.positionTexture = trails.colorTexture = trails.positionBuffer = trails.colorBuffer = trails.VAO = 0;
+    trails.objectCount = trails.count = 0;
+}
+
+void setTrailPosition(Trails& trails, int object, const glm::vec3& position) {
+    trails.row[object] = glm::vec4(position, 1.0f);
+}
+
+void updateTrails(Trails& trails, float time) {
+    TRACE_SCOPE("update trails");
+    if (trails.objectCount == 0)
+        return;
+    if (trails.count == 0) {
+        trails.count = 1;
+        trails.nextSample = time + trails.interval;
+    }
+    else if (time >= trails.nextSample) {
+        // Keep the newest row and start a new one
+        trails.head = (trails.head + 1) % trails.length;
+        trails.count = std::min(trails.count + 1, trails.length);
+        trails.nextSample += trails.interval;
+        // After a stall, don't try to catch up
+        if (time >= trails.nextSample)
+            trails.nextSample = time + trails.interval;
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, trails.positionBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)trails.head * trails.objectCount * sizeof(glm::vec4),
+        trails.objectCount * sizeof(glm::vec4), trails.row.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void drawTrails(const Trails& trails, GLuint program) {
+    if (trails.count < 2)
+        return;
+    glUniform1i(glGetUniformLocation(program, "trailPositions"), 0);
+    glUniform1i(glGetUniformLocation(program, "trailColors"), 1);
+    glUniform1i(glGetUniformLocation(program, "trailObjects"), trails.objectCount);
+    glUniform1i(glGetUniformLocation(program, "trailLength"), trails.length);
+    glUniform1i(glGetUniformLocation(program, "trailHead"), trails.head);
+    glUniform1i(glGetUniformLocation(program, "trailCount"), trails.count);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, trails.positionTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, trails.colorTexture);
+    glBindVertexArray(trails.VAO);
+    glDrawArrays(GL_TRIANGLES, 0, trails.objectCount * (trails.count - 1) * LINE_VERTICES_PER_SEGMENT);
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+// Fading trails behind moving objects.
+//
+// Every object's history lives in one texture buffer, a ring of `length`
+// rows where a row is one sample of every object ([slot * objectCount +
+// object]). The newest row follows the objects live and is rewritten every
+// frame with a single glBufferSubData; every `interval` seconds the ring
+// advances and that row is kept. Per-frame CPU work and upload size depend
+// only on the number of objects, not on how long the trails are, and all
+// trails are drawn with one glDrawArrays as wide lines (wide_lines.h)
+// fading towards their oldest point.
+struct Trails {
+    int objectCount;
+    int length;     // samples kept per object
+    float interval; // seconds between kept samples
+    int head;       // slot of the newest row
+    int count;      // rows holding samples, up to length
+    float nextSample;
+    std::vector<glm::vec4> row;
+
+    GLuint positionBuffer;
+    GLuint positionTexture; // RGBA32F, length * objectCount texels
+    GLuint colorBuffer;
+    GLuint colorTexture;    // RGBA32F, one texel per object
+    GLuint VAO;
+
+    Trails()
+        : objectCount(0), length(0), interval(0.0f), head(0), count(0), nextSample(0.0f), positionBuffer(0),
+        positionTexture(0), colorBuffer(0), colorTexture(0), VAO(0) {}
+};
+
+// One trail per colour, covering `seconds` with `length` samples.
+void createTrails(Trails& trails, const std::vector<glm::vec3>& colors, int length, float seconds);
+void destroyTrails(Trails& trails);
+
+void setTrailPosition(Trails& trails, int object, const glm::vec3& position);
+// Uploads the positions set since the last call as the newest samples, at
+// simulation time `time`. Once per frame.
+void updateTrails(Trails& trails, float time);
+// Binds the positions and colours on texture units 0 and 1 and draws with
+// `program` (see the trail effect).
+void drawTrails(const Trails& trails, GLuint program);
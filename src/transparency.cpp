@@ -0,0 +1,357 @@
+#include "transparency.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "post_process.h"
+#include "scene_depth.h"
+#include "shader_program.h"
+#include "trace.h"
+
+// Both modes take the fragment's window depth and its distance along the
+// view axis in world units (1 / gl_FragCoord.w for ordinary geometry).
+// Weighted blending favours near layers where they overlap, falling off
+// with the square of the distance and steeply past the far scale (the
+// paper's equation 8, rescaled to this scene); the weight includes alpha,
+// so faint layers don't tint denser ones.
+const char* transparencyShaderSource = R"(
+#ifndef TRANSPARENCY_NEAR
+#define TRANSPARENCY_NEAR 1000.0
+#endif
+#ifndef TRANSPARENCY_FAR
+#define TRANSPARENCY_FAR 20000.0
+#endif
+
+#ifdef TRANSPARENCY_LINKED_LIST
+layout (r32ui) uniform coherent uimage2D fragmentHeads;
+layout (rgba32ui) uniform writeonly uimageBuffer fragmentNodes;
+layout (r32ui) uniform coherent uimageBuffer fragmentCount;
+uniform sampler2D opaqueDepth;
+uniform int nodeCapacity;
+
+void writeTransparent(vec4 color, float depth, float viewDepth) {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    if (!inFront(depth, texelFetch(opaqueDepth, pixel, 0).r))
+        return;
+    uint index = imageAtomicAdd(fragmentCount, 0, 1u);
+    if (index >= uint(nodeCapacity))
+        return;
+    uint next = imageAtomicExchange(fragmentHeads, pixel, index);
+    imageStore(fragmentNodes, int(index),
+        uvec4(packHalf2x16(color.rg), packHalf2x16(color.ba), floatBitsToUint(viewDepth), next));
+}
+#else
+layout (location = 0) out vec4 Accumulation;
+layout (location = 1) out float Weight;
+
+void writeTransparent(vec4 color, float depth, float viewDepth) {
+    float nearScale = viewDepth / TRANSPARENCY_NEAR;
+    float farScale = viewDepth / TRANSPARENCY_FAR;
+    float weight = color.a * clamp(10.0 / (1e-5 + nearScale * nearScale + pow(farScale, 6.0)), 1e-2, 3e3);
+    Accumulation = vec4(color.rgb * weight, color.a);
+    Weight = color.a * weight;
+}
+#endif
+)";
+
+// The scene effects are #version 330; lists need these on top
+const char* transparencyListShaderConstants =
+    "#extension GL_ARB_shader_image_load_store : require\n"
+    "#extension GL_ARB_shading_language_packing : require\n"
+    "#define TRANSPARENCY_LINKED_LIST 1\n";
+
+// Revealage is in the accumulation alpha; an untouched pixel stays as it was
+static const char* weightedCompositeFragmentShaderSource = R"(
+#version 330 core
+out vec4 FragColor;
+uniform sampler2D accumulation;
+uniform sampler2D weights;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(accumulation, pixel, 0);
+    float weight = texelFetch(weights, pixel, 0).r;
+    if (weight <= 0.0)
+        discard;
+    // Halves overflow to infinity when many near layers pile up
+    vec3 color = min(accum.rgb, vec3(65504.0)) / max(weight, 1e-5);
+    FragColor = vec4(color * (1.0 - accum.a), accum.a);
+}
+)";
+
+// Keeps the nearest layers, sorted by insertion, and blends them front to back
+static const char* listCompositeFragmentShaderSource = R"(
+#version 420 core
+out vec4 FragColor;
+layout (r32ui) uniform readonly uimage2D fragmentHeads;
+layout (rgba32ui) uniform readonly uimageBuffer fragmentNodes;
+
+void main() {
+    uint index = imageLoad(fragmentHeads, ivec2(gl_FragCoord.xy)).r;
+    if (index == 0xFFFFFFFFu)
+        discard;
+
+    uvec4 layers[MAX_LAYERS];
+    int count = 0;
+    while (index != 0xFFFFFFFFu) {
+        uvec4 node = imageLoad(fragmentNodes, int(index));
+        index = node.w;
+        float layerDistance = uintBitsToFloat(node.z);
+        if (count == MAX_LAYERS && layerDistance >= uintBitsToFloat(layers[MAX_LAYERS - 1].z))
+            continue;
+        int i = min(count, MAX_LAYERS - 1);
+        count = min(count + 1, MAX_LAYERS);
+        for (; i > 0 && uintBitsToFloat(layers[i - 1].z) > layerDistance; --i)
+            layers[i] = layers[i - 1];
+        layers[i] = node;
+    }
+
+    vec3 color = vec3(0.0);
+    float transmittance = 1.0;
+    for (int i = 0; i < count; ++i) {
+        vec4 layer = vec4(unpackHalf2x16(layers[i].x), unpackHalf2x16(layers[i].y));
+        color += transmittance * layer.rgb;
+        transmittance *= 1.0 - layer.a;
+    }
+    FragColor = vec4(color, transmittance);
+}
+)";
+
+// Image units used by the lists, and the texture unit of the opaque depth
+static const GLuint HEAD_IMAGE_UNIT = 0;
+static const GLuint NODE_IMAGE_UNIT = 1;
+static const GLuint COUNTER_IMAGE_UNIT = 2;
+static const GLuint DEPTH_TEXTURE_UNIT = 5;
+
+static GLuint createTargetTexture(GLenum internalFormat, GLenum format, GLenum type, int width, int height) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+static GLuint createBufferTexture(GLuint buffer, GLenum format) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    return texture;
+}
+
+static void destroyTargets(Transparency& transparency) {
+    glDeleteFramebuffers(1, &transparency.fbo);
+    glDeleteFramebuffers(1, &transparency.headFBO);
+    glDeleteFramebuffers(1, &transparency.depthFBO);
+    GLuint textures[] = { transparency.accumulation, transparency.weights, transparency.headTexture,
+        transparency.nodeTexture, transparency.counterTexture, transparency.depthTexture };
+    glDeleteTextures(6, textures);
+    glDeleteBuffers(1, &transparency.nodeBuffer);
+    glDeleteBuffers(1, &transparency.counterBuffer);
+    transparency.fbo = transparency.headFBO = transparency.depthFBO = 0;
+    transparency.accumulation = transparency.weights = transparency.headTexture = 0;
+    transparency.nodeTexture = transparency.counterTexture = transparency.depthTexture = 0;
+    transparency.nodeBuffer = transparency.counterBuffer = 0;
+    transparency.nodeCapacity = 0;
+}
+
+static bool createTargets(Transparency& transparency, const PostProcess& post) {
+    TRACE_SCOPE("create transparency targets");
+    transparency.width = post.width;
+    transparency.height = post.height;
+    transparency.sceneDepth = post.sceneDepth;
+    bool complete;
+
+    if (transparency.mode == TRANSPARENCY_WEIGHTED) {
+        transparency.accumulation = createTargetTexture(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, post.width, post.height);
+        transparency.weights = createTargetTexture(GL_R16F, GL_RED, GL_HALF_FLOAT, post.width, post.height);
+        glGenFramebuffers(1, &transparency.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, transparency.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, transparency.accumulation, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, transparency.weights, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, post.sceneDepth);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
+    else {
+        transparency.headTexture = createTargetTexture(GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, post.width,
+            post.height);
+        glGenFramebuffers(1, &transparency.headFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, transparency.headFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, transparency.headTexture, 0);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+        transparency.depthTexture = createTargetTexture(SCENE_DEPTH_FORMAT, GL_DEPTH_COMPONENT, GL_FLOAT,
+            post.width, post.height);
+        glGenFramebuffers(1, &transparency.depthFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, transparency.depthFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, transparency.depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        transparency.nodeCapacity = (int)std::min((long long)maxTexels,
+            (long long)post.width * post.height * TRANSPARENCY_NODES_PER_PIXEL);
+        glGenBuffers(1, &transparency.nodeBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, transparency.nodeBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)transparency.nodeCapacity * 4 * sizeof(GLuint), nullptr,
+            GL_DYNAMIC_COPY);
+        glGenBuffers(1, &transparency.counterBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, transparency.counterBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        transparency.nodeTexture = createBufferTexture(transparency.nodeBuffer, GL_RGBA32UI);
+        transparency.counterTexture = createBufferTexture(transparency.counterBuffer, GL_R32UI);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, post.sceneFBO);
+
+    if (!complete)
+        std::cerr << "ERROR: Transparency framebuffer is incomplete" << std::endl;
+    return complete;
+}
+
+static void bindListImages(const Transparency& transparency) {
+    glBindImageTexture(HEAD_IMAGE_UNIT, transparency.headTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    glBindImageTexture(NODE_IMAGE_UNIT, transparency.nodeTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32UI);
+    glBindImageTexture(COUNTER_IMAGE_UNIT, transparency.counterTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+}
+
+bool createTransparency(Transparency& transparency, TransparencyMode mode) {
+    transparency = Transparency();
+    transparency.mode = mode;
+    if (mode == TRANSPARENCY_LINKED_LIST) {
+        if (GLAD_GL_VERSION_4_2)
+            transparency.compositeProgram = buildProgram("transparency_list", fullscreenVertexShaderSource,
+                listCompositeFragmentShaderSource,
+                "#define MAX_LAYERS " + std::to_string(TRANSPARENCY_MAX_LAYERS) + "\n");
+        if (!transparency.compositeProgram) {
+            std::cout << "Transparency: no image load/store, using weighted blending" << std::endl;
+            transparency.mode = TRANSPARENCY_WEIGHTED;
+        }
+    }
+    if (transparency.mode == TRANSPARENCY_WEIGHTED) {
+        transparency.compositeProgram = buildProgram("transparency_weighted", fullscreenVertexShaderSource,
+            weightedCompositeFragmentShaderSource);
+        glUseProgram(transparency.compositeProgram);
+        glUniform1i(glGetUniformLocation(transparency.compositeProgram, "accumulation"), 0);
+        glUniform1i(glGetUniformLocation(transparency.compositeProgram, "weights"), 1);
+    }
+    else {
+        glUseProgram(transparency.compositeProgram);
+        glUniform1i(glGetUniformLocation(transparency.compositeProgram, "fragmentHeads"), HEAD_IMAGE_UNIT);
+        glUniform1i(glGetUniformLocation(transparency.compositeProgram, "fragmentNodes"), NODE_IMAGE_UNIT);
+    }
+    return transparency.compositeProgram != 0;
+}
+
+void destroyTransparency(Transparency& transparency) {
+    destroyTargets(transparency);
+    glDeleteProgram(transparency.compositeProgram);
+    transparency.compositeProgram = 0;
+}
+
+void beginTransparency(Transparency& transparency, const PostProcess& post) {
+    if (transparency.width != post.width || transparency.height != post.height ||
+        transparency.sceneDepth != post.sceneDepth) {
+        destroyTargets(transparency);
+        createTargets(transparency, post);
+    }
+    glDepthMask(GL_FALSE);
+
+    if (transparency.mode == TRANSPARENCY_WEIGHTED) {
+        glBindFramebuffer(GL_FRAMEBUFFER, transparency.fbo);
+        const GLfloat clearAccumulation[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        const GLfloat clearWeight[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, clearAccumulation);
+        glClearBufferfv(GL_COLOR, 1, clearWeight);
+        // Colour and weight add up, revealage multiplies by 1 - alpha
+        glEnable(GL_BLEND);
+        glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+        return;
+    }
+
+    // Last frame's appends must land before the counter is reset
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+    const GLuint zero = 0;
+    glBindBuffer(GL_TEXTURE_BUFFER, transparency.counterBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(GLuint), &zero);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, transparency.headFBO);
+    const GLuint noHead[] = { 0xFFFFFFFFu, 0u, 0u, 0u };
+    glClearBufferuiv(GL_COLOR, 0, noHead);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, post.sceneFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, transparency.depthFBO);
+    glBlitFramebuffer(0, 0, post.renderWidth, post.renderHeight, 0, 0, post.renderWidth, post.renderHeight,
+        GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, post.sceneFBO);
+    bindListImages(transparency);
+
+    // The shaders test depth against the copy themselves and only append
+    glDisable(GL_DEPTH_TEST);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+}
+
+void bindTransparency(const Transparency& transparency, GLuint program) {
+    if (transparency.mode != TRANSPARENCY_LINKED_LIST)
+        return;
+    glUniform1i(glGetUniformLocation(program, "fragmentHeads"), HEAD_IMAGE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "fragmentNodes"), NODE_IMAGE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "fragmentCount"), COUNTER_IMAGE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "nodeCapacity"), transparency.nodeCapacity);
+    glUniform1i(glGetUniformLocation(program, "opaqueDepth"), DEPTH_TEXTURE_UNIT);
+    glActiveTexture(GL_TEXTURE0 + DEPTH_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, transparency.depthTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void endTransparency(Transparency& transparency, const PostProcess& post) {
+    glBindFramebuffer(GL_FRAMEBUFFER, post.sceneFBO);
+    glUseProgram(transparency.compositeProgram);
+    if (transparency.mode == TRANSPARENCY_WEIGHTED) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, transparency.accumulation);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, transparency.weights);
+        glActiveTexture(GL_TEXTURE0);
+        glDisable(GL_BLEND);
+    }
+    else {
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        bindListImages(transparency);
+    }
+
+    // Layers over the scene, which shows through by the transmittance in
+    // alpha; motion vectors stay those of the opaque scene
+    glDisable(GL_DEPTH_TEST);
+    glEnablei(GL_BLEND, 0);
+    glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+    if (post.sceneVelocity)
+        glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glBindVertexArray(post.emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    if (post.sceneVelocity)
+        glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDisablei(GL_BLEND, 0);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+}
+
+bool parseTransparencyMode(const std::string& text, TransparencyMode& mode) {
+    if (text == "weighted")
+        mode = TRANSPARENCY_WEIGHTED;
+    else if (text == "linked-list")
+        mode = TRANSPARENCY_LINKED_LIST;
+    else
+        return false;
+    return true;
+}
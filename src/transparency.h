@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+
+#include <glad/glad.h>
+
+struct PostProcess;
+
+// Order-independent transparency for translucent layers (rings,
+// atmospheres), so they can be drawn in any order and never need sorting.
+//
+// Weighted blended (McGuire and Bavoil, 2013), the default: every fragment
+// adds its premultiplied colour, weighted by distance, to an accumulation
+// target and multiplies the revealage (what still shows through) by
+// 1 - alpha. A composite pass divides the weights out and blends the result
+// over the opaque scene. One pass, two targets, GL 3.3; exact for a single
+// layer and approximate where several of similar opacity overlap.
+//
+// Per-pixel linked lists, for reference: every fragment is appended to a
+// node buffer, linked from a per-pixel head image, and the composite sorts
+// each pixel's list by distance and blends it exactly. Needs image
+// load/store (GL 4.2) and tests depth itself against a copy of the opaque
+// depth. Fragments beyond the node budget are dropped.
+enum TransparencyMode { TRANSPARENCY_WEIGHTED, TRANSPARENCY_LINKED_LIST };
+
+const int TRANSPARENCY_NODES_PER_PIXEL = 4; // average list budget
+const int TRANSPARENCY_MAX_LAYERS = 16;     // sorted per pixel, the nearest kept
+
+struct Transparency {
+    TransparencyMode mode;
+    int width;
+    int height;
+    GLuint sceneDepth; // the depth buffer the targets were built around
+
+    // Weighted blended
+    GLuint fbo;
+    GLuint accumulation; // RGBA16F: weighted colour, revealage in alpha
+    GLuint weights;      // R16F: sum of the weighted alphas
+
+    // Linked lists
+    GLuint headTexture; // R32UI, ~0u = empty
+    GLuint headFBO;     // for clearing the heads
+    GLuint nodeBuffer;  // RGBA32UI texels: colour as halves, distance, next
+    GLuint nodeTexture;
+    GLuint counterBuffer; // one R32UI texel
+    GLuint counterTexture;
+    GLuint depthTexture; // the opaque depth, copied
+    GLuint depthFBO;
+    int nodeCapacity;
+
+    GLuint compositeProgram;
+
+    Transparency()
+        : mode(TRANSPARENCY_WEIGHTED), width(0), height(0), sceneDepth(0), fbo(0), accumulation(0), weights(0),
+        headTexture(0), headFBO(0), nodeBuffer(0), nodeTexture(0), counterBuffer(0), counterTexture(0),
+        depthTexture(0), depthFBO(0), nodeCapacity(0), compositeProgram(0) {}
+};
+
+// transparency.glsl, for scene effects: writeTransparent(premultiplied,
+// depth, viewDepth) instead of a colour output, after depth.glsl (see
+// scene_depth.h). TRANSPARENCY_LINKED_LIST variants need the effect
+// constants below ahead of everything else.
+extern const char* transparencyShaderSource;
+extern const char* transparencyListShaderConstants;
+
+// Falls back to weighted blending if linked lists aren't supported.
+bool createTransparency(Transparency& transparency, TransparencyMode mode);
+void destroyTransparency(Transparency& transparency);
+
+// Call after the opaque geometry, with the scene target of `post` bound.
+// (Re)builds the targets around the scene's size and depth buffer, clears
+// them and sets up blending and depth for the translucent draws.
+void beginTransparency(Transparency& transparency, const PostProcess& post);
+// Sets the list images and opaque depth on a program writing transparent
+// fragments; a no-op for weighted blending. `program` must be current.
+void bindTransparency(const Transparency& transparency, GLuint program);
+// Composites the layers over the scene target and leaves it bound, with
+// blending off and depth writes back on.
+void endTransparency(Transparency& transparency, const PostProcess& post);
+
+bool parseTransparencyMode(const std::string& text, TransparencyMode& mode);
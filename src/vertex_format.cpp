@@ -0,0 +1,81 @@
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+void applyVertexLayout(const VertexLayout& layout) {
+    for (const auto& attribute : layout.attributes) {
+        glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized,
+            layout.stride, (void*)attribute.offset);
+        glEnableVertexAttribArray(attribute.location);
+        if (attribute.divisor)
+            glVertexAttribDivisor(attribute.location, attribute.divisor);
+    }
+}
+
+const VertexLayout& packedVertexLayout() {
+    static const VertexLayout layout = VertexLayout(sizeof(PackedVertex))
+        .add(0, 3, GL_SHORT, GL_TRUE, offsetof(PackedVertex, position))
+        .add(1, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, normal))
+        .add(2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, texCoord));
+    return layout;
+}
+
+static int16_t packSnorm16(float value) {
+    return (int16_t)std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f);
+}
+
+// Unit vector to the octahedron folded onto [-1, 1]^2
+static glm::vec2 octahedralEncode(glm::vec3 n) {
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f) {
+        glm::vec2 folded = 1.0f - glm::abs(glm::vec2(e.y, e.x));
+        e = glm::vec2(e.x >= 0.0f ? folded.x : -folded.x, e.y >= 0.0f ? folded.y : -folded.y);
+    }
+    return e;
+}
+
+void packVertices(const std::vector<float>& vertices, std::vector<PackedVertex>& packed, MeshBounds& bounds) {
+    size_t count = vertices.size() / 8;
+    packed.resize(count);
+    if (count == 0) {
+        bounds = MeshBounds();
+        return;
+    }
+
+    glm::vec3 low(vertices[0], vertices[1], vertices[2]), high = low;
+    for (size_t i = 0; i < count; ++i) {
+        glm::vec3 p = glm::make_vec3(&vertices[i * 8]);
+        low = glm::min(low, p);
+        high = glm::max(high, p);
+    }
+    bounds.center = (low + high) * 0.5f;
+    bounds.halfExtent = (high - low) * 0.5f;
+
+    for (size_t i = 0; i < count; ++i) {
+        const float* v = &vertices[i * 8];
+        PackedVertex& out = packed[i];
+        for (int axis = 0; axis < 3; ++axis) {
+            float extent = bounds.halfExtent[axis];
+            out.position[axis] = extent > 0.0f ? packSnorm16((v[axis] - bounds.center[axis]) / extent) : 0;
+        }
+        out.position[3] = 0;
+
+        glm::vec3 normal = glm::make_vec3(v + 3);
+        glm::vec2 octahedral = glm::length(normal) > 0.0f ? octahedralEncode(normal) : glm::vec2(0.0f);
+        out.normal[0] = packSnorm16(octahedral.x);
+        out.normal[1] = packSnorm16(octahedral.y);
+
+        out.texCoord[0] = (uint16_t)glm::packHalf1x16(v[6]);
+        out.texCoord[1] = (uint16_t)glm::packHalf1x16(v[7]);
+    }
+}
+
+void setMeshBounds(GLuint program, const MeshBounds& bounds) {
+    glUniform3fv(glGetUniformLocation(program, "positionOffset"), 1, glm::value_ptr(bounds.center));
+    glUniform3fv(glGetUniformLocation(program, "positionScale"), 1, glm::value_ptr(bounds.halfExtent));
+}
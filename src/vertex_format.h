@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+// Describes how a vertex buffer feeds vertex attributes, so buffers are set
+// up from one table instead of a run of glVertexAttribPointer calls.
+struct VertexAttribute {
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    size_t offset;
+    GLuint divisor; // 0 per vertex, 1 per instance
+};
+
+struct VertexLayout {
+    GLsizei stride;
+    std::vector<VertexAttribute> attributes;
+
+    explicit VertexLayout(GLsizei s) : stride(s) {}
+
+    VertexLayout& add(GLuint location, GLint components, GLenum type, GLboolean normalized, size_t offset,
+        GLuint divisor = 0) {
+        attributes.push_back({ location, components, type, normalized, offset, divisor });
+        return *this;
+    }
+};
+
+// Points the bound VAO's attributes at the buffer bound to GL_ARRAY_BUFFER.
+void applyVertexLayout(const VertexLayout& layout);
+
+// Mesh vertex in 16 bytes instead of 32:
+//   0 position  3 x snorm16 within the mesh bounds (w unused)
+//   1 normal    2 x snorm16, octahedral
+//   2 texcoord  2 x half float
+// The surface effect decodes it with packed_vertex.glsl.
+struct PackedVertex {
+    int16_t position[4];
+    int16_t normal[2];
+    uint16_t texCoord[2];
+};
+
+// Positions decode as center + p * halfExtent.
+struct MeshBounds {
+    glm::vec3 center;
+    glm::vec3 halfExtent;
+
+    MeshBounds() : center(0.0f), halfExtent(1.0f) {}
+};
+
+const VertexLayout& packedVertexLayout();
+
+// Packs interleaved position / normal / texcoord floats (8 per vertex).
+void packVertices(const std::vector<float>& vertices, std::vector<PackedVertex>& packed, MeshBounds& bounds);
+
+// Sets the decode uniforms (positionOffset, positionScale) on the current
+// program.
+void setMeshBounds(GLuint program, const MeshBounds& bounds);
@@ -0,0 +1,19 @@
+#include "wide_lines.h"
+
+void beginLineDraw() {
+    glEnablei(GL_BLEND, 0);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+}
+
+void endLineDraw() {
+    glDepthMask(GL_TRUE);
+    glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDisablei(GL_BLEND, 0);
+}
+
+void setLineUniforms(GLuint program, float width, int renderWidth, int renderHeight, int outputHeight) {
+    glUniform2f(glGetUniformLocation(program, "viewportSize"), (float)renderWidth, (float)renderHeight);
+    glUniform1f(glGetUniformLocation(program, "lineWidth"), width * renderHeight / outputHeight);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Anti-aliased lines of any width, without GL line rasterisation.
+//
+// Effects that draw lines include "line.glsl" in their vertex shader and
+// supply linePoint(); every line segment is drawn as six vertices (two
+// triangles) that the snippet places around the segment in screen space,
+// mitred against the neighbouring segments so joints neither overlap nor
+// gap. The shared line fragment shader turns the distance from the centre
+// line into box-filtered coverage, so edges are smooth at any width and
+// lines thinner than a pixel fade instead of breaking up. Lines are blended
+// over the opaque scene and test depth without writing it, so draw them
+// after everything opaque.
+const int LINE_VERTICES_PER_SEGMENT = 6;
+
+// Blending on the colour attachment and no depth writes. The motion vector
+// attachment is masked: even a faint fringe of coverage would otherwise
+// stamp the line's motion over what is behind it, and temporal AA would
+// smear that. Lines take the motion of what they cover instead.
+void beginLineDraw();
+void endLineDraw();
+
+// `width` is in output pixels; it's scaled to the render resolution so
+// lines keep their size on screen.
+void setLineUniforms(GLuint program, float width, int renderWidth, int renderHeight, int outputHeight);